@@ -0,0 +1,331 @@
+/**
+ * Collector.h
+ * Result collectors that models record into and replications merge
+ */
+
+#ifndef SIM_COLLECTOR_H_INCLUDED
+#define SIM_COLLECTOR_H_INCLUDED
+
+#include "Clock.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <vector>
+
+namespace sim {
+
+/**
+ * @brief A named result a simulation accumulates, see Simulation::collector
+ * Collectors are not synchronized: within a run, record from one partition only or
+ * make the collector thread safe. Replicas each get their own, merged once all ended.
+ */
+class Collector {
+public:
+  virtual ~Collector() = default;
+
+  /**
+   * @brief Fold the results of another collector of the same kind into this one
+   * @param other a collector of the same name from another replica
+   */
+  virtual void merge( const Collector &other ) = 0;
+};
+
+/**
+ * @brief Count, sum and extremes of recorded values
+ */
+class Tally : public Collector {
+public:
+  void add( double value ) noexcept {
+    ++m_count;
+    m_sum += value;
+    m_min = std::min( m_min, value );
+    m_max = std::max( m_max, value );
+  }
+
+  void merge( const Collector &other ) override {
+    auto tally = dynamic_cast<const Tally *>( &other );
+    if ( !tally ) {
+      return;
+    }
+    m_count += tally->m_count;
+    m_sum += tally->m_sum;
+    m_min = std::min( m_min, tally->m_min );
+    m_max = std::max( m_max, tally->m_max );
+  }
+
+  size_t count() const noexcept {
+    return m_count;
+  }
+  double sum() const noexcept {
+    return m_sum;
+  }
+  double mean() const noexcept {
+    return m_count ? m_sum / m_count : 0.0;
+  }
+  double min() const noexcept {
+    return m_min;
+  }
+  double max() const noexcept {
+    return m_max;
+  }
+
+private:
+  size_t m_count = 0;
+  double m_sum = 0.0;
+  double m_min = std::numeric_limits<double>::infinity();
+  double m_max = -std::numeric_limits<double>::infinity();
+};
+
+/**
+ * @brief Mean and variance of recorded values, updated in one pass (Welford)
+ * Stays accurate where a sum of squares would cancel, e.g. for large values that vary little.
+ */
+class Moments : public Collector {
+public:
+  void add( double value ) noexcept {
+    ++m_count;
+    auto delta = value - m_mean;
+    m_mean += delta / double( m_count );
+    m_m2 += delta * ( value - m_mean );
+    m_min = std::min( m_min, value );
+    m_max = std::max( m_max, value );
+  }
+
+  void merge( const Collector &other ) override {
+    auto moments = dynamic_cast<const Moments *>( &other );
+    if ( !moments || !moments->m_count ) {
+      return;
+    }
+    // Chan et al.'s pairwise update
+    auto count = m_count + moments->m_count;
+    auto delta = moments->m_mean - m_mean;
+    m_mean += delta * double( moments->m_count ) / double( count );
+    m_m2 += moments->m_m2 + delta * delta * double( m_count ) * double( moments->m_count ) / double( count );
+    m_count = count;
+    m_min = std::min( m_min, moments->m_min );
+    m_max = std::max( m_max, moments->m_max );
+  }
+
+  size_t count() const noexcept {
+    return m_count;
+  }
+  double mean() const noexcept {
+    return m_mean;
+  }
+  /**
+   * @brief Get the sample variance, 0 for fewer than two values
+   */
+  double variance() const noexcept {
+    return m_count > 1 ? m_m2 / double( m_count - 1 ) : 0.0;
+  }
+  double stddev() const noexcept {
+    return std::sqrt( variance() );
+  }
+  double min() const noexcept {
+    return m_min;
+  }
+  double max() const noexcept {
+    return m_max;
+  }
+
+private:
+  size_t m_count = 0;
+  double m_mean = 0.0;
+  double m_m2 = 0.0; // sum of squared differences from the mean
+  double m_min = std::numeric_limits<double>::infinity();
+  double m_max = -std::numeric_limits<double>::infinity();
+};
+
+/**
+ * @brief Log-linear histogram of recorded values, in the manner of HDR histograms
+ * Every power of two is split into 2^precision equal buckets, so a quantile is off by
+ * at most 2^-precision of its value at any magnitude. Only the powers of two values fell
+ * in are held, so values far apart cost no more than values close together. Values at
+ * or below zero are counted together as zero, ones that aren't finite not at all.
+ */
+class Histogram : public Collector {
+public:
+  /**
+   * @param precision bits of each value kept, 1 to 16
+   */
+  explicit Histogram( unsigned precision = 7 );
+
+  void add( double value, uint64_t count = 1 );
+  void merge( const Collector &other ) override;
+
+  uint64_t count() const noexcept {
+    return m_count;
+  }
+  double mean() const noexcept {
+    return m_count ? m_sum / double( m_count ) : 0.0;
+  }
+  double min() const noexcept {
+    return m_min;
+  }
+  double max() const noexcept {
+    return m_max;
+  }
+  /**
+   * @brief Get the value below which a fraction of the recorded values lie
+   * @param fraction from 0 for the least value to 1 for the greatest
+   * @return double the middle of the bucket the value fell in, within min() and max(),
+   * or 0 if nothing was recorded
+   */
+  double quantile( double fraction ) const;
+
+private:
+  /**
+   * @brief Count a value above zero in its bucket, holding its power of two if need be
+   */
+  void place( double value, uint64_t count );
+  double bucketMiddle( int exponent, size_t bucket ) const;
+
+  unsigned m_precision;
+  std::map<int, std::vector<uint64_t>> m_powers; // 2^precision buckets by exponent
+  uint64_t m_zeros = 0;
+  uint64_t m_count = 0;
+  double m_sum = 0.0;
+  double m_min = std::numeric_limits<double>::infinity();
+  double m_max = -std::numeric_limits<double>::infinity();
+};
+
+/**
+ * @brief Quantiles of recorded values in bounded memory (Dunning's merging t-digest)
+ * Values are buffered and merged into at most about compression centroids, kept small
+ * near either end so that tail quantiles stay accurate. Digests merge without losing
+ * more than that, unlike single quantile estimators such as P-squared.
+ */
+class TDigest : public Collector {
+public:
+  /**
+   * @param compression about the number of centroids kept, 20 or more
+   */
+  explicit TDigest( double compression = 100.0 );
+
+  void add( double value );
+  void merge( const Collector &other ) override;
+
+  uint64_t count() const noexcept {
+    return m_count;
+  }
+  double min() const noexcept {
+    return m_min;
+  }
+  double max() const noexcept {
+    return m_max;
+  }
+  /**
+   * @brief Estimate the value below which a fraction of the recorded values lie
+   * @param fraction from 0 for the least value to 1 for the greatest
+   * @return double the estimate or 0 if nothing was recorded
+   */
+  double quantile( double fraction ) const;
+
+private:
+  struct Centroid {
+    double mean;
+    double weight;
+  };
+
+  /**
+   * @brief Merge the buffered values into the centroids
+   */
+  void compress() const;
+
+  double m_compression;
+  // merged lazily, also when reading
+  mutable std::vector<Centroid> m_centroids; // by mean
+  mutable std::vector<Centroid> m_buffer;
+  uint64_t m_count = 0;
+  double m_min = std::numeric_limits<double>::infinity();
+  double m_max = -std::numeric_limits<double>::infinity();
+};
+
+/**
+ * @brief Average over simulation time of a level that changes in steps, e.g. a queue
+ * length or whether a server is busy
+ * Each change weighs the level it ends by how long that lasted. The level after the last
+ * change counts once another change, or a call to mean( until ), says how long it lasted.
+ */
+class TimeWeighted : public Collector {
+public:
+  /**
+   * @brief Change the level, at a time no earlier than the last change
+   */
+  void set( Clock::time_point time, double level ) noexcept {
+    if ( m_started ) {
+      auto span = std::max( 0.0, std::chrono::duration<double>( time - m_last ).count() );
+      m_area += m_level * span;
+      m_duration += span;
+    }
+    m_started = true;
+    m_last = std::max( m_last, time );
+    m_level = level;
+    m_min = std::min( m_min, level );
+    m_max = std::max( m_max, level );
+  }
+  /**
+   * @brief Change the level by an amount, e.g. 1 for an arrival and -1 for a departure
+   */
+  void add( Clock::time_point time, double change ) noexcept {
+    set( time, m_level + change );
+  }
+
+  void merge( const Collector &other ) override {
+    auto weighted = dynamic_cast<const TimeWeighted *>( &other );
+    if ( !weighted ) {
+      return;
+    }
+    m_area += weighted->m_area;
+    m_duration += weighted->m_duration;
+    m_min = std::min( m_min, weighted->m_min );
+    m_max = std::max( m_max, weighted->m_max );
+  }
+
+  double level() const noexcept {
+    return m_level;
+  }
+  /**
+   * @brief Get the average up to the last change, over every replica merged
+   */
+  double mean() const noexcept {
+    return m_duration > 0.0 ? m_area / m_duration : m_level;
+  }
+  /**
+   * @brief Get the average up to a time, the current level lasting until then
+   */
+  double mean( Clock::time_point until ) const noexcept {
+    auto span = m_started ? std::max( 0.0, std::chrono::duration<double>( until - m_last ).count() ) : 0.0;
+    auto duration = m_duration + span;
+    return duration > 0.0 ? ( m_area + m_level * span ) / duration : m_level;
+  }
+  /**
+   * @brief Get the seconds of simulation time averaged over
+   */
+  double duration() const noexcept {
+    return m_duration;
+  }
+  double min() const noexcept {
+    return m_min;
+  }
+  double max() const noexcept {
+    return m_max;
+  }
+
+private:
+  bool m_started = false;
+  Clock::time_point m_last{};
+  double m_level = 0.0;
+  double m_area = 0.0;     // level seconds
+  double m_duration = 0.0; // seconds
+  double m_min = std::numeric_limits<double>::infinity();
+  double m_max = -std::numeric_limits<double>::infinity();
+};
+
+} // namespace sim
+
+#endif // SIM_COLLECTOR_H_INCLUDED
@@ -10,6 +10,21 @@ namespace sim {
 
 using PropertyList = std::unordered_map<std::string, acpp::unstructured_value>;
 
+/**
+ * @brief Allocation counters of a simulation's memory pool
+ * allocations and bytes count blocks handed out by the pool; system_allocations and
+ * system_bytes count what the pool itself took from the system allocator. A
+ * system_allocations count that stops growing means stepping has gone malloc-free.
+ */
+struct AllocatorStats {
+  size_t allocations = 0;
+  size_t deallocations = 0;
+  size_t bytes_in_use = 0;
+  size_t peak_bytes = 0;
+  size_t system_allocations = 0;
+  size_t system_bytes = 0;
+};
+
 } // namespace sim
 
 #endif // SIM_COMMON_H_INCLUDED
@@ -0,0 +1,187 @@
+/**
+ * Coroutine.h
+ * C++20 coroutine activity bodies (build with SIM_COROUTINES)
+ */
+
+#ifndef SIM_COROUTINE_H_INCLUDED
+#define SIM_COROUTINE_H_INCLUDED
+
+#include "Instance.h"
+#include "Payload.h"
+
+#if !defined( __cpp_impl_coroutine ) || ACPP_LESSON < 5
+#error "coroutine activities need C++20 and ACPP_LESSON > 4, configure with SIM_COROUTINES=ON"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <string>
+#include <utility>
+
+namespace sim {
+
+class AsyncActivity;
+
+/**
+ * @brief Return type of a coroutine activity body
+ * A body taking ( Instance &, AsyncActivity, ... ) has its frame allocated from the
+ * simulation's pool. The simulation loop resumes the coroutine directly whenever a
+ * wait it awaited ends.
+ */
+class Task {
+public:
+  struct promise_type {
+    Task get_return_object() noexcept {
+      return Task{ std::coroutine_handle<promise_type>::from_promise( *this ) };
+    }
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_always final_suspend() noexcept {
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept {
+      exception = std::current_exception();
+    }
+
+    template <typename... Args>
+    static void *operator new( size_t size, Instance &, AsyncActivity &activity, Args &... ) {
+      return allocate( size, &activity );
+    }
+    static void *operator new( size_t size ) {
+      return allocate( size, nullptr );
+    }
+    // sized, as a frame is freed with its size when the promise has such a delete
+    static void operator delete( void *frame, size_t size ) noexcept;
+
+    std::exception_ptr exception;
+
+  private:
+    static void *allocate( size_t size, AsyncActivity *activity );
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  Task() noexcept = default;
+  explicit Task( handle_type handle ) noexcept : m_handle{ handle } {}
+  Task( Task &&other ) noexcept : m_handle{ std::exchange( other.m_handle, {} ) } {}
+  Task &operator=( Task &&other ) noexcept {
+    if ( this != &other ) {
+      reset();
+      m_handle = std::exchange( other.m_handle, {} );
+    }
+    return *this;
+  }
+  ~Task() noexcept {
+    reset();
+  }
+
+  /**
+   * @brief Give up ownership of the coroutine frame
+   */
+  handle_type release() noexcept {
+    return std::exchange( m_handle, {} );
+  }
+
+private:
+  void reset() noexcept {
+    if ( m_handle ) {
+      m_handle.destroy();
+      m_handle = {};
+    }
+  }
+
+  handle_type m_handle;
+};
+
+/**
+ * @brief An activity as seen from a coroutine body: its waits are awaited
+ * `co_await activity.waitFor( d )`, `auto msg = co_await activity.padReceive( "in" )`,
+ * `co_await activity.padSend( "out", payload )`.
+ */
+class AsyncActivity {
+public:
+  explicit AsyncActivity( Activity &activity ) noexcept : m_activity{ &activity } {}
+
+  struct WaitAwaiter {
+    Activity *activity;
+    Clock::time_point time;
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+    bool await_suspend( std::coroutine_handle<> handle );
+    void await_resume() const noexcept {}
+  };
+
+  struct ReceiveAwaiter {
+    Activity *activity;
+    std::string pad_name;
+    Clock::time_point time; // timeout or {} for none
+    std::string error;
+    bool suspended = false;
+
+    bool await_ready();
+    bool await_suspend( std::coroutine_handle<> handle );
+    acpp::value_result<Payload> await_resume();
+  };
+
+  struct SendAwaiter {
+    bool sent;
+
+    bool await_ready() const noexcept {
+      return true;
+    }
+    void await_suspend( std::coroutine_handle<> ) const noexcept {}
+    bool await_resume() const noexcept {
+      return sent;
+    }
+  };
+
+  Activity &activity() const noexcept {
+    return *m_activity;
+  }
+  Activity::State state() const {
+    return m_activity->state();
+  }
+  std::shared_ptr<Instance> owner() const {
+    return m_activity->owner();
+  }
+
+  WaitAwaiter waitFor( Clock::duration duration ) const;
+  WaitAwaiter waitUntil( const Clock::time_point &time ) const;
+  ReceiveAwaiter padReceive( const std::string &pad_name ) const;
+  ReceiveAwaiter padReceive( const std::string &pad_name, Clock::duration timeout ) const;
+  SendAwaiter padSend( const std::string &pad_name, Payload payload ) const;
+
+private:
+  Activity *m_activity;
+};
+
+/**
+ * Coroutine activity body. source and payload are taken by value because the body
+ * outlives the invocation that started it.
+ */
+using CoroutineBody = std::function<Task( Instance &instance, AsyncActivity activity, std::string source, Payload payload )>;
+
+/**
+ * @brief Activity::Func that starts a coroutine body, recognized by the activity so
+ * that it runs without a fiber
+ */
+struct CoroutineFunc {
+  CoroutineBody body;
+
+  void operator()( Instance &instance, Activity &activity, const std::string &source, Payload &payload ) const;
+};
+
+/**
+ * @brief Make an activity function from a coroutine body, e.g. for an ActivitySpec
+ */
+inline ActivityFunc coroutine( CoroutineBody body ) {
+  return CoroutineFunc{ std::move( body ) };
+}
+
+}  // namespace sim
+
+#endif  // SIM_COROUTINE_H_INCLUDED
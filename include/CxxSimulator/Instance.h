@@ -7,8 +7,10 @@
 
 #include "cpp_utils.h"
 #include "Clock.h"
+#include "Collector.h"
 #include "Common.h"
 #include "Model.h"
+#include "Payload.h"
 
 #include <optional>
 #include <string>
@@ -16,7 +18,6 @@
 #include <memory>
 #include <map>
 #include <utility>
-#include <any>
 
 namespace sim {
 
@@ -37,6 +38,17 @@ public:
   std::shared_ptr<Instance> owner() const;
   std::shared_ptr<Pad> peer() const;
   size_t available() const;
+  /**
+   * @brief Get the delay of messages sent out of this pad, from its spec's "lookahead"
+   * @return Clock::duration the delay, zero for immediate delivery
+   */
+  Clock::duration lookahead() const;
+  /**
+   * @brief Keep the number of messages waiting at this pad in a collector, updated on
+   * every message queued and taken out
+   * @param length the collector, e.g. Simulation::collector<TimeWeighted>, or nullptr to stop
+   */
+  void observe( std::shared_ptr<TimeWeighted> length );
 
   /**
    * @brief Connect this pad to a peer on another instance
@@ -57,7 +69,7 @@ public:
 
 class Activity : public std::enable_shared_from_this<Activity> {
 public:
-  using Func = std::function<void( Instance &, Activity &, const std::string &source, const std::any &payload )>;
+  using Func = ActivityFunc;
 #if ACPP_LESSON > 4
   enum class State : uint32_t { init, run, pause, done };
 #endif // ACPP_LESSON > 4
@@ -66,7 +78,7 @@ public:
     std::shared_ptr<Instance> instance,
     const ActivitySpec &spec,
     const std::string &name,
-    const Func &func );
+    const Func &func = {} );
 
   Activity( Activity &&other ) noexcept;
   Activity &operator=( Activity &&other ) noexcept;
@@ -78,7 +90,7 @@ public:
    * @param source the source of the activity's invocation
    * @param payload a payload to pass to the activity
    */
-  void invoke( const std::string &source, const std::any &payload );
+  void invoke( const std::string &source, Payload &&payload );
 
 #if ACPP_LESSON > 4
   State state() const;
@@ -92,22 +104,41 @@ public:
    * The following are meant for the activity itself to call
    */
 #if ACPP_LESSON > 3
-  acpp::value_result<std::any> padReceive( const std::string &pad_name, const std::string &then_activity );
-  acpp::value_result<std::any> padReceive( const std::string &pad_name, sim::Clock::duration timeout, const std::string &then_activity );
-  bool padSend( const std::string &pad_name, const std::any &payload, const std::string &then_activity );
+  acpp::value_result<Payload> padReceive( const std::string &pad_name, const std::string &then_activity );
+  acpp::value_result<Payload> padReceive( const std::string &pad_name, sim::Clock::duration timeout, const std::string &then_activity );
+  bool padSend( const std::string &pad_name, Payload payload, const std::string &then_activity );
 #endif
 
 #if ACPP_LESSON > 4
-  void waitFor( sim::Clock::duration dur );
-  void waitUntil( const sim::Clock::time_point &time );
-  acpp::value_result<std::any> padReceive( const std::string &pad_name );
-  acpp::value_result<std::any> padReceive( const std::string &pad_name, sim::Clock::duration timeout );
-  bool padSend( const std::string &pad_name, const std::any &payload, bool block = false );
+  /**
+   * @brief Suspend the activity for a simulated duration
+   * Once the activity is canceled, as its simulation goes away, this and every other wait
+   * fail at once without waiting: a body must stop when one does.
+   * @return acpp::void_result<> Success, or an error if canceled or not running on its fiber
+   */
+  acpp::void_result<> waitFor( sim::Clock::duration dur );
+  acpp::void_result<> waitUntil( const sim::Clock::time_point &time );
+  /**
+   * @brief Suspend the activity until a signal is raised, see Simulation::raiseSignal
+   * @return acpp::void_result<> Success, or an error if canceled or not running on its fiber
+   */
+  acpp::void_result<> waitOn( const std::string &signal );
+  acpp::value_result<Payload> padReceive( const std::string &pad_name );
+  acpp::value_result<Payload> padReceive( const std::string &pad_name, sim::Clock::duration timeout );
+  /**
+   * @brief Send a message out of a pad without waiting
+   * @param block waiting for room at the peer is not supported yet, true sends nothing
+   * @return bool whether the message was sent
+   */
+  bool padSend( const std::string &pad_name, Payload payload, bool block = false );
 #endif
 
 private:
   class Impl;
   std::unique_ptr<Impl> impl;
+
+public:
+  class Private;
 };
 
 class Instance : public std::enable_shared_from_this<Instance> {
@@ -156,10 +187,26 @@ public:
    * @return std::shared_ptr<Activity> the activity made or nullptr on failure
    */
   virtual std::shared_ptr<Activity> makeActivity( const ActivitySpec &spec, const std::string &name );
+  /**
+   * @brief Save what an optimistic run may have to roll this instance back to
+   * Called before each event the instance handles in an optimistic run, so it should be
+   * cheap. Override it, with restoreState, for the instance to take part in one; the
+   * default refuses.
+   * @return acpp::value_result<Payload> a copy of the model state or an error
+   */
+  virtual acpp::value_result<Payload> saveState() const;
+  /**
+   * @brief Go back to a state saveState returned, undoing the events handled since
+   * @param state the saved state
+   */
+  virtual void restoreState( Payload &&state ) noexcept;
 
 private:
   class Impl;
   std::unique_ptr<Impl> impl;
+
+public:
+  class Private;
 };
 
 
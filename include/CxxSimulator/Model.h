@@ -8,13 +8,14 @@
 #include "cpp_utils.h"
 #include "Clock.h"
 #include "Common.h"
+#include "Payload.h"
 
+#include <functional>
 #include <optional>
 #include <string>
 #include <system_error>
 #include <bitset>
 #include <map>
-#include <any>
 
 namespace sim {
 
@@ -24,12 +25,25 @@ class Model;
 class Activity;
 class Instance;
 
+/**
+ * Function run when an activity is invoked
+ */
+using ActivityFunc = std::function<void( Instance &, Activity &, const std::string &source, Payload &payload )>;
+
 #if ACPP_LESSON > 3
 /**
  * Structure to specify how a pad is constructed (a connection point for a instance)
+ * A "lookahead" parameter, in seconds, delays what is sent out of the pad by that much;
+ * pad links between the partitions of a parallel run need one above zero.
+ * A "capacity" parameter sizes the ring holding the messages waiting in the pad, 64 by
+ * default and rounded up to a power of two. A full pad still takes what is sent to it,
+ * keeping the rest in order in an overflow list until there is room, so no message is
+ * lost; size the ring for the usual backlog to stay off the heap. An instance parameter
+ * "<pad name>.capacity" overrides it for the pad of that instance. FAN_IN pads take
+ * messages from several threads at once.
  */
 struct PadSpec {
-  enum class Flag : uint32_t { CAN_INPUT, CAN_OUTPUT, IS_TEMPLATE, BY_REQUEST, COUNT__ };
+  enum class Flag : uint32_t { CAN_INPUT, CAN_OUTPUT, IS_TEMPLATE, BY_REQUEST, FAN_IN, COUNT__ };
 
   PadSpec() = default; // results in an invalid/null padspec
   PadSpec( const std::string &name,
@@ -52,6 +66,9 @@ struct PadSpec {
 
 /**
  * Structure to specify a how an activity is constructed
+ * A pad_receive activity named after a pad runs once for every message the pad
+ * receives, with the pad's name as source and the message as payload, instead of the
+ * message being queued for padReceive.
  */
 struct ActivitySpec {
   enum class Type {
@@ -66,9 +83,11 @@ struct ActivitySpec {
   ActivitySpec() = default; // this will make an invalid/null spec
   ActivitySpec(
       const std::string &name,
-      const Type &type ) :
+      const Type &type,
+      const ActivityFunc &function = {} ) :
       name( name ),
-      type( type ) {}
+      type( type ),
+      function( function ) {}
   ~ActivitySpec() noexcept = default;
   ActivitySpec( const ActivitySpec &other ) = default;
   ActivitySpec( ActivitySpec &&other ) noexcept = default;
@@ -77,6 +96,7 @@ struct ActivitySpec {
 
   std::string name;
   Type type = Type::undefined;
+  ActivityFunc function; // empty runs the model's startActivity
 };
 
 /**
@@ -97,8 +117,9 @@ public:
   PadSpec pad( const std::string &name );
 #endif // ACPP_LESSON > 3
 
-  // entry point for the model
-  virtual void startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity ) = 0;
+  // entry point for the model, run by activities whose spec has no function; by default
+  // it does nothing
+  virtual void startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity );
 
   virtual std::shared_ptr<Instance> makeInstance(
       std::shared_ptr<Simulation> sim,
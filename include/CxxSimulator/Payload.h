@@ -0,0 +1,295 @@
+/**
+ * Payload.h
+ * Move-only, small-buffer message payloads
+ */
+
+#ifndef SIM_PAYLOAD_H_INCLUDED
+#define SIM_PAYLOAD_H_INCLUDED
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef SIM_PAYLOAD_INLINE
+#define SIM_PAYLOAD_INLINE 48
+#endif
+
+namespace sim {
+
+/**
+ * @brief Whether a type may be moved by copying its bytes and forgetting the source
+ * Only such types are stored inline in a payload. Specialize to opt a type in.
+ */
+template <typename T>
+struct is_trivially_relocatable : std::bool_constant<std::is_trivially_copyable_v<T>> {};
+
+template <typename T>
+constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
+
+namespace detail {
+
+inline uint32_t next_payload_tag() noexcept {
+  // automatic tags stay clear of the range used by SIM_REGISTER_PAYLOAD
+  static std::atomic<uint32_t> next{ 0x80000000u };
+  return next.fetch_add( 1, std::memory_order_relaxed );
+}
+
+}  // namespace detail
+
+/**
+ * @brief Integer type tag for payload values
+ * Unregistered types get a process-local tag on first use. Register a type with
+ * SIM_REGISTER_PAYLOAD to give it a tag that is stable across runs, which anything
+ * serializing payloads relies on.
+ */
+template <typename T>
+struct payload_tag {
+  static uint32_t value() noexcept {
+    static const uint32_t tag = detail::next_payload_tag();
+    return tag;
+  }
+};
+
+/**
+ * @brief Register a stable type tag for a payload value type (use at global scope)
+ * Tags must be non-zero and below 0x80000000.
+ */
+#define SIM_REGISTER_PAYLOAD( Type, Tag )                        \
+  template <>                                                    \
+  struct sim::payload_tag<Type> {                                \
+    static_assert( ( Tag ) > 0 && ( Tag ) < 0x80000000u );       \
+    static constexpr uint32_t value() noexcept { return Tag; }   \
+  };
+
+/**
+ * @brief A type-tagged value that can only be moved
+ * Trivially relocatable values up to InlineSize bytes live in an inline buffer,
+ * anything else on the heap. Either way a move copies the buffer and a pointer, so
+ * passing a payload along send, queue and pull never allocates for small values.
+ * @tparam InlineSize bytes of inline storage
+ * @tparam Align alignment of the inline storage
+ */
+template <size_t InlineSize = SIM_PAYLOAD_INLINE, size_t Align = alignof( std::max_align_t )>
+class BasicPayload {
+  static_assert( InlineSize >= sizeof( void * ) );
+
+public:
+  static constexpr size_t inline_size = InlineSize;
+
+  template <typename T>
+  static constexpr bool fits_inline =
+      sizeof( T ) <= InlineSize && Align % alignof( T ) == 0 && is_trivially_relocatable_v<T>;
+
+  BasicPayload() noexcept = default;
+  ~BasicPayload() noexcept {
+    reset();
+  }
+  BasicPayload( const BasicPayload & ) = delete;
+  BasicPayload &operator=( const BasicPayload & ) = delete;
+  BasicPayload( BasicPayload &&other ) noexcept {
+    relocate( other );
+  }
+  BasicPayload &operator=( BasicPayload &&other ) noexcept {
+    if ( this != &other ) {
+      reset();
+      relocate( other );
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Construct holding a value
+   */
+  template <typename T,
+      typename Vt = std::decay_t<T>,
+      typename = std::enable_if_t<!std::is_same_v<Vt, BasicPayload>>>
+  BasicPayload( T &&value ) {
+    emplace<Vt>( std::forward<T>( value ) );
+  }
+
+  /**
+   * @brief Make a payload holding a T constructed from args (brace-initialized for aggregates)
+   */
+  template <typename T, typename... Args>
+  static BasicPayload make( Args &&... args ) {
+    BasicPayload payload;
+    payload.template emplace<T>( std::forward<Args>( args )... );
+    return payload;
+  }
+
+  template <typename T, typename... Args>
+  T &emplace( Args &&... args ) {
+    reset();
+    T *value;
+    if constexpr ( fits_inline<T> ) {
+      value = construct<T>( m_storage.buffer, std::forward<Args>( args )... );
+    } else {
+      void *memory = ::operator new( sizeof( T ), std::align_val_t( alignof( T ) ) );
+      try {
+        value = construct<T>( memory, std::forward<Args>( args )... );
+      } catch ( ... ) {
+        ::operator delete( memory, std::align_val_t( alignof( T ) ) );
+        throw;
+      }
+      m_storage.heap = value;
+    }
+    m_ops = &ops<T>;
+    return *value;
+  }
+
+  void reset() noexcept {
+    if ( m_ops ) {
+      m_ops->destroy( *this );
+      m_ops = nullptr;
+    }
+  }
+
+  bool has_value() const noexcept {
+    return m_ops != nullptr;
+  }
+  explicit operator bool() const noexcept {
+    return has_value();
+  }
+  /**
+   * @brief Get the type tag of the held value
+   * @return uint32_t the tag or 0 if empty
+   */
+  uint32_t tag() const noexcept {
+    return m_ops ? m_ops->tag() : 0;
+  }
+  bool is_inline() const noexcept {
+    return m_ops && m_ops->is_inline;
+  }
+  /**
+   * @brief Whether clone() can copy the held value, true if empty
+   */
+  bool copyable() const noexcept {
+    return !m_ops || m_ops->copy;
+  }
+  /**
+   * @brief Copy the held value into a new payload
+   * @return BasicPayload the copy, empty if this is empty or its value can't be copied
+   */
+  BasicPayload clone() const {
+    BasicPayload payload;
+    if ( m_ops && m_ops->copy ) {
+      m_ops->copy( payload, *this );
+    }
+    return payload;
+  }
+
+  template <typename T>
+  bool is() const noexcept {
+    return m_ops == &ops<T> || ( m_ops && m_ops->tag() == payload_tag<T>::value() );
+  }
+  template <typename T>
+  T *get_if() noexcept {
+    return is<T>() ? address<T>() : nullptr;
+  }
+  template <typename T>
+  const T *get_if() const noexcept {
+    return is<T>() ? const_cast<BasicPayload *>( this )->template address<T>() : nullptr;
+  }
+  template <typename T>
+  T &get() noexcept {
+    assert( is<T>() );
+    return *address<T>();
+  }
+  template <typename T>
+  const T &get() const noexcept {
+    assert( is<T>() );
+    return *const_cast<BasicPayload *>( this )->template address<T>();
+  }
+  /**
+   * @brief Move the held value out, leaving the payload empty
+   */
+  template <typename T>
+  T take() {
+    assert( is<T>() );
+    T value( std::move( *address<T>() ) );
+    reset();
+    return value;
+  }
+
+private:
+  struct Ops {
+    uint32_t ( *tag )() noexcept;
+    void ( *destroy )( BasicPayload &payload ) noexcept;
+    void ( *copy )( BasicPayload &to, const BasicPayload &from ); // nullptr if T can't be copied
+    size_t size; // bytes of m_storage in use
+    bool is_inline;
+  };
+
+  template <typename T, typename... Args>
+  static T *construct( void *memory, Args &&... args ) {
+    if constexpr ( std::is_constructible_v<T, Args...> ) {
+      return new ( memory ) T( std::forward<Args>( args )... );
+    } else {
+      return new ( memory ) T{ std::forward<Args>( args )... };
+    }
+  }
+
+  template <typename T>
+  T *address() noexcept {
+    if constexpr ( fits_inline<T> ) {
+      return std::launder( reinterpret_cast<T *>( m_storage.buffer ) );
+    } else {
+      return static_cast<T *>( m_storage.heap );
+    }
+  }
+
+  template <typename T>
+  static void destroy( BasicPayload &payload ) noexcept {
+    T *value = payload.address<T>();
+    value->~T();
+    if constexpr ( !fits_inline<T> ) {
+      ::operator delete( value, std::align_val_t( alignof( T ) ) );
+    }
+  }
+
+  template <typename T>
+  static void copy( BasicPayload &to, const BasicPayload &from ) {
+    to.template emplace<T>( from.template get<T>() );
+  }
+
+  template <typename T>
+  static constexpr auto copier() noexcept {
+    void ( *function )( BasicPayload &, const BasicPayload & ) = nullptr;
+    if constexpr ( std::is_copy_constructible_v<T> ) {
+      function = &copy<T>;
+    }
+    return function;
+  }
+
+  template <typename T>
+  static constexpr Ops ops{ &payload_tag<T>::value,
+      &destroy<T>,
+      copier<T>(),
+      fits_inline<T> ? sizeof( T ) : sizeof( void * ),
+      fits_inline<T> };
+
+  void relocate( BasicPayload &other ) noexcept {
+    if ( other.m_ops ) {
+      std::memcpy( &m_storage, &other.m_storage, other.m_ops->size );
+    }
+    m_ops = other.m_ops;
+    other.m_ops = nullptr;
+  }
+
+  union Storage {
+    alignas( Align ) unsigned char buffer[InlineSize];
+    void *heap;
+  } m_storage;
+  const Ops *m_ops = nullptr;
+};
+
+using Payload = BasicPayload<>;
+
+}  // namespace sim
+
+#endif  // SIM_PAYLOAD_H_INCLUDED
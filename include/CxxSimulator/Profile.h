@@ -0,0 +1,82 @@
+/**
+ * Profile.h
+ * Where the event loop of a simulation spends its time, see Simulation::startProfile
+ */
+
+#ifndef SIM_PROFILE_H_INCLUDED
+#define SIM_PROFILE_H_INCLUDED
+
+#include "cpp_utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+/**
+ * @brief The events handled of one kind and what they cost
+ */
+struct ProfileCost {
+  uint64_t events = 0;
+  double seconds = 0.0;   // wall clock handling them, the model code they ran included
+  uint64_t depth_sum = 0; // events pending in the partition at each dispatch, summed
+  uint64_t depth_max = 0;
+
+  double meanDepth() const noexcept {
+    return events ? double( depth_sum ) / double( events ) : 0.0;
+  }
+  void add( const ProfileCost &other ) noexcept {
+    events += other.events;
+    seconds += other.seconds;
+    depth_sum += other.depth_sum;
+    depth_max = std::max( depth_max, other.depth_max );
+  }
+};
+
+/**
+ * @brief What a simulation handled while profiling, by event type and instance
+ */
+class Profile {
+public:
+  struct Row {
+    std::string type;     // of the events, e.g. "RESUME_ACTIVITY"
+    std::string model;    // of their instance, empty for events of no instance
+    std::string instance; // the instance they were for, spawned or handled by
+    ProfileCost cost;
+  };
+
+  std::vector<Row> rows; // one per event type and instance, by instance then type
+  double simulated = 0.0; // seconds of simulated time the profile covers
+  double wall = 0.0;      // seconds of wall time it covers
+
+  ProfileCost total() const;
+  std::map<std::string, ProfileCost> byType() const;
+  std::map<std::string, ProfileCost> byModel() const;
+  std::map<std::string, ProfileCost> byInstance() const;
+  /**
+   * @brief Get the rate of some events in simulated time, 0 if no simulated time passed
+   */
+  double eventsPerSimulatedSecond( const ProfileCost &cost ) const noexcept {
+    return simulated > 0.0 ? double( cost.events ) / simulated : 0.0;
+  }
+
+  /**
+   * @brief Write the wall time as folded stacks, "model;instance;TYPE nanoseconds" a line,
+   * for flame graph tools
+   * Events of no instance are under "simulation;TYPE".
+   */
+  void writeFolded( std::ostream &out ) const;
+  /**
+   * @brief Write the folded stacks to a file, see writeFolded( std::ostream & )
+   * @return acpp::void_result<> error if the file can't be written
+   */
+  acpp::void_result<> writeFolded( const std::string &path ) const;
+};
+
+}  // namespace sim
+
+#endif  // SIM_PROFILE_H_INCLUDED
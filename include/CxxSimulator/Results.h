@@ -0,0 +1,152 @@
+/**
+ * Results.h
+ * Columnar files of per-record results, written in the background and scanned by column
+ */
+
+#ifndef SIM_RESULTS_H_INCLUDED
+#define SIM_RESULTS_H_INCLUDED
+
+#include "cpp_utils.h"
+#include "Clock.h"
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace sim {
+
+/**
+ * @brief A column of a results file
+ * Integers, which include times as Clock nanoseconds, are stored as zigzag varints of the
+ * difference to the row before, so ids and times that mostly rise take a byte or two.
+ * Reals are stored as they are.
+ */
+struct ResultsColumn {
+  enum class Type : uint8_t { INTEGER, REAL };
+
+  std::string name;
+  Type type = Type::INTEGER;
+};
+
+/**
+ * @brief Appends rows to a results file without holding up the thread appending
+ * Rows fill a chunk column by column. A full chunk is handed to a thread of the writer,
+ * which encodes and writes it while the next one fills, so appending only waits when
+ * the thread fell a whole chunk behind. Like collectors, a writer is not synchronized:
+ * append from one thread at a time.
+ * Layout of the file, in the byte order of the machine that wrote it: magic, version,
+ * the column count and each column as its type and name, then chunks, each its row count,
+ * the byte size of each column and the columns' bytes, so that a reader skips the columns
+ * it doesn't want.
+ */
+class ResultsWriter {
+public:
+  /**
+   * @brief A value of a row, converted to the type of its column
+   */
+  struct Value {
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    Value( T value ) : integer{ int64_t( value ) }, real{ double( value ) } {}
+    Value( double value ) : integer{ std::llround( value ) }, real{ value } {}
+    Value( Clock::time_point time ) :
+        integer{ time.time_since_epoch().count() },
+        real{ std::chrono::duration<double>( time.time_since_epoch() ).count() } {}
+
+    int64_t integer;
+    double real; // seconds for times
+  };
+
+  /**
+   * @brief Create a results file and start its writer thread
+   * @param path the file to write
+   * @param columns the columns of every row
+   * @param chunk_rows rows encoded and written together
+   * @return the writer or error if the file can't be made
+   */
+  static acpp::value_result<std::unique_ptr<ResultsWriter>> open(
+      const std::string &path,
+      const std::vector<ResultsColumn> &columns,
+      size_t chunk_rows = s_chunk_rows );
+  /**
+   * @brief Close, ignoring any error; see close()
+   */
+  ~ResultsWriter() noexcept;
+  ResultsWriter( const ResultsWriter & ) = delete;
+  ResultsWriter &operator=( const ResultsWriter & ) = delete;
+
+  /**
+   * @brief Add a row, one value per column in column order
+   * A row of the wrong size is ignored.
+   */
+  void append( std::initializer_list<Value> row );
+  /**
+   * @brief Write what is left, stop the thread and close the file
+   * @return acpp::void_result<> error of the first write that failed
+   */
+  acpp::void_result<> close();
+
+  /**
+   * Rows in a chunk by default, 512 KiB per column of integers before encoding
+   */
+  static constexpr size_t s_chunk_rows = 64 * 1024;
+
+private:
+  ResultsWriter();
+
+  // PIMPL
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+/**
+ * @brief Reads the columns of a results file, one at a time
+ */
+class ResultsReader {
+public:
+  /**
+   * @brief Read the columns of a results file
+   * @return the reader or error if the file can't be read or isn't a results file
+   */
+  static acpp::value_result<std::unique_ptr<ResultsReader>> open( const std::string &path );
+  ~ResultsReader() noexcept;
+  ResultsReader( const ResultsReader & ) = delete;
+  ResultsReader &operator=( const ResultsReader & ) = delete;
+
+  const std::vector<ResultsColumn> &columns() const;
+  /**
+   * @brief Count the rows, from the chunk headers alone
+   */
+  uint64_t rows() const;
+  /**
+   * @brief Decode one integer column a chunk at a time, skipping the others
+   * @param column the name of the column
+   * @param chunk called with each chunk's values
+   * @return acpp::void_result<> error if there is no such integer column or the file is
+   * corrupt
+   */
+  acpp::void_result<> scanIntegers(
+      const std::string &column,
+      const std::function<void( const int64_t *values, size_t count )> &chunk ) const;
+  /**
+   * @brief Decode one real column a chunk at a time, skipping the others
+   */
+  acpp::void_result<> scanReals(
+      const std::string &column,
+      const std::function<void( const double *values, size_t count )> &chunk ) const;
+
+private:
+  ResultsReader();
+
+  // PIMPL
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+} // namespace sim
+
+#endif // SIM_RESULTS_H_INCLUDED
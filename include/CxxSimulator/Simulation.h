@@ -9,10 +9,14 @@
 #include "Model.h"
 #include "Instance.h"
 #include "Clock.h"
+#include "Collector.h"
+#include "Profile.h"
 #include "Common.h"
 
 #include <memory>
 #include <functional>
+#include <iosfwd>
+#include <map>
 #include <string>
 #include <system_error>
 #include <optional>
@@ -26,8 +30,28 @@ class Simulator;
 class Simulation : public std::enable_shared_from_this<Simulation> {
 public:
   enum class State { INIT, RUN, PAUSE, DONE };
+  /**
+   * @brief Event list implementations, see Timeline.h
+   * HEAP is O(log n) per event; CALENDAR and LADDER are amortized O(1) and suit large event lists.
+   */
+  enum class EventQueue { HEAP, CALENDAR, LADDER };
+  /**
+   * @brief How the partitions of a parallel run keep in step, see runParallel
+   */
+  enum class Synchronization { CONSERVATIVE, OPTIMISTIC };
+  /**
+   * @brief Which clocks a Chrome trace lays its events out by, see startChromeTrace
+   */
+  enum class TraceAxis { SIMULATED, WALL, BOTH };
 
   Simulation();
+  explicit Simulation( EventQueue queue );
+  /**
+   * @brief Make a simulation resolving its models from a simulator other than the global one
+   * @param simulator where models are registered, must outlive the simulation
+   * @param queue the event list implementation
+   */
+  explicit Simulation( Simulator &simulator, EventQueue queue = EventQueue::HEAP );
   Simulation( Simulation &&other );
   Simulation &operator=( Simulation &&other );
   ~Simulation() noexcept;
@@ -67,6 +91,30 @@ public:
    * @return acpp::void_result<> A success or error indicator
    */
   acpp::void_result<> setParameter( const std::string &name, const acpp::unstructured_value &value );
+  /**
+   * @brief Get a named result collector, making it on first use
+   * Models record their results here rather than in members of their Model, which is
+   * shared by every simulation of the simulator.
+   * @param name the name of the collector
+   * @param make makes the collector if there is none of this name yet
+   * @return std::shared_ptr<Collector> the collector
+   */
+  std::shared_ptr<Collector> collector( const std::string &name, const std::function<std::shared_ptr<Collector>()> &make );
+  /**
+   * @brief Get a named result collector of a given type, making it on first use
+   * @tparam T the type of collector
+   * @param name the name of the collector
+   * @return std::shared_ptr<T> the collector or nullptr if one of another type has the name
+   */
+  template <typename T>
+  std::shared_ptr<T> collector( const std::string &name ) {
+    return std::dynamic_pointer_cast<T>( collector( name, [] { return std::make_shared<T>(); } ) );
+  }
+  /**
+   * @brief Get all result collectors by name
+   * @return std::map<std::string, std::shared_ptr<Collector>>
+   */
+  std::map<std::string, std::shared_ptr<Collector>> collectors() const;
   /**
    * @brief Get the current simulation time
    * @return Clock::time_point the current simulation time
@@ -89,6 +137,199 @@ public:
    * @return acpp::void_result<> A success or error indicator
    */
   acpp::void_result<> setState( const State &state );
+  /**
+   * @brief Get the event list implementation chosen at construction
+   * @return EventQueue the event list implementation
+   */
+  EventQueue eventQueue() const;
+  /**
+   * @brief Get the allocation counters of this simulation's memory pool
+   * Instances, activities, pads and event bookkeeping are allocated from a pool owned
+   * by the simulation and released with it, so they must not outlive it.
+   * @return AllocatorStats a snapshot of the counters
+   */
+  AllocatorStats allocatorStats() const;
+  /**
+   * @brief Split the instances into partitions, each with its own event list
+   * Only possible before anything is spawned. An instance goes to the partition given by
+   * its "partition" parameter, or round-robin in spawn order. Events at equal times are
+   * ordered by the instance that scheduled them, so results don't depend on the split.
+   * @param count the number of partitions, 1 by default
+   * @return acpp::void_result<> A success or error indicator
+   */
+  acpp::void_result<> setPartitions( size_t count );
+  size_t partitions() const;
+  /**
+   * @brief Choose how partitions synchronize in the next parallel runs
+   * @param synchronization CONSERVATIVE by default
+   * @return acpp::void_result<> error while running
+   */
+  acpp::void_result<> setSynchronization( Synchronization synchronization );
+  Synchronization synchronization() const;
+  /**
+   * @brief Run all events up to a time with one thread per partition, then return
+   * Conservative partitions (Chandy-Misra-Bryant) only run events nothing can arrive
+   * before: a message crossing partitions is delayed by its pad's lookahead, and each
+   * partition keeps its neighbours posted, by null messages, on how soon it could send
+   * them anything.
+   * Optimistic partitions (Time Warp) run ahead regardless, saving the state of each
+   * instance before it handles an event. A message arriving in a partition's past rolls
+   * it back, and takes back what it sent since with anti-messages. Every so often the
+   * partitions agree on the global virtual time, before which nothing can roll back, and
+   * drop the saved states older than it. This needs no lookahead, but every instance
+   * must implement Instance::saveState and restoreState, activities must not wait, and
+   * messages must go to pad_receive activities in copyable payloads.
+   * Either way the events run in the order a sequential run would, a single partition
+   * runs on the calling thread and no instance can spawn while running.
+   * @param until the last time to run events at, max() to run until none are left, and
+   * the simulation time afterward as with runUntil
+   * @return acpp::void_result<> error if the topology or models don't suit the synchronization
+   */
+  acpp::void_result<> runParallel( const Clock::time_point &until = Clock::time_point::max() );
+  /**
+   * @brief Run events on the calling thread until the next one is later than a time
+   * Events of all partitions run in one time order, in a tight loop with no other
+   * thread involved, so a simulation can be driven from the caller's own scheduler.
+   * setState( PAUSE ) or setState( DONE ), from an event or another thread, stops the run
+   * within a few dozen events and becomes its state. Otherwise the simulation time is
+   * time afterward, and the state DONE once no events are left, else PAUSE.
+   * @param time the last time to run events at
+   * @return acpp::value_result<size_t> the number of events run or error if already running
+   */
+  acpp::value_result<size_t> runUntil( const Clock::time_point &time );
+  /**
+   * @brief Run events on the calling thread for a while, see runUntil
+   * @param duration how far past the current simulation time to run
+   * @return acpp::value_result<size_t> the number of events run or error if already running
+   */
+  acpp::value_result<size_t> runFor( Clock::duration duration );
+  /**
+   * @brief Run a number of events on the calling thread, see runUntil
+   * The simulation time is that of the last event run.
+   * @param count the most events to run
+   * @return acpp::value_result<size_t> the number of events run, fewer if none were left
+   */
+  acpp::value_result<size_t> step( size_t count = 1 );
+  /**
+   * @brief Run events on the calling thread until none are left, see runUntil
+   * @return acpp::value_result<size_t> the number of events run or error if already running
+   */
+  acpp::value_result<size_t> runToCompletion();
+
+  /**
+   * @brief Save the whole simulation between runs, to restore it later or elsewhere
+   * A checkpoint holds the simulation time and parameters, every instance with its
+   * parameters, its model state from Instance::saveState and the messages queued in its
+   * pads, the pad links, and the pending events with their payloads. Payloads need a
+   * serializer registered with Simulator::addPayloadSerializer. Collectors are not saved.
+   * Activities suspended in a wait (waitFor, padReceive, co_await) can't be saved, their
+   * fiber stacks and coroutine frames being tied to the process, and the checkpoint
+   * fails naming one. Model what has to be saved mid-run as pad_receive activities and
+   * spawned ones that keep their state in the instance, as the sim::queuing models do
+   * unless built with coroutine bodies.
+   * @param path the file to write
+   * @return acpp::void_result<> error while running, with an activity waiting, or if a
+   * payload has no serializer
+   */
+  acpp::void_result<> checkpoint( const std::string &path );
+  /**
+   * @brief Save the simulation to a stream, see checkpoint( const std::string & )
+   * Messages queued in pads are taken out and put back in order, so it isn't const.
+   * @param out the stream, opened in binary mode
+   */
+  acpp::void_result<> checkpoint( std::ostream &out );
+  /**
+   * @brief Continue a checkpointed simulation in this one, which must not have spawned anything
+   * The models and payload serializers must be registered with this simulation's
+   * simulator under the names and tags they had. Several simulations can be restored
+   * from one checkpoint at once, to fork what-if runs off one warmed-up state. If it
+   * fails the simulation is left half restored, to be thrown away.
+   * @param path the file written by checkpoint
+   * @return acpp::void_result<> error if the checkpoint can't be read or doesn't fit
+   */
+  acpp::void_result<> restore( const std::string &path );
+  /**
+   * @brief Restore from a stream, see restore( const std::string & )
+   */
+  acpp::void_result<> restore( std::istream &in );
+  /**
+   * @brief Make a copy of the simulation by checkpointing it into a new one
+   * Change the copy's parameters to run a what-if from the current state.
+   * @return acpp::value_result<std::shared_ptr<Simulation>> the copy or error, see checkpoint
+   */
+  acpp::value_result<std::shared_ptr<Simulation>> fork();
+  /**
+   * @brief Count and time the events handled from now on, by event type and instance, between runs
+   * Each partition counts into its own table on its own thread, timing the handling of an
+   * event, the model code it runs included, by the time stamp counter where there is one,
+   * and noting how many events were pending as it went. Starting again starts over. An
+   * optimistic run also counts the events it later rolls back.
+   * @return acpp::void_result<> error while running or profiling
+   */
+  acpp::void_result<> startProfile();
+  /**
+   * @brief Stop counting, keeping what was counted for profile(), between runs
+   * @return acpp::void_result<> error while running or if not profiling
+   */
+  acpp::void_result<> stopProfile();
+  /**
+   * @brief Get what was counted since startProfile, while profiling or after
+   * Call it between runs, or from the activities of a run on one thread.
+   * @return acpp::value_result<Profile> the profile or error if never profiled or while
+   * partitions run on their threads
+   */
+  acpp::value_result<Profile> profile() const;
+  /**
+   * @brief Export what the instances do from now on to a Chrome Trace Event file, between runs
+   * Each instance is a process in the trace, with a track per activity showing when it
+   * ran and what it waited on (waitFor, waitOn, padReceive), and a counter per pad of the
+   * messages queued there. By simulated time a run is an instant and a wait a span; by
+   * wall clock a run is the time the event took to handle and waits are the gaps. With
+   * BOTH every instance appears twice, and each event notes its time on the other clock.
+   * Partitions record into their own rings and a writer thread formats them, so recording
+   * never waits; events that find a ring full are counted as dropped. The file opens in
+   * chrome://tracing and ui.perfetto.dev.
+   * @param path the file to write, replaced if it exists
+   * @param axis the clocks to lay events out by
+   * @return acpp::void_result<> error while running or exporting, or if the file can't be made
+   */
+  acpp::void_result<> startChromeTrace( const std::string &path, TraceAxis axis = TraceAxis::BOTH );
+  /**
+   * @brief Write out what is left of the Chrome trace and close its file, between runs
+   * Also done when the simulation is destroyed.
+   * @return acpp::void_result<> error while running, if not exporting or if the file can't be written
+   */
+  acpp::void_result<> stopChromeTrace();
+  /**
+   * @brief Record every event handled from now on to a binary trace file, between runs
+   * Each partition's thread records into its own ring and a writer thread copies the
+   * rings to the file, so recording never waits; events that find a ring full are
+   * counted as dropped. An optimistic run also records the events it later rolls back.
+   * The file layout is in src/Trace.h. Only available when built with SIM_TRACE.
+   * @param path the file to write, replaced if it exists
+   * @return acpp::void_result<> error while running or tracing, if the file can't be made
+   * or if tracing was compiled out
+   */
+  acpp::void_result<> startTrace( const std::string &path );
+  /**
+   * @brief Write out what is left of the trace and close its file, between runs
+   * Also done when the simulation is destroyed.
+   * @return acpp::void_result<> error while running, if not tracing or if the file can't be written
+   */
+  acpp::void_result<> stopTrace();
+  /**
+   * @brief Run through a trace recorded from a simulation set up like this one, checking that
+   * every event handled matches the trace
+   * Spawns and messages that came from outside the simulation while tracing, e.g. from
+   * spawnInstance or inject, are scheduled again from the trace when their turn comes,
+   * which needs a serializer for their payloads as checkpoints do. Events go on the calling
+   * thread in time order, however the trace was recorded. Only available when built with
+   * SIM_TRACE.
+   * @param path the file written while tracing, see startTrace
+   * @return acpp::value_result<size_t> the number of events handled or error describing the
+   * first event that differs, after which the simulation stays where it got to
+   */
+  acpp::value_result<size_t> replayTrace( const std::string &path );
   
   /**
    * @brief Request an instance to be spawned in the simulation
@@ -116,6 +357,36 @@ public:
       const std::string &name,
       const std::string &instance,
       const Clock::time_point &time = {} );
+  /**
+   * @brief Send a message to a pad of an instance from outside the simulation
+   * Any number of threads may inject at once, also while the simulation runs: events go
+   * through a lock-free inbox that the run moves into its event lists every few dozen
+   * events, never touching them from the injecting threads. spawnInstance and
+   * spawnActivity called from another thread during a run go the same way.
+   * A parallel run only takes in what was posted before it started.
+   * @param instance name of the receiving instance (must have spawned)
+   * @param pad name of the receiving pad
+   * @param payload the message
+   * @param time simulation time to deliver at, {} or a time gone by for as soon as possible
+   * @return acpp::void_result<> error std::errc::resource_unavailable_try_again while the
+   * inbox is full, to try again once the run caught up
+   */
+  acpp::void_result<> inject(
+      const std::string &instance,
+      const std::string &pad,
+      Payload payload,
+      const Clock::time_point &time = {} );
+  /**
+   * @brief Wake the activities waiting on a signal, see Activity::waitOn
+   * Called from an activity during a run, only the waiters of its own partition are woken.
+   * Called from another thread during a run, the signal goes through the inbox like an
+   * injected message and is raised as the run takes it in. Signals are not recorded in
+   * traces, so a replay doesn't raise them again.
+   * @param signal the name of the signal
+   * @return acpp::value_result<size_t> the number of activities woken, 0 if posted to the
+   * inbox, or error std::errc::resource_unavailable_try_again while the inbox is full
+   */
+  acpp::value_result<size_t> raiseSignal( const std::string &signal );
 
 private:
   friend class Simulator;
@@ -8,40 +8,195 @@
 #include "cpp_utils.h"
 #include "Model.h"
 #include "Simulation.h"
+#include "Collector.h"
 #include "Common.h"
 
+#include <cstdint>
 #include <memory>
 #include <functional>
+#include <map>
 #include <string>
+#include <vector>
 #include <system_error>
 #include <optional>
 #include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <iosfwd>
+#include <type_traits>
 
 namespace sim {
 
+/**
+ * @brief Writes a payload type into a checkpoint and reads it back, see Simulation::checkpoint
+ * save appends the bytes of a payload holding the type; load makes a payload from them.
+ */
+struct PayloadSerializer {
+  std::function<void( const Payload &payload, std::string &bytes )> save;
+  std::function<acpp::value_result<Payload>( const std::string &bytes )> load;
+};
+
 /**
  * @brief The manager and factory of simulations
- * This is a singleton
+ * getInstance() is the global simulator that simulations use by default; others can be
+ * made to keep sets of models apart.
  */
 class Simulator {
-private:
-  Simulator(); // mark as not publicly constructable
-
 public:
+  Simulator();
+  ~Simulator();
+
   static Simulator &getInstance();
 
   void reset();
 
   std::shared_ptr<Model> model( const std::string &name );
+  /**
+   * @brief Get the serializer registered for a payload type tag
+   * @return const PayloadSerializer* the serializer or nullptr if none is registered
+   */
+  const PayloadSerializer *payloadSerializer( uint32_t tag ) const;
 
   // design choice: no throw
   
   /**
    * @brief Load a topology from a JSON description
+   * The document is streamed through rather than parsed into a tree, making each
+   * instance as soon as its object ends, so it can hold millions of instances:
+   *   {
+   *     "parameters": { "seed": 7 },  // simulation parameters, scalars or arrays of them
+   *     "partitions": 4,              // see Simulation::setPartitions
+   *     "instance_count": 1000000,    // optional, reserves the instance tables up front
+   *     "instances": [ { "name": "n0", "model": "Node", "parameters": { "id": 0 } }, ... ],
+   *     "links": [ { "from": "n0.out", "to": "n1.in" }, ... ]
+   *   }
+   * Instances are made at once and their pads connected before any start activity runs;
+   * the start activities are scheduled at time zero in file order. Links may name
+   * instances that come later in the file. Other keys are skipped.
    * @param topo_json The topology as a JSON string
    * @return the created simulation or failure as a value_result
    */
-  std::shared_ptr<Simulation> loadTopology( const std::string &topo_json );
+  acpp::value_result<std::shared_ptr<Simulation>> loadTopology( const std::string &topo_json );
+  /**
+   * @brief Load a topology from a JSON stream, see loadTopology( const std::string & )
+   * @param topo_json The stream, read to the end of the document
+   * @return the created simulation or failure as a value_result
+   */
+  acpp::value_result<std::shared_ptr<Simulation>> loadTopology( std::istream &topo_json );
+  /**
+   * @brief Compile a JSON topology into a binary image for loadCompiledTopology
+   * The image holds a string table, instance and parameter records and the pad links
+   * already resolved to instance indexes. Models need not be registered to compile.
+   * @param topo_json The topology, see loadTopology
+   * @param image_path The file to write the image to
+   * @return acpp::void_result<> error if the topology is invalid or can't be written
+   */
+  acpp::void_result<> compileTopology( std::istream &topo_json, const std::string &image_path );
+  /**
+   * @brief Load a topology compiled by compileTopology, mapping the image in place
+   * Builds the same simulation loadTopology would from the JSON, without parsing.
+   * @param image_path The image file
+   * @return the created simulation or failure as a value_result
+   */
+  acpp::value_result<std::shared_ptr<Simulation>> loadCompiledTopology( const std::string &image_path );
+
+  /**
+   * @brief Builds the topology of one replica: spawns instances, sets parameters...
+   */
+  using Topology = std::function<acpp::void_result<>( std::shared_ptr<Simulation> simulation )>;
+  /**
+   * @brief Results of runReplications
+   */
+  struct Replications {
+    std::vector<std::string> errors; // by replica, empty for those that ran fine
+    std::map<std::string, std::shared_ptr<Collector>> collectors; // merged over the replicas that ran fine
+
+    size_t failed() const {
+      return std::count_if( errors.begin(), errors.end(), []( const auto &error ) { return !error.empty(); } );
+    }
+  };
+
+  /**
+   * @brief Run independent replicas of a topology on a pool of threads
+   * Each replica is a simulation of its own with a "seed" parameter, built by topology
+   * and run with Simulation::runParallel. Replicas share nothing but the models, which
+   * must keep their state in instances or collectors, and must not be added meanwhile.
+   * Collectors are merged in replica order, so results don't depend on the threads.
+   * @param topology builds each replica, called on the thread running it
+   * @param count the number of replicas
+   * @param seeds the seed of each replica, or empty for 0 to count - 1
+   * @param threads the number of threads, 0 for one per hardware thread
+   * @param until the last time to run events at
+   * @return acpp::value_result<Replications> the results or error if the arguments don't fit
+   */
+  acpp::value_result<Replications> runReplications(
+      const Topology &topology,
+      size_t count,
+      const std::vector<uint64_t> &seeds = {},
+      size_t threads = 0,
+      const Clock::time_point &until = Clock::time_point::max() );
+
+  /**
+   * @brief A design of experiments over the parameters of a compiled topology, see runSweep
+   */
+  struct Sweep {
+    /**
+     * @brief A parameter varied between low and high
+     * name is "instance.parameter" for a parameter of an instance, e.g. "server.rate" or
+     * "queue.depth", or a simulation parameter's name.
+     */
+    struct Factor {
+      std::string name;
+      double low = 0.0;
+      double high = 1.0;
+      size_t levels = 2;    // evenly spaced values from low to high, for FULL_FACTORIAL
+      bool integer = false; // rounded and set as an integer, for depths and counts
+    };
+    enum class Design {
+      FULL_FACTORIAL,  // every combination of the levels, the last factor varying fastest
+      LATIN_HYPERCUBE, // points values, each factor's range cut into points strata hit once each
+      SOBOL            // the first points of the Sobol sequence, after its origin
+    };
+
+    std::vector<Factor> factors;
+    Design design = Design::FULL_FACTORIAL;
+    size_t points = 0;  // for LATIN_HYPERCUBE and SOBOL
+    uint64_t seed = 0;  // of the Latin hypercube, and the first run's "seed" parameter
+    size_t threads = 0; // 0 for one per hardware thread
+    Clock::time_point until = Clock::time_point::max(); // the last time to run events at
+  };
+  /**
+   * @brief The results of one point of a sweep
+   */
+  struct SweepPoint {
+    size_t index = 0;
+    std::vector<double> values; // by factor
+    std::string error;          // empty if the run went fine
+    std::map<std::string, std::shared_ptr<Collector>> collectors;
+  };
+
+  /**
+   * @brief Get the factor values of the points of a sweep, without running them
+   * @return the values by point and factor, or error if the sweep doesn't fit its design
+   */
+  static acpp::value_result<std::vector<std::vector<double>>> sweepPoints( const Sweep &sweep );
+  /**
+   * @brief Run a topology once for each point of a sweep, on a pool of threads
+   * The image is mapped and checked once, and the factor names resolved once; each run
+   * builds its simulation from the shared image with the point's values on top, sets
+   * "seed" to the sweep's seed plus the point index and runs with Simulation::runParallel.
+   * As for runReplications, runs share nothing else but the models.
+   * @param image_path a topology compiled by compileTopology
+   * @param sweep the factors and how to choose their values
+   * @param done called with each point once its run ended, in the order they end, one
+   * call at a time
+   * @return acpp::void_result<> error if the image or the sweep is unusable; the errors of
+   * single runs go to done
+   */
+  acpp::void_result<> runSweep(
+      const std::string &image_path,
+      const Sweep &sweep,
+      const std::function<void( SweepPoint &&point )> &done );
 
   // design choice: throw
   
@@ -60,6 +215,37 @@ public:
     addModel( std::make_shared<ModelType>() );
   }
 
+  /**
+   * @brief Register how payloads of a type are checkpointed
+   * Like models, serializers must not be added while simulations use them.
+   * @param tag the type's tag, registered with SIM_REGISTER_PAYLOAD so it is the same in
+   * the process restoring a checkpoint
+   * @param serializer saves and loads the type
+   */
+  void addPayloadSerializer( uint32_t tag, PayloadSerializer serializer );
+
+  /**
+   * @brief Register a trivially copyable payload type to be checkpointed by its bytes
+   * @tparam T the type, registered with SIM_REGISTER_PAYLOAD
+   */
+  template <typename T>
+  void addPayloadSerializer() {
+    static_assert( std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>,
+        "give other types a PayloadSerializer" );
+    addPayloadSerializer( payload_tag<T>::value(),
+        PayloadSerializer{ []( const Payload &payload, std::string &bytes ) {
+                            bytes.append( reinterpret_cast<const char *>( &payload.get<T>() ), sizeof( T ) );
+                          },
+            []( const std::string &bytes ) -> acpp::value_result<Payload> {
+              if ( bytes.size() != sizeof( T ) ) {
+                return { {}, "payload size mismatch" };
+              }
+              T value{};
+              std::memcpy( &value, bytes.data(), sizeof( T ) );
+              return acpp::value_result<Payload>{ Payload{ value } };
+            } } );
+  }
+
   // mark as immoveable
   Simulator( Simulator && ) = delete;
   Simulator &operator =(Simulator && ) = delete;
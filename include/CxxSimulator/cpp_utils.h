@@ -121,15 +121,13 @@ struct value_result : public void_result<S> {
 
   value_result( const error_type &err, const std::string &msg ) noexcept : void_result<error_type>( err, msg ) {}
 
-  explicit value_result(
-      std::enable_if_t<std::is_copy_constructible_v<value_type>, const value_type &> value ) noexcept :
-      value{value} {
-    static_assert( std::is_copy_constructible_v<value_type> );
-  }
+  template <typename V = value_type, typename = std::enable_if_t<std::is_copy_constructible_v<V>>>
+  explicit value_result( const value_type &value ) noexcept : value{value} {}
 
   explicit value_result( value_type &&value ) noexcept : value{ std::forward<value_type>( value ) } {}
 
-  const std::optional<value_type> value;
+  std::optional<value_type> value; // not const so move-only values can be taken out
+
 };
 
 /**
@@ -1,5 +1,15 @@
 
 #include "SimQueuing.h"
+#include <CxxSimulator/Results.h>
+#ifdef SIM_COROUTINES
+#include <CxxSimulator/Coroutine.h>
+#endif // SIM_COROUTINES
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <optional>
 
 namespace sim {
 namespace queuing {
@@ -13,128 +23,724 @@ struct ModelRegistrar {
     simulator.addModel<DelayModel>();
     simulator.addModel<MultiplexModel>();
     simulator.addModel<SinkModel>();
+    addPayloadSerializers( simulator );
   }
 };
 
 static ModelRegistrar simQueuingRegistrar;
 
-SourceModel::SourceModel() : Model("SourceModel") {
-  addPadSpec( { "out", { PadSpec::Flag::CAN_OUTPUT }, {} } );
+#if ACPP_LESSON > 4
+/*
+ * Measurements the models keep in their simulation's collectors, named after the
+ * instance: "<name>.length" the messages waiting at a queue or server, "<name>.busy" the time it
+ * is serving and "<name>.time" the time messages took from the source to a sink. A sink
+ * given a "records" file also writes a row per message there, times in nanoseconds.
+ */
+namespace {
+
+Clock::duration seconds( double value ) {
+  return std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( value ) );
+}
+
+/**
+ * @brief Open the file of per-message records a sink writes if its "records" parameter names one
+ */
+struct SinkModelInstance : public Instance {
+  SinkModelInstance(
+      std::shared_ptr<Simulation> sim,
+      std::shared_ptr<Model> model,
+      const std::string &name,
+      const PropertyList &parameters ) :
+      Instance{ sim, model, name, parameters },
+      tally{ sim->collector<Tally>( name ) },
+      times{ sim->collector<Histogram>( name + ".time" ) } {
+    auto found = parameters.find( "records" );
+    auto path = found != parameters.end() ? std::get_if<std::string>( &found->second ) : nullptr;
+    if ( !path ) {
+      return;
+    }
+    auto opened = ResultsWriter::open( *path, {
+        { "id", ResultsColumn::Type::INTEGER },
+        { "length", ResultsColumn::Type::INTEGER },
+        { "arrival", ResultsColumn::Type::INTEGER },
+        { "start", ResultsColumn::Type::INTEGER },
+        { "departure", ResultsColumn::Type::INTEGER } } );
+    if ( opened ) {
+      records = std::move( *opened.value );
+    }
+  }
+
+#ifndef SIM_COROUTINES
+  acpp::value_result<Payload> saveState() const override;
+  void restoreState( Payload &&state ) noexcept override;
+#endif // SIM_COROUTINES
+
+  std::shared_ptr<Tally> tally;      // of the lengths of the messages received
+  std::shared_ptr<Histogram> times;  // of their times from the source
+  std::unique_ptr<ResultsWriter> records; // complete once the instance is gone
+};
+
+void recordArrival( Instance &instance, const QueueMessage &message ) {
+  auto &sink = static_cast<SinkModelInstance &>( instance );
+  auto now = instance.owner()->simtime();
+  if ( sink.tally ) {
+    sink.tally->add( double( message.length ) );
+  }
+  if ( sink.times ) {
+    sink.times->add( std::chrono::duration<double>( now - message.created ).count() );
+  }
+  if ( sink.records ) {
+    sink.records->append( { message.id, message.length, message.created, message.start, message.departure } );
+  }
+}
+
+}  // namespace
+#endif // ACPP_LESSON > 4
+
+#ifdef SIM_COROUTINES
+/*
+ * Coroutine bodies of the models. Each runs as its instance's start activity and keeps
+ * its state in the coroutine frame, which is allocated from the simulation's pool. They
+ * hold their simulation by plain pointer: it owns the instance, and a shared_ptr in a
+ * suspended frame would keep it alive for good. A frame is beyond the reach of
+ * saveState, so these models can't be checkpointed mid-run or run optimistically.
+ */
+namespace {
+
+std::shared_ptr<TimeWeighted> observeService( Instance &instance ) {
+  auto simulation = instance.owner();
+  if ( auto in = instance.pad( "in" ) ) {
+    in->observe( simulation->collector<TimeWeighted>( instance.name() + ".length" ) );
+  }
+  auto busy = simulation->collector<TimeWeighted>( instance.name() + ".busy" );
+  if ( busy ) {
+    busy->set( simulation->simtime(), 0.0 );
+  }
+  return busy;
+}
+
+Task sourceBody( Instance &instance, AsyncActivity activity, std::string, Payload ) {
+  auto duty_cycle = instance.parameter<double>( "duty_cycle" ).value_or( 2.0 );
+  auto interval = seconds( 1.0 / duty_cycle );
+  auto *simulation = instance.owner().get();
+  size_t id = 0;
+  while ( activity.state() == Activity::State::run ) {
+    co_await activity.padSend( "out", Payload::make<QueueMessage>( id++, size_t( 1 ), simulation->simtime() ) );
+    co_await activity.waitFor( interval );
+  }
+}
+
+// forward messages in arrival order, the in pad being the queue; linked to the ready pad of
+// the server fed, only while fewer than depth of them wait there
+Task forwardBody( Instance &instance, AsyncActivity activity, std::string, Payload ) {
+  auto depth = std::max<size_t>( instance.parameter<size_t>( "depth" ).value_or( 1 ), 1 );
+  auto ready = instance.pad( "ready" );
+  if ( auto in = instance.pad( "in" ); in && ready ) {
+    in->observe( instance.owner()->collector<TimeWeighted>( instance.name() + ".length" ) );
+  }
+  size_t outstanding = 0;
+  while ( activity.state() == Activity::State::run ) {
+    auto received = co_await activity.padReceive( "in" );
+    if ( !received ) {
+      break;
+    }
+    if ( ready && ready->peer() && received.value->is<QueueMessage>() ) {
+      for ( ; outstanding >= depth; --outstanding ) {
+        if ( !co_await activity.padReceive( "ready" ) ) {
+          co_return;
+        }
+      }
+      ++outstanding;
+    }
+    co_await activity.padSend( "out", std::move( *received.value ) );
+  }
+}
+
+// hold each message for length * rate seconds, one at a time, measuring the messages
+// waiting and the time busy in collectors named after the instance
+Task serviceBody( Instance &instance, AsyncActivity activity, std::string, Payload ) {
+  auto rate = instance.parameter<double>( "rate" ).value_or( 1.0 );
+  auto *simulation = instance.owner().get();
+  auto busy = observeService( instance );
+  auto ready = instance.pad( "ready" );
+  while ( activity.state() == Activity::State::run ) {
+    auto received = co_await activity.padReceive( "in" );
+    if ( !received ) {
+      break;
+    }
+    if ( !received.value->is<QueueMessage>() ) {
+      continue;
+    }
+    if ( ready && ready->peer() ) {
+      co_await activity.padSend( "ready", Payload{} );
+    }
+    auto message = received.value->take<QueueMessage>();
+    message.start = simulation->simtime();
+    if ( busy ) {
+      busy->set( message.start, 1.0 );
+    }
+    co_await activity.waitFor( seconds( message.length * rate ) );
+    message.departure = simulation->simtime();
+    if ( busy ) {
+      busy->set( message.departure, 0.0 );
+    }
+    co_await activity.padSend( "out", Payload::make<QueueMessage>( message ) );
+  }
+}
+
+// tally the lengths of the messages received in a collector named after the instance, and
+// their times from the source in another
+Task sinkBody( Instance &instance, AsyncActivity activity, std::string, Payload ) {
+  while ( activity.state() == Activity::State::run ) {
+    auto received = co_await activity.padReceive( "in" );
+    if ( !received ) {
+      break;
+    }
+    if ( received.value->is<QueueMessage>() ) {
+      recordArrival( instance, received.value->get<QueueMessage>() );
+    }
+  }
 }
 
+}  // namespace
+#elif ACPP_LESSON > 4
+/*
+ * Handlers of the models, doing what the coroutine bodies above do without ever
+ * waiting: messages arrive through pad_receive activities, and a source's next message
+ * and the end of a service are activities spawned for when they are due. Each model
+ * keeps its state in its instance, never in the Model, which every simulation of the
+ * simulator shares, and saves it whole, collectors included, so an optimistic run can
+ * roll it back.
+ */
+namespace {
+
+struct SourceState {
+  size_t next = 0; // id of the next message
+};
+
+struct QueueState {
+  std::deque<QueueMessage> waiting;
+  size_t outstanding = 0;
+  std::optional<TimeWeighted> length; // the collector as it was, for a rollback
+};
+
+struct ServiceState {
+  std::deque<QueueMessage> waiting;
+  std::optional<QueueMessage> serving;
+  std::optional<TimeWeighted> length, busy; // the collectors as they were, for a rollback
+};
+
+struct SinkState {
+  std::optional<Tally> tally; // as they were, for a rollback
+  std::optional<Histogram> times;
+};
+
+}  // namespace
+}  // namespace queuing
+}  // namespace sim
+
+SIM_REGISTER_PAYLOAD( sim::queuing::SourceState, 2 )
+SIM_REGISTER_PAYLOAD( sim::queuing::ServiceState, 3 )
+SIM_REGISTER_PAYLOAD( sim::queuing::SinkState, 4 )
+SIM_REGISTER_PAYLOAD( sim::queuing::QueueState, 5 )
+
+namespace sim {
+namespace queuing {
+namespace {
+
 struct SourceModelInstance : public Instance {
   SourceModelInstance(
       std::shared_ptr<Simulation> sim,
       std::shared_ptr<Model> model,
       const std::string &name,
       const PropertyList &parameters ) :
-      Instance{ sim, model, name, parameters } {
-    duty_cycle = parameter<double>( "duty_cycle" ).value_or( 2.0 );
+      Instance{ sim, model, name, parameters },
+      interval{ seconds( 1.0 / parameter<double>( "duty_cycle" ).value_or( 2.0 ) ) } {}
+
+  acpp::value_result<Payload> saveState() const override {
+    return acpp::value_result<Payload>( Payload{ SourceState{ next } } );
+  }
+  void restoreState( Payload &&state ) noexcept override {
+    next = state.take<SourceState>().next;
+  }
+
+  Clock::duration interval;
+  size_t next = 0;
+};
+
+// send a message and spawn the start activity again for the next one
+void sendMessage( Instance &instance, Activity &activity, const std::string &, Payload & ) {
+  auto &source = static_cast<SourceModelInstance &>( instance );
+  activity.padSend( "out", Payload::make<QueueMessage>( source.next++, size_t( 1 ), instance.owner()->simtime() ) );
+  instance.spawnActivity( "start", "start", source.interval );
+}
+
+/**
+ * @brief An instance with nothing to save, that can still be rolled back
+ */
+struct ForwardModelInstance : public Instance {
+  using Instance::Instance;
+
+  acpp::value_result<Payload> saveState() const override {
+    return acpp::value_result<Payload>( Payload{} );
+  }
+};
+
+void forwardMessage( Instance &, Activity &activity, const std::string &, Payload &payload ) {
+  activity.padSend( "out", std::move( payload ) );
+}
+
+struct QueueModelInstance : public Instance {
+  QueueModelInstance(
+      std::shared_ptr<Simulation> sim,
+      std::shared_ptr<Model> model,
+      const std::string &name,
+      const PropertyList &parameters ) :
+      Instance{ sim, model, name, parameters },
+      depth{ std::max<size_t>( parameter<size_t>( "depth" ).value_or( 1 ), 1 ) },
+      length{ sim->collector<TimeWeighted>( name + ".length" ) } {
+    if ( length ) {
+      length->set( sim->simtime(), 0.0 );
+    }
+  }
+
+  acpp::value_result<Payload> saveState() const override {
+    QueueState state{ waiting, outstanding, {} };
+    if ( length ) {
+      state.length = *length;
+    }
+    return acpp::value_result<Payload>( Payload{ std::move( state ) } );
+  }
+  void restoreState( Payload &&payload ) noexcept override {
+    auto state = payload.take<QueueState>();
+    waiting = std::move( state.waiting );
+    outstanding = state.outstanding;
+    // a checkpoint holds no collectors, the one made on restoring it goes on from its level
+    if ( length && state.length ) {
+      *length = *state.length;
+    } else if ( length ) {
+      length->set( owner()->simtime(), double( waiting.size() ) );
+    }
+  }
+
+  // send on what the server fed has room for, everything if it isn't linked back
+  void forward( Activity &activity ) {
+    auto ready = pad( "ready" );
+    bool bounded = ready && ready->peer();
+    while ( !waiting.empty() && ( !bounded || outstanding < depth ) ) {
+      activity.padSend( "out", Payload::make<QueueMessage>( waiting.front() ) );
+      waiting.pop_front();
+      outstanding += bounded ? 1 : 0;
+    }
+    if ( length ) {
+      length->set( owner()->simtime(), double( waiting.size() ) );
+    }
+  }
+
+  size_t depth;
+  std::shared_ptr<TimeWeighted> length;
+  std::deque<QueueMessage> waiting;
+  size_t outstanding = 0; // messages sent on that the server hasn't taken into service
+};
+
+void queueMessage( Instance &instance, Activity &activity, const std::string &, Payload &payload ) {
+  if ( !payload.is<QueueMessage>() ) {
+    activity.padSend( "out", std::move( payload ) );
+    return;
+  }
+  auto &queue = static_cast<QueueModelInstance &>( instance );
+  queue.waiting.push_back( payload.take<QueueMessage>() );
+  queue.forward( activity );
+}
+
+// the server fed took a message into service, making room for another
+void takeReady( Instance &instance, Activity &activity, const std::string &, Payload & ) {
+  auto &queue = static_cast<QueueModelInstance &>( instance );
+  if ( queue.outstanding > 0 ) {
+    --queue.outstanding;
+  }
+  queue.forward( activity );
+}
+
+struct ServiceModelInstance : public Instance {
+  ServiceModelInstance(
+      std::shared_ptr<Simulation> sim,
+      std::shared_ptr<Model> model,
+      const std::string &name,
+      const PropertyList &parameters ) :
+      Instance{ sim, model, name, parameters },
+      rate{ parameter<double>( "rate" ).value_or( 1.0 ) },
+      length{ sim->collector<TimeWeighted>( name + ".length" ) },
+      busy{ sim->collector<TimeWeighted>( name + ".busy" ) } {
+    if ( length ) {
+      length->set( sim->simtime(), 0.0 );
+    }
+    if ( busy ) {
+      busy->set( sim->simtime(), 0.0 );
+    }
+  }
+
+  acpp::value_result<Payload> saveState() const override {
+    ServiceState state{ waiting, serving, {}, {} };
+    if ( length ) {
+      state.length = *length;
+    }
+    if ( busy ) {
+      state.busy = *busy;
+    }
+    return acpp::value_result<Payload>( Payload{ std::move( state ) } );
+  }
+  void restoreState( Payload &&payload ) noexcept override {
+    auto state = payload.take<ServiceState>();
+    waiting = std::move( state.waiting );
+    serving = state.serving;
+    // a checkpoint holds no collectors, those made on restoring it go on from its levels
+    auto now = owner()->simtime();
+    if ( length && state.length ) {
+      *length = *state.length;
+    } else if ( length ) {
+      length->set( now, double( waiting.size() ) );
+    }
+    if ( busy && state.busy ) {
+      *busy = *state.busy;
+    } else if ( busy ) {
+      busy->set( now, serving ? 1.0 : 0.0 );
+    }
   }
 
-  void start( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity );
+  // take the next message waiting into service, for length * rate seconds, telling the
+  // queue feeding the server if there is one
+  void serveNext( Activity &activity ) {
+    auto now = owner()->simtime();
+    serving = waiting.front();
+    waiting.pop_front();
+    serving->start = now;
+    auto ready = pad( "ready" );
+    if ( ready && ready->peer() ) {
+      activity.padSend( "ready", Payload{} );
+    }
+    if ( length ) {
+      length->set( now, double( waiting.size() ) );
+    }
+    if ( busy ) {
+      busy->set( now, 1.0 );
+    }
+    spawnActivity( "done", "done", seconds( serving->length * rate ) );
+  }
 
-  double duty_cycle = 2.0;
+  double rate;
+  std::shared_ptr<TimeWeighted> length;
+  std::shared_ptr<TimeWeighted> busy;
+  std::deque<QueueMessage> waiting;
+  std::optional<QueueMessage> serving;
 };
 
+// queue a message for service, serving it at once if the server is idle
+void arriveForService( Instance &instance, Activity &activity, const std::string &, Payload &payload ) {
+  if ( !payload.is<QueueMessage>() ) {
+    return;
+  }
+  auto &server = static_cast<ServiceModelInstance &>( instance );
+  server.waiting.push_back( payload.take<QueueMessage>() );
+  if ( server.length ) {
+    server.length->set( instance.owner()->simtime(), double( server.waiting.size() ) );
+  }
+  if ( !server.serving ) {
+    server.serveNext( activity );
+  }
+}
+
+// send the message served on and take the next
+void endService( Instance &instance, Activity &activity, const std::string &, Payload & ) {
+  auto &server = static_cast<ServiceModelInstance &>( instance );
+  if ( !server.serving ) {
+    return;
+  }
+  auto message = *server.serving;
+  message.departure = instance.owner()->simtime();
+  server.serving.reset();
+  if ( server.busy ) {
+    server.busy->set( message.departure, 0.0 );
+  }
+  activity.padSend( "out", Payload::make<QueueMessage>( message ) );
+  if ( !server.waiting.empty() ) {
+    server.serveNext( activity );
+  }
+}
+
+void sinkMessage( Instance &instance, Activity &, const std::string &, Payload &payload ) {
+  if ( payload.is<QueueMessage>() ) {
+    recordArrival( instance, payload.get<QueueMessage>() );
+  }
+}
+
+}  // namespace
+
+// rows written can't be taken back, so a sink writing records has no state to roll back
+acpp::value_result<Payload> SinkModelInstance::saveState() const {
+  if ( records ) {
+    return { {}, "sink " + name() + " writes records, which can't be rolled back" };
+  }
+  SinkState state;
+  if ( tally ) {
+    state.tally = *tally;
+  }
+  if ( times ) {
+    state.times = *times;
+  }
+  return acpp::value_result<Payload>( Payload{ std::move( state ) } );
+}
+
+void SinkModelInstance::restoreState( Payload &&payload ) noexcept {
+  auto state = payload.take<SinkState>();
+  if ( tally && state.tally ) {
+    *tally = *state.tally;
+  }
+  if ( times && state.times ) {
+    *times = std::move( *state.times );
+  }
+}
+#endif // ACPP_LESSON > 4
+
+SourceModel::SourceModel() : Model("SourceModel") {
+  addPadSpec( { "out", { PadSpec::Flag::CAN_OUTPUT }, {} } );
+#ifdef SIM_COROUTINES
+  addActivitySpec( { "start", ActivitySpec::Type::plain, coroutine( &sourceBody ) } );
+#elif ACPP_LESSON > 4
+  addActivitySpec( { "start", ActivitySpec::Type::plain, &sendMessage } );
+#endif // ACPP_LESSON > 4
+}
+
 std::shared_ptr<Instance> SourceModel::makeInstance(
     std::shared_ptr<Simulation> sim,
     const std::string &name,
     const PropertyList &parameters ) {
-  auto instance = std::make_shared<SourceModelInstance>( sim, shared_from_this(), name, parameters );
-  ActivitySpec startSpec { "start", };
-}
-
-#if ACPP_LESSON > 4
-void SourceModel::startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity ) {
-  auto duty_cycle = instance->parameter<double>( "duty_cycle" ).value_or( 2.0 );
-  Clock::duration interval { static_cast<Clock::duration::rep>( Clock::period::den / duty_cycle ) };
-  
-  while (activity->state() == Activity::State::RUN) {
-    activity->padSend( "out", std::make_any<QueueMessage>( 0, 1 ) );
-    activity->waitFor( interval );
-  }
+#if ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+  return std::make_shared<SourceModelInstance>( sim, shared_from_this(), name, parameters );
+#else
+  return Model::makeInstance( sim, name, parameters );
+#endif // ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
 }
-#else // ACPP_LESSON <= 4
 
-#endif // ACPP_LESSON <= 4
 QueueModel::QueueModel() : Model("QueueModel") {
   addPadSpec( { "in", { PadSpec::Flag::CAN_INPUT }, {} } );
   addPadSpec( { "out", { PadSpec::Flag::CAN_OUTPUT }, {} } );
+  addPadSpec( { "ready", { PadSpec::Flag::CAN_INPUT }, {} } );
+#ifdef SIM_COROUTINES
+  addActivitySpec( { "start", ActivitySpec::Type::plain, coroutine( &forwardBody ) } );
+#elif ACPP_LESSON > 4
+  addActivitySpec( { "in", ActivitySpec::Type::pad_receive, &queueMessage } );
+  addActivitySpec( { "ready", ActivitySpec::Type::pad_receive, &takeReady } );
+#endif // ACPP_LESSON > 4
 }
 
-void QueueModel::startActivity( Instance &instance, Activity &activity ) {
-  auto queue_depth = instance.parameter<size_t>( "depth" ).value_or( 1 );
-  auto out = instance.pad( "out" );
-  auto out_peer = out->peer();
-  if (!out_peer) {
-    return;
-  }
-  if (out_peer->available() < queue_depth) {
-    auto received = activity.padReceive( "in" );
-    if (received) {
-      activity.padSend( "out", received.value );
-    }
-  }
+QueueModel::~QueueModel() = default;
+
+std::shared_ptr<Instance> QueueModel::makeInstance(
+    std::shared_ptr<Simulation> sim,
+    const std::string &name,
+    const PropertyList &parameters ) {
+#if ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+  return std::make_shared<QueueModelInstance>( sim, shared_from_this(), name, parameters );
+#else
+  return Model::makeInstance( sim, name, parameters );
+#endif // ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
 }
 
 ProcessorModel::ProcessorModel() : Model("ProcessorModel") {
   addPadSpec( { "in", { PadSpec::Flag::CAN_INPUT }, {} } );
   addPadSpec( { "out", { PadSpec::Flag::CAN_OUTPUT }, {} } );
+  addPadSpec( { "ready", { PadSpec::Flag::CAN_OUTPUT }, {} } );
+#ifdef SIM_COROUTINES
+  addActivitySpec( { "start", ActivitySpec::Type::plain, coroutine( &serviceBody ) } );
+#elif ACPP_LESSON > 4
+  addActivitySpec( { "in", ActivitySpec::Type::pad_receive, &arriveForService } );
+  addActivitySpec( { "done", ActivitySpec::Type::plain, &endService } );
+#endif // ACPP_LESSON > 4
 }
 
-void ProcessorModel::startActivity( Instance &instance, Activity &activity ) {
-  auto rate = instance.parameter<double>( "rate" ).value_or( 1.0 );
-  if (m_received.has_value() ) {
-    // woke up after a delay
-    activity.padSend( "out", std::make_any<QueueMessage>( *m_received ) );
-    m_received.reset();
-  }
-  auto received = activity.padReceive( "in" );
-  if (received && received.value.value().type() == typeid(QueueMessage)) {
-    m_received.emplace( std::any_cast<QueueMessage &&>( std::move( received.value.value() ) ) );
-    Clock::duration execution_delay { static_cast<Clock::duration::rep>( Clock::period::den / duty_cycle ) };
+ProcessorModel::~ProcessorModel() = default;
 
-    auto execution_delay = std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( m_received->length * rate ) );
-    activity.waitFor( execution_delay );
-  }
+std::shared_ptr<Instance> ProcessorModel::makeInstance(
+    std::shared_ptr<Simulation> sim,
+    const std::string &name,
+    const PropertyList &parameters ) {
+#if ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+  return std::make_shared<ServiceModelInstance>( sim, shared_from_this(), name, parameters );
+#else
+  return Model::makeInstance( sim, name, parameters );
+#endif // ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
 }
 
 DelayModel::DelayModel() : Model("DelayModel") {
   addPadSpec( { "in", { PadSpec::Flag::CAN_INPUT }, {} } );
   addPadSpec( { "out", { PadSpec::Flag::CAN_OUTPUT }, {} } );
+  addPadSpec( { "ready", { PadSpec::Flag::CAN_OUTPUT }, {} } );
+#ifdef SIM_COROUTINES
+  addActivitySpec( { "start", ActivitySpec::Type::plain, coroutine( &serviceBody ) } );
+#elif ACPP_LESSON > 4
+  addActivitySpec( { "in", ActivitySpec::Type::pad_receive, &arriveForService } );
+  addActivitySpec( { "done", ActivitySpec::Type::plain, &endService } );
+#endif // ACPP_LESSON > 4
 }
 
-void DelayModel::startActivity( Instance &instance, Activity &activity ) {
-  auto rate = instance.parameter<double>( "rate" ).value_or( 1.0 );
-  if (m_received.has_value() ) {
-    // woke up after a delay
-    activity.padSend( "out", std::make_any<QueueMessage>( *m_received ) );
-    m_received.reset();
-  }
-  auto received = activity.padReceive( "in" );
-  if (received && received.value.value().type() == typeid(QueueMessage)) {
-    m_received.emplace( std::any_cast<QueueMessage &&>( std::move( received.value.value() ) ) );
-    auto execution_delay = std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( m_received->length * rate ) );
-    activity.waitFor( execution_delay );
-  }
+DelayModel::~DelayModel() = default;
+
+std::shared_ptr<Instance> DelayModel::makeInstance(
+    std::shared_ptr<Simulation> sim,
+    const std::string &name,
+    const PropertyList &parameters ) {
+#if ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+  return std::make_shared<ServiceModelInstance>( sim, shared_from_this(), name, parameters );
+#else
+  return Model::makeInstance( sim, name, parameters );
+#endif // ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
 }
 
 MultiplexModel::MultiplexModel() : Model("MultiplexModel") {
   addPadSpec( { "in", { PadSpec::Flag::CAN_INPUT }, {} } );
   addPadSpec( { "out", { PadSpec::Flag::CAN_OUTPUT, PadSpec::Flag::BY_REQUEST }, {} } );
+#ifdef SIM_COROUTINES
+  addActivitySpec( { "start", ActivitySpec::Type::plain, coroutine( &forwardBody ) } );
+#elif ACPP_LESSON > 4
+  addActivitySpec( { "in", ActivitySpec::Type::pad_receive, &forwardMessage } );
+#endif // ACPP_LESSON > 4
 }
 
-void MultiplexModel::startActivity( Instance &instance, Activity &activity ) {
+MultiplexModel::~MultiplexModel() = default;
+
+std::shared_ptr<Instance> MultiplexModel::makeInstance(
+    std::shared_ptr<Simulation> sim,
+    const std::string &name,
+    const PropertyList &parameters ) {
+#if ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+  return std::make_shared<ForwardModelInstance>( sim, shared_from_this(), name, parameters );
+#else
+  return Model::makeInstance( sim, name, parameters );
+#endif // ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
 }
 
 SinkModel::SinkModel() : Model("SinkModel") {
   addPadSpec( { "in", { PadSpec::Flag::CAN_INPUT }, {} } );
+#ifdef SIM_COROUTINES
+  addActivitySpec( { "start", ActivitySpec::Type::plain, coroutine( &sinkBody ) } );
+#elif ACPP_LESSON > 4
+  addActivitySpec( { "in", ActivitySpec::Type::pad_receive, &sinkMessage } );
+#endif // ACPP_LESSON > 4
+}
+
+SinkModel::~SinkModel() = default;
+
+std::shared_ptr<Instance> SinkModel::makeInstance(
+    std::shared_ptr<Simulation> sim,
+    const std::string &name,
+    const PropertyList &parameters ) {
+#if ACPP_LESSON > 4
+  auto instance = std::make_shared<SinkModelInstance>( sim, shared_from_this(), name, parameters );
+  if ( parameters.count( "records" ) && !instance->records ) {
+    return nullptr; // the records can't be written
+  }
+  return instance;
+#else
+  return Model::makeInstance( sim, name, parameters );
+#endif // ACPP_LESSON > 4
 }
 
-void SinkModel::startActivity( Instance &instance, Activity &activity ) {
+#if ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+namespace {
+
+template <typename T>
+void append( std::string &bytes, const T &value ) {
+  bytes.append( reinterpret_cast<const char *>( &value ), sizeof( T ) );
+}
+
+template <typename T>
+bool extract( const std::string &bytes, size_t &at, T &value ) {
+  if ( bytes.size() - at < sizeof( T ) ) {
+    return false;
+  }
+  std::memcpy( &value, bytes.data() + at, sizeof( T ) );
+  at += sizeof( T );
+  return true;
 }
 
+}  // namespace
+#endif // ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+
+void addPayloadSerializers( Simulator &simulator ) {
+  simulator.addPayloadSerializer<QueueMessage>();
+#if ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+  simulator.addPayloadSerializer<SourceState>();
+  // the messages of a server, not its collectors
+  simulator.addPayloadSerializer( payload_tag<ServiceState>::value(),
+      PayloadSerializer{ []( const Payload &payload, std::string &bytes ) {
+                          auto &state = payload.get<ServiceState>();
+                          append( bytes, uint8_t( state.serving ? 1 : 0 ) );
+                          if ( state.serving ) {
+                            append( bytes, *state.serving );
+                          }
+                          append( bytes, uint64_t( state.waiting.size() ) );
+                          for ( const auto &message : state.waiting ) {
+                            append( bytes, message );
+                          }
+                        },
+          []( const std::string &bytes ) -> acpp::value_result<Payload> {
+            ServiceState state;
+            size_t at = 0;
+            uint8_t serving = 0;
+            uint64_t waiting = 0;
+            if ( !extract( bytes, at, serving ) ) {
+              return { {}, "service state truncated" };
+            }
+            if ( serving ) {
+              state.serving.emplace();
+              if ( !extract( bytes, at, *state.serving ) ) {
+                return { {}, "service state truncated" };
+              }
+            }
+            if ( !extract( bytes, at, waiting ) || ( bytes.size() - at ) / sizeof( QueueMessage ) != waiting ) {
+              return { {}, "service state truncated" };
+            }
+            state.waiting.resize( waiting );
+            for ( auto &message : state.waiting ) {
+              extract( bytes, at, message );
+            }
+            return acpp::value_result<Payload>{ Payload{ std::move( state ) } };
+          } } );
+  // the messages of a queue and how many it sent on, not its collector
+  simulator.addPayloadSerializer( payload_tag<QueueState>::value(),
+      PayloadSerializer{ []( const Payload &payload, std::string &bytes ) {
+                          auto &state = payload.get<QueueState>();
+                          append( bytes, uint64_t( state.outstanding ) );
+                          append( bytes, uint64_t( state.waiting.size() ) );
+                          for ( const auto &message : state.waiting ) {
+                            append( bytes, message );
+                          }
+                        },
+          []( const std::string &bytes ) -> acpp::value_result<Payload> {
+            QueueState state;
+            size_t at = 0;
+            uint64_t outstanding = 0;
+            uint64_t waiting = 0;
+            if ( !extract( bytes, at, outstanding ) || !extract( bytes, at, waiting ) ||
+                 ( bytes.size() - at ) / sizeof( QueueMessage ) != waiting ) {
+              return { {}, "queue state truncated" };
+            }
+            state.outstanding = size_t( outstanding );
+            state.waiting.resize( waiting );
+            for ( auto &message : state.waiting ) {
+              extract( bytes, at, message );
+            }
+            return acpp::value_result<Payload>{ Payload{ std::move( state ) } };
+          } } );
+  // a sink's state is its collectors, which checkpoints don't hold
+  simulator.addPayloadSerializer( payload_tag<SinkState>::value(),
+      PayloadSerializer{ []( const Payload &, std::string & ) {},
+          []( const std::string & ) -> acpp::value_result<Payload> {
+            return acpp::value_result<Payload>{ Payload{ SinkState{} } };
+          } } );
+#endif // ACPP_LESSON > 4 && !defined( SIM_COROUTINES )
+}
 
 } // namespace queuing
 } // namespace sim
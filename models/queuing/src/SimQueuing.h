@@ -9,10 +9,29 @@ namespace sim {
 namespace queuing {
 
 struct QueueMessage {
-  size_t id;
-  size_t length;
+  size_t id = 0;
+  size_t length = 0;
+  Clock::time_point created{};   // when the source sent it
+  Clock::time_point start{};     // of its service at the last server it went through
+  Clock::time_point departure{}; // from that server
 };
 
+}  // namespace queuing
+}  // namespace sim
+
+SIM_REGISTER_PAYLOAD( sim::queuing::QueueMessage, 1 )
+
+namespace sim {
+namespace queuing {
+
+/**
+ * @brief Register how messages and the states of the models are checkpointed
+ * The global simulator gets them with the models; add them to any other simulator the
+ * models are added to, before checkpointing or restoring its simulations.
+ * @param simulator the simulator
+ */
+void addPayloadSerializers( Simulator &simulator );
+
 class SourceModel : public Model {
 public:
   SourceModel();
@@ -22,14 +41,18 @@ public:
   SourceModel( SourceModel &other ) = default;
   SourceModel &operator=( SourceModel &other ) = default;
 
-  // entry point for the model
-  void startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity ) override;
   std::shared_ptr<Instance> makeInstance(
       std::shared_ptr<Simulation> sim,
       const std::string &name,
       const PropertyList &parameters ) override;
 };
 
+/**
+ * @brief Holds messages in arrival order for the server its "out" pad feeds
+ * Linked to that server's "ready" pad through its own, it sends a message on only while
+ * fewer than its "depth" parameter (1 by default, at least 1) wait at the server.
+ * Unlinked, it sends each on as it arrives.
+ */
 class QueueModel : public Model {
 public:
   QueueModel();
@@ -39,20 +62,16 @@ public:
   QueueModel( QueueModel &other ) = default;
   QueueModel &operator=( QueueModel &other ) = default;
 
-  // entry point for the model
-  void startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity ) override;
   std::shared_ptr<Instance> makeInstance(
       std::shared_ptr<Simulation> sim,
       const std::string &name,
       const PropertyList &parameters ) override;
-
-#if ACPP_LESSON < 5
-protected:
-  void sentActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity, Pad &pad );
-  void receivedActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity, Pad &pad );
-#endif // ACPP_LESSON < 5
 };
 
+/**
+ * @brief Serves messages one at a time, each for its length times the "rate" parameter
+ * Its "ready" pad tells the queue feeding it whenever a message leaves its waiting line.
+ */
 class ProcessorModel : public Model {
 public:
   ProcessorModel();
@@ -62,14 +81,15 @@ public:
   ProcessorModel( ProcessorModel &other ) = default;
   ProcessorModel &operator=( ProcessorModel &other ) = default;
 
-  // entry point for the model
-  void startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity ) override;
   std::shared_ptr<Instance> makeInstance(
       std::shared_ptr<Simulation> sim,
       const std::string &name,
       const PropertyList &parameters ) override;
 };
 
+/**
+ * @brief Holds messages like ProcessorModel, with the same "rate" and "ready" pad
+ */
 class DelayModel : public Model {
 public:
   DelayModel();
@@ -79,8 +99,6 @@ public:
   DelayModel( DelayModel &other ) = default;
   DelayModel &operator=( DelayModel &other ) = default;
 
-  // entry point for the model
-  void startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity ) override;
   std::shared_ptr<Instance> makeInstance(
       std::shared_ptr<Simulation> sim,
       const std::string &name,
@@ -96,8 +114,6 @@ public:
   MultiplexModel( MultiplexModel &other ) = default;
   MultiplexModel &operator=( MultiplexModel &other ) = default;
 
-  // entry point for the model
-  void startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity ) override;
   std::shared_ptr<Instance> makeInstance(
       std::shared_ptr<Simulation> sim,
       const std::string &name,
@@ -113,8 +129,6 @@ public:
   SinkModel( SinkModel &other ) = default;
   SinkModel &operator=( SinkModel &other ) = default;
 
-  // entry point for the model
-  void startActivity( std::shared_ptr<Instance> instance, std::shared_ptr<Activity> activity ) override;
   std::shared_ptr<Instance> makeInstance(
       std::shared_ptr<Simulation> sim,
       const std::string &name,
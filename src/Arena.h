@@ -0,0 +1,156 @@
+/**
+ * Arena.h
+ * Per-simulation pooled memory with allocation counters
+ */
+
+#ifndef SIM_ARENA_H_INCLUDED
+#define SIM_ARENA_H_INCLUDED
+
+#include <CxxSimulator/Common.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+namespace sim {
+
+/**
+ * @brief Memory resource forwarding to an upstream resource and counting what passes through
+ */
+class CountingResource : public std::pmr::memory_resource {
+public:
+  explicit CountingResource( std::pmr::memory_resource *upstream ) noexcept : m_upstream{ upstream } {}
+
+  size_t allocations() const noexcept {
+    return m_allocations.load( std::memory_order_relaxed );
+  }
+  size_t deallocations() const noexcept {
+    return m_deallocations.load( std::memory_order_relaxed );
+  }
+  size_t bytes() const noexcept {
+    return m_bytes.load( std::memory_order_relaxed );
+  }
+  size_t peakBytes() const noexcept {
+    return m_peak_bytes.load( std::memory_order_relaxed );
+  }
+
+private:
+  void *do_allocate( size_t bytes, size_t alignment ) override {
+    void *memory = m_upstream->allocate( bytes, alignment );
+    m_allocations.fetch_add( 1, std::memory_order_relaxed );
+    auto in_use = m_bytes.fetch_add( bytes, std::memory_order_relaxed ) + bytes;
+    auto peak = m_peak_bytes.load( std::memory_order_relaxed );
+    while ( in_use > peak && !m_peak_bytes.compare_exchange_weak( peak, in_use, std::memory_order_relaxed ) ) {
+    }
+    return memory;
+  }
+  void do_deallocate( void *memory, size_t bytes, size_t alignment ) override {
+    m_upstream->deallocate( memory, bytes, alignment );
+    m_deallocations.fetch_add( 1, std::memory_order_relaxed );
+    m_bytes.fetch_sub( bytes, std::memory_order_relaxed );
+  }
+  bool do_is_equal( const std::pmr::memory_resource &other ) const noexcept override {
+    return this == &other;
+  }
+
+  std::pmr::memory_resource *m_upstream;
+  std::atomic<size_t> m_allocations{ 0 };
+  std::atomic<size_t> m_deallocations{ 0 };
+  std::atomic<size_t> m_bytes{ 0 };
+  std::atomic<size_t> m_peak_bytes{ 0 };
+};
+
+/**
+ * @brief Pooled memory owned by one simulation
+ * Blocks are recycled through per-size free lists and only go back to the system when
+ * the arena is destroyed, so once a simulation has warmed up, stepping it should not
+ * reach the system allocator at all; stats().system_allocations confirms that.
+ * Everything allocated from an arena must be released before it is destroyed.
+ */
+class Arena {
+public:
+  Arena() :
+      m_system{ std::pmr::new_delete_resource() },
+      m_pool{ std::pmr::pool_options{ 0, s_largest_pooled_block }, &m_system },
+      m_counted{ &m_pool } {}
+  Arena( const Arena & ) = delete;
+  Arena &operator=( const Arena & ) = delete;
+
+  std::pmr::memory_resource *resource() noexcept {
+    return &m_counted;
+  }
+
+  AllocatorStats stats() const noexcept {
+    AllocatorStats stats;
+    stats.allocations = m_counted.allocations();
+    stats.deallocations = m_counted.deallocations();
+    stats.bytes_in_use = m_counted.bytes();
+    stats.peak_bytes = m_counted.peakBytes();
+    stats.system_allocations = m_system.allocations();
+    stats.system_bytes = m_system.bytes();
+    return stats;
+  }
+
+private:
+  // pad rings and the like are a few KiB each and number one or two per instance; left
+  // unpooled, the pool tracks each in a sorted list and large topologies slow to a crawl
+  static constexpr size_t s_largest_pooled_block = 64 * 1024;
+
+  CountingResource m_system; // what the pool takes from the system allocator
+  std::pmr::synchronized_pool_resource m_pool;
+  CountingResource m_counted; // what the simulation takes from the pool
+};
+
+/**
+ * @brief Make a shared object with its control block in one allocation from a resource
+ */
+template <typename Tp, typename... Args>
+inline std::shared_ptr<Tp> allocate_shared_from( std::pmr::memory_resource *resource, Args &&... args ) {
+  return std::allocate_shared<Tp>( std::pmr::polymorphic_allocator<Tp>( resource ), std::forward<Args>( args )... );
+}
+
+/**
+ * @brief Base for PIMPL blocks that may live in an arena
+ * `new ( resource ) Impl{ ... }` allocates from resource and remembers it, so the
+ * owning std::unique_ptr<Impl> still releases the block with a plain delete.
+ */
+struct ArenaObject {
+  static void *operator new( size_t size, std::pmr::memory_resource *resource ) {
+    if ( !resource ) {
+      resource = std::pmr::new_delete_resource();
+    }
+    auto *memory = static_cast<std::byte *>( resource->allocate( size + header_size, alignof( std::max_align_t ) ) );
+    ::new ( memory ) Header{ resource, size + header_size };
+    return memory + header_size;
+  }
+  static void *operator new( size_t size ) {
+    return operator new( size, nullptr );
+  }
+  static void operator delete( void *object ) noexcept {
+    if ( !object ) {
+      return;
+    }
+    auto *memory = static_cast<std::byte *>( object ) - header_size;
+    auto header = *std::launder( reinterpret_cast<Header *>( memory ) );
+    header.resource->deallocate( memory, header.size, alignof( std::max_align_t ) );
+  }
+  // called if the constructor throws
+  static void operator delete( void *object, std::pmr::memory_resource * ) noexcept {
+    operator delete( object );
+  }
+
+private:
+  struct Header {
+    std::pmr::memory_resource *resource;
+    size_t size;
+  };
+  static constexpr size_t header_size =
+      ( sizeof( Header ) + alignof( std::max_align_t ) - 1 ) / alignof( std::max_align_t ) * alignof( std::max_align_t );
+};
+
+}  // namespace sim
+
+#endif  // SIM_ARENA_H_INCLUDED
@@ -0,0 +1,219 @@
+// Checkpoint.cpp : binary streams of simulation checkpoints
+//
+
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace sim {
+
+namespace {
+
+/*
+ * Strings are read in pieces this large, so that a corrupt length fails at the end of
+ * the stream rather than on allocating it all
+ */
+constexpr size_t s_read_chunk = 64 * 1024;
+
+template <typename Item>
+void putList( CheckpointWriter &writer, const std::vector<Item> &items ) {
+  writer.put( uint32_t( items.size() ) );
+  for ( const auto &item : items ) {
+    if constexpr ( std::is_same_v<Item, std::string> ) {
+      writer.putString( item );
+    } else {
+      writer.put( item );
+    }
+  }
+}
+
+template <typename Item>
+bool getList( CheckpointReader &reader, std::vector<Item> &items ) {
+  uint32_t count = 0;
+  if ( !reader.get( count ) ) {
+    return false;
+  }
+  items.clear();
+  items.reserve( std::min<size_t>( count, s_read_chunk ) );
+  for ( uint32_t index = 0; index < count; ++index ) {
+    Item item{};
+    bool read;
+    if constexpr ( std::is_same_v<Item, std::string> ) {
+      read = reader.getString( item );
+    } else {
+      read = reader.get( item );
+    }
+    if ( !read ) {
+      return false;
+    }
+    items.push_back( std::move( item ) );
+  }
+  return true;
+}
+
+}  // namespace
+
+void CheckpointWriter::write( const void *data, size_t size ) {
+  m_out.write( static_cast<const char *>( data ), static_cast<std::streamsize>( size ) );
+}
+
+bool CheckpointWriter::good() const {
+  return m_out.good();
+}
+
+void CheckpointWriter::putString( const std::string &text ) {
+  put( uint32_t( text.size() ) );
+  write( text.data(), text.size() );
+}
+
+void CheckpointWriter::putValue( const acpp::unstructured_value &value ) {
+  put( uint8_t( value.index() ) );
+  std::visit( [this]( const auto &item ) {
+    using Vt = std::decay_t<decltype( item )>;
+    if constexpr ( std::is_same_v<Vt, std::string> ) {
+      putString( item );
+    } else if constexpr ( std::is_arithmetic_v<Vt> ) {
+      put( item );
+    } else if constexpr ( !std::is_same_v<Vt, std::monostate> ) {
+      putList( *this, item );
+    }
+  }, value );
+}
+
+void CheckpointWriter::putProperties( const PropertyList &properties ) {
+  std::vector<const PropertyList::value_type *> sorted;
+  sorted.reserve( properties.size() );
+  for ( const auto &property : properties ) {
+    sorted.push_back( &property );
+  }
+  std::sort( sorted.begin(), sorted.end(), []( auto *lhs, auto *rhs ) { return lhs->first < rhs->first; } );
+  put( uint32_t( sorted.size() ) );
+  for ( auto *property : sorted ) {
+    putString( property->first );
+    putValue( property->second );
+  }
+}
+
+acpp::void_result<> CheckpointWriter::putPayload( const Payload &payload ) {
+  auto tag = payload.tag();
+  put( tag );
+  if ( !tag ) {
+    return {};
+  }
+  auto serializer = m_simulator.payloadSerializer( tag );
+  if ( !serializer ) {
+    return { {}, "no serializer for payload tag " + std::to_string( tag ) };
+  }
+  m_bytes.clear();
+  serializer->save( payload, m_bytes );
+  putString( m_bytes );
+  return {};
+}
+
+bool CheckpointReader::read( void *data, size_t size ) {
+  m_in.read( static_cast<char *>( data ), static_cast<std::streamsize>( size ) );
+  return static_cast<bool>( m_in );
+}
+
+bool CheckpointReader::good() const {
+  return !m_in.fail();
+}
+
+bool CheckpointReader::getString( std::string &text ) {
+  uint32_t length = 0;
+  if ( !get( length ) ) {
+    return false;
+  }
+  text.clear();
+  while ( text.size() < length ) {
+    auto offset = text.size();
+    text.resize( offset + std::min<size_t>( length - offset, s_read_chunk ) );
+    if ( !read( &text[offset], text.size() - offset ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CheckpointReader::getValue( acpp::unstructured_value &value ) {
+  uint8_t kind = 0;
+  if ( !get( kind ) ) {
+    return false;
+  }
+  // read an alternative in place, it being default constructible
+  auto read = [&]( auto alternative ) {
+    using Vt = decltype( alternative );
+    auto &item = value.emplace<Vt>();
+    if constexpr ( std::is_same_v<Vt, std::string> ) {
+      return getString( item );
+    } else if constexpr ( std::is_arithmetic_v<Vt> ) {
+      return get( item );
+    } else {
+      return getList( *this, item );
+    }
+  };
+  switch ( kind ) {
+  case 0:
+    value = std::monostate{};
+    return true;
+  case 1:
+    return read( intmax_t{} );
+  case 2:
+    return read( uintmax_t{} );
+  case 3:
+    return read( double{} );
+  case 4:
+    return read( std::string{} );
+  case 5:
+    return read( std::vector<intmax_t>{} );
+  case 6:
+    return read( std::vector<uintmax_t>{} );
+  case 7:
+    return read( std::vector<double>{} );
+  case 8:
+    return read( std::vector<std::string>{} );
+  default:
+    return false;
+  }
+}
+
+bool CheckpointReader::getProperties( PropertyList &properties ) {
+  uint32_t count = 0;
+  if ( !get( count ) ) {
+    return false;
+  }
+  properties.clear();
+  for ( uint32_t index = 0; index < count; ++index ) {
+    std::string name;
+    acpp::unstructured_value value;
+    if ( !getString( name ) || !getValue( value ) ) {
+      return false;
+    }
+    properties.insert_or_assign( std::move( name ), std::move( value ) );
+  }
+  return true;
+}
+
+acpp::value_result<Payload> CheckpointReader::getPayload() {
+  uint32_t tag = 0;
+  if ( !get( tag ) ) {
+    return { {}, "checkpoint truncated" };
+  }
+  if ( !tag ) {
+    return acpp::value_result<Payload>{ Payload{} };
+  }
+  auto serializer = m_simulator.payloadSerializer( tag );
+  if ( !serializer ) {
+    return { {}, "no serializer for payload tag " + std::to_string( tag ) };
+  }
+  if ( !getString( m_bytes ) ) {
+    return { {}, "checkpoint truncated" };
+  }
+  return serializer->load( m_bytes );
+}
+
+}  // namespace sim
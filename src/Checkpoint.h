@@ -0,0 +1,104 @@
+/**
+ * Checkpoint.h
+ * Binary streams that simulation checkpoints are written to and read from
+ */
+
+#ifndef SIM_CHECKPOINT_H_INCLUDED
+#define SIM_CHECKPOINT_H_INCLUDED
+
+#include <CxxSimulator/Simulator.h>
+#include <CxxSimulator/Common.h>
+#include <CxxSimulator/Payload.h>
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <type_traits>
+
+namespace sim {
+
+/**
+ * Layout of a checkpoint, every number in the byte order of the machine that wrote it:
+ *   header:      magic, version, byte order
+ *   simulation:  partitions, state, simtime, external seq, name tables, parameters
+ *   instances:   id, model, partition, event count, parameters, saved state, queued messages
+ *   links:       pad to pad, by instance and pad name ids
+ *   spawns:      instances whose SPAWN_INSTANCE is still to come, with their parameters
+ *   events:      by partition, each with its tie-breaker and payload
+ * Strings and payloads are a 32-bit length followed by their bytes; payloads are preceded
+ * by their type tag, 0 for none.
+ */
+namespace checkpoint {
+
+constexpr char s_magic[8] = { 'C', 'x', 'S', 'i', 'm', 'C', 'h', 'k' };
+constexpr uint32_t s_version = 1;
+constexpr uint32_t s_byte_order = 0x01020304;
+
+}  // namespace checkpoint
+
+/**
+ * @brief Writes the values a checkpoint is made of to a stream
+ */
+class CheckpointWriter {
+public:
+  /**
+   * @param out the stream, opened in binary mode
+   * @param simulator where payload serializers are registered
+   */
+  CheckpointWriter( std::ostream &out, const Simulator &simulator ) : m_out{ out }, m_simulator{ simulator } {}
+
+  template <typename T>
+  void put( const T &value ) {
+    static_assert( std::is_trivially_copyable_v<T> );
+    write( &value, sizeof( T ) );
+  }
+  void putString( const std::string &text );
+  void putValue( const acpp::unstructured_value &value );
+  /**
+   * @brief Write properties sorted by name, so that equal lists make equal checkpoints
+   */
+  void putProperties( const PropertyList &properties );
+  /**
+   * @return acpp::void_result<> error if no serializer is registered for the payload's type
+   */
+  acpp::void_result<> putPayload( const Payload &payload );
+  bool good() const;
+
+private:
+  void write( const void *data, size_t size );
+
+  std::ostream &m_out;
+  const Simulator &m_simulator;
+  std::string m_bytes; // scratch for serializers
+};
+
+/**
+ * @brief Reads back what a CheckpointWriter wrote, failing for good at the first bad value
+ * Lengths and counts read are checked against the stream rather than trusted.
+ */
+class CheckpointReader {
+public:
+  CheckpointReader( std::istream &in, const Simulator &simulator ) : m_in{ in }, m_simulator{ simulator } {}
+
+  template <typename T>
+  bool get( T &value ) {
+    static_assert( std::is_trivially_copyable_v<T> );
+    return read( &value, sizeof( T ) );
+  }
+  bool getString( std::string &text );
+  bool getValue( acpp::unstructured_value &value );
+  bool getProperties( PropertyList &properties );
+  acpp::value_result<Payload> getPayload();
+  bool good() const;
+
+private:
+  bool read( void *data, size_t size );
+
+  std::istream &m_in;
+  const Simulator &m_simulator;
+  std::string m_bytes;
+};
+
+}  // namespace sim
+
+#endif  // SIM_CHECKPOINT_H_INCLUDED
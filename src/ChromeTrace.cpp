@@ -0,0 +1,317 @@
+// ChromeTrace.cpp : Chrome Trace Event JSON of what instances do, and the thread writing it
+//
+
+#include "ChromeTrace.h"
+
+#include <array>
+#include <cstdio>
+#include <map>
+#include <utility>
+
+namespace sim {
+
+namespace {
+
+void appendString( std::string &out, const std::string &text ) {
+  out += '"';
+  for ( char ch : text ) {
+    switch ( ch ) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    default:
+      if ( static_cast<unsigned char>( ch ) < 0x20 ) {
+        char escaped[8];
+        std::snprintf( escaped, sizeof( escaped ), "\\u%04x", unsigned( ch ) );
+        out += escaped;
+      } else {
+        out += ch;
+      }
+    }
+  }
+  out += '"';
+}
+
+/**
+ * @brief Append microseconds, the unit of Chrome trace times, to the nanosecond
+ */
+void appendMicros( std::string &out, double micros ) {
+  char text[32];
+  std::snprintf( text, sizeof( text ), "%.3f", micros );
+  out += text;
+}
+
+constexpr uint32_t s_no_thread = ~uint32_t( 0 ); // a process with only counters seen
+
+}  // namespace
+
+acpp::value_result<std::unique_ptr<ChromeTraceWriter>> ChromeTraceWriter::open(
+    const std::string &path, chrome_trace::Axis axis, chrome_trace::Names &&names ) {
+  std::unique_ptr<ChromeTraceWriter> writer{ new ChromeTraceWriter };
+  writer->m_out.open( path, std::ios::binary | std::ios::trunc );
+  if ( !writer->m_out ) {
+    return { {}, "can't open " + path };
+  }
+  writer->m_path = path;
+  writer->m_axis = axis;
+  writer->m_names = std::move( names );
+  writer->m_out << "{\"traceEvents\":[\n";
+  writer->m_start_ticks = ticks();
+  writer->m_thread = std::thread{ [writer = writer.get()] { writer->flushMain(); } };
+  return acpp::value_result<std::unique_ptr<ChromeTraceWriter>>{ std::move( writer ) };
+}
+
+ChromeTraceWriter::~ChromeTraceWriter() noexcept {
+  stop();
+}
+
+void ChromeTraceWriter::stop() noexcept {
+  if ( m_thread.joinable() ) {
+    {
+      std::lock_guard lock{ m_stop_mut };
+      m_stop = true;
+    }
+    m_stop_cnd.notify_one();
+    m_thread.join();
+  }
+}
+
+ChromeTraceBuffer &ChromeTraceWriter::buffer( size_t partition, const Clock::time_point &simtime ) {
+  std::lock_guard lock{ m_buffers_mut };
+  if ( m_buffers.size() <= partition ) {
+    m_buffers.resize( partition + 1 );
+  }
+  auto &buffer = m_buffers[partition];
+  if ( !buffer ) {
+    buffer = std::make_unique<ChromeTraceBuffer>( s_buffer_capacity, simtime );
+  }
+  buffer->m_simtime = &simtime; // the partitions may have been made again
+  return *buffer;
+}
+
+void ChromeTraceWriter::flushMain() {
+  std::unique_lock lock{ m_stop_mut };
+  while ( !m_stop ) {
+    m_stop_cnd.wait_for( lock, s_flush_interval, [this] { return m_stop; } );
+    lock.unlock();
+    flush();
+    lock.lock();
+  }
+}
+
+void ChromeTraceWriter::flush() {
+  std::lock_guard lock{ m_buffers_mut };
+  if ( auto rate = m_rate.perSecond(); rate > 0.0 ) {
+    m_ticks_per_micro = rate * 1e-6;
+  }
+  std::array<chrome_trace::Record, s_flush_batch> records;
+  std::string text;
+  for ( auto &buffer : m_buffers ) {
+    while ( buffer ) {
+      auto count = buffer->m_ring.pop( records.data(), records.size() );
+      if ( count == 0 ) {
+        break;
+      }
+      if ( m_failure ) {
+        continue; // drained all the same, so that recording never blocks
+      }
+      text.clear();
+      for ( size_t record = 0; record < count; ++record ) {
+        format( records[record], text );
+      }
+      m_out.write( text.data(), std::streamsize( text.size() ) );
+      if ( !m_out ) {
+        m_failure = "can't write " + m_path;
+      }
+    }
+  }
+}
+
+double ChromeTraceWriter::wallMicros( uint64_t at ) const noexcept {
+  return m_ticks_per_micro > 0.0 ? double( int64_t( at - m_start_ticks ) ) / m_ticks_per_micro : 0.0;
+}
+
+const std::string &ChromeTraceWriter::name( SymbolId id ) {
+  if ( id >= m_name_cache.size() ) {
+    m_name_cache.resize( id + 1 );
+  }
+  auto &cached = m_name_cache[id];
+  if ( cached.empty() ) {
+    cached = m_names.name( id );
+  }
+  return cached;
+}
+
+const std::string &ChromeTraceWriter::instanceName( SymbolId id ) {
+  if ( id >= m_instance_cache.size() ) {
+    m_instance_cache.resize( id + 1 );
+  }
+  auto &cached = m_instance_cache[id];
+  if ( cached.empty() ) {
+    cached = m_names.instance( id );
+  }
+  return cached;
+}
+
+void ChromeTraceWriter::begin( std::string &out, const char *phase, const std::string &name, uint32_t pid, uint32_t tid ) {
+  out += m_first ? "{\"name\":" : ",\n{\"name\":";
+  m_first = false;
+  appendString( out, name );
+  out += ",\"ph\":\"";
+  out += phase;
+  out += "\",\"pid\":";
+  out += std::to_string( pid );
+  if ( tid != s_no_thread ) {
+    out += ",\"tid\":";
+    out += std::to_string( tid );
+  }
+  m_threads.insert( uint64_t( pid ) << 32 | tid );
+}
+
+void ChromeTraceWriter::format( const chrome_trace::Record &record, std::string &out ) {
+  using chrome_trace::Axis;
+  using chrome_trace::Kind;
+  bool simulated = m_axis != Axis::WALL;
+  bool wall = m_axis != Axis::SIMULATED;
+  uint32_t pid = record.instance == no_symbol ? 0 : record.instance + 1;
+  uint32_t tid = record.track == no_symbol ? 0 : record.track + 1;
+  auto sim_begin = double( record.sim_begin ) * 1e-3;
+  auto wall_begin = wallMicros( record.wall_begin );
+
+  switch ( record.kind ) {
+  case Kind::RUN: {
+    // named after the activity it ran, or the event if none
+    std::string label = record.track != no_symbol ? name( record.track ) : m_names.type( record.type );
+    auto wall_duration = wallMicros( record.wall_end ) - wall_begin;
+    if ( simulated ) {
+      // takes no simulated time
+      begin( out, "i", label, pid, tid );
+      out += ",\"s\":\"t\",\"ts\":";
+      appendMicros( out, sim_begin );
+      out += ",\"args\":{\"event\":\"";
+      out += m_names.type( record.type );
+      out += "\",\"wall_us\":";
+      appendMicros( out, wall_begin );
+      out += ",\"wall_dur_us\":";
+      appendMicros( out, wall_duration );
+      out += "}}";
+    }
+    if ( wall ) {
+      begin( out, "X", label, pid + s_wall_pid, tid );
+      out += ",\"ts\":";
+      appendMicros( out, wall_begin );
+      out += ",\"dur\":";
+      appendMicros( out, wall_duration );
+      out += ",\"args\":{\"event\":\"";
+      out += m_names.type( record.type );
+      out += "\",\"sim_us\":";
+      appendMicros( out, sim_begin );
+      out += "}}";
+    }
+    break;
+  }
+  case Kind::WAIT: {
+    // on the wall clock a wait is the gap between the events of its activity
+    if ( !simulated ) {
+      break;
+    }
+    std::string label;
+    switch ( record.wait ) {
+    case chrome_trace::Wait::TIME:
+      label = "waitFor";
+      break;
+    case chrome_trace::Wait::SIGNAL:
+      label = "waitOn " + name( record.what );
+      break;
+    case chrome_trace::Wait::PAD:
+      label = "padReceive " + name( record.what );
+      break;
+    }
+    begin( out, "X", label, pid, tid );
+    out += ",\"ts\":";
+    appendMicros( out, sim_begin );
+    out += ",\"dur\":";
+    appendMicros( out, double( record.sim_end - record.sim_begin ) * 1e-3 );
+    out += ",\"args\":{\"wall_us\":";
+    appendMicros( out, wall_begin );
+    out += ",\"wall_dur_us\":";
+    appendMicros( out, wallMicros( record.wall_end ) - wall_begin );
+    out += "}}";
+    break;
+  }
+  case Kind::LENGTH: {
+    const auto &pad = name( record.track );
+    auto value = std::to_string( record.value );
+    if ( simulated ) {
+      begin( out, "C", pad, pid, s_no_thread );
+      out += ",\"ts\":";
+      appendMicros( out, sim_begin );
+      out += ",\"args\":{\"messages\":" + value + "}}";
+    }
+    if ( wall ) {
+      begin( out, "C", pad, pid + s_wall_pid, s_no_thread );
+      out += ",\"ts\":";
+      appendMicros( out, wall_begin );
+      out += ",\"args\":{\"messages\":" + value + "}}";
+    }
+    break;
+  }
+  }
+}
+
+acpp::void_result<> ChromeTraceWriter::finish() {
+  stop();
+  flush();
+  if ( m_failure ) {
+    return { {}, std::move( *m_failure ) };
+  }
+
+  // name every process and thread seen, processes in id order: by simulated time first
+  std::map<uint32_t, std::vector<uint32_t>> processes;
+  for ( auto key : m_threads ) {
+    auto &threads = processes[uint32_t( key >> 32 )];
+    if ( uint32_t( key ) != s_no_thread ) {
+      threads.push_back( uint32_t( key ) );
+    }
+  }
+  std::string text;
+  auto metadata = [&]( const char *kind, uint32_t pid, uint32_t tid, const char *arg, const std::string &value ) {
+    begin( text, "M", kind, pid, tid );
+    text += ",\"args\":{\"";
+    text += arg;
+    text += "\":" + value + "}}";
+  };
+  for ( const auto &[pid, threads] : processes ) {
+    bool on_wall = pid >= s_wall_pid;
+    auto id = on_wall ? pid - s_wall_pid : pid;
+    std::string process = id == 0 ? "simulation" : instanceName( id - 1 );
+    if ( on_wall ) {
+      process += " (wall clock)";
+    }
+    std::string quoted;
+    appendString( quoted, process );
+    metadata( "process_name", pid, s_no_thread, "name", quoted );
+    metadata( "process_sort_index", pid, s_no_thread, "sort_index", std::to_string( pid ) );
+    for ( auto tid : threads ) {
+      quoted.clear();
+      appendString( quoted, tid == 0 ? std::string( "events" ) : name( tid - 1 ) );
+      metadata( "thread_name", pid, tid, "name", quoted );
+    }
+  }
+  uint64_t dropped = 0;
+  for ( auto &buffer : m_buffers ) {
+    dropped += buffer ? buffer->m_dropped.load( std::memory_order_relaxed ) : 0;
+  }
+  text += "\n],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"dropped\":" + std::to_string( dropped ) + "}}\n";
+  m_out.write( text.data(), std::streamsize( text.size() ) );
+  m_out.close();
+  if ( !m_out ) {
+    return { {}, "can't write " + m_path };
+  }
+  return {};
+}
+
+}  // namespace sim
@@ -0,0 +1,214 @@
+/**
+ * ChromeTrace.h
+ * Timelines of what instances do, recorded into per-partition rings and written out as
+ * Chrome Trace Event JSON, which chrome://tracing and the Perfetto UI open
+ */
+
+#ifndef SIM_CHROME_TRACE_H_INCLUDED
+#define SIM_CHROME_TRACE_H_INCLUDED
+
+#include <CxxSimulator/Clock.h>
+#include <CxxSimulator/cpp_utils.h>
+#include "RingBuffer.h"
+#include "SymbolTable.h"
+#include "Ticks.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace sim {
+
+namespace chrome_trace {
+
+/**
+ * @brief Which clocks the events are laid out by, as Simulation::TraceAxis
+ */
+enum class Axis : uint8_t { SIMULATED, WALL, BOTH };
+
+enum class Kind : uint8_t {
+  RUN,    // an event handled, from wall_begin to wall_end at sim_begin
+  WAIT,   // an activity blocked from sim_begin to sim_end, see Wait
+  LENGTH  // the messages queued at a pad, in value, at sim_begin and wall_begin
+};
+
+/**
+ * @brief What a WAIT was for
+ */
+enum class Wait : uint8_t { TIME, SIGNAL, PAD };
+
+/**
+ * @brief One thing an instance did
+ */
+struct Record {
+  int64_t sim_begin;   // nanoseconds
+  int64_t sim_end;     // nanoseconds, WAIT only
+  uint64_t wall_begin; // ticks
+  uint64_t wall_end;   // ticks, RUN and WAIT
+  uint64_t value;      // LENGTH only
+  uint32_t instance;   // id, no_symbol for events of no instance
+  uint32_t track;      // activity name id of a RUN or WAIT, pad name id of a LENGTH
+  uint32_t what;       // signal or pad name id of a WAIT
+  uint8_t type;        // of the event a RUN handled, see SimEvent::Type
+  Kind kind;
+  Wait wait;
+};
+
+static_assert( sizeof( Record ) == 56, "records are fixed size" );
+
+/**
+ * @brief How the writer thread names what records refer to, each called from that thread
+ */
+struct Names {
+  std::function<std::string( SymbolId )> name;     // model, activity, pad and signal names
+  std::function<std::string( SymbolId )> instance; // instance names
+  std::function<const char *( uint8_t )> type;     // event types
+};
+
+}  // namespace chrome_trace
+
+/**
+ * @brief Where one partition's thread records, never waiting for the writer
+ * A record that finds the ring full is counted as dropped rather than holding up the run.
+ */
+class ChromeTraceBuffer {
+public:
+  /**
+   * @param simtime the time of the partition recording, read at each record
+   */
+  ChromeTraceBuffer( size_t capacity, const Clock::time_point &simtime ) : m_ring{ capacity }, m_simtime{ &simtime } {}
+
+  void run( SymbolId instance, SymbolId track, uint8_t type, uint64_t wall_begin, uint64_t wall_end ) noexcept {
+    push( chrome_trace::Record{ nanoseconds( *m_simtime ), 0, wall_begin, wall_end, 0, instance, track, no_symbol, type,
+        chrome_trace::Kind::RUN, chrome_trace::Wait::TIME } );
+  }
+  /**
+   * @brief Record a wait that ends now
+   */
+  void wait( SymbolId instance, SymbolId activity, chrome_trace::Wait wait, SymbolId what,
+      const Clock::time_point &since, uint64_t wall_since ) noexcept {
+    push( chrome_trace::Record{ nanoseconds( since ), nanoseconds( *m_simtime ), wall_since, ticks(), 0, instance,
+        activity, what, 0, chrome_trace::Kind::WAIT, wait } );
+  }
+  void length( SymbolId instance, SymbolId pad, size_t messages ) noexcept {
+    push( chrome_trace::Record{ nanoseconds( *m_simtime ), 0, ticks(), 0, messages, instance, pad, no_symbol, 0,
+        chrome_trace::Kind::LENGTH, chrome_trace::Wait::TIME } );
+  }
+
+private:
+  friend class ChromeTraceWriter;
+
+  static int64_t nanoseconds( const Clock::time_point &time ) noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( time.time_since_epoch() ).count();
+  }
+  void push( chrome_trace::Record &&record ) noexcept {
+    if ( !m_ring.push( std::move( record ) ) ) {
+      m_dropped.fetch_add( 1, std::memory_order_relaxed );
+    }
+  }
+
+  SpscRing<chrome_trace::Record> m_ring;
+  std::atomic<uint64_t> m_dropped{ 0 };
+  const Clock::time_point *m_simtime;
+};
+
+/**
+ * @brief Owns a Chrome trace file and the thread turning the buffers into JSON for it
+ * Each instance is a process with a thread per activity, or per pad for messages it
+ * handled without one, and a counter per pad; events of no instance go to a process of
+ * their own. Laid out by both clocks, every instance shows twice, by simulated time
+ * first and by wall clock time after.
+ */
+class ChromeTraceWriter {
+public:
+  /**
+   * @brief Create the file and start writing
+   * @return the writer or error if the file can't be made
+   */
+  static acpp::value_result<std::unique_ptr<ChromeTraceWriter>> open(
+      const std::string &path, chrome_trace::Axis axis, chrome_trace::Names &&names );
+  ~ChromeTraceWriter() noexcept;
+  ChromeTraceWriter( const ChromeTraceWriter & ) = delete;
+  ChromeTraceWriter &operator=( const ChromeTraceWriter & ) = delete;
+
+  /**
+   * @brief Get the buffer of a partition, making it on first use
+   * Only one thread at a time may record into a buffer, and none while it is got.
+   * @param simtime the partition's time, see ChromeTraceBuffer
+   */
+  ChromeTraceBuffer &buffer( size_t partition, const Clock::time_point &simtime );
+  /**
+   * @brief Write what is left, name the processes and threads seen and close the file
+   */
+  acpp::void_result<> finish();
+
+  /**
+   * Records a buffer holds before it drops them, 3.5 MiB worth
+   */
+  static constexpr size_t s_buffer_capacity = 64 * 1024;
+  /**
+   * How often the writer thread drains the buffers
+   */
+  static constexpr std::chrono::milliseconds s_flush_interval{ 20 };
+  /**
+   * Records the writer thread moves out of a buffer at a time
+   */
+  static constexpr size_t s_flush_batch = 1024;
+  /**
+   * Added to an instance's process id for its wall clock timeline
+   */
+  static constexpr uint32_t s_wall_pid = 1u << 30;
+
+private:
+  ChromeTraceWriter() = default;
+  void stop() noexcept;
+  void flushMain();
+  /**
+   * @brief Format the records of every buffer into the file, on the writer thread or once it ended
+   */
+  void flush();
+  void format( const chrome_trace::Record &record, std::string &out );
+  /**
+   * @brief Format the start of an event on a thread, noting the thread for finish()
+   */
+  void begin( std::string &out, const char *phase, const std::string &name, uint32_t pid, uint32_t tid );
+  const std::string &name( SymbolId id );
+  const std::string &instanceName( SymbolId id );
+  /**
+   * @brief Microseconds of wall clock since the file was opened
+   */
+  double wallMicros( uint64_t at ) const noexcept;
+
+  std::ofstream m_out;
+  std::string m_path;
+  chrome_trace::Axis m_axis = chrome_trace::Axis::BOTH;
+  chrome_trace::Names m_names;
+  std::vector<std::string> m_name_cache;     // by SymbolId, empty until looked up
+  std::vector<std::string> m_instance_cache; // by SymbolId, empty until looked up
+  std::unordered_set<uint64_t> m_threads;    // pid << 32 | tid of every event written
+  std::mutex m_buffers_mut;                  // m_buffers grows while flushing
+  std::vector<std::unique_ptr<ChromeTraceBuffer>> m_buffers;
+  bool m_first = true; // no event written yet
+  std::optional<std::string> m_failure; // of the first write that failed
+  uint64_t m_start_ticks = 0;
+  TickRate m_rate;
+  double m_ticks_per_micro = 0.0; // measured again at each flush
+  std::mutex m_stop_mut;
+  std::condition_variable m_stop_cnd;
+  bool m_stop = false;
+  std::thread m_thread;
+};
+
+}  // namespace sim
+
+#endif  // SIM_CHROME_TRACE_H_INCLUDED
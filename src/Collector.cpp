@@ -0,0 +1,201 @@
+// Collector.cpp : histograms and quantile digests
+//
+
+#include <CxxSimulator/Collector.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace sim {
+
+namespace {
+
+/*
+ * A digest buffers this many times its compression in values before merging them, so
+ * that most adds are an append
+ */
+constexpr double s_buffer_factor = 5.0;
+
+constexpr double s_pi = 3.14159265358979323846;
+
+}  // namespace
+
+Histogram::Histogram( unsigned precision ) : m_precision{ precision } {
+  if ( precision < 1 || precision > 16 ) {
+    throw "histogram precision out of range";
+  }
+}
+
+void Histogram::add( double value, uint64_t count ) {
+  if ( !std::isfinite( value ) || !count ) {
+    return;
+  }
+  m_count += count;
+  m_sum += value * double( count );
+  m_min = std::min( m_min, value );
+  m_max = std::max( m_max, value );
+  if ( value <= 0.0 ) {
+    m_zeros += count;
+    return;
+  }
+  place( value, count );
+}
+
+void Histogram::place( double value, uint64_t count ) {
+  size_t per = size_t( 1 ) << m_precision;
+  int exponent = 0;
+  auto fraction = std::frexp( value, &exponent ); // in [0.5, 1)
+  auto bucket = std::min( per - 1, size_t( ( fraction * 2.0 - 1.0 ) * double( per ) ) );
+  auto &counts = m_powers[exponent];
+  if ( counts.empty() ) {
+    counts.resize( per );
+  }
+  counts[bucket] += count;
+}
+
+double Histogram::bucketMiddle( int exponent, size_t bucket ) const {
+  size_t per = size_t( 1 ) << m_precision;
+  auto fraction = 0.5 + ( double( bucket ) + 0.5 ) / double( 2 * per );
+  return std::ldexp( fraction, exponent );
+}
+
+void Histogram::merge( const Collector &other ) {
+  auto histogram = dynamic_cast<const Histogram *>( &other );
+  if ( !histogram || !histogram->m_count ) {
+    return;
+  }
+  m_count += histogram->m_count;
+  m_sum += histogram->m_sum;
+  m_min = std::min( m_min, histogram->m_min );
+  m_max = std::max( m_max, histogram->m_max );
+  m_zeros += histogram->m_zeros;
+  // a bucket's middle falls in the same bucket at the same precision
+  for ( auto &[exponent, counts] : histogram->m_powers ) {
+    for ( size_t bucket = 0; bucket < counts.size(); ++bucket ) {
+      if ( counts[bucket] ) {
+        place( histogram->bucketMiddle( exponent, bucket ), counts[bucket] );
+      }
+    }
+  }
+}
+
+double Histogram::quantile( double fraction ) const {
+  if ( !m_count ) {
+    return 0.0;
+  }
+  auto rank = std::clamp( fraction, 0.0, 1.0 ) * double( m_count - 1 );
+  auto counted = m_zeros;
+  if ( rank < double( counted ) ) {
+    return std::clamp( 0.0, m_min, m_max );
+  }
+  for ( auto &[exponent, counts] : m_powers ) {
+    for ( size_t bucket = 0; bucket < counts.size(); ++bucket ) {
+      counted += counts[bucket];
+      if ( rank < double( counted ) ) {
+        return std::clamp( bucketMiddle( exponent, bucket ), m_min, m_max );
+      }
+    }
+  }
+  return m_max;
+}
+
+TDigest::TDigest( double compression ) : m_compression{ compression } {
+  if ( !( compression >= 20.0 ) ) {
+    throw "digest compression below 20";
+  }
+}
+
+void TDigest::add( double value ) {
+  if ( !std::isfinite( value ) ) {
+    return;
+  }
+  ++m_count;
+  m_min = std::min( m_min, value );
+  m_max = std::max( m_max, value );
+  m_buffer.push_back( Centroid{ value, 1.0 } );
+  if ( double( m_buffer.size() ) >= s_buffer_factor * m_compression ) {
+    compress();
+  }
+}
+
+void TDigest::merge( const Collector &other ) {
+  auto digest = dynamic_cast<const TDigest *>( &other );
+  if ( !digest || !digest->m_count ) {
+    return;
+  }
+  digest->compress();
+  m_buffer.insert( m_buffer.end(), digest->m_centroids.begin(), digest->m_centroids.end() );
+  m_count += digest->m_count;
+  m_min = std::min( m_min, digest->m_min );
+  m_max = std::max( m_max, digest->m_max );
+  compress();
+}
+
+void TDigest::compress() const {
+  if ( m_buffer.empty() ) {
+    return;
+  }
+  m_buffer.insert( m_buffer.end(), m_centroids.begin(), m_centroids.end() );
+  std::sort( m_buffer.begin(), m_buffer.end(), []( const Centroid &lhs, const Centroid &rhs ) {
+    return lhs.mean < rhs.mean;
+  } );
+  double total = 0.0;
+  for ( const auto &centroid : m_buffer ) {
+    total += centroid.weight;
+  }
+  // the quantile a centroid starting at q may reach, one step of the arcsine scale k1 on
+  auto limit = [this]( double q ) {
+    auto k = m_compression / ( 2.0 * s_pi ) * std::asin( 2.0 * q - 1.0 ) + 1.0;
+    return ( std::sin( std::min( k * 2.0 * s_pi / m_compression, s_pi / 2.0 ) ) + 1.0 ) / 2.0;
+  };
+  m_centroids.clear();
+  auto current = m_buffer.front();
+  double before = 0.0;
+  double bound = total * limit( 0.0 );
+  for ( size_t index = 1; index < m_buffer.size(); ++index ) {
+    const auto &next = m_buffer[index];
+    if ( before + current.weight + next.weight <= bound ) {
+      current.weight += next.weight;
+      current.mean += ( next.mean - current.mean ) * next.weight / current.weight;
+    } else {
+      m_centroids.push_back( current );
+      before += current.weight;
+      bound = total * limit( before / total );
+      current = next;
+    }
+  }
+  m_centroids.push_back( current );
+  m_buffer.clear();
+}
+
+double TDigest::quantile( double fraction ) const {
+  compress();
+  if ( m_centroids.empty() ) {
+    return 0.0;
+  }
+  const auto &centroids = m_centroids;
+  auto total = double( m_count );
+  auto target = std::clamp( fraction, 0.0, 1.0 ) * total;
+  // each centroid sits at the middle of its weight, the extremes at either end
+  const auto &first = centroids.front();
+  if ( target <= first.weight / 2.0 ) {
+    return m_min + ( first.mean - m_min ) * target / ( first.weight / 2.0 );
+  }
+  const auto &last = centroids.back();
+  if ( target >= total - last.weight / 2.0 ) {
+    return m_max - ( m_max - last.mean ) * ( total - target ) / ( last.weight / 2.0 );
+  }
+  auto center = first.weight / 2.0;
+  for ( size_t index = 0; index + 1 < centroids.size(); ++index ) {
+    auto next = center + ( centroids[index].weight + centroids[index + 1].weight ) / 2.0;
+    if ( target <= next ) {
+      auto value = centroids[index].mean +
+                   ( centroids[index + 1].mean - centroids[index].mean ) * ( target - center ) / ( next - center );
+      return std::clamp( value, m_min, m_max );
+    }
+    center = next;
+  }
+  return last.mean;
+}
+
+}  // namespace sim
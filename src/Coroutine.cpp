@@ -0,0 +1,106 @@
+// Coroutine.cpp : awaiters and frame allocation for coroutine activities
+//
+
+#include <CxxSimulator/Coroutine.h>
+#include <CxxSimulator/Simulation.h>
+#include "Simulation_p.h"
+#include "Instance_p.h"
+#include "Arena.h"
+
+namespace sim {
+
+namespace {
+
+/**
+ * @brief The time an activity's simulation is at, or none once the simulation is gone
+ */
+Clock::time_point simtime( const Activity &activity ) {
+  auto instance = activity.owner();
+  auto simulation = instance ? instance->owner() : nullptr;
+  return simulation ? simulation->simtime() : Clock::time_point{};
+}
+
+}  // namespace
+
+void *Task::promise_type::allocate( size_t size, AsyncActivity *activity ) {
+  std::pmr::memory_resource *resource = nullptr;
+  if ( activity ) {
+    auto instance = activity->owner();
+    resource = Simulation::Private::resource( instance ? instance->owner() : nullptr );
+  }
+  return ArenaObject::operator new( size, resource );
+}
+
+void Task::promise_type::operator delete( void *frame, size_t ) noexcept {
+  ArenaObject::operator delete( frame ); // the arena header knows the pool and the size
+}
+
+void CoroutineFunc::operator()( Instance &instance, Activity &activity, const std::string &source, Payload &payload ) const {
+  if ( !body ) {
+    return;
+  }
+  Task task = body( instance, AsyncActivity{ activity }, source, std::move( payload ) );
+  Activity::Private::startTask( activity, task.release() );
+}
+
+bool AsyncActivity::WaitAwaiter::await_suspend( std::coroutine_handle<> ) {
+  return static_cast<bool>( Activity::Private::suspendTask( *activity, time, {} ) );
+}
+
+bool AsyncActivity::ReceiveAwaiter::await_ready() {
+  auto instance = activity->owner();
+  auto pad = instance ? instance->pad( pad_name ) : nullptr;
+  if ( !pad ) {
+    error = "no pad: " + pad_name;
+    return true;
+  }
+  return pad->available() > 0;
+}
+
+bool AsyncActivity::ReceiveAwaiter::await_suspend( std::coroutine_handle<> ) {
+  auto waiting = Activity::Private::suspendTask( *activity, time, pad_name );
+  if ( !waiting ) {
+    error = waiting.msg;
+    return false;
+  }
+  suspended = true;
+  return true;
+}
+
+acpp::value_result<Payload> AsyncActivity::ReceiveAwaiter::await_resume() {
+  if ( !error.empty() ) {
+    return { {}, error };
+  }
+  if ( suspended && !Activity::Private::woken( *activity ) ) {
+    return { {}, "receive canceled" };
+  }
+  auto instance = activity->owner();
+  auto pad = instance ? instance->pad( pad_name ) : nullptr;
+  if ( !pad ) {
+    return { {}, "no pad: " + pad_name };
+  }
+  return Pad::Private::pull( pad );
+}
+
+AsyncActivity::WaitAwaiter AsyncActivity::waitFor( Clock::duration duration ) const {
+  // without a simulation the wait is refused as the coroutine suspends, whatever the time
+  return waitUntil( simtime( *m_activity ) + duration );
+}
+
+AsyncActivity::WaitAwaiter AsyncActivity::waitUntil( const Clock::time_point &time ) const {
+  return WaitAwaiter{ m_activity, time };
+}
+
+AsyncActivity::ReceiveAwaiter AsyncActivity::padReceive( const std::string &pad_name ) const {
+  return ReceiveAwaiter{ m_activity, pad_name, {}, {}, false };
+}
+
+AsyncActivity::ReceiveAwaiter AsyncActivity::padReceive( const std::string &pad_name, Clock::duration timeout ) const {
+  return ReceiveAwaiter{ m_activity, pad_name, simtime( *m_activity ) + timeout, {}, false };
+}
+
+AsyncActivity::SendAwaiter AsyncActivity::padSend( const std::string &pad_name, Payload payload ) const {
+  return SendAwaiter{ m_activity->padSend( pad_name, std::move( payload ) ) };
+}
+
+}  // namespace sim
@@ -0,0 +1,366 @@
+// CxxSimulatorBench.cpp : the engine's hot paths under Google Benchmark
+//
+// usage: CxxSimulatorBench [--benchmark_filter=regex] [--benchmark_out=file --benchmark_out_format=json]
+// The bench target runs them all and writes CxxSimulatorBench.json in the build directory,
+// for comparing runs across commits with benchmark's tools/compare.py.
+// Covers the event list under the hold model, pad rings, fiber and activity switches,
+// parameter lookups and, where activities can wait, a whole queuing pipeline.
+
+#include <CxxSimulator/Simulator.h>
+#include <CxxSimulator/Simulation.h>
+#include <CxxSimulator/Instance.h>
+#include "Fiber.h"
+#include "Instance_p.h"
+#include "Timeline.h"
+#include "SimQueuing.h"
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t s_draws = size_t( 1 ) << 16; // pre-drawn increments, cycled through
+constexpr double s_mean_increment = 1e6;      // in keys, a millisecond of Clock ticks
+
+/*
+ * Increment distributions of the hold model, all with a mean of about 1. Timelines
+ * sort and bucket differently depending on how far ahead events are scheduled.
+ */
+struct Exponential {
+  double operator()( std::mt19937_64 &random ) const {
+    return std::exponential_distribution<double>{ 1.0 }( random );
+  }
+};
+
+struct Uniform {
+  double operator()( std::mt19937_64 &random ) const {
+    return std::uniform_real_distribution<double>{ 0.0, 2.0 }( random );
+  }
+};
+
+// most events soon, one in ten far ahead: hard on calendar bucket widths
+struct Bimodal {
+  double operator()( std::mt19937_64 &random ) const {
+    if ( std::uniform_real_distribution<double>{}( random ) < 0.9 ) {
+      return std::uniform_real_distribution<double>{ 0.0, 0.2 }( random );
+    }
+    return std::uniform_real_distribution<double>{ 9.0, 10.0 }( random );
+  }
+};
+
+struct Triangular {
+  double operator()( std::mt19937_64 &random ) const {
+    std::uniform_real_distribution<double> unit;
+    return unit( random ) + unit( random );
+  }
+};
+
+template <typename Distribution>
+std::vector<int64_t> drawIncrements( std::mt19937_64 &random ) {
+  Distribution distribution;
+  std::vector<int64_t> increments( s_draws );
+  for ( auto &increment : increments ) {
+    increment = int64_t( distribution( random ) * s_mean_increment );
+  }
+  return increments;
+}
+
+/**
+ * @brief The hold model: take out the earliest of n events, schedule one an increment later
+ * The timeline stays at n events; range(0) is n.
+ */
+template <typename Queue, typename Distribution>
+void BM_TimelineHold( benchmark::State &state ) {
+  auto count = size_t( state.range( 0 ) );
+  std::mt19937_64 random{ 1 };
+  auto increments = drawIncrements<Distribution>( random );
+  sim::Timeline<int64_t, Queue> events;
+  events.reserve( count );
+  for ( size_t event = 0; event < count; ++event ) {
+    events.emplace( increments[event % s_draws] );
+  }
+  size_t draw = count;
+  for ( auto _ : state ) {
+    auto now = events.extract();
+    events.emplace( now + increments[draw++ % s_draws] );
+  }
+  state.SetItemsProcessed( int64_t( state.iterations() ) );
+}
+
+/**
+ * @brief An event of the cancel benchmark, knowing where its handle is kept
+ */
+struct HeldEvent {
+  sim::Clock::time_point time;
+  uint32_t index;
+};
+
+sim::Clock::time_point later( sim::Clock::time_point now, int64_t increment ) {
+  return now + sim::Clock::duration( increment );
+}
+
+/**
+ * @brief The hold model with a cancel: also erase a random pending event and schedule
+ * another in its place, as timeouts that don't fire do. range(0) is the events pending.
+ */
+template <typename Queue, typename Distribution>
+void BM_TimelineCancel( benchmark::State &state ) {
+  auto count = size_t( state.range( 0 ) );
+  std::mt19937_64 random{ 1 };
+  auto increments = drawIncrements<Distribution>( random );
+  std::vector<uint32_t> victims( s_draws );
+  for ( auto &victim : victims ) {
+    victim = uint32_t( random() % count );
+  }
+  sim::Timeline<HeldEvent, Queue> events;
+  events.reserve( count );
+  std::vector<sim::TimelineHandle> handles( count );
+  sim::Clock::time_point now{};
+  for ( size_t event = 0; event < count; ++event ) {
+    handles[event] = events.emplace( HeldEvent{ later( now, increments[event % s_draws] ), uint32_t( event ) } );
+  }
+  size_t draw = count;
+  for ( auto _ : state ) {
+    auto top = events.extract();
+    now = top.time;
+    handles[top.index] = events.emplace( HeldEvent{ later( now, increments[draw++ % s_draws] ), top.index } );
+    auto victim = victims[draw % s_draws];
+    events.cancel( handles[victim] );
+    handles[victim] = events.emplace( HeldEvent{ later( now, increments[draw++ % s_draws] ), victim } );
+  }
+  state.SetItemsProcessed( int64_t( state.iterations() ) );
+}
+
+#define SIM_BENCH_TIMELINE( bench, queue )                                                               \
+  BENCHMARK_TEMPLATE( bench, queue, Exponential )->RangeMultiplier( 10 )->Range( 1000, 10000000 );      \
+  BENCHMARK_TEMPLATE( bench, queue, Uniform )->RangeMultiplier( 10 )->Range( 1000, 10000000 );          \
+  BENCHMARK_TEMPLATE( bench, queue, Bimodal )->RangeMultiplier( 10 )->Range( 1000, 10000000 );          \
+  BENCHMARK_TEMPLATE( bench, queue, Triangular )->RangeMultiplier( 10 )->Range( 1000, 10000000 )
+
+SIM_BENCH_TIMELINE( BM_TimelineHold, sim::HeapQueue );
+SIM_BENCH_TIMELINE( BM_TimelineHold, sim::CalendarQueue );
+SIM_BENCH_TIMELINE( BM_TimelineHold, sim::LadderQueue );
+SIM_BENCH_TIMELINE( BM_TimelineCancel, sim::HeapQueue );
+SIM_BENCH_TIMELINE( BM_TimelineCancel, sim::CalendarQueue );
+SIM_BENCH_TIMELINE( BM_TimelineCancel, sim::LadderQueue );
+
+/**
+ * @brief Push range(0) messages into a pad, then pull them all out
+ * With a batch of 1 the time is the latency of a message through the ring, with larger
+ * ones items/s is its throughput. range(1) nonzero makes the pad FAN_IN, a ring for
+ * several producers.
+ */
+void BM_PadPushPull( benchmark::State &state ) {
+  auto batch = size_t( state.range( 0 ) );
+  acpp::flagset<sim::PadSpec::Flag> flags{ sim::PadSpec::Flag::CAN_INPUT };
+  if ( state.range( 1 ) ) {
+    flags += sim::PadSpec::Flag::FAN_IN;
+  }
+  sim::PadSpec spec{ "in", flags, { { "capacity", uintmax_t( batch ) } } };
+  auto pad = std::make_shared<sim::Pad>( nullptr, spec, "in" );
+  for ( auto _ : state ) {
+    for ( size_t message = 0; message < batch; ++message ) {
+      sim::Pad::Private::push( pad, sim::Payload::make<uint64_t>( message ) );
+    }
+    for ( size_t message = 0; message < batch; ++message ) {
+      benchmark::DoNotOptimize( sim::Pad::Private::pull( pad ) );
+    }
+  }
+  state.SetItemsProcessed( int64_t( state.iterations() * batch ) );
+}
+BENCHMARK( BM_PadPushPull )->ArgsProduct( { { 1, 64, 4096 }, { 0, 1 } } );
+
+/**
+ * @brief Switch into a fiber and back: one item is a resume and the yield ending it
+ */
+void BM_FiberSwitch( benchmark::State &state ) {
+  sim::StackPool stacks;
+  sim::Fiber fiber;
+  bool stop = false;
+  auto body = []( void *arg ) {
+    while ( !*static_cast<bool *>( arg ) ) {
+      sim::Fiber::yield();
+    }
+  };
+  if ( !fiber.start( stacks, body, &stop ) ) {
+    state.SkipWithError( "no fiber stack" );
+    return;
+  }
+  for ( auto _ : state ) {
+    fiber.resume();
+  }
+  stop = true;
+  fiber.resume();
+  state.SetItemsProcessed( int64_t( state.iterations() ) );
+}
+BENCHMARK( BM_FiberSwitch );
+
+/**
+ * @brief A model with nothing to do but hold parameters
+ */
+class ParameterModel : public sim::Model {
+public:
+  ParameterModel() : Model( "ParameterModel" ) {
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+/**
+ * @brief Convert a parameter value held as an integer, a double or a string
+ */
+template <typename Rt>
+void BM_GetAs( benchmark::State &state ) {
+  acpp::unstructured_value value;
+  switch ( state.range( 0 ) ) {
+  case 0:
+    value = intmax_t( 42 );
+    state.SetLabel( "from integer" );
+    break;
+  case 1:
+    value = 42.0;
+    state.SetLabel( "from double" );
+    break;
+  default:
+    value = std::string( "42" );
+    state.SetLabel( "from string" );
+    break;
+  }
+  for ( auto _ : state ) {
+    benchmark::DoNotOptimize( acpp::get_as<Rt>( value ) );
+  }
+}
+BENCHMARK_TEMPLATE( BM_GetAs, double )->DenseRange( 0, 2 );
+BENCHMARK_TEMPLATE( BM_GetAs, intmax_t )->DenseRange( 0, 2 );
+
+/**
+ * @brief Look a parameter up by name on an instance with range(0) of them, as models do
+ */
+void BM_InstanceParameter( benchmark::State &state ) {
+  sim::Simulator simulator;
+  simulator.addModel<ParameterModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  sim::PropertyList parameters;
+  for ( int64_t parameter = 1; parameter < state.range( 0 ); ++parameter ) {
+    parameters["p" + std::to_string( parameter )] = double( parameter );
+  }
+  parameters["rate"] = 0.5;
+  if ( !simulation->spawnInstance( "ParameterModel", "holder", parameters ) || !simulation->step() ) {
+    state.SkipWithError( "can't spawn the instance" );
+    return;
+  }
+  auto instance = simulation->instance( "holder" );
+  for ( auto _ : state ) {
+    benchmark::DoNotOptimize( instance->parameter<double>( "rate" ) );
+  }
+}
+BENCHMARK( BM_InstanceParameter )->Arg( 1 )->Arg( 16 );
+
+#if ACPP_LESSON > 4
+/**
+ * @brief A model whose activity waits a microsecond at a time, forever
+ */
+class SpinnerModel : public sim::Model {
+public:
+  SpinnerModel() : Model( "SpinnerModel" ) {
+    addActivitySpec( { "start", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          while ( activity.waitFor( std::chrono::microseconds( 1 ) ) ) {
+          }
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+/**
+ * @brief Handle one activity resume: dispatch, switch to its fiber, schedule its next
+ * wait and switch back. range(0) activities take turns, so the timeline holds as many.
+ */
+void BM_ActivityWait( benchmark::State &state ) {
+  sim::Simulator simulator;
+  simulator.addModel<SpinnerModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  auto count = size_t( state.range( 0 ) );
+  for ( size_t spinner = 0; spinner < count; ++spinner ) {
+    if ( !simulation->spawnInstance( "SpinnerModel", "spinner" + std::to_string( spinner ) ) ) {
+      state.SkipWithError( "can't spawn the spinners" );
+      return;
+    }
+  }
+  simulation->step( count );
+  for ( auto _ : state ) {
+    simulation->step();
+  }
+  state.SetItemsProcessed( int64_t( state.iterations() ) );
+}
+BENCHMARK( BM_ActivityWait )->Arg( 1 )->Arg( 1024 );
+
+/**
+ * @brief Write range(0) Source -> Queue -> Processor -> Sink pipelines at 80% load
+ */
+std::string pipelines( int64_t count ) {
+  std::ostringstream out;
+  out << "{ \"instances\": [\n";
+  for ( int64_t line = 0; line < count; ++line ) {
+    auto at = std::to_string( line );
+    out << ( line ? ",\n" : "" )
+        << "  { \"name\": \"src" << at << "\", \"model\": \"SourceModel\", \"parameters\": { \"duty_cycle\": 2000.0 } },\n"
+        << "  { \"name\": \"queue" << at << "\", \"model\": \"QueueModel\" },\n"
+        << "  { \"name\": \"cpu" << at << "\", \"model\": \"ProcessorModel\", \"parameters\": { \"rate\": 0.0004 } },\n"
+        << "  { \"name\": \"sink" << at << "\", \"model\": \"SinkModel\" }";
+  }
+  out << "\n], \"links\": [\n";
+  for ( int64_t line = 0; line < count; ++line ) {
+    auto at = std::to_string( line );
+    out << ( line ? ",\n" : "" )
+        << "  { \"from\": \"src" << at << ".out\", \"to\": \"queue" << at << ".in\" },\n"
+        << "  { \"from\": \"queue" << at << ".out\", \"to\": \"cpu" << at << ".in\" },\n"
+        << "  { \"from\": \"cpu" << at << ".ready\", \"to\": \"queue" << at << ".ready\" },\n"
+        << "  { \"from\": \"cpu" << at << ".out\", \"to\": \"sink" << at << ".in\" }";
+  }
+  out << "\n] }\n";
+  return out.str();
+}
+
+/**
+ * @brief Run queuing pipelines 10 ms of simulated time at a time; items/s is events/s
+ */
+void BM_QueuingPipeline( benchmark::State &state ) {
+  sim::Simulator simulator;
+  simulator.addModel<sim::queuing::SourceModel>();
+  simulator.addModel<sim::queuing::QueueModel>();
+  simulator.addModel<sim::queuing::ProcessorModel>();
+  simulator.addModel<sim::queuing::SinkModel>();
+  auto loaded = simulator.loadTopology( pipelines( state.range( 0 ) ) );
+  if ( !loaded ) {
+    state.SkipWithError( loaded.msg.c_str() );
+    return;
+  }
+  auto simulation = *loaded.value;
+  size_t events = 0;
+  for ( auto _ : state ) {
+    auto ran = simulation->runFor( std::chrono::milliseconds( 10 ) );
+    if ( !ran ) {
+      state.SkipWithError( ran.msg.c_str() );
+      break;
+    }
+    events += *ran.value;
+  }
+  state.SetItemsProcessed( int64_t( events ) );
+}
+BENCHMARK( BM_QueuingPipeline )->Arg( 1 )->Arg( 64 )->Arg( 1024 );
+#endif // ACPP_LESSON > 4
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -1,14 +1,43 @@
-
 #include <CxxSimulator/Simulator.h>
 #include <CxxSimulator/Simulation.h>
 #include <CxxSimulator/Instance.h>
 
+#include <fstream>
 #include <iostream>
+#include <string>
+
+namespace {
+
+int usage() {
+  std::cerr << "usage: CxxSimulator compile <topology.json> <image>\n"
+            << "  compile  compile a JSON topology into a binary image for Simulator::loadCompiledTopology\n";
+  return 2;
+}
+
+int compile( sim::Simulator &simulator, const std::string &json_path, const std::string &image_path ) {
+  std::ifstream topology{ json_path };
+  if ( !topology ) {
+    std::cerr << "can't open " << json_path << "\n";
+    return 1;
+  }
+  auto compiled = simulator.compileTopology( topology, image_path );
+  if ( !compiled ) {
+    std::cerr << json_path << ": " << compiled.msg << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
 
 int main( int argc, char *argv[] ) {
   auto &simulator = sim::Simulator::getInstance();
-  
-  
-  
-  return 0;
+  if ( argc < 2 ) {
+    return usage();
+  }
+  std::string command = argv[1];
+  if ( command == "compile" && argc == 4 ) {
+    return compile( simulator, argv[2], argv[3] );
+  }
+  return usage();
 }
@@ -0,0 +1,121 @@
+// CxxSimulatorLoadBench.cpp : time and peak memory of loading a large topology
+//
+// usage: CxxSimulatorLoadBench [instances] [file]
+// Writes a ring of instances linked pad to pad (1000000 by default) to file, or a
+// temporary one, then streams it back through Simulator::loadTopology. Then compiles
+// it to an image next to it and loads that through Simulator::loadCompiledTopology.
+
+#include <CxxSimulator/Simulator.h>
+#include <CxxSimulator/Simulation.h>
+#include <CxxSimulator/Instance.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <sys/resource.h>
+#define SIM_BENCH_RUSAGE 1
+#endif
+
+namespace {
+
+class NodeModel : public sim::Model {
+public:
+  NodeModel() : Model( "Node" ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addPadSpec( { "out", { sim::PadSpec::Flag::CAN_OUTPUT }, {} } );
+    addActivitySpec( { "in", sim::ActivitySpec::Type::pad_receive,
+        []( sim::Instance &, sim::Activity &, const std::string &, sim::Payload & ) {} } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+/**
+ * @brief Peak resident memory of the process so far, in MiB, or 0 where unknown
+ */
+double peakMiB() {
+#ifdef SIM_BENCH_RUSAGE
+  rusage usage{};
+  getrusage( RUSAGE_SELF, &usage );
+#if defined( __APPLE__ )
+  return usage.ru_maxrss / ( 1024.0 * 1024.0 ); // bytes
+#else
+  return usage.ru_maxrss / 1024.0; // KiB
+#endif
+#else
+  return 0.0;
+#endif
+}
+
+void writeRing( const std::string &path, size_t count ) {
+  std::ofstream out{ path };
+  out << "{\n  \"instance_count\": " << count << ",\n  \"instances\": [\n";
+  for ( size_t node = 0; node < count; ++node ) {
+    out << "    { \"name\": \"n" << node << "\", \"model\": \"Node\", \"parameters\": { \"id\": " << node << " } }"
+        << ( node + 1 < count ? ",\n" : "\n" );
+  }
+  out << "  ],\n  \"links\": [\n";
+  for ( size_t node = 0; node < count; ++node ) {
+    out << "    { \"from\": \"n" << node << ".out\", \"to\": \"n" << ( node + 1 ) % count << ".in\" }"
+        << ( node + 1 < count ? ",\n" : "\n" );
+  }
+  out << "  ]\n}\n";
+}
+
+}  // namespace
+
+int main( int argc, char *argv[] ) {
+  size_t count = argc > 1 ? std::strtoull( argv[1], nullptr, 10 ) : 1000000;
+  bool temporary = argc < 3;
+  std::string path = temporary ? "CxxSimulatorLoadBench.json" : argv[2];
+
+  writeRing( path, count );
+  auto before = peakMiB();
+
+  sim::Simulator simulator;
+  simulator.addModel<NodeModel>();
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed{};
+  {
+    std::ifstream in{ path };
+    auto loaded = simulator.loadTopology( in );
+    elapsed = std::chrono::steady_clock::now() - start;
+    if ( !loaded ) {
+      std::cerr << "load failed: " << loaded.msg << "\n";
+      return 1;
+    }
+  }
+  std::cout << "instances:      " << count << "\n"
+            << "load time:      " << elapsed.count() << " s\n"
+            << "per instance:   " << elapsed.count() * 1e6 / count << " us\n"
+            << "peak memory:    " << peakMiB() << " MiB (" << before << " MiB before loading)\n";
+
+  auto image = path + ".simtopo";
+  {
+    std::ifstream in{ path };
+    auto compiled = simulator.compileTopology( in, image );
+    if ( !compiled ) {
+      std::cerr << "compile failed: " << compiled.msg << "\n";
+      return 1;
+    }
+  }
+  if ( temporary ) {
+    std::remove( path.c_str() );
+  }
+  start = std::chrono::steady_clock::now();
+  auto mapped = simulator.loadCompiledTopology( image );
+  elapsed = std::chrono::steady_clock::now() - start;
+  std::remove( image.c_str() );
+  if ( !mapped ) {
+    std::cerr << "image load failed: " << mapped.msg << "\n";
+    return 1;
+  }
+  std::cout << "image load time: " << elapsed.count() << " s\n";
+  return 0;
+}
@@ -0,0 +1,149 @@
+// CxxSimulatorReplayBench.cpp : event list backends timed on the operations of a recorded run
+//
+// usage: CxxSimulatorReplayBench file [repeats]
+// Reads a trace written by Simulation::startTrace and, for each queue backend, does every
+// partition's schedules, cancels, reschedules and handles over again on a Timeline of bare
+// times, with no model code in between. Checks that each handle takes out the event the
+// simulation took, then prints the time per operation, best of repeats (5 by default).
+
+#include "Timeline.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief A trace record reduced to what the event list sees, its event numbered densely
+ */
+struct Step {
+  sim::trace::Op op;
+  uint64_t seq;
+  int64_t time;
+  uint32_t event;
+};
+
+/**
+ * @brief The steps of one partition, and the events it had before the trace started
+ */
+struct Script {
+  std::vector<Step> pending;
+  std::vector<Step> steps;
+  uint32_t events = 0;
+};
+
+std::vector<Script> makeScripts( const sim::TraceFile &trace ) {
+  std::vector<Script> scripts;
+  std::vector<std::unordered_map<uint64_t, uint32_t>> numbers;
+  for ( const auto &record : trace.records ) {
+    if ( record.partition >= scripts.size() ) {
+      scripts.resize( record.partition + 1 );
+      numbers.resize( record.partition + 1 );
+    }
+    auto &script = scripts[record.partition];
+    auto found = numbers[record.partition].try_emplace( record.seq, script.events );
+    if ( found.second ) {
+      ++script.events;
+      if ( record.op != sim::trace::Op::SCHEDULE ) {
+        // scheduled before the trace started; a cancel doesn't say when for, so never first
+        auto time = record.op == sim::trace::Op::CANCEL ? std::numeric_limits<int64_t>::max() : record.simtime;
+        script.pending.push_back( Step{ sim::trace::Op::SCHEDULE, record.seq, time, found.first->second } );
+      }
+    }
+    script.steps.push_back( Step{ record.op, record.seq, record.simtime, found.first->second } );
+  }
+  return scripts;
+}
+
+/**
+ * @brief Do the steps of every partition on Timelines with one backend
+ * @return double the seconds taken, or a negative number if a handle took out another event
+ */
+template <typename Queue>
+double replay( const std::vector<Script> &scripts, std::string &failure ) {
+  auto begin = std::chrono::steady_clock::now();
+  for ( size_t partition = 0; partition < scripts.size(); ++partition ) {
+    const auto &script = scripts[partition];
+    sim::Timeline<int64_t, Queue> events;
+    std::vector<sim::TimelineHandle> handles( script.events );
+    for ( const auto &step : script.pending ) {
+      handles[step.event] = events.emplace_ordered( step.seq, step.time );
+    }
+    for ( const auto &step : script.steps ) {
+      switch ( step.op ) {
+      case sim::trace::Op::SCHEDULE:
+        handles[step.event] = events.emplace_ordered( step.seq, step.time );
+        break;
+      case sim::trace::Op::CANCEL:
+        events.cancel( handles[step.event] );
+        break;
+      case sim::trace::Op::RESCHEDULE:
+        events.reschedule( handles[step.event], step.time );
+        break;
+      case sim::trace::Op::HANDLE:
+        if ( events.empty() || events.top_entry().seq != step.seq ) {
+          failure = "partition " + std::to_string( partition ) + " handled seq " + std::to_string( step.seq ) +
+                    ", the timeline has " + ( events.empty() ? "none" : std::to_string( events.top_entry().seq ) );
+          return -1.0;
+        }
+        events.extract();
+        break;
+      }
+    }
+  }
+  return std::chrono::duration<double>( std::chrono::steady_clock::now() - begin ).count();
+}
+
+template <typename Queue>
+bool report( const char *name, const std::vector<Script> &scripts, size_t steps, int repeats ) {
+  double best = std::numeric_limits<double>::max();
+  for ( int repeat = 0; repeat < repeats; ++repeat ) {
+    std::string failure;
+    auto seconds = replay<Queue>( scripts, failure );
+    if ( seconds < 0.0 ) {
+      std::cerr << name << ": " << failure << "\n";
+      return false;
+    }
+    best = std::min( best, seconds );
+  }
+  std::printf( "%-10s %10.3f ms %8.2f ns/op\n", name, best * 1e3, best * 1e9 / double( std::max<size_t>( steps, 1 ) ) );
+  return true;
+}
+
+}  // namespace
+
+int main( int argc, char *argv[] ) {
+  if ( argc < 2 ) {
+    std::cerr << "usage: CxxSimulatorReplayBench file [repeats]\n";
+    return 2;
+  }
+  int repeats = argc > 2 ? std::max( 1, std::atoi( argv[2] ) ) : 5;
+  auto read = sim::readTrace( argv[1] );
+  if ( !read ) {
+    std::cerr << read.msg << "\n";
+    return 1;
+  }
+  const auto &trace = *read.value;
+  if ( trace.header.dropped > 0 ) {
+    std::cerr << argv[1] << " lost " << trace.header.dropped << " records, timing what is left\n";
+  }
+  auto scripts = makeScripts( trace );
+  size_t steps = 0;
+  for ( const auto &script : scripts ) {
+    steps += script.steps.size();
+  }
+  std::printf( "%zu operations in %zu partitions\n", steps, scripts.size() );
+
+  bool ok = report<sim::HeapQueue>( "heap", scripts, steps, repeats );
+  ok = report<sim::CalendarQueue>( "calendar", scripts, steps, repeats ) && ok;
+  ok = report<sim::LadderQueue>( "ladder", scripts, steps, repeats ) && ok;
+  return ok ? 0 : 1;
+}
@@ -3,7 +3,29 @@
 #include <gmock/gmock.h>
 
 #include <CxxSimulator/Simulator.h>
+#include <CxxSimulator/Payload.h>
+#include <CxxSimulator/Collector.h>
+#include <CxxSimulator/Results.h>
 #include "Timeline.h"
+#include "SymbolTable.h"
+#include "Arena.h"
+#include "Fiber.h"
+#include "RingBuffer.h"
+#ifdef SIM_TRACE
+#include "Trace.h"
+#endif
+#ifdef SIM_COROUTINES
+#include <CxxSimulator/Coroutine.h>
+#endif
+#include "SimQueuing.h"
+
+#include <random>
+#include <thread>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <set>
+#include <numeric>
 
 TEST( heap, remove ) {
   std::vector<int> inputs { 5, 1, 9, 11, 4, 10, 2 };
@@ -13,6 +35,323 @@ TEST( heap, remove ) {
   EXPECT_TRUE( std::is_heap( inputs.begin(), inputs.end(), std::greater<int>{} ) );
 }
 
+TEST( timeline, backends ) {
+  for ( auto kind : { sim::QueueKind::HEAP, sim::QueueKind::CALENDAR, sim::QueueKind::LADDER } ) {
+    sim::Timeline<int, sim::SelectableQueue> timeline{ sim::SelectableQueue{ kind } };
+    std::vector<int> inputs { 5, 1, 9, 11, 4, 10, 2, 9 };
+    for ( auto input : inputs ) {
+      timeline.emplace( input );
+    }
+    timeline.erase( std::find( timeline.begin(), timeline.end(), 11 ) );
+    EXPECT_EQ( timeline.size(), inputs.size() - 1 );
+    std::vector<int> outputs;
+    while ( !timeline.empty() ) {
+      outputs.push_back( timeline.extract() );
+    }
+    EXPECT_EQ( outputs, ( std::vector<int>{ 1, 2, 4, 5, 9, 9, 10 } ) );
+
+    // a peek looks ahead past empty days, which must not strand what comes in before them
+    timeline.emplace( 1 );
+    timeline.emplace( 10 );
+    EXPECT_EQ( timeline.extract(), 1 );
+    EXPECT_EQ( timeline.top(), 10 );
+    timeline.emplace( 5 );
+    EXPECT_EQ( timeline.extract(), 5 );
+    EXPECT_EQ( timeline.extract(), 10 );
+  }
+}
+
+TEST( timeline, handles ) {
+  for ( auto kind : { sim::QueueKind::HEAP, sim::QueueKind::CALENDAR, sim::QueueKind::LADDER } ) {
+    sim::Timeline<int, sim::SelectableQueue> timeline{ sim::SelectableQueue{ kind } };
+    auto five = timeline.emplace( 5 );
+    auto seven = timeline.emplace( 7 );
+    auto nine = timeline.emplace( 9 );
+    EXPECT_TRUE( timeline.cancel( seven ) );
+    EXPECT_FALSE( timeline.cancel( seven ) );
+    EXPECT_TRUE( timeline.reschedule( nine, 1 ) );
+    EXPECT_EQ( *timeline.get( nine ), 1 );
+    EXPECT_EQ( timeline.extract(), 1 );
+    EXPECT_FALSE( timeline.contains( nine ) );
+    EXPECT_FALSE( timeline.reschedule( nine, 3 ) );
+    EXPECT_TRUE( timeline.contains( five ) );
+    EXPECT_EQ( timeline.extract(), 5 );
+    EXPECT_TRUE( timeline.empty() );
+  }
+}
+
+TEST( timeline, ordered_ties ) {
+  // equal keys go by the caller's tie-breaker, not by insertion
+  sim::Timeline<int> timeline;
+  timeline.emplace_ordered( 30, 5 );
+  timeline.emplace_ordered( 10, 5 );
+  timeline.emplace_ordered( 20, 1 );
+  EXPECT_EQ( timeline.top_entry().seq, 20u );
+  timeline.extract();
+  EXPECT_EQ( timeline.top_entry().seq, 10u );
+}
+
+TEST( symbols, interning ) {
+  sim::SymbolTable symbols;
+  auto in = symbols.intern( "in" );
+  auto out = symbols.intern( "out" );
+  EXPECT_NE( in, out );
+  EXPECT_EQ( symbols.intern( std::string( "in" ) ), in );
+  EXPECT_EQ( symbols.find( "out" ), out );
+  EXPECT_EQ( symbols.find( "other" ), sim::no_symbol );
+  EXPECT_EQ( symbols.name( out ), "out" );
+  EXPECT_EQ( symbols.size(), 2u );
+}
+
+TEST( payload, inline_and_heap ) {
+  struct Small { size_t id; size_t length; };
+  auto small = sim::Payload::make<Small>( 3u, 7u );
+  EXPECT_TRUE( small.is_inline() );
+  EXPECT_TRUE( small.is<Small>() );
+  EXPECT_EQ( small.get_if<std::string>(), nullptr );
+
+  sim::Payload moved = std::move( small );
+  EXPECT_FALSE( small.has_value() );
+  EXPECT_EQ( moved.get<Small>().length, 7u );
+
+  sim::Payload text = std::string( 100, 'x' );
+  EXPECT_FALSE( text.is_inline() );
+  EXPECT_NE( text.tag(), moved.tag() );
+  auto copy = text.clone();
+  EXPECT_EQ( text.take<std::string>().size(), 100u );
+  EXPECT_FALSE( text.has_value() );
+  EXPECT_EQ( copy.get<std::string>().size(), 100u );
+
+  auto unique = sim::Payload::make<std::unique_ptr<int>>();
+  EXPECT_FALSE( unique.copyable() );
+  EXPECT_FALSE( unique.clone().has_value() );
+}
+
+TEST( arena, recycles_blocks ) {
+  sim::Arena arena;
+  {
+    auto first = sim::allocate_shared_from<std::array<char, 200>>( arena.resource() );
+  }
+  auto warm = arena.stats();
+  EXPECT_EQ( warm.allocations, 1u );
+  EXPECT_EQ( warm.bytes_in_use, 0u );
+  EXPECT_GT( warm.system_allocations, 0u );
+  for ( int i = 0; i < 100; ++i ) {
+    auto again = sim::allocate_shared_from<std::array<char, 200>>( arena.resource() );
+  }
+  auto stats = arena.stats();
+  EXPECT_EQ( stats.allocations, 101u );
+  EXPECT_EQ( stats.deallocations, 101u );
+  EXPECT_EQ( stats.system_allocations, warm.system_allocations );
+}
+
+TEST( ring, spsc_moves_in_order ) {
+  sim::SpscRing<std::unique_ptr<int>> ring{ 3 };
+  EXPECT_EQ( ring.capacity(), 4u );
+  for ( int value = 0; value < 4; ++value ) {
+    EXPECT_TRUE( ring.push( std::make_unique<int>( value ) ) );
+  }
+  auto spare = std::make_unique<int>( 4 );
+  EXPECT_FALSE( ring.push( std::move( spare ) ) );
+  EXPECT_TRUE( spare ); // a full ring leaves the value alone
+  EXPECT_EQ( ring.size(), 4u );
+
+  constexpr int count = 20000;
+  std::thread producer{ [&] {
+    for ( int value = 4; value < count; ++value ) {
+      auto element = std::make_unique<int>( value );
+      while ( !ring.push( std::move( element ) ) ) {
+        std::this_thread::yield();
+      }
+    }
+  } };
+  int expected = 0;
+  std::unique_ptr<int> element;
+  while ( expected < count ) {
+    if ( ring.pop( element ) ) {
+      ASSERT_EQ( *element, expected++ );
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_EQ( ring.size(), 0u );
+  EXPECT_FALSE( ring.pop( element ) );
+
+  // a batch takes what there is, oldest first, across the wrap
+  for ( int value = 0; value < 3; ++value ) {
+    EXPECT_TRUE( ring.push( std::make_unique<int>( value ) ) );
+  }
+  std::unique_ptr<int> batch[8];
+  ASSERT_EQ( ring.pop( batch, 8 ), 3u );
+  EXPECT_EQ( *batch[0], 0 );
+  EXPECT_EQ( *batch[2], 2 );
+  EXPECT_EQ( ring.pop( batch, 8 ), 0u );
+}
+
+TEST( ring, mpsc_keeps_each_producers_order ) {
+  constexpr int producers = 4;
+  constexpr int count = 20000;
+  sim::MpscRing<std::pair<int, int>> ring{ 64 };
+  std::vector<std::thread> threads;
+  for ( int producer = 0; producer < producers; ++producer ) {
+    threads.emplace_back( [&ring, producer] {
+      for ( int value = 0; value < count; ++value ) {
+        while ( !ring.push( { producer, value } ) ) {
+          std::this_thread::yield();
+        }
+      }
+    } );
+  }
+  std::vector<int> next( producers, 0 );
+  std::pair<int, int> element;
+  for ( int popped = 0; popped < producers * count; ) {
+    if ( ring.pop( element ) ) {
+      ASSERT_EQ( element.second, next[element.first]++ );
+      ++popped;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  for ( auto &thread : threads ) {
+    thread.join();
+  }
+  EXPECT_EQ( next, std::vector<int>( producers, count ) );
+  EXPECT_EQ( ring.size(), 0u );
+}
+
+TEST( fiber, yield_and_resume ) {
+  sim::StackPool stacks;
+  std::vector<int> trace;
+  sim::Fiber fiber;
+  auto body = []( void *arg ) {
+    auto &trace = *static_cast<std::vector<int> *>( arg );
+    for ( int step = 0; step < 3; ++step ) {
+      trace.push_back( step );
+      sim::Fiber::yield();
+    }
+  };
+  ASSERT_TRUE( fiber.start( stacks, body, &trace ) );
+  EXPECT_EQ( stacks.outstanding(), 1u );
+  int resumes = 1;
+  while ( fiber.resume() ) {
+    EXPECT_EQ( trace.size(), static_cast<size_t>( resumes ) );
+    ++resumes;
+  }
+  EXPECT_EQ( trace, ( std::vector<int>{ 0, 1, 2 } ) );
+  EXPECT_FALSE( fiber.active() );
+  EXPECT_EQ( stacks.outstanding(), 0u );
+  EXPECT_FALSE( sim::Fiber::yield() ); // not on a fiber
+}
+
+TEST( collector, streaming ) {
+  std::mt19937_64 random{ 42 };
+  std::exponential_distribution<double> exponential{ 2.0 };
+  std::vector<double> values;
+  sim::Moments moments[2];
+  sim::Histogram histogram[2];
+  sim::TDigest digest[2];
+  for ( size_t index = 0; index < 20000; ++index ) {
+    auto value = exponential( random );
+    values.push_back( value );
+    // two replicas, merged below
+    moments[index % 2].add( value );
+    histogram[index % 2].add( value );
+    digest[index % 2].add( value );
+  }
+  moments[0].merge( moments[1] );
+  histogram[0].merge( histogram[1] );
+  digest[0].merge( digest[1] );
+  std::sort( values.begin(), values.end() );
+  double mean = 0.0, squares = 0.0;
+  for ( auto value : values ) {
+    mean += value / double( values.size() );
+  }
+  for ( auto value : values ) {
+    squares += ( value - mean ) * ( value - mean );
+  }
+  EXPECT_EQ( moments[0].count(), values.size() );
+  EXPECT_NEAR( moments[0].mean(), mean, 1e-9 );
+  EXPECT_NEAR( moments[0].variance(), squares / double( values.size() - 1 ), 1e-9 );
+  EXPECT_EQ( histogram[0].count(), values.size() );
+  EXPECT_EQ( digest[0].count(), values.size() );
+  for ( double fraction : { 0.01, 0.5, 0.9, 0.999 } ) {
+    auto exact = values[size_t( fraction * double( values.size() - 1 ) )];
+    EXPECT_NEAR( histogram[0].quantile( fraction ), exact, exact / 64 ) << fraction;
+    // a digest is accurate in rank rather than in value
+    auto estimate = digest[0].quantile( fraction );
+    auto rank = double( std::lower_bound( values.begin(), values.end(), estimate ) - values.begin() );
+    EXPECT_NEAR( rank / double( values.size() ), fraction, 0.005 ) << fraction;
+  }
+  EXPECT_EQ( histogram[0].quantile( 1.0 ), values.back() );
+  EXPECT_EQ( digest[0].quantile( 0.0 ), values.front() );
+
+  // only the powers of two values fell in are held, however far apart
+  sim::Histogram wide{ 16 };
+  wide.add( 1e-300 );
+  wide.add( 3.0, 2 );
+  wide.add( 1e300 );
+  EXPECT_NEAR( wide.quantile( 0.0 ), 1e-300, 1e-300 / 65536 );
+  EXPECT_NEAR( wide.quantile( 0.5 ), 3.0, 3.0 / 65536 );
+  EXPECT_NEAR( wide.quantile( 1.0 ), 1e300, 1e300 / 65536 );
+
+  // a queue of 2 for a second, then empty for three
+  sim::TimeWeighted length;
+  sim::Clock::time_point start{};
+  length.add( start, 1.0 );
+  length.add( start, 1.0 );
+  length.set( start + std::chrono::seconds( 1 ), 0.0 );
+  EXPECT_DOUBLE_EQ( length.mean(), 2.0 );
+  EXPECT_DOUBLE_EQ( length.mean( start + std::chrono::seconds( 4 ) ), 0.5 );
+  EXPECT_EQ( length.max(), 2.0 );
+}
+
+TEST( results, columns ) {
+  auto path = testing::TempDir() + "results.simres";
+  auto opened = sim::ResultsWriter::open( path, {
+      { "id", sim::ResultsColumn::Type::INTEGER },
+      { "time", sim::ResultsColumn::Type::INTEGER },
+      { "value", sim::ResultsColumn::Type::REAL } }, 1000 );
+  ASSERT_TRUE( opened );
+  auto &writer = *opened.value;
+  constexpr size_t rows = 10500; // ten chunks and a part
+  for ( size_t row = 0; row < rows; ++row ) {
+    // times that mostly rise, and fall now and then
+    auto time = sim::Clock::time_point{ std::chrono::microseconds( int64_t( row ) * 10 - ( row % 7 == 3 ? 15 : 0 ) ) };
+    writer->append( { row, time, double( row ) / 4 } );
+  }
+  writer->append( { 1, 2 } ); // not a row
+  ASSERT_TRUE( writer->close() );
+
+  auto read = sim::ResultsReader::open( path );
+  ASSERT_TRUE( read ) << read.msg;
+  auto &reader = *read.value;
+  ASSERT_EQ( reader->columns().size(), 3u );
+  EXPECT_EQ( reader->columns()[1].name, "time" );
+  EXPECT_EQ( reader->rows(), rows );
+  std::vector<int64_t> times;
+  ASSERT_TRUE( reader->scanIntegers( "time", [&]( const int64_t *values, size_t count ) {
+    times.insert( times.end(), values, values + count );
+  } ) );
+  ASSERT_EQ( times.size(), rows );
+  EXPECT_EQ( times[3], 15000 );
+  EXPECT_EQ( times.back(), int64_t( rows - 1 ) * 10000 );
+  double sum = 0.0;
+  ASSERT_TRUE( reader->scanReals( "value", [&]( const double *values, size_t count ) {
+    sum = std::accumulate( values, values + count, sum );
+  } ) );
+  EXPECT_DOUBLE_EQ( sum, double( rows - 1 ) * rows / 8 );
+  EXPECT_FALSE( reader->scanReals( "id", []( const double *, size_t ) {} ) );
+
+  // a file cut short is refused
+  std::ifstream in{ path, std::ios::binary };
+  std::string bytes{ std::istreambuf_iterator<char>( in ), {} };
+  in.close();
+  std::ofstream{ path, std::ios::binary | std::ios::trunc } << bytes.substr( 0, bytes.size() - 3 );
+  EXPECT_FALSE( sim::ResultsReader::open( path ) );
+  std::remove( path.c_str() );
+}
+
 TEST( flagset, metas ) {
   enum class Flags : uint32_t { ONE, TWO, THREE, COUNT__ };
   acpp::flagset<Flags> fs2( Flags::ONE, Flags::TWO );
@@ -44,7 +383,7 @@ public:
   EmptyModel() : Model( "EmptyModel" ) {
   }
 
-  void startActivity( sim::Instance &, sim::Activity & ) override {
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
   }
 };
 
@@ -70,27 +409,31 @@ TEST_F( SimulatorTest, instancing ) {
  * Fixture for testing the simulator which resets the global simulator instance for each test.
  */
 struct SimulationTest : testing::Test {
+  /**
+   * Sends "beats" messages out of its "out" pad at "duty_cycle" a second, tallying those coming in
+   */
   class LoopbackModel : public sim::Model {
   public:
     LoopbackModel() : Model( "LoopbackModel" ) {
-      addActivitySpec( {"sink",
-          []( sim::Instance &instance, sim::Activity &activity ) {
-            while ( activity.state() == sim::Activity::State::RUN ) {
-              activity.padReceive( "in" );
-            }
-          },
-          "in::receive"} );
-      addPadSpec( {"in", {sim::PadSpec::Flag::CAN_INPUT}, {}} );
-      addPadSpec( {"out", {sim::PadSpec::Flag::CAN_OUTPUT}, {}} );
+      addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+      addPadSpec( { "out", { sim::PadSpec::Flag::CAN_OUTPUT }, {} } );
+      addActivitySpec( { "in", sim::ActivitySpec::Type::pad_receive,
+          []( sim::Instance &instance, sim::Activity &, const std::string &, sim::Payload & ) {
+            instance.owner()->collector<sim::Tally>( "looped" )->add( 1.0 );
+          } } );
+      addActivitySpec( { "beat", sim::ActivitySpec::Type::plain,
+          []( sim::Instance &, sim::Activity &activity, const std::string &, sim::Payload & ) {
+            activity.padSend( "out", sim::Payload::make<int>( 0 ), std::string{} );
+          } } );
     }
 
-    void startActivity( sim::Instance &instance, sim::Activity &activity ) override {
-      auto duty_cycle = instance.parameter<double>( "duty_cycle" ).value_or( 2.0 );
+    void startActivity( std::shared_ptr<sim::Instance> instance, std::shared_ptr<sim::Activity> ) override {
+      auto duty_cycle = instance->parameter<double>( "duty_cycle" ).value_or( 2.0 );
+      auto beats = instance->parameter<uintmax_t>( "beats" ).value_or( 0 );
       sim::Clock::duration interval{
           static_cast<sim::Clock::duration::rep>( sim::Clock::period::den / duty_cycle )};
-      while ( activity.state() == sim::Activity::State::RUN ) {
-        instance.pad( "out" );
-        activity.waitFor( interval );
+      for ( uintmax_t beat = 0; beat < beats; ++beat ) {
+        instance->spawnActivity( "beat", "beat" + std::to_string( beat ), interval * ( beat + 1 ) );
       }
     }
   };
@@ -110,7 +453,1353 @@ struct SimulationTest : testing::Test {
 };
 
 TEST_F( SimulationTest, instance_basic ) {
-  simulation->spawnInstance( "LoopbackModel", "looper" );
+  ASSERT_TRUE( simulation->spawnInstance( "LoopbackModel", "looper", { { "beats", uintmax_t( 4 ) } } ) );
+  ASSERT_TRUE( simulation->step() ); // the spawn
+  auto looper = simulation->instance( "looper" );
+  ASSERT_TRUE( looper );
+  ASSERT_TRUE( looper->pad( "out" )->connect( looper, "in" ) );
+
+  auto start = simulation->simtime();
+  ASSERT_TRUE( simulation->runToCompletion() );
+  EXPECT_EQ( simulation->collector<sim::Tally>( "looped" )->count(), 4u );
+  EXPECT_EQ( simulation->simtime(), start + std::chrono::seconds( 2 ) );
+}
+
+#if ACPP_LESSON > 4
+/**
+ * A ring of nodes passing tokens on, every link with lookahead so that it can cross partitions
+ */
+class RingModel : public sim::Model {
+public:
+  using Log = std::vector<std::pair<sim::Clock::time_point, uint64_t>>;
+
+  RingModel( std::vector<Log> &logs ) : Model( "RingModel" ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addPadSpec( { "out", { sim::PadSpec::Flag::CAN_OUTPUT }, { { "lookahead", 0.002 } } } );
+    addActivitySpec( { "start", sim::ActivitySpec::Type::plain,
+        [&logs]( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          auto id = instance.parameter<uintmax_t>( "id" ).value_or( 0 );
+          activity.waitFor( std::chrono::milliseconds( 1 ) );
+          activity.padSend( "out", sim::Payload::make<uint64_t>( id ) );
+          while ( true ) {
+            auto msg = activity.padReceive( "in" );
+            if ( !msg ) {
+              break; // canceled as the simulation goes away
+            }
+            auto token = msg.value->take<uint64_t>();
+            logs[id].emplace_back( instance.owner()->simtime(), token );
+            activity.waitFor( std::chrono::milliseconds( ( token + id ) % 3 ) );
+            if ( logs[id].size() < 50 ) {
+              activity.padSend( "out", sim::Payload::make<uint64_t>( token + 1 ) );
+            }
+          }
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {}
+};
+
+TEST_F( SimulatorTest, parallel_matches_sequential ) {
+  constexpr size_t nodes = 12;
+  std::vector<RingModel::Log> logs;
+  sim::Simulator::getInstance().addModel( std::make_shared<RingModel>( logs ) );
+  auto run = [&]( size_t partitions ) {
+    logs.assign( nodes, {} );
+    auto simulation = std::make_shared<sim::Simulation>();
+    EXPECT_TRUE( simulation->setPartitions( partitions ) );
+    for ( size_t node = 0; node < nodes; ++node ) {
+      simulation->spawnInstance( "RingModel", "n" + std::to_string( node ), { { "id", uintmax_t( node ) } } );
+    }
+    EXPECT_TRUE( simulation->runParallel( sim::Clock::time_point{} ) ); // just the spawns
+    for ( size_t node = 0; node < nodes; ++node ) {
+      auto next = simulation->instance( "n" + std::to_string( ( node + 1 ) % nodes ) );
+      EXPECT_TRUE( simulation->instance( "n" + std::to_string( node ) )->pad( "out" )->connect( next, "in" ) );
+    }
+    EXPECT_TRUE( simulation->runParallel() );
+    EXPECT_EQ( simulation->state(), sim::Simulation::State::DONE );
+    return logs;
+  };
+  auto sequential = run( 1 );
+  EXPECT_EQ( sequential.front().size(), 50u );
+  EXPECT_EQ( run( 3 ), sequential );
+  EXPECT_EQ( run( 4 ), sequential );
+}
+
+/**
+ * Nodes relaying tokens as they receive them, keeping their log as instance state so
+ * that an optimistic run can roll it back. Without lookahead a hop takes no time.
+ */
+class RelayModel : public sim::Model {
+public:
+  using Log = RingModel::Log;
+
+  class Node : public sim::Instance {
+  public:
+    using sim::Instance::Instance;
+
+    acpp::value_result<sim::Payload> saveState() const override {
+      return acpp::value_result<sim::Payload>( sim::Payload{ log } );
+    }
+    void restoreState( sim::Payload &&state ) noexcept override {
+      log = state.take<Log>();
+    }
+
+    Log log;
+  };
+
+  RelayModel( const std::string &name, double lookahead ) : Model( name ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addPadSpec( { "out", { sim::PadSpec::Flag::CAN_OUTPUT }, { { "lookahead", lookahead } } } );
+    addActivitySpec( { "kick", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          activity.padSend( "out", sim::Payload::make<uint64_t>( instance.parameter<uintmax_t>( "id" ).value_or( 0 ) ) );
+        } } );
+    addActivitySpec( { "in", sim::ActivitySpec::Type::pad_receive,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload &payload ) {
+          auto &node = static_cast<Node &>( instance );
+          auto token = payload.take<uint64_t>();
+          node.log.emplace_back( instance.owner()->simtime(), token );
+          if ( node.log.size() < 40 ) {
+            activity.padSend( "out", sim::Payload::make<uint64_t>( token * 7 + 1 ) );
+          }
+        } } );
+  }
+
+  std::shared_ptr<sim::Instance> makeInstance(
+      std::shared_ptr<sim::Simulation> simulation,
+      const std::string &name,
+      const sim::PropertyList &parameters ) override {
+    return std::make_shared<Node>( simulation, shared_from_this(), name, parameters );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance> instance, std::shared_ptr<sim::Activity> ) override {
+    instance->spawnActivity( "kick", "kick", std::chrono::milliseconds( 1 ) );
+  }
+};
+
+TEST_F( SimulatorTest, optimistic_matches_sequential ) {
+  constexpr size_t nodes = 12;
+  sim::Simulator::getInstance().addModel( std::make_shared<RelayModel>( "Relay", 0.0 ) );
+  sim::Simulator::getInstance().addModel( std::make_shared<RelayModel>( "Delay", 0.003 ) );
+  auto run = [&]( size_t partitions, sim::Simulation::Synchronization synchronization ) {
+    auto simulation = std::make_shared<sim::Simulation>();
+    EXPECT_TRUE( simulation->setPartitions( partitions ) );
+    for ( size_t node = 0; node < nodes; ++node ) {
+      simulation->spawnInstance(
+          node % 3 ? "Relay" : "Delay", "n" + std::to_string( node ), { { "id", uintmax_t( node ) } } );
+    }
+    EXPECT_TRUE( simulation->runParallel( sim::Clock::time_point{} ) );
+    for ( size_t node = 0; node < nodes; ++node ) {
+      auto next = simulation->instance( "n" + std::to_string( ( node + 1 ) % nodes ) );
+      EXPECT_TRUE( simulation->instance( "n" + std::to_string( node ) )->pad( "out" )->connect( next, "in" ) );
+    }
+    EXPECT_TRUE( simulation->setSynchronization( synchronization ) );
+    auto ran = simulation->runParallel();
+    std::vector<RelayModel::Log> logs;
+    if ( ran ) {
+      EXPECT_EQ( simulation->state(), sim::Simulation::State::DONE );
+      for ( size_t node = 0; node < nodes; ++node ) {
+        logs.push_back( std::static_pointer_cast<RelayModel::Node>( simulation->instance( "n" + std::to_string( node ) ) )->log );
+      }
+    }
+    return logs;
+  };
+  auto sequential = run( 1, sim::Simulation::Synchronization::CONSERVATIVE );
+  ASSERT_EQ( sequential.size(), nodes );
+  EXPECT_EQ( sequential.front().size(), 40u );
+  // zero-delay hops between partitions leave conservative runs nothing to go on
+  EXPECT_TRUE( run( 3, sim::Simulation::Synchronization::CONSERVATIVE ).empty() );
+  EXPECT_EQ( run( 3, sim::Simulation::Synchronization::OPTIMISTIC ), sequential );
+  EXPECT_EQ( run( 4, sim::Simulation::Synchronization::OPTIMISTIC ), sequential );
+}
+
+/**
+ * Draws samples from the simulation's seed into a tally, keeping nothing in the model
+ */
+class SamplerModel : public sim::Model {
+public:
+  SamplerModel() : Model( "SamplerModel" ) {
+    addActivitySpec( { "start", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          auto simulation = instance.owner();
+          auto tally = simulation->collector<sim::Tally>( "samples" );
+          std::mt19937_64 random{ simulation->parameter<uintmax_t>( "seed" ).value_or( 0 ) };
+          for ( int sample = 0; sample < 10; ++sample ) {
+            tally->add( double( random() % 1000 ) );
+            activity.waitFor( std::chrono::milliseconds( 1 ) );
+          }
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+TEST( Simulator, replications ) {
+  sim::Simulator simulator;
+  simulator.addModel<SamplerModel>();
+  auto topology = []( std::shared_ptr<sim::Simulation> simulation ) {
+    return simulation->spawnInstance( "SamplerModel", "sampler" );
+  };
+  constexpr size_t count = 16;
+  double expected = 0.0;
+  for ( uint64_t seed = 0; seed < count; ++seed ) {
+    std::mt19937_64 random{ seed };
+    for ( int sample = 0; sample < 10; ++sample ) {
+      expected += double( random() % 1000 );
+    }
+  }
+
+  auto serial = simulator.runReplications( topology, count, {}, 1 );
+  ASSERT_TRUE( serial );
+  EXPECT_EQ( serial.value->failed(), 0u );
+  auto tally = std::dynamic_pointer_cast<sim::Tally>( serial.value->collectors["samples"] );
+  ASSERT_TRUE( tally );
+  EXPECT_EQ( tally->count(), count * 10 );
+  EXPECT_EQ( tally->sum(), expected );
+
+  auto pooled = simulator.runReplications( topology, count, {}, 4 );
+  ASSERT_TRUE( pooled );
+  auto pooled_tally = std::dynamic_pointer_cast<sim::Tally>( pooled.value->collectors["samples"] );
+  ASSERT_TRUE( pooled_tally );
+  EXPECT_EQ( pooled_tally->sum(), tally->sum() );
+  EXPECT_EQ( pooled_tally->min(), tally->min() );
+  EXPECT_EQ( pooled_tally->max(), tally->max() );
+
+  EXPECT_FALSE( simulator.runReplications( topology, count, { 1, 2, 3 } ) );
+  // the invariants of the engine are thrown as plain messages
+  auto thrown = simulator.runReplications(
+      []( std::shared_ptr<sim::Simulation> ) -> acpp::void_result<> { throw "pad capacity below one"; }, 2 );
+  ASSERT_TRUE( thrown );
+  EXPECT_EQ( thrown.value->failed(), 2u );
+  EXPECT_EQ( thrown.value->errors.front(), "pad capacity below one" );
+  // the global simulator knows no such model
+  EXPECT_FALSE( sim::Simulator::getInstance().model( "SamplerModel" ) );
+}
+
+/**
+ * Ticks every millisecond, asking the simulation to pause at a given tick
+ */
+class TickerModel : public sim::Model {
+public:
+  TickerModel() : Model( "TickerModel" ) {
+    addActivitySpec( { "start", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          auto simulation = instance.owner();
+          auto ticks = simulation->collector<sim::Tally>( "ticks" );
+          auto pause_at = instance.parameter<uintmax_t>( "pause_at" ).value_or( 0 );
+          for ( size_t tick = 1; tick <= 1000; ++tick ) {
+            activity.waitFor( std::chrono::milliseconds( 1 ) );
+            ticks->add( 1.0 );
+            if ( tick == pause_at ) {
+              simulation->setState( sim::Simulation::State::PAUSE );
+            }
+          }
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+TEST( Simulation, run_control ) {
+  sim::Simulator simulator;
+  simulator.addModel<TickerModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( simulation->spawnInstance( "TickerModel", "ticker", { { "pause_at", uintmax_t( 500 ) } } ) );
+  auto ticks = simulation->collector<sim::Tally>( "ticks" );
+  auto start = simulation->simtime();
+
+  auto stepped = simulation->step( 2 ); // the spawn, which starts the ticker, then its first tick
+  ASSERT_TRUE( stepped );
+  EXPECT_EQ( *stepped.value, 2u );
+  EXPECT_EQ( ticks->count(), 1u );
+  EXPECT_EQ( simulation->simtime(), start + std::chrono::milliseconds( 1 ) );
+  EXPECT_EQ( simulation->state(), sim::Simulation::State::PAUSE );
+
+  EXPECT_TRUE( simulation->runFor( std::chrono::milliseconds( 10 ) ) );
+  EXPECT_EQ( ticks->count(), 11u );
+  EXPECT_EQ( simulation->simtime(), start + std::chrono::milliseconds( 11 ) );
+  EXPECT_TRUE( simulation->runFor( std::chrono::microseconds( 500 ) ) );
+  EXPECT_EQ( ticks->count(), 11u );
+  EXPECT_EQ( simulation->simtime(), start + std::chrono::microseconds( 11500 ) );
+
+  // the pause asked for at tick 500 is noticed within a poll interval
+  EXPECT_TRUE( simulation->runToCompletion() );
+  EXPECT_EQ( simulation->state(), sim::Simulation::State::PAUSE );
+  EXPECT_GE( ticks->count(), 500u );
+  EXPECT_LT( ticks->count(), 600u );
+
+  // a duration past the end of time runs until the end of time
+  EXPECT_TRUE( simulation->runFor( sim::Clock::duration::max() ) );
+  EXPECT_EQ( ticks->count(), 1000u );
+  auto rest = simulation->runToCompletion();
+  ASSERT_TRUE( rest );
+  EXPECT_EQ( simulation->state(), sim::Simulation::State::DONE );
+  EXPECT_EQ( ticks->count(), 1000u );
+  EXPECT_EQ( simulation->simtime(), start + std::chrono::milliseconds( 1000 ) );
+  auto none = simulation->step();
+  ASSERT_TRUE( none );
+  EXPECT_EQ( *none.value, 0u );
+}
+
+TEST( Simulation, profile ) {
+  sim::Simulator simulator;
+  simulator.addModel<TickerModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  EXPECT_FALSE( simulation->profile() );
+  ASSERT_TRUE( simulation->spawnInstance( "TickerModel", "ticker" ) );
+  ASSERT_TRUE( simulation->startProfile() );
+  EXPECT_FALSE( simulation->startProfile() );
+  ASSERT_TRUE( simulation->runFor( std::chrono::milliseconds( 100 ) ) );
+
+  // queryable between runs while it goes on
+  auto partway = simulation->profile();
+  ASSERT_TRUE( partway ) << partway.msg;
+  EXPECT_EQ( partway.value->total().events, 101u );
+  ASSERT_TRUE( simulation->runToCompletion() );
+  ASSERT_TRUE( simulation->stopProfile() );
+  EXPECT_FALSE( simulation->stopProfile() );
+
+  auto profiled = simulation->profile();
+  ASSERT_TRUE( profiled ) << profiled.msg;
+  const auto &profile = *profiled.value;
+  auto types = profile.byType();
+  EXPECT_EQ( types["SPAWN_INSTANCE"].events, 1u );
+  EXPECT_EQ( types["RESUME_ACTIVITY"].events, 1000u );
+  EXPECT_EQ( profile.byModel()["TickerModel"].events, 1001u );
+  auto ticker = profile.byInstance()["ticker"];
+  EXPECT_LE( ticker.meanDepth(), double( ticker.depth_max ) );
+  EXPECT_DOUBLE_EQ( profile.simulated, 1.0 );
+  EXPECT_DOUBLE_EQ( profile.eventsPerSimulatedSecond( profile.total() ), 1001.0 );
+  EXPECT_GT( profile.total().seconds, 0.0 );
+  EXPECT_LE( profile.total().seconds, profile.wall );
+
+  std::ostringstream folded;
+  profile.writeFolded( folded );
+  EXPECT_NE( folded.str().find( "TickerModel;ticker;RESUME_ACTIVITY " ), std::string::npos );
+}
+
+TEST( Simulation, many_waiting_activities ) {
+  sim::Simulator simulator;
+  simulator.addModel<TickerModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  constexpr size_t tickers = 300;
+  for ( size_t index = 0; index < tickers; ++index ) {
+    ASSERT_TRUE( simulation->spawnInstance( "TickerModel", "ticker" + std::to_string( index ) ) );
+  }
+  auto ticks = simulation->collector<sim::Tally>( "ticks" );
+  auto start = simulation->simtime();
+
+  // every ticker waits at once, each resume finds its own
+  EXPECT_TRUE( simulation->runFor( std::chrono::microseconds( 10500 ) ) );
+  EXPECT_EQ( ticks->count(), tickers * 10 );
+  EXPECT_TRUE( simulation->runToCompletion() );
+  EXPECT_EQ( ticks->count(), tickers * 1000 );
+  EXPECT_EQ( simulation->simtime(), start + std::chrono::milliseconds( 1000 ) );
+}
+
+/**
+ * Waits a millisecond at a time for as long as its waits succeed, noting how they fail
+ */
+std::vector<std::string> poller_failures; // outlives the simulation unwinding the poller
+
+class PollerModel : public sim::Model {
+public:
+  PollerModel() : Model( "PollerModel" ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addActivitySpec( { "start", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          for ( ;; ) {
+            auto waited = activity.waitFor( std::chrono::milliseconds( 1 ) );
+            if ( !waited ) {
+              poller_failures.push_back( waited.msg );
+              break;
+            }
+          }
+          // once canceled every wait fails at once, even with a message there to receive
+          poller_failures.push_back( activity.waitFor( std::chrono::milliseconds( 1 ) ).msg );
+          poller_failures.push_back( activity.padReceive( "in" ).msg );
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+TEST( Simulation, cancel_waits ) {
+  sim::Simulator simulator;
+  simulator.addModel<PollerModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( simulation->spawnInstance( "PollerModel", "poller" ) );
+  ASSERT_TRUE( simulation->runFor( std::chrono::milliseconds( 10 ) ) );
+  ASSERT_TRUE( simulation->inject( "poller", "in", sim::Payload::make<int>( 1 ) ) );
+  ASSERT_TRUE( simulation->runUntil( simulation->simtime() ) );
+  EXPECT_EQ( simulation->instance( "poller" )->pad( "in" )->available(), 1u );
+  poller_failures.clear();
+  simulation.reset();
+  EXPECT_EQ( poller_failures, ( std::vector<std::string>{ "wait canceled", "wait canceled", "receive canceled" } ) );
+}
+
+/**
+ * Tallies each time "go" is raised, while a gate keeps the run going until told to stop
+ */
+std::atomic<int> signal_phase{ 0 }; // 1 once the gate runs, 2 once it may stop
+
+class SignalModel : public sim::Model {
+public:
+  SignalModel() : Model( "SignalModel" ) {
+    addActivitySpec( { "start", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          auto woken = instance.owner()->collector<sim::Tally>( "woken" );
+          while ( activity.waitOn( "go" ) ) {
+            woken->add( 1.0 );
+          }
+        } } );
+    addActivitySpec( { "gate", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          signal_phase = 1;
+          while ( signal_phase.load() < 2 && activity.waitFor( std::chrono::microseconds( 1 ) ) ) {
+          }
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+TEST( Simulation, foreign_signal ) {
+  sim::Simulator simulator;
+  simulator.addModel<SignalModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( simulation->spawnInstance( "SignalModel", "listener" ) );
+  ASSERT_TRUE( simulation->step() );
+  auto woken = simulation->collector<sim::Tally>( "woken" );
+  auto direct = simulation->raiseSignal( "go" ); // between runs it wakes the listener at once
+  ASSERT_TRUE( direct );
+  EXPECT_EQ( *direct.value, 1u );
+  ASSERT_TRUE( simulation->runUntil( simulation->simtime() ) );
+  EXPECT_EQ( woken->count(), 1u );
+
+  // raised from another thread while the gate keeps the run busy
+  signal_phase = 0;
+  ASSERT_TRUE( simulation->spawnActivity( "gate", "gate", "listener", simulation->simtime() ) );
+  std::optional<acpp::value_result<size_t>> posted;
+  std::thread raiser{ [&] {
+    while ( signal_phase.load() < 1 ) {
+      std::this_thread::yield();
+    }
+    posted.emplace( simulation->raiseSignal( "go" ) );
+    signal_phase = 2;
+  } };
+  EXPECT_TRUE( simulation->runToCompletion() );
+  raiser.join();
+  ASSERT_TRUE( posted && *posted ) << ( posted ? posted->msg : "not raised" );
+  EXPECT_EQ( *posted->value, 0u ); // taken in by the run rather than woken there and then
+  EXPECT_EQ( woken->count(), 2u );
+  EXPECT_EQ( *simulation->raiseSignal( "nobody waits on this" ).value, 0u );
+}
+
+/**
+ * Tallies the values arriving at its "in" pad
+ */
+class CounterModel : public sim::Model {
+public:
+  CounterModel() : Model( "CounterModel" ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addActivitySpec( { "in", sim::ActivitySpec::Type::pad_receive,
+        []( sim::Instance &instance, sim::Activity &, const std::string &, sim::Payload &payload ) {
+          instance.owner()->collector<sim::Tally>( "received" )->add( double( payload.take<int>() ) );
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+/**
+ * Sends the values of its "values" parameter out of its "out" pad as it starts
+ */
+class SourceModel : public sim::Model {
+public:
+  SourceModel() : Model( "SourceModel" ) {
+    addPadSpec( { "out", { sim::PadSpec::Flag::CAN_OUTPUT }, {} } );
+    addActivitySpec( { "start", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          for ( auto value : instance.parameter<std::vector<uintmax_t>>( "values" ).value_or( std::vector<uintmax_t>{} ) ) {
+            activity.padSend( "out", sim::Payload::make<int>( int( value ) ) );
+          }
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+TEST( Simulator, load_topology ) {
+  sim::Simulator simulator;
+  simulator.addModel<SourceModel>();
+  simulator.addModel<CounterModel>();
+  auto loaded = simulator.loadTopology( R"({
+    "comment": { "skipped": [ 1, { "deep": true } ] },
+    "parameters": { "seed": 7, "rates": [ 0.5, 2 ] },
+    "instance_count": 4,
+    "instances": [
+      { "name": "a", "model": "SourceModel", "parameters": { "values": [ 1, 2, 3 ] } },
+      { "name": "x", "model": "CounterModel" },
+      { "name": "b", "model": "SourceModel", "parameters": { "values": [ 10 ], "note": "kept" } },
+      { "name": "y", "model": "CounterModel", "layout": [ 0, 1 ] }
+    ],
+    "links": [ { "from": "a.out", "to": "x.in" }, { "from": "b.out", "to": "y.in" } ]
+  })" );
+  ASSERT_TRUE( loaded ) << loaded.msg;
+  auto simulation = *loaded.value;
+  EXPECT_EQ( acpp::get_as<uintmax_t>( simulation->parameter( "seed" ) ), 7u );
+  EXPECT_EQ( acpp::get_as<std::vector<double>>( simulation->parameter( "rates" ) ), std::vector<double>( { 0.5, 2.0 } ) );
+  EXPECT_EQ( std::get<std::string>( simulation->instance( "b" )->parameter( "note" ) ), "kept" );
+  EXPECT_EQ( simulation->instance( "a" )->pad( "out" )->peer(), simulation->instance( "x" )->pad( "in" ) );
+
+  // the pads were connected before the sources started
+  EXPECT_TRUE( simulation->runToCompletion() );
+  auto received = simulation->collector<sim::Tally>( "received" );
+  EXPECT_EQ( received->count(), 4u );
+  EXPECT_EQ( received->sum(), 16.0 );
+
+  // links may come before the instances they name
+  std::istringstream stream{ R"({ "links": [ { "from": "a.out", "to": "x.in" } ],
+    "instances": [ { "name": "a", "model": "SourceModel" }, { "name": "x", "model": "CounterModel" } ] })" };
+  auto streamed = simulator.loadTopology( stream );
+  ASSERT_TRUE( streamed ) << streamed.msg;
+  EXPECT_TRUE( ( *streamed.value )->instance( "a" )->pad( "out" )->peer() );
+
+  EXPECT_FALSE( simulator.loadTopology( R"({ "instances": [ { "name": "a", "model": "NoModel" } ] })" ) );
+  EXPECT_FALSE( simulator.loadTopology( R"({ "instances": [ { "name": "a", "model": "SourceModel" } ],
+    "links": [ { "from": "a.out", "to": "nobody.in" } ] })" ) );
+  EXPECT_FALSE( simulator.loadTopology( R"({ "instances": [ )" ) );
+}
+
+TEST( Simulator, compiled_topology ) {
+  sim::Simulator simulator;
+  simulator.addModel<SourceModel>();
+  simulator.addModel<CounterModel>();
+  std::istringstream topology{ R"({
+    "links": [ { "from": "b.out", "to": "y.in" } ],
+    "parameters": { "seed": 7, "offset": -3, "names": [ "p", "q" ] },
+    "instances": [
+      { "name": "a", "model": "SourceModel", "parameters": { "values": [ 1, 2, 3 ], "weights": [ -1, 2 ] } },
+      { "name": "x", "model": "CounterModel" },
+      { "name": "b", "model": "SourceModel", "parameters": { "values": [ 10 ], "note": "kept", "rate": 0.25 } },
+      { "name": "y", "model": "CounterModel" }
+    ],
+    "partitions": 2
+  })" };
+  // partitions can't follow instances in a simulation, but an image applies them first
+  auto path = testing::TempDir() + "compiled_topology.simtopo";
+  auto compiled = simulator.compileTopology( topology, path );
+  ASSERT_TRUE( compiled ) << compiled.msg;
+
+  auto loaded = simulator.loadCompiledTopology( path );
+  ASSERT_TRUE( loaded ) << loaded.msg;
+  auto simulation = *loaded.value;
+  EXPECT_EQ( simulation->partitions(), 2u );
+  EXPECT_EQ( acpp::get_as<uintmax_t>( simulation->parameter( "seed" ) ), 7u );
+  EXPECT_EQ( acpp::get_as<intmax_t>( simulation->parameter( "offset" ) ), -3 );
+  EXPECT_EQ( acpp::get_as<std::vector<std::string>>( simulation->parameter( "names" ) ), std::vector<std::string>( { "p", "q" } ) );
+  auto b = simulation->instance( "b" );
+  EXPECT_EQ( std::get<std::string>( b->parameter( "note" ) ), "kept" );
+  EXPECT_EQ( b->parameter<double>( "rate" ), 0.25 );
+  EXPECT_EQ( simulation->instance( "a" )->parameter<std::vector<intmax_t>>( "weights" ), std::vector<intmax_t>( { -1, 2 } ) );
+  EXPECT_EQ( simulation->instance( "a" )->pad( "out" )->peer(), nullptr ); // not linked
+  EXPECT_EQ( b->pad( "out" )->peer(), simulation->instance( "y" )->pad( "in" ) );
+
+  EXPECT_TRUE( simulation->runToCompletion() );
+  auto received = simulation->collector<sim::Tally>( "received" );
+  EXPECT_EQ( received->count(), 1u );
+  EXPECT_EQ( received->sum(), 10.0 );
+
+  {
+    std::fstream image{ path, std::ios::in | std::ios::out | std::ios::binary };
+    image.seekp( 0 );
+    image.put( 'X' );
+  }
+  EXPECT_FALSE( simulator.loadCompiledTopology( path ) );
+  std::remove( path.c_str() );
+  EXPECT_FALSE( simulator.loadCompiledTopology( path ) );
+}
+
+/**
+ * Keeps what its "in" pad receives and, a millisecond in, records how many messages it
+ * holds and its "rate" and the simulation's "level" parameters
+ */
+class HolderModel : public sim::Model {
+public:
+  HolderModel() : Model( "HolderModel" ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addActivitySpec( { "start", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          auto simulation = instance.owner();
+          simulation->collector<sim::Tally>( "rate" )->add( instance.parameter<double>( "rate" ).value_or( -1.0 ) );
+          simulation->collector<sim::Tally>( "level" )->add( simulation->parameter<double>( "level" ).value_or( -1.0 ) );
+          activity.waitFor( std::chrono::milliseconds( 1 ) );
+          simulation->collector<sim::Tally>( "held" )->add( double( instance.pad( "in" )->available() ) );
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+TEST( Simulator, sweep ) {
+  using Sweep = sim::Simulator::Sweep;
+  Sweep sweep;
+  sweep.factors = { { "h.rate", 0.0, 1.0, 3 }, { "h.in.capacity", 2.0, 4.0, 2, true }, { "level", 5.0, 9.0, 1 } };
+  auto factorial = sim::Simulator::sweepPoints( sweep );
+  ASSERT_TRUE( factorial ) << factorial.msg;
+  ASSERT_EQ( factorial.value->size(), 6u );
+  EXPECT_EQ( factorial.value->at( 1 ), std::vector<double>( { 0.0, 4.0, 5.0 } ) );
+  EXPECT_EQ( factorial.value->at( 4 ), std::vector<double>( { 1.0, 2.0, 5.0 } ) );
+
+  sweep.design = Sweep::Design::LATIN_HYPERCUBE;
+  sweep.points = 5;
+  auto hypercube = sim::Simulator::sweepPoints( sweep );
+  ASSERT_TRUE( hypercube ) << hypercube.msg;
+  std::set<int> strata;
+  for ( const auto &point : *hypercube.value ) {
+    strata.insert( int( point[0] * 5.0 ) );
+  }
+  EXPECT_EQ( strata.size(), 5u ); // each fifth of the range once
+
+  sweep.design = Sweep::Design::SOBOL;
+  sweep.factors.pop_back();
+  sweep.factors[1].integer = false;
+  auto sobol = sim::Simulator::sweepPoints( sweep );
+  ASSERT_TRUE( sobol ) << sobol.msg;
+  EXPECT_EQ( sobol.value->at( 0 ), std::vector<double>( { 0.5, 3.0 } ) );
+  EXPECT_EQ( sobol.value->at( 1 ), std::vector<double>( { 0.75, 2.5 } ) );
+  EXPECT_EQ( sobol.value->at( 2 ), std::vector<double>( { 0.25, 3.5 } ) );
+  sweep.points = 0;
+  EXPECT_FALSE( sim::Simulator::sweepPoints( sweep ) );
+
+  sim::Simulator simulator;
+  simulator.addModel<SourceModel>();
+  simulator.addModel<HolderModel>();
+  std::istringstream topology{ R"({
+    "parameters": { "level": 1 },
+    "instances": [
+      { "name": "s", "model": "SourceModel", "parameters": { "values": [ 1, 2, 3, 4, 5, 6, 7, 8 ] } },
+      { "name": "h", "model": "HolderModel", "parameters": { "rate": 0.5 } }
+    ],
+    "links": [ { "from": "s.out", "to": "h.in" } ]
+  })" };
+  auto path = testing::TempDir() + "sweep.simtopo";
+  ASSERT_TRUE( simulator.compileTopology( topology, path ) );
+
+  sweep = Sweep{};
+  sweep.factors = { { "h.rate", 0.0, 1.0, 3 }, { "h.in.capacity", 2.0, 4.0, 2, true }, { "level", 5.0, 9.0, 1 } };
+  sweep.threads = 3;
+  std::vector<sim::Simulator::SweepPoint> points;
+  auto swept = simulator.runSweep( path, sweep, [&]( sim::Simulator::SweepPoint &&point ) {
+    points.push_back( std::move( point ) );
+  } );
+  ASSERT_TRUE( swept ) << swept.msg;
+  ASSERT_EQ( points.size(), 6u );
+  std::set<size_t> indexes;
+  for ( const auto &point : points ) {
+    indexes.insert( point.index );
+    ASSERT_TRUE( point.error.empty() ) << point.error;
+    auto tally = [&]( const char *name ) { return std::dynamic_pointer_cast<sim::Tally>( point.collectors.at( name ) ); };
+    EXPECT_EQ( tally( "rate" )->sum(), point.values[0] );
+    EXPECT_EQ( tally( "held" )->sum(), 8.0 ); // past its capacity a pad holds the rest in overflow
+    EXPECT_EQ( tally( "level" )->sum(), 5.0 );
+  }
+  EXPECT_EQ( indexes.size(), 6u );
+
+  sweep.factors[0].name = "nobody.rate";
+  EXPECT_FALSE( simulator.runSweep( path, sweep, []( sim::Simulator::SweepPoint && ) {} ) );
+  std::remove( path.c_str() );
+  sweep.factors[0].name = "h.rate";
+  EXPECT_FALSE( simulator.runSweep( path, sweep, []( sim::Simulator::SweepPoint && ) {} ) );
+}
+
+TEST( Simulation, injection ) {
+  sim::Simulator simulator;
+  simulator.addModel<TickerModel>();
+  simulator.addModel<CounterModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( simulation->spawnInstance( "CounterModel", "counter" ) );
+  ASSERT_TRUE( simulation->spawnInstance( "TickerModel", "ticker" ) );
+  EXPECT_FALSE( simulation->inject( "counter", "in", sim::Payload::make<int>( 1 ) ) ); // not spawned yet
+  ASSERT_TRUE( simulation->step( 2 ) );
+  auto received = simulation->collector<sim::Tally>( "received" );
+
+  // producers inject while the ticker keeps the simulation running
+  constexpr int producers = 3;
+  constexpr int count = 200;
+  std::vector<std::thread> threads;
+  for ( int producer = 0; producer < producers; ++producer ) {
+    threads.emplace_back( [&] {
+      for ( int value = 1; value <= count; ++value ) {
+        while ( !simulation->inject( "counter", "in", sim::Payload::make<int>( value ) ) ) {
+          std::this_thread::yield();
+        }
+      }
+    } );
+  }
+  EXPECT_TRUE( simulation->runToCompletion() );
+  for ( auto &thread : threads ) {
+    thread.join();
+  }
+  EXPECT_TRUE( simulation->runToCompletion() ); // what came after the ticker was done
+  EXPECT_EQ( received->count(), size_t( producers * count ) );
+  EXPECT_EQ( received->sum(), producers * count * ( count + 1 ) / 2.0 );
+
+  // a full inbox pushes back until a run takes its events in
+  size_t accepted = 0;
+  for ( ;; ) {
+    auto posted = simulation->inject( "counter", "in", sim::Payload::make<int>( 1 ) );
+    if ( !posted ) {
+      EXPECT_EQ( posted.err, std::errc::resource_unavailable_try_again );
+      break;
+    }
+    ++accepted;
+  }
+  EXPECT_GT( accepted, 0u );
+  EXPECT_TRUE( simulation->runToCompletion() );
+  EXPECT_EQ( received->count(), producers * count + accepted );
+  EXPECT_TRUE( simulation->inject( "counter", "in", sim::Payload::make<int>( 1 ) ) );
+}
+/**
+ * A token hopping around a ring, and what a node saw of them
+ */
+struct Hop {
+  uint64_t token;
+  uint32_t hops;
+};
+struct HopsSeen {
+  uint64_t count;
+  uint64_t sum;
+};
+SIM_REGISTER_PAYLOAD( Hop, 0x1701 )
+SIM_REGISTER_PAYLOAD( HopsSeen, 0x1702 )
+
+/**
+ * Nodes passing hops on, keeping what they saw as instance state so that checkpoints hold it
+ */
+class HopModel : public sim::Model {
+public:
+  class Node : public sim::Instance {
+  public:
+    using sim::Instance::Instance;
+
+    acpp::value_result<sim::Payload> saveState() const override {
+      return acpp::value_result<sim::Payload>( sim::Payload{ seen } );
+    }
+    void restoreState( sim::Payload &&state ) noexcept override {
+      seen = state.get<HopsSeen>();
+    }
+
+    HopsSeen seen{};
+  };
+
+  HopModel() : Model( "HopModel" ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addPadSpec( { "out", { sim::PadSpec::Flag::CAN_OUTPUT }, { { "lookahead", 0.001 } } } );
+    addPadSpec( { "mailbox", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addActivitySpec( { "kick", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          activity.padSend( "out", Hop{ instance.parameter<uintmax_t>( "id" ).value_or( 0 ), 0 } );
+        } } );
+    addActivitySpec( { "in", sim::ActivitySpec::Type::pad_receive,
+        []( sim::Instance &instance, sim::Activity &activity, const std::string &, sim::Payload &payload ) {
+          auto &node = static_cast<Node &>( instance );
+          auto hop = payload.get<Hop>();
+          ++node.seen.count;
+          node.seen.sum += hop.token;
+          auto stride = instance.owner()->parameter<uintmax_t>( "stride" ).value_or( 1 );
+          if ( hop.hops < 30 ) {
+            activity.padSend( "out", Hop{ hop.token * stride + 1, hop.hops + 1 } );
+          }
+        } } );
+  }
+
+  std::shared_ptr<sim::Instance> makeInstance(
+      std::shared_ptr<sim::Simulation> simulation,
+      const std::string &name,
+      const sim::PropertyList &parameters ) override {
+    return std::make_shared<Node>( simulation, shared_from_this(), name, parameters );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance> instance, std::shared_ptr<sim::Activity> ) override {
+    instance->spawnActivity( "kick", "kick", std::chrono::milliseconds( 1 ) );
+  }
+};
+
+TEST( Simulation, checkpoint_restore ) {
+  constexpr size_t nodes = 6;
+  sim::Simulator simulator;
+  simulator.addModel<HopModel>();
+  simulator.addPayloadSerializer<Hop>();
+  simulator.addPayloadSerializer<HopsSeen>();
+  std::string topology = R"({ "partitions": 2, "instances": [)";
+  for ( size_t node = 0; node < nodes; ++node ) {
+    topology += ( node ? "," : "" ) + std::string( R"({ "name": "n)" ) + std::to_string( node ) +
+                R"(", "model": "HopModel", "parameters": { "id": )" + std::to_string( node ) + " } }";
+  }
+  topology += R"(], "links": [)";
+  for ( size_t node = 0; node < nodes; ++node ) {
+    topology += ( node ? "," : "" ) + std::string( R"({ "from": "n)" ) + std::to_string( node ) + R"(.out", "to": "n)" +
+                std::to_string( ( node + 1 ) % nodes ) + R"(.in" })";
+  }
+  topology += "] }";
+  auto loaded = simulator.loadTopology( topology );
+  ASSERT_TRUE( loaded );
+  auto simulation = *loaded.value;
+  auto seen = []( const std::shared_ptr<sim::Simulation> &simulation ) {
+    std::vector<std::pair<uint64_t, uint64_t>> seen;
+    for ( size_t node = 0; node < nodes; ++node ) {
+      auto &state = std::static_pointer_cast<HopModel::Node>( simulation->instance( "n" + std::to_string( node ) ) )->seen;
+      seen.emplace_back( state.count, state.sum );
+    }
+    return seen;
+  };
+
+  // warm up, leaving a message queued in a mailbox and another on its way
+  ASSERT_TRUE( simulation->runUntil( sim::Clock::time_point{ std::chrono::milliseconds( 12 ) } ) );
+  ASSERT_TRUE( simulation->inject( "n0", "mailbox", Hop{ 7, 0 } ) );
+  ASSERT_TRUE( simulation->runUntil( simulation->simtime() ) );
+  ASSERT_TRUE( simulation->inject( "n1", "mailbox", Hop{ 9, 0 }, simulation->simtime() + std::chrono::milliseconds( 5 ) ) );
+  auto path = testing::TempDir() + "checkpoint_restore.simchk";
+  ASSERT_TRUE( simulation->checkpoint( path ) );
+  EXPECT_EQ( simulation->instance( "n0" )->pad( "mailbox" )->available(), 1u ); // put back
+  auto warm = seen( simulation );
+
+  auto restored = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( restored->restore( path ) );
+  std::remove( path.c_str() );
+  EXPECT_EQ( restored->partitions(), 2u );
+  EXPECT_EQ( restored->simtime(), simulation->simtime() );
+  EXPECT_EQ( seen( restored ), warm );
+  EXPECT_EQ( restored->instance( "n0" )->pad( "mailbox" )->available(), 1u );
+  EXPECT_FALSE( restored->restore( path ) ); // not fresh
+
+  auto forked = restored->fork();
+  ASSERT_TRUE( forked );
+  auto what_if = *forked.value;
+  what_if->setParameter( "stride", uintmax_t( 3 ) );
+
+  EXPECT_TRUE( simulation->runToCompletion() );
+  EXPECT_TRUE( restored->runToCompletion() );
+  EXPECT_TRUE( what_if->runToCompletion() );
+  EXPECT_EQ( seen( restored ), seen( simulation ) );
+  EXPECT_EQ( seen( restored ).front().first, 31u );
+  EXPECT_NE( seen( what_if ), seen( simulation ) );
+  EXPECT_EQ( restored->instance( "n1" )->pad( "mailbox" )->available(), 1u );
+
+  // what can't be saved fails the checkpoint and stays as it was
+  EXPECT_TRUE( simulation->inject( "n2", "mailbox", sim::Payload::make<int>( 1 ) ) );
+  EXPECT_TRUE( simulation->runUntil( simulation->simtime() ) );
+  std::stringstream snapshot;
+  EXPECT_FALSE( simulation->checkpoint( snapshot ) );
+  EXPECT_EQ( simulation->instance( "n2" )->pad( "mailbox" )->available(), 1u );
+  std::stringstream garbage{ "CxSimChk but not really" };
+  EXPECT_FALSE( std::make_shared<sim::Simulation>( simulator )->restore( garbage ) );
+
+  simulator.addModel<SamplerModel>();
+  auto waiting = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( waiting->spawnInstance( "SamplerModel", "sampler" ) );
+  ASSERT_TRUE( waiting->step( 2 ) );
+  EXPECT_FALSE( waiting->checkpoint( snapshot ) );
+}
+
+/**
+ * Receives what waits in its "in" pad once told to drain it, in the order it came
+ */
+std::vector<uint64_t> drained;
+
+class DrainModel : public sim::Model {
+public:
+  DrainModel() : Model( "DrainModel" ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, { { "capacity", 4.0 } } } );
+    addActivitySpec( { "drain", sim::ActivitySpec::Type::plain,
+        []( sim::Instance &, sim::Activity &activity, const std::string &, sim::Payload & ) {
+          for ( ;; ) {
+            auto message = activity.padReceive( "in" );
+            if ( !message ) {
+              break;
+            }
+            drained.push_back( message.value->get<Hop>().token );
+          }
+        } } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {
+  }
+};
+
+TEST( Simulation, pad_overflow ) {
+  sim::Simulator simulator;
+  simulator.addModel<DrainModel>();
+  simulator.addPayloadSerializer<Hop>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( simulation->spawnInstance( "DrainModel", "drain" ) );
+  ASSERT_TRUE( simulation->step() );
+  constexpr size_t count = 100;
+  for ( uint64_t token = 0; token < count; ++token ) {
+    ASSERT_TRUE( simulation->inject( "drain", "in", Hop{ token, 0 } ) );
+  }
+  ASSERT_TRUE( simulation->runUntil( simulation->simtime() ) );
+  auto pad = simulation->instance( "drain" )->pad( "in" );
+  EXPECT_EQ( pad->available(), count ); // 4 in the ring, the rest overflowing
+
+  // a checkpoint takes them all out and puts them all back
+  std::stringstream snapshot;
+  ASSERT_TRUE( simulation->checkpoint( snapshot ) );
+  EXPECT_EQ( pad->available(), count );
+
+  drained.clear();
+  ASSERT_TRUE( simulation->spawnActivity( "drain", "drain", "drain", simulation->simtime() ) );
+  ASSERT_TRUE( simulation->runToCompletion() );
+  std::vector<uint64_t> expected( count );
+  std::iota( expected.begin(), expected.end(), 0u );
+  EXPECT_EQ( drained, expected );
+  EXPECT_EQ( pad->available(), 0u );
+}
+
+TEST( Simulation, trace ) {
+  sim::Simulator simulator;
+  simulator.addModel<HopModel>();
+  simulator.addPayloadSerializer<Hop>();
+  auto make = [&simulator]() -> std::shared_ptr<sim::Simulation> {
+    auto loaded = simulator.loadTopology( R"({ "partitions": 2, "instances": [
+        { "name": "n0", "model": "HopModel", "parameters": { "id": 0 } },
+        { "name": "n1", "model": "HopModel", "parameters": { "id": 1 } } ],
+      "links": [ { "from": "n0.out", "to": "n1.in" }, { "from": "n1.out", "to": "n0.in" } ] })" );
+    return loaded ? *loaded.value : nullptr;
+  };
+  auto simulation = make();
+  ASSERT_TRUE( simulation );
+  auto path = testing::TempDir() + "trace.simtrc";
+#ifndef SIM_TRACE
+  EXPECT_FALSE( simulation->startTrace( path ) );
+  EXPECT_FALSE( simulation->replayTrace( path ) );
+#else
+  ASSERT_TRUE( simulation->startTrace( path ) );
+  EXPECT_FALSE( simulation->startTrace( path ) );
+  // stimuli from outside, which a replay has to schedule again
+  ASSERT_TRUE( simulation->inject( "n0", "mailbox", Hop{ 7, 0 } ) );
+  ASSERT_TRUE( simulation->spawnActivity( "kick", "again", "n1", sim::Clock::time_point{ std::chrono::milliseconds( 20 ) } ) );
+  ASSERT_TRUE( simulation->spawnInstance( "HopModel", "n2", { { "id", uintmax_t( 2 ) } } ) );
+  auto ran = simulation->runToCompletion();
+  ASSERT_TRUE( ran );
+  ASSERT_TRUE( simulation->stopTrace() );
+  EXPECT_FALSE( simulation->stopTrace() );
+
+  auto read = sim::readTrace( path );
+  ASSERT_TRUE( read );
+  const auto &trace = *read.value;
+  EXPECT_EQ( trace.header.dropped, 0u );
+  EXPECT_EQ( trace.stimuli.size(), 3u );
+  // each partition handles its events in time order
+  size_t handled = 0;
+  int64_t last[2] = { 0, 0 };
+  for ( auto &record : trace.records ) {
+    ASSERT_LT( record.partition, 2u );
+    if ( record.op == sim::trace::Op::HANDLE ) {
+      ++handled;
+      EXPECT_GE( record.simtime, last[record.partition] );
+      last[record.partition] = record.simtime;
+    }
+  }
+  EXPECT_EQ( handled, *ran.value );
+  std::set<std::string> names( trace.names.begin(), trace.names.end() );
+  EXPECT_TRUE( names.count( "HopModel" ) );
+  EXPECT_TRUE( names.count( "kick" ) );
+  EXPECT_EQ( trace.instance_names.size(), 3u );
+
+  // a simulation set up the same way goes through the same events
+  auto replica = make();
+  ASSERT_TRUE( replica );
+  auto replayed = replica->replayTrace( path );
+  ASSERT_TRUE( replayed ) << replayed.msg;
+  EXPECT_EQ( *replayed.value, *ran.value );
+  EXPECT_EQ( replica->instance( "n0" )->pad( "mailbox" )->available(), 1u );
+
+  // one given a message the original never had parts from it where the message comes in
+  auto diverged = make();
+  ASSERT_TRUE( diverged );
+  ASSERT_TRUE( diverged->inject( "n1", "mailbox", Hop{ 9, 0 } ) );
+  auto failed = diverged->replayTrace( path );
+  EXPECT_FALSE( failed );
+  EXPECT_NE( failed.msg.find( "differs" ), std::string::npos ) << failed.msg;
+  std::remove( path.c_str() );
+#endif
+}
+
+TEST( Simulation, chrome_trace ) {
+  std::vector<RingModel::Log> logs( 4 );
+  sim::Simulator simulator;
+  simulator.addModel( std::make_shared<RingModel>( logs ) );
+  auto loaded = simulator.loadTopology( R"({ "partitions": 2, "instances": [
+      { "name": "n0", "model": "RingModel", "parameters": { "id": 0 } },
+      { "name": "n1", "model": "RingModel", "parameters": { "id": 1 } },
+      { "name": "n2", "model": "RingModel", "parameters": { "id": 2 } },
+      { "name": "n3", "model": "RingModel", "parameters": { "id": 3 } } ],
+    "links": [ { "from": "n0.out", "to": "n1.in" }, { "from": "n1.out", "to": "n2.in" },
+      { "from": "n2.out", "to": "n3.in" }, { "from": "n3.out", "to": "n0.in" } ] })" );
+  ASSERT_TRUE( loaded );
+  auto simulation = *loaded.value;
+  auto read = []( const std::string &path ) {
+    std::ifstream in{ path };
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+  };
+  auto path = testing::TempDir() + "chrome_trace.json";
+  EXPECT_FALSE( simulation->stopChromeTrace() );
+  ASSERT_TRUE( simulation->startChromeTrace( path ) );
+  EXPECT_FALSE( simulation->startChromeTrace( path ) );
+  ASSERT_TRUE( simulation->runFor( std::chrono::milliseconds( 50 ) ) );
+  ASSERT_TRUE( simulation->stopChromeTrace() );
+  EXPECT_FALSE( simulation->stopChromeTrace() );
+
+  auto both = read( path );
+  EXPECT_EQ( both.rfind( R"({"traceEvents":[)", 0 ), 0u );
+  EXPECT_NE( both.find( R"("name":"waitFor","ph":"X")" ), std::string::npos );
+  EXPECT_NE( both.find( R"("name":"padReceive in","ph":"X")" ), std::string::npos );
+  EXPECT_NE( both.find( R"("name":"in","ph":"C")" ), std::string::npos );
+  EXPECT_NE( both.find( R"("args":{"name":"n0"})" ), std::string::npos );
+  EXPECT_NE( both.find( "\"args\":{\"name\":\"n1 (wall clock)\"}" ), std::string::npos );
+  EXPECT_NE( both.find( R"("dropped":0)" ), std::string::npos );
+
+  // the rest of the run, by simulated time only
+  ASSERT_TRUE( simulation->startChromeTrace( path, sim::Simulation::TraceAxis::SIMULATED ) );
+  ASSERT_TRUE( simulation->runToCompletion() );
+  ASSERT_TRUE( simulation->stopChromeTrace() );
+  auto simulated = read( path );
+  EXPECT_NE( simulated.find( R"("args":{"name":"n3"})" ), std::string::npos );
+  EXPECT_EQ( simulated.find( "(wall clock)" ), std::string::npos );
+  std::remove( path.c_str() );
+
+  EXPECT_FALSE( simulation->startChromeTrace( testing::TempDir() + "no/such/dir/chrome_trace.json" ) );
+}
+
+TEST( queuing, pipeline ) {
+  sim::Simulator simulator;
+  simulator.addModel<sim::queuing::SourceModel>();
+  simulator.addModel<sim::queuing::ProcessorModel>();
+  simulator.addModel<sim::queuing::SinkModel>();
+  auto loaded = simulator.loadTopology( R"({ "instances": [
+      { "name": "source", "model": "SourceModel", "parameters": { "duty_cycle": 10.0 } },
+      { "name": "server", "model": "ProcessorModel", "parameters": { "rate": 0.05 } },
+      { "name": "sink", "model": "SinkModel" } ],
+    "links": [ { "from": "source.out", "to": "server.in" }, { "from": "server.out", "to": "sink.in" } ] })" );
+  ASSERT_TRUE( loaded );
+  auto simulation = *loaded.value;
+
+  // a message every 100ms, each served for 50ms
+  ASSERT_TRUE( simulation->runUntil( sim::Clock::time_point{ std::chrono::milliseconds( 1000 ) } ) );
+  auto sink = simulation->collector<sim::Tally>( "sink" );
+  ASSERT_TRUE( sink );
+  EXPECT_EQ( sink->count(), 10u );
+  auto busy = simulation->collector<sim::TimeWeighted>( "server.busy" );
+  ASSERT_TRUE( busy );
+  EXPECT_NEAR( busy->mean( simulation->simtime() ), 0.5, 0.01 );
+}
+
+TEST( queuing, depth ) {
+  sim::Simulator simulator;
+  simulator.addModel<sim::queuing::SourceModel>();
+  simulator.addModel<sim::queuing::QueueModel>();
+  simulator.addModel<sim::queuing::ProcessorModel>();
+  simulator.addModel<sim::queuing::SinkModel>();
+  auto run = [&]( size_t depth, bool linked ) {
+    auto loaded = simulator.loadTopology( R"({ "instances": [
+        { "name": "source", "model": "SourceModel", "parameters": { "duty_cycle": 10.0 } },
+        { "name": "queue", "model": "QueueModel", "parameters": { "depth": )" + std::to_string( depth ) + R"( } },
+        { "name": "server", "model": "ProcessorModel", "parameters": { "rate": 0.15 } },
+        { "name": "sink", "model": "SinkModel" } ],
+      "links": [ { "from": "source.out", "to": "queue.in" }, { "from": "queue.out", "to": "server.in" },
+        { "from": "server.out", "to": "sink.in" } )" + ( linked ? R"(, { "from": "server.ready", "to": "queue.ready" } )" : "" ) + "] }" );
+    EXPECT_TRUE( loaded );
+    std::vector<double> results;
+    if ( loaded ) {
+      auto simulation = *loaded.value;
+      EXPECT_TRUE( simulation->runUntil( sim::Clock::time_point{ std::chrono::seconds( 3 ) } ) );
+      results = { simulation->collector<sim::TimeWeighted>( "queue.length" )->max(),
+          simulation->collector<sim::TimeWeighted>( "server.length" )->max(),
+          double( simulation->collector<sim::Tally>( "sink" )->count() ) };
+    }
+    return results;
+  };
+  // the server falls behind, at most depth messages waiting there and the rest in the queue
+  auto shallow = run( 1, true );
+  ASSERT_EQ( shallow.size(), 3u );
+  EXPECT_EQ( shallow[1], 1.0 );
+  EXPECT_GT( shallow[0], 5.0 );
+  auto deep = run( 3, true );
+  ASSERT_EQ( deep.size(), 3u );
+  EXPECT_EQ( deep[1], 3.0 );
+  EXPECT_EQ( deep[0], shallow[0] - 2.0 );
+  EXPECT_EQ( deep[2], shallow[2] );
+  // unlinked, the queue holds nothing back
+  auto unbounded = run( 1, false );
+  ASSERT_EQ( unbounded.size(), 3u );
+  EXPECT_GT( unbounded[1], 5.0 );
+  EXPECT_EQ( unbounded[2], shallow[2] );
+}
+
+TEST( queuing, checkpoint ) {
+  sim::Simulator simulator;
+  simulator.addModel<sim::queuing::SourceModel>();
+  simulator.addModel<sim::queuing::ProcessorModel>();
+  simulator.addModel<sim::queuing::SinkModel>();
+  sim::queuing::addPayloadSerializers( simulator );
+  auto loaded = simulator.loadTopology( R"({ "instances": [
+      { "name": "source", "model": "SourceModel", "parameters": { "duty_cycle": 10.0 } },
+      { "name": "server", "model": "ProcessorModel", "parameters": { "rate": 0.05 } },
+      { "name": "sink", "model": "SinkModel" } ],
+    "links": [ { "from": "source.out", "to": "server.in" }, { "from": "server.out", "to": "sink.in" } ] })" );
+  ASSERT_TRUE( loaded );
+  auto simulation = *loaded.value;
+
+  // nothing waits before the run, the spawns are saved pending
+  std::stringstream before;
+  ASSERT_TRUE( simulation->checkpoint( before ) );
+  auto restored = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( restored->restore( before ) );
+  sim::Clock::time_point until{ std::chrono::milliseconds( 1000 ) };
+  ASSERT_TRUE( simulation->runUntil( until ) );
+  ASSERT_TRUE( restored->runUntil( until ) );
+  EXPECT_EQ( restored->collector<sim::Tally>( "sink" )->count(), simulation->collector<sim::Tally>( "sink" )->count() );
+
+  std::stringstream during;
+#ifdef SIM_COROUTINES
+  // the coroutine bodies of every model then wait, suspended where a checkpoint can't reach them
+  auto refused = simulation->checkpoint( during );
+  EXPECT_FALSE( refused );
+  EXPECT_NE( refused.msg.find( "is waiting" ), std::string::npos ) << refused.msg;
+  EXPECT_FALSE( simulation->fork() );
+#else
+  // the models keep their state in their instances, where a checkpoint reaches it
+  EXPECT_TRUE( simulation->checkpoint( during ) );
+#endif // SIM_COROUTINES
+  ASSERT_TRUE( simulation->runUntil( until + std::chrono::milliseconds( 1000 ) ) );
+  EXPECT_EQ( simulation->collector<sim::Tally>( "sink" )->count(), 20u );
+}
+
+#ifndef SIM_COROUTINES
+TEST( queuing, fork ) {
+  sim::Simulator simulator;
+  simulator.addModel<sim::queuing::SourceModel>();
+  simulator.addModel<sim::queuing::QueueModel>();
+  simulator.addModel<sim::queuing::ProcessorModel>();
+  simulator.addModel<sim::queuing::SinkModel>();
+  sim::queuing::addPayloadSerializers( simulator );
+  auto loaded = simulator.loadTopology( R"({ "instances": [
+      { "name": "source", "model": "SourceModel", "parameters": { "duty_cycle": 10.0 } },
+      { "name": "queue", "model": "QueueModel" },
+      { "name": "server", "model": "ProcessorModel", "parameters": { "rate": 0.15 } },
+      { "name": "sink", "model": "SinkModel" } ],
+    "links": [ { "from": "source.out", "to": "queue.in" }, { "from": "queue.out", "to": "server.in" },
+      { "from": "server.out", "to": "sink.in" }, { "from": "server.ready", "to": "queue.ready" } ] })" );
+  ASSERT_TRUE( loaded );
+  auto simulation = *loaded.value;
+
+  // mid-run, messages wait in the queue, one is in service and the next arrival is due
+  ASSERT_TRUE( simulation->runUntil( sim::Clock::time_point{ std::chrono::milliseconds( 1550 ) } ) );
+  ASSERT_GT( simulation->collector<sim::TimeWeighted>( "queue.length" )->level(), 1.0 );
+  ASSERT_EQ( simulation->collector<sim::TimeWeighted>( "server.busy" )->level(), 1.0 );
+  auto served = simulation->collector<sim::Tally>( "sink" )->count();
+  std::stringstream saved;
+  ASSERT_TRUE( simulation->checkpoint( saved ) );
+  auto restored = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( restored->restore( saved ) );
+  auto forked = simulation->fork();
+  ASSERT_TRUE( forked ) << forked.msg;
+
+  sim::Clock::time_point until{ std::chrono::seconds( 3 ) };
+  ASSERT_TRUE( simulation->runUntil( until ) );
+  for ( const auto &copy : { restored, *forked.value } ) {
+    ASSERT_TRUE( copy->runUntil( until ) );
+    // collectors aren't checkpointed, the copies measure from the checkpoint on
+    EXPECT_EQ( copy->collector<sim::Tally>( "sink" )->count(),
+        simulation->collector<sim::Tally>( "sink" )->count() - served );
+    EXPECT_EQ( copy->collector<sim::Histogram>( "sink.time" )->max(),
+        simulation->collector<sim::Histogram>( "sink.time" )->max() );
+    EXPECT_EQ( copy->collector<sim::TimeWeighted>( "queue.length" )->level(),
+        simulation->collector<sim::TimeWeighted>( "queue.length" )->level() );
+    EXPECT_EQ( copy->collector<sim::TimeWeighted>( "queue.length" )->max(),
+        simulation->collector<sim::TimeWeighted>( "queue.length" )->max() );
+    EXPECT_EQ( copy->collector<sim::TimeWeighted>( "server.busy" )->mean( until ),
+        simulation->collector<sim::TimeWeighted>( "server.busy" )->mean( until ) );
+  }
+}
+
+TEST( queuing, optimistic ) {
+  sim::Simulator simulator;
+  simulator.addModel<sim::queuing::SourceModel>();
+  simulator.addModel<sim::queuing::QueueModel>();
+  simulator.addModel<sim::queuing::ProcessorModel>();
+  simulator.addModel<sim::queuing::SinkModel>();
+  // two lines served slower than they arrive, their hops taking no time across partitions
+  std::string lines = R"( "instances": [
+      { "name": "source0", "model": "SourceModel", "parameters": { "duty_cycle": 10.0 } },
+      { "name": "queue0", "model": "QueueModel" },
+      { "name": "server0", "model": "ProcessorModel", "parameters": { "rate": 0.15 } },
+      { "name": "sink0", "model": "SinkModel" },
+      { "name": "source1", "model": "SourceModel", "parameters": { "duty_cycle": 8.0 } },
+      { "name": "queue1", "model": "QueueModel" },
+      { "name": "server1", "model": "ProcessorModel", "parameters": { "rate": 0.13 } },
+      { "name": "sink1", "model": "SinkModel" } ],
+    "links": [
+      { "from": "source0.out", "to": "queue0.in" }, { "from": "queue0.out", "to": "server0.in" },
+      { "from": "server0.out", "to": "sink0.in" }, { "from": "source1.out", "to": "queue1.in" },
+      { "from": "queue1.out", "to": "server1.in" }, { "from": "server1.out", "to": "sink1.in" },
+      { "from": "server0.ready", "to": "queue0.ready" }, { "from": "server1.ready", "to": "queue1.ready" } ] })";
+  sim::Clock::time_point until{ std::chrono::seconds( 3 ) };
+  auto run = [&]( size_t partitions, sim::Simulation::Synchronization synchronization ) {
+    auto loaded = simulator.loadTopology( R"({ "partitions": )" + std::to_string( partitions ) + "," + lines );
+    EXPECT_TRUE( loaded );
+    std::vector<double> results;
+    if ( !loaded ) {
+      return results;
+    }
+    auto simulation = *loaded.value;
+    EXPECT_TRUE( simulation->setSynchronization( synchronization ) );
+    auto ran = simulation->runParallel( until );
+    EXPECT_TRUE( ran ) << ran.msg;
+    for ( auto line : { "0", "1" } ) {
+      auto sink = simulation->collector<sim::Tally>( std::string( "sink" ) + line );
+      auto times = simulation->collector<sim::Histogram>( std::string( "sink" ) + line + ".time" );
+      auto queued = simulation->collector<sim::TimeWeighted>( std::string( "queue" ) + line + ".length" );
+      auto length = simulation->collector<sim::TimeWeighted>( std::string( "server" ) + line + ".length" );
+      auto busy = simulation->collector<sim::TimeWeighted>( std::string( "server" ) + line + ".busy" );
+      results.insert( results.end(), { double( sink->count() ), times->mean(), times->max(), queued->mean( until ),
+                                         length->mean( until ), busy->mean( until ) } );
+    }
+    return results;
+  };
+  auto sequential = run( 1, sim::Simulation::Synchronization::CONSERVATIVE );
+  ASSERT_EQ( sequential.size(), 12u );
+  EXPECT_NEAR( sequential[0], 20.0, 1.0 ); // of 30 arrivals every 100ms, each served for 150ms
+  EXPECT_GT( sequential[3], 1.0 );         // so messages wait in the queue
+  EXPECT_EQ( run( 3, sim::Simulation::Synchronization::OPTIMISTIC ), sequential );
+  EXPECT_EQ( run( 4, sim::Simulation::Synchronization::OPTIMISTIC ), sequential );
+}
+#endif // SIM_COROUTINES
+
+#ifdef SIM_COROUTINES
+namespace {
+
+bool await_unwound = false; // set as a suspended hold body is destroyed
+
+sim::Task tickBody( sim::Instance &instance, sim::AsyncActivity activity, std::string, sim::Payload ) {
+  auto ticks = instance.owner()->collector<sim::Tally>( "ticks" );
+  for ( int tick = 0; tick < 3; ++tick ) {
+    co_await activity.waitFor( std::chrono::milliseconds( 1 ) );
+    ticks->add( double( tick ) );
+  }
+}
+
+sim::Task receiveBody( sim::Instance &instance, sim::AsyncActivity activity, std::string, sim::Payload ) {
+  auto *simulation = instance.owner().get();
+  auto message = co_await activity.padReceive( "in" );
+  if ( message ) {
+    simulation->collector<sim::Tally>( "received" )->add( double( message.value->take<int>() ) );
+  }
+  auto late = co_await activity.padReceive( "in", std::chrono::milliseconds( 5 ) );
+  if ( !late ) {
+    simulation->collector<sim::Tally>( "timeouts" )->add( 1.0 );
+  }
+}
+
+sim::Task holdBody( sim::Instance &, sim::AsyncActivity activity, std::string, sim::Payload ) {
+  struct Unwound {
+    ~Unwound() {
+      await_unwound = true;
+    }
+  } unwound;
+  co_await activity.padReceive( "in" );
+}
+
+sim::Task throwBody( sim::Instance &, sim::AsyncActivity activity, std::string, sim::Payload ) {
+  co_await activity.waitFor( std::chrono::milliseconds( 1 ) );
+  throw std::runtime_error( "body failed" );
+}
+
+}  // namespace
+
+/**
+ * Coroutine bodies awaiting each kind of wait, spawned by name
+ */
+class AwaitModel : public sim::Model {
+public:
+  AwaitModel() : Model( "AwaitModel" ) {
+    addPadSpec( { "in", { sim::PadSpec::Flag::CAN_INPUT }, {} } );
+    addActivitySpec( { "tick", sim::ActivitySpec::Type::plain, sim::coroutine( &tickBody ) } );
+    addActivitySpec( { "receive", sim::ActivitySpec::Type::plain, sim::coroutine( &receiveBody ) } );
+    addActivitySpec( { "hold", sim::ActivitySpec::Type::plain, sim::coroutine( &holdBody ) } );
+    addActivitySpec( { "throw", sim::ActivitySpec::Type::plain, sim::coroutine( &throwBody ) } );
+  }
+
+  void startActivity( std::shared_ptr<sim::Instance>, std::shared_ptr<sim::Activity> ) override {}
+};
+
+TEST( coroutine, waits ) {
+  sim::Simulator simulator;
+  simulator.addModel<AwaitModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( simulation->spawnInstance( "AwaitModel", "await" ) );
+  ASSERT_TRUE( simulation->step() );
+  auto start = simulation->simtime();
+  ASSERT_TRUE( simulation->spawnActivity( "tick", "tick", "await", start ) );
+  ASSERT_TRUE( simulation->spawnActivity( "receive", "receive", "await", start ) );
+  ASSERT_TRUE( simulation->runFor( std::chrono::milliseconds( 2 ) ) );
+  auto ticks = simulation->collector<sim::Tally>( "ticks" );
+  EXPECT_EQ( ticks->count(), 2u );
+  EXPECT_EQ( simulation->collector<sim::Tally>( "received" )->count(), 0u );
+
+  // the receive goes on where it awaited, then times out waiting for another
+  ASSERT_TRUE( simulation->inject( "await", "in", sim::Payload::make<int>( 7 ) ) );
+  ASSERT_TRUE( simulation->runToCompletion() );
+  EXPECT_EQ( ticks->count(), 3u );
+  auto received = simulation->collector<sim::Tally>( "received" );
+  EXPECT_EQ( received->count(), 1u );
+  EXPECT_DOUBLE_EQ( received->mean(), 7.0 );
+  EXPECT_EQ( simulation->collector<sim::Tally>( "timeouts" )->count(), 1u );
+  EXPECT_EQ( simulation->simtime(), start + std::chrono::milliseconds( 7 ) );
+
+  // once the name is known, another body's frame goes back to the pool as it ends
+  ASSERT_TRUE( simulation->spawnActivity( "tick", "again", "await", simulation->simtime() ) );
+  ASSERT_TRUE( simulation->runToCompletion() );
+  auto idle = simulation->allocatorStats();
+  ASSERT_TRUE( simulation->spawnActivity( "tick", "again", "await", simulation->simtime() ) );
+  ASSERT_TRUE( simulation->runToCompletion() );
+  auto done = simulation->allocatorStats();
+  EXPECT_EQ( ticks->count(), 9u );
+  EXPECT_GT( done.deallocations, idle.deallocations );
+  EXPECT_EQ( done.bytes_in_use, idle.bytes_in_use );
+}
+
+TEST( coroutine, cancel_and_throw ) {
+  sim::Simulator simulator;
+  simulator.addModel<AwaitModel>();
+  auto simulation = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( simulation->spawnInstance( "AwaitModel", "await" ) );
+  ASSERT_TRUE( simulation->step() );
+  await_unwound = false;
+  ASSERT_TRUE( simulation->spawnActivity( "hold", "hold", "await", simulation->simtime() ) );
+  ASSERT_TRUE( simulation->runToCompletion() );
+  EXPECT_FALSE( await_unwound );
+  // destroying the simulation destroys the suspended body, locals and all
+  simulation.reset();
+  EXPECT_TRUE( await_unwound );
 
-  simulation->setState( sim::Simulation::State::RUN );
+  simulation = std::make_shared<sim::Simulation>( simulator );
+  ASSERT_TRUE( simulation->spawnInstance( "AwaitModel", "await" ) );
+  ASSERT_TRUE( simulation->step() );
+  ASSERT_TRUE( simulation->spawnActivity( "throw", "throw", "await", simulation->simtime() ) );
+  EXPECT_THROW( simulation->runToCompletion(), std::runtime_error );
 }
+#endif // SIM_COROUTINES
+#endif // ACPP_LESSON > 4
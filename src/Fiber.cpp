@@ -0,0 +1,345 @@
+// Fiber.cpp : stack pool and context switching for activity fibers
+//
+
+#include "Fiber.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <sys/mman.h>
+#include <unistd.h>
+#define SIM_FIBER_MMAP 1
+#endif
+
+#if !( defined( __x86_64__ ) || defined( __aarch64__ ) )
+#include <ucontext.h>
+#endif
+
+namespace sim {
+
+namespace {
+
+thread_local Fiber *t_current = nullptr;
+
+size_t pageSize() {
+#ifdef SIM_FIBER_MMAP
+  static const size_t page = static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+  return page;
+#else
+  return 4096;
+#endif
+}
+
+}  // namespace
+
+/*
+ * sim_fiber_switch( from_sp, to_sp ) pushes the callee-saved registers, stores the
+ * stack pointer in *from_sp, loads to_sp and pops the registers saved there. A new
+ * fiber's stack is seeded so that the first switch into it "returns" into
+ * sim_fiber_trampoline, which calls entry( arg ) from the seeded registers.
+ */
+#if defined( __x86_64__ ) || defined( __aarch64__ )
+
+#if defined( __APPLE__ )
+#define SIM_ASM_SYMBOL( name ) "_" #name
+#define SIM_ASM_TYPE( name )
+#else
+#define SIM_ASM_SYMBOL( name ) #name
+#define SIM_ASM_TYPE( name ) ".type " #name ", @function\n"
+#endif
+
+extern "C" void sim_fiber_switch( void **from_sp, void *to_sp );
+extern "C" void sim_fiber_trampoline();
+
+#if defined( __x86_64__ )
+asm( ".text\n"
+     ".globl " SIM_ASM_SYMBOL( sim_fiber_switch ) "\n"
+     SIM_ASM_TYPE( sim_fiber_switch )
+     ".p2align 4\n"
+     SIM_ASM_SYMBOL( sim_fiber_switch ) ":\n"
+     "  pushq %rbp\n"
+     "  pushq %rbx\n"
+     "  pushq %r12\n"
+     "  pushq %r13\n"
+     "  pushq %r14\n"
+     "  pushq %r15\n"
+     "  subq $8, %rsp\n"
+     "  stmxcsr (%rsp)\n"
+     "  fnstcw 4(%rsp)\n"
+     "  movq %rsp, (%rdi)\n"
+     "  movq %rsi, %rsp\n"
+     "  ldmxcsr (%rsp)\n"
+     "  fldcw 4(%rsp)\n"
+     "  addq $8, %rsp\n"
+     "  popq %r15\n"
+     "  popq %r14\n"
+     "  popq %r13\n"
+     "  popq %r12\n"
+     "  popq %rbx\n"
+     "  popq %rbp\n"
+     "  ret\n"
+     ".globl " SIM_ASM_SYMBOL( sim_fiber_trampoline ) "\n"
+     SIM_ASM_TYPE( sim_fiber_trampoline )
+     ".p2align 4\n"
+     SIM_ASM_SYMBOL( sim_fiber_trampoline ) ":\n"
+     "  movq %r12, %rdi\n"
+     "  callq *%r13\n"
+     "  ud2\n" );
+
+namespace {
+
+void *seedStack( void *base, size_t size, Fiber::Entry entry, void *arg ) {
+  void *top = static_cast<char *>( base ) + size;
+  // from the saved sp up: csr, r15, r14, r13, r12, rbx, rbp, return address
+  auto *sp = reinterpret_cast<uint64_t *>( reinterpret_cast<uintptr_t>( top ) & ~uintptr_t( 15 ) ) - 10;
+  sp[0] = 0x1F80 | ( uint64_t( 0x037F ) << 32 ); // default mxcsr and x87 control word
+  sp[1] = 0;
+  sp[2] = 0;
+  sp[3] = reinterpret_cast<uint64_t>( entry );
+  sp[4] = reinterpret_cast<uint64_t>( arg );
+  sp[5] = 0;
+  sp[6] = 0;
+  sp[7] = reinterpret_cast<uint64_t>( &sim_fiber_trampoline ); // leaves rsp 16-aligned for the call
+  return sp;
+}
+
+}  // namespace
+
+#else // __aarch64__
+asm( ".text\n"
+     ".globl " SIM_ASM_SYMBOL( sim_fiber_switch ) "\n"
+     SIM_ASM_TYPE( sim_fiber_switch )
+     ".p2align 4\n"
+     SIM_ASM_SYMBOL( sim_fiber_switch ) ":\n"
+     "  sub sp, sp, #160\n"
+     "  stp x19, x20, [sp, #0]\n"
+     "  stp x21, x22, [sp, #16]\n"
+     "  stp x23, x24, [sp, #32]\n"
+     "  stp x25, x26, [sp, #48]\n"
+     "  stp x27, x28, [sp, #64]\n"
+     "  stp x29, x30, [sp, #80]\n"
+     "  stp d8, d9, [sp, #96]\n"
+     "  stp d10, d11, [sp, #112]\n"
+     "  stp d12, d13, [sp, #128]\n"
+     "  stp d14, d15, [sp, #144]\n"
+     "  mov x2, sp\n"
+     "  str x2, [x0]\n"
+     "  mov sp, x1\n"
+     "  ldp x19, x20, [sp, #0]\n"
+     "  ldp x21, x22, [sp, #16]\n"
+     "  ldp x23, x24, [sp, #32]\n"
+     "  ldp x25, x26, [sp, #48]\n"
+     "  ldp x27, x28, [sp, #64]\n"
+     "  ldp x29, x30, [sp, #80]\n"
+     "  ldp d8, d9, [sp, #96]\n"
+     "  ldp d10, d11, [sp, #112]\n"
+     "  ldp d12, d13, [sp, #128]\n"
+     "  ldp d14, d15, [sp, #144]\n"
+     "  add sp, sp, #160\n"
+     "  ret\n"
+     ".globl " SIM_ASM_SYMBOL( sim_fiber_trampoline ) "\n"
+     SIM_ASM_TYPE( sim_fiber_trampoline )
+     ".p2align 4\n"
+     SIM_ASM_SYMBOL( sim_fiber_trampoline ) ":\n"
+     "  mov x0, x19\n"
+     "  blr x20\n"
+     "  brk #0\n" );
+
+namespace {
+
+void *seedStack( void *base, size_t size, Fiber::Entry entry, void *arg ) {
+  void *top = static_cast<char *>( base ) + size;
+  // from the saved sp up: x19..x28, x29, x30, d8..d15
+  auto *sp = reinterpret_cast<uint64_t *>( reinterpret_cast<uintptr_t>( top ) & ~uintptr_t( 15 ) ) - 20;
+  for ( int reg = 0; reg < 20; ++reg ) {
+    sp[reg] = 0;
+  }
+  sp[0] = reinterpret_cast<uint64_t>( arg );
+  sp[1] = reinterpret_cast<uint64_t>( entry );
+  sp[11] = reinterpret_cast<uint64_t>( &sim_fiber_trampoline );
+  return sp;
+}
+
+}  // namespace
+#endif // __aarch64__
+
+#else // other architectures fall back to ucontext, which is slower but portable
+
+namespace {
+
+/*
+ * What a new fiber runs, kept at the top of its own stack above its context so that
+ * seeding another fiber before this one first runs can't overwrite it
+ */
+struct StartRecord {
+  Fiber::Entry entry;
+  void *arg;
+};
+
+// makecontext passes int arguments only, so the record's address comes in two halves
+void startContext( unsigned high, unsigned low ) {
+  auto *record = reinterpret_cast<StartRecord *>( ( uintptr_t( high ) << 16 << 16 ) | uintptr_t( low ) );
+  record->entry( record->arg );
+}
+
+void *seedStack( void *base, size_t size, Fiber::Entry entry, void *arg ) {
+  // the record, then the context of a new fiber, sit at the top of its own stack
+  auto top = reinterpret_cast<uintptr_t>( base ) + size;
+  auto *record = reinterpret_cast<StartRecord *>( ( top - sizeof( StartRecord ) ) & ~uintptr_t( 15 ) );
+  ::new ( record ) StartRecord{ entry, arg };
+  auto *context = reinterpret_cast<ucontext_t *>(
+      ( reinterpret_cast<uintptr_t>( record ) - sizeof( ucontext_t ) ) & ~uintptr_t( 15 ) );
+  getcontext( context );
+  context->uc_stack.ss_sp = base;
+  context->uc_stack.ss_size = reinterpret_cast<char *>( context ) - static_cast<char *>( base );
+  context->uc_link = nullptr;
+  auto address = reinterpret_cast<uintptr_t>( record );
+  makecontext( context, reinterpret_cast<void ( * )()>( &startContext ), 2,
+      unsigned( address >> 16 >> 16 ), unsigned( address & 0xFFFFFFFFu ) );
+  return context;
+}
+
+}  // namespace
+
+extern "C" void sim_fiber_switch( void **from_sp, void *to_sp ) {
+  ucontext_t here;
+  *from_sp = &here;
+  swapcontext( &here, static_cast<ucontext_t *>( to_sp ) );
+}
+
+#endif
+
+StackPool::StackPool( size_t stack_size ) {
+  auto page = pageSize();
+  m_stack_size = ( stack_size + page - 1 ) / page * page;
+  if ( m_stack_size < 4 * page ) {
+    m_stack_size = 4 * page;
+  }
+}
+
+StackPool::~StackPool() noexcept {
+  for ( auto &stack : m_free ) {
+#ifdef SIM_FIBER_MMAP
+    munmap( static_cast<char *>( stack.base ) - pageSize(), stack.size + pageSize() );
+#else
+    ::operator delete( stack.base );
+#endif
+  }
+}
+
+StackPool::Stack StackPool::acquire() {
+  Stack stack;
+  if ( !m_free.empty() ) {
+    stack = m_free.back();
+    m_free.pop_back();
+    ++m_outstanding;
+    return stack;
+  }
+#ifdef SIM_FIBER_MMAP
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  auto page = pageSize();
+  void *memory = mmap( nullptr, m_stack_size + page, PROT_READ | PROT_WRITE, flags, -1, 0 );
+  if ( memory == MAP_FAILED ) {
+    return {};
+  }
+  mprotect( memory, page, PROT_NONE ); // guard page, stacks grow down into it
+  stack.base = static_cast<char *>( memory ) + page;
+#else
+  stack.base = ::operator new( m_stack_size, std::nothrow );
+  if ( !stack.base ) {
+    return {};
+  }
+#endif
+  stack.size = m_stack_size;
+  ++m_outstanding;
+  return stack;
+}
+
+void StackPool::release( Stack stack ) noexcept {
+  if ( !stack.base ) {
+    return;
+  }
+  --m_outstanding;
+  m_free.push_back( stack );
+}
+
+Fiber::~Fiber() noexcept {
+  // a suspended fiber is abandoned without unwinding its stack
+  if ( m_pool ) {
+    m_pool->release( m_stack );
+  }
+}
+
+bool Fiber::start( StackPool &pool, Entry entry, void *arg ) {
+  if ( active() ) {
+    return false;
+  }
+  m_stack = pool.acquire();
+  if ( !m_stack.base ) {
+    return false;
+  }
+  m_pool = &pool;
+  m_entry = entry;
+  m_arg = arg;
+  m_finished = false;
+  m_exception = nullptr;
+  m_sp = seedStack( m_stack.base, m_stack.size, &Fiber::main, this );
+  return true;
+}
+
+bool Fiber::resume() {
+  if ( !active() ) {
+    return false;
+  }
+  m_caller = t_current;
+  t_current = this;
+  sim_fiber_switch( &m_caller_sp, m_sp );
+  t_current = m_caller;
+  if ( !m_finished ) {
+    return true;
+  }
+  finish();
+  if ( m_exception ) {
+    std::rethrow_exception( std::exchange( m_exception, nullptr ) );
+  }
+  return false;
+}
+
+bool Fiber::yield() {
+  auto *self = t_current;
+  if ( !self ) {
+    return false;
+  }
+  sim_fiber_switch( &self->m_sp, self->m_caller_sp );
+  return true;
+}
+
+Fiber *Fiber::current() noexcept {
+  return t_current;
+}
+
+void Fiber::main( void *self ) {
+  auto *fiber = static_cast<Fiber *>( self );
+  try {
+    fiber->m_entry( fiber->m_arg );
+  } catch ( ... ) {
+    fiber->m_exception = std::current_exception();
+  }
+  fiber->m_finished = true;
+  sim_fiber_switch( &fiber->m_sp, fiber->m_caller_sp );
+  std::abort(); // a finished fiber is never resumed
+}
+
+void Fiber::finish() noexcept {
+  m_pool->release( m_stack );
+  m_stack = {};
+  m_pool = nullptr;
+}
+
+}  // namespace sim
@@ -0,0 +1,120 @@
+/**
+ * Fiber.h
+ * Stackful user-space fibers that activities run on
+ */
+
+#ifndef SIM_FIBER_H_INCLUDED
+#define SIM_FIBER_H_INCLUDED
+
+#include <cstddef>
+#include <exception>
+#include <vector>
+
+#ifndef SIM_FIBER_STACK_SIZE
+#define SIM_FIBER_STACK_SIZE ( 64 * 1024 )
+#endif
+
+namespace sim {
+
+/**
+ * @brief Recycles fixed-size fiber stacks
+ * Stacks are mapped with a guard page below them where the platform allows, and are
+ * only committed as they are touched, so a pool can back hundreds of thousands of
+ * mostly idle fibers. Not thread safe; a simulation owns one and uses it from its loop.
+ */
+class StackPool {
+public:
+  struct Stack {
+    void *base = nullptr; // lowest usable address
+    size_t size = 0;
+  };
+
+  explicit StackPool( size_t stack_size = SIM_FIBER_STACK_SIZE );
+  ~StackPool() noexcept;
+  StackPool( const StackPool & ) = delete;
+  StackPool &operator=( const StackPool & ) = delete;
+
+  /**
+   * @brief Take a stack from the pool, mapping a new one if none is free
+   * @return Stack the stack or an empty Stack if mapping failed
+   */
+  Stack acquire();
+  void release( Stack stack ) noexcept;
+  size_t stackSize() const noexcept {
+    return m_stack_size;
+  }
+  /**
+   * @brief Count the stacks currently held by fibers
+   */
+  size_t outstanding() const noexcept {
+    return m_outstanding;
+  }
+
+private:
+  size_t m_stack_size;
+  size_t m_outstanding = 0;
+  std::vector<Stack> m_free;
+};
+
+/**
+ * @brief A function running on its own stack that can suspend itself
+ * resume() switches from the caller into the fiber until the fiber calls yield() or
+ * its function returns; either way control comes back to the resume() call. A
+ * switch saves and restores only callee-saved registers, no kernel involved.
+ */
+class Fiber {
+public:
+  using Entry = void ( * )( void *arg );
+
+  Fiber() noexcept = default;
+  ~Fiber() noexcept;
+  Fiber( const Fiber & ) = delete;
+  Fiber &operator=( const Fiber & ) = delete;
+
+  /**
+   * @brief Prepare the fiber to run entry( arg ) on a stack from pool
+   * @return false if the fiber is still running or no stack could be had
+   */
+  bool start( StackPool &pool, Entry entry, void *arg );
+  /**
+   * @brief Run the fiber until it yields or finishes
+   * An exception escaping the fiber's function is rethrown here once it finished.
+   * @return true if the fiber is still suspended afterward, false once it finished
+   */
+  bool resume();
+  /**
+   * @brief Suspend the current fiber, returning to whoever resumed it
+   * @return false if not called on a fiber
+   */
+  static bool yield();
+  /**
+   * @brief Get the fiber running on this thread
+   * @return Fiber* the fiber or nullptr outside of any fiber
+   */
+  static Fiber *current() noexcept;
+
+  /**
+   * @brief Whether the fiber was started and has not finished
+   */
+  bool active() const noexcept {
+    return m_stack.base != nullptr;
+  }
+
+private:
+  static void main( void *self );
+  void finish() noexcept;
+
+  StackPool *m_pool = nullptr;
+  StackPool::Stack m_stack;
+  Entry m_entry = nullptr;
+  void *m_arg = nullptr;
+  void *m_sp = nullptr;        // saved stack pointer of the suspended fiber
+  void *m_caller_sp = nullptr; // saved stack pointer of the resumer while the fiber runs
+  Fiber *m_caller = nullptr;   // fiber that resumed this one, if any
+  std::exception_ptr m_exception;
+  bool m_finished = false;
+};
+
+}  // namespace sim
+
+#endif  // SIM_FIBER_H_INCLUDED
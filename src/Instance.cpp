@@ -5,17 +5,23 @@
 #include <CxxSimulator/Model.h>
 #include "Simulation_p.h"
 #include "Instance_p.h"
+#include "Fiber.h"
+#include "RingBuffer.h"
+#include "ChromeTrace.h"
 
 #include <map>
 #include <string>
 #include <memory>
 #include <queue>
+#include <deque>
 #include <shared_mutex>
 #include <random>
+#include <memory_resource>
+#include <variant>
 
 namespace sim {
 
-struct Instance::Impl {
+struct Instance::Impl : ArenaObject {
   Impl(
       Instance &instance,
       std::shared_ptr<Simulation> simulation,
@@ -30,13 +36,13 @@ struct Instance::Impl {
     if ( m_name.empty() ) {
       throw "name not supplied";
     }
-    if( !m_simulation ) {
+    if( !simulation ) {
       throw "simulation not supplied";
     }
     if( !m_model ) {
       throw "model not supplied";
     }
-    makeStartActivity();
+    m_id = Simulation::Private::instanceId( simulation, m_name );
   }
   
   ~Impl() = default;
@@ -44,16 +50,25 @@ struct Instance::Impl {
   Impl &operator=( Impl &&other ) noexcept = default;
 
   void makeStartActivity(); // can throw on error because making invariant
+#if ACPP_LESSON > 3
+  void makePads();
+#endif // ACPP_LESSON > 3
   acpp::void_result<> spawnActivity( const std::string spec_name, const std::string &name, Clock::duration delay );
+  std::shared_ptr<Simulation> simulation() const {
+    return m_simulation.lock();
+  }
 
   Instance &m_instance; // Instance owns Instance::Impl
-  std::shared_ptr<Simulation> m_simulation;
+  std::weak_ptr<Simulation> m_simulation; // which owns the instance
   std::shared_ptr<Model> m_model;
   std::string m_name;
+  SymbolId m_id = no_symbol;
+  uint32_t m_partition = 0;
+  uint64_t m_event_seq = 0; // events this instance scheduled, only touched from its partition
   PropertyList m_parameters;
-  std::unordered_map<std::string, std::shared_ptr<Activity>> m_activities;
+  std::vector<std::shared_ptr<Activity>> m_activities; // by activity name id
 #if ACPP_LESSON > 3
-  std::unordered_map<std::string, std::shared_ptr<Pad>> m_pads;
+  std::vector<std::shared_ptr<Pad>> m_pads; // by pad name id
 #endif // ACPP_LESSON > 3
 };
 
@@ -66,7 +81,7 @@ Instance::Instance(
     std::shared_ptr<Model> model,
     const std::string &name,
     const PropertyList &parameters ) :
-    impl( new Impl{ *this, sim, model, name, parameters } ) {
+    impl( new ( Simulation::Private::resource( sim ) ) Impl{ *this, sim, model, name, parameters } ) {
 }
 
 std::string Instance::name() const {
@@ -74,20 +89,60 @@ std::string Instance::name() const {
 }
 
 std::shared_ptr<Simulation> Instance::owner() const {
-  return impl->m_simulation;
+  return impl->simulation();
 }
 
 std::shared_ptr<Model> Instance::model() const {
   return impl->m_model;
 }
 
+SymbolId Instance::Private::id( const Instance &instance ) {
+  return instance.impl->m_id;
+}
+
+std::shared_ptr<Activity> Instance::Private::activity( const Instance &instance, SymbolId name ) {
+  return symbol_get( instance.impl->m_activities, name );
+}
+
+void Instance::Private::initialize( Instance &instance, uint32_t partition ) {
+  instance.impl->m_partition = partition;
+#if ACPP_LESSON > 3
+  instance.impl->makePads();
+#endif // ACPP_LESSON > 3
+  instance.impl->makeStartActivity();
+}
+
+uint32_t Instance::Private::partition( const Instance &instance ) {
+  return instance.impl->m_partition;
+}
+
+const PropertyList &Instance::Private::parameters( const Instance &instance ) {
+  return instance.impl->m_parameters;
+}
+
+uint64_t Instance::Private::nextSeq( Instance &instance ) {
+  return ++instance.impl->m_event_seq;
+}
+
+uint64_t Instance::Private::eventCount( const Instance &instance ) {
+  return instance.impl->m_event_seq;
+}
+
+void Instance::Private::setEventCount( Instance &instance, uint64_t count ) {
+  instance.impl->m_event_seq = count;
+}
+
 #if ACPP_LESSON > 3
 std::shared_ptr<Pad> Instance::pad( const std::string &name ) const {
-  auto iter = impl->m_pads.find( name );
-  if ( iter == impl->m_pads.end() ) {
-    return {};
-  }
-  return iter->second;
+  return Private::pad( *this, Simulation::Private::symbol( impl->simulation(), name ) );
+}
+
+std::shared_ptr<Pad> Instance::Private::pad( const Instance &instance, SymbolId name ) {
+  return symbol_get( instance.impl->m_pads, name );
+}
+
+const std::vector<std::shared_ptr<Pad>> &Instance::Private::pads( const Instance &instance ) {
+  return instance.impl->m_pads;
 }
 #endif // ACPP_LESSON > 3
 
@@ -101,30 +156,50 @@ acpp::unstructured_value Instance::parameter( const std::string &name ) const {
 
 std::vector<std::shared_ptr<Activity>> Instance::activities() const {
   std::vector<std::shared_ptr<Activity>> activities;
-  for ( const auto &activityent : impl->m_activities ) {
-    activities.push_back( activityent.second );
+  for ( const auto &activity : impl->m_activities ) {
+    if ( activity ) {
+      activities.push_back( activity );
+    }
   }
   return activities;
 }
 
 std::shared_ptr<Activity> Instance::activity( const std::string &name ) const {
-  auto iter = impl->m_activities.find( name );
-  if ( iter == impl->m_activities.end() ) {
-    return {};
-  }
-  return iter->second;
+  return Private::activity( *this, Simulation::Private::symbol( impl->simulation(), name ) );
 }
 
 void Instance::Impl::makeStartActivity() {
-  ActivitySpec spec( "start", ActivitySpec::Type::plain );
-  auto activity = std::make_shared<Activity>( m_instance.shared_from_this(), spec, "start" );
+  // a model may define its own start spec, e.g. to give it a coroutine body
+  auto spec = m_model->activity( "start" );
+  if ( spec.type == ActivitySpec::Type::undefined ) {
+    spec = ActivitySpec( "start", ActivitySpec::Type::plain );
+  }
+  auto activity = Simulation::Private::makeShared<Activity>( simulation(), m_instance.shared_from_this(), spec, "start" );
   if (!activity) {
     throw "could not create start activity";
   }
-  auto rv = m_activities.emplace( "start", activity );
-  if (!rv.second) {
+  auto &slot = symbol_slot( m_activities, Activity::Private::id( *activity ) );
+  if (slot) {
     throw "could not insert start activity";
   }
+  slot = activity;
+}
+
+#if ACPP_LESSON > 3
+void Instance::Impl::makePads() {
+  for ( const auto &spec : m_model->pads() ) {
+    if ( spec.flags & ( PadSpec::Flag::IS_TEMPLATE | PadSpec::Flag::BY_REQUEST ) ) {
+      continue; // made on request, not with the instance
+    }
+    auto pad = Simulation::Private::makeShared<Pad>( simulation(), m_instance.shared_from_this(), spec, spec.name );
+    symbol_slot( m_pads, Pad::Private::id( *pad ) ) = pad;
+  }
+}
+#endif // ACPP_LESSON > 3
+
+acpp::void_result<> Instance::Impl::spawnActivity( const std::string spec_name, const std::string &name, Clock::duration delay ) {
+  auto simulation = this->simulation();
+  return simulation->spawnActivity( spec_name, name, m_name, simulation->simtime() + delay );
 }
 
 std::shared_ptr<Activity> Instance::addActivity( const std::string &spec_name, const std::string &name ) {
@@ -139,19 +214,26 @@ std::shared_ptr<Activity> Instance::addActivity( const std::string &spec_name, c
   if (!activity) {
     return {};
   }
-  auto rv = impl->m_activities.emplace( name, activity );
+  symbol_slot( impl->m_activities, Activity::Private::id( *activity ) ) = activity;
   return activity;
 }
 
 std::shared_ptr<Activity> Instance::makeActivity( const ActivitySpec &spec, const std::string &name ) {
-  return std::make_shared<Activity>( shared_from_this(), spec, name );
+  return Simulation::Private::makeShared<Activity>( impl->simulation(), shared_from_this(), spec, name );
 }
 
 acpp::void_result<> Instance::spawnActivity( const std::string spec_name, const std::string &name, Clock::duration delay ) {
   return impl->spawnActivity( spec_name, name, delay );
 }
 
-struct Activity::Impl {
+acpp::value_result<Payload> Instance::saveState() const {
+  return { {}, "instance " + impl->m_name + " can't save its state" };
+}
+
+void Instance::restoreState( Payload && ) noexcept {
+}
+
+struct Activity::Impl : ArenaObject {
   Impl(
       Activity &activity,
       std::shared_ptr<Instance> instance,
@@ -162,35 +244,62 @@ struct Activity::Impl {
       m_instance{ instance },
       m_spec{ spec },
       m_name{ name },
-      m_func{ func } {
+      m_func{ func ? func : spec.function } {
     if ( name.empty() ) {
       throw "name not supplied";
     }
+    if ( instance ) {
+      m_id = Simulation::Private::intern( instance->owner(), m_name );
+      m_slot = Simulation::Private::activitySlot( instance->owner() );
+    }
+    if ( !m_func ) {
+      m_func = []( Instance &instance, Activity &activity, const std::string &, Payload & ) {
+        instance.model()->startActivity( instance.shared_from_this(), activity.shared_from_this() );
+      };
+    }
   }
+#if ACPP_LESSON > 4
+  ~Impl() {
+    unwind();
+  }
+#endif // ACPP_LESSON > 4
   Activity &m_activity; // Activity owns Activity::Impl
   std::weak_ptr<Instance> m_instance;
   ActivitySpec m_spec;
   std::string m_name;
+  SymbolId m_id = no_symbol;
+  uint32_t m_slot = no_symbol; // dense index of the activity within its simulation
   Func m_func;
 #if ACPP_LESSON > 4
   State m_state = State::init;
-  std::thread m_worker;
-  std::mutex m_state_mut;
-  std::condition_variable m_state_cnd;
+  Fiber m_fiber;
+  std::string m_source; // arguments of the current invocation, read on the fiber
+  Payload m_payload;
+  bool m_woken = false; // whether the last wait ended by a resume rather than a cancel
+  bool m_unwinding = false; // canceled, every wait from now on fails at once
+#ifdef SIM_COROUTINES
+  Task::handle_type m_task; // body of a coroutine activity, resumed instead of m_fiber
+#endif // SIM_COROUTINES
 #endif // ACPP_LESSON > 4
 
-  void invoke( const std::string &source, const std::any &payload );
+  void invoke( const std::string &source, Payload &&payload );
 
 #if ACPP_LESSON > 3
-  acpp::value_result<std::any> padReceive( const std::string &pad_name, sim::Clock::time_point time, const std::string &activity_name );
-  bool padSend( const std::string &pad_name, const std::any &payload, const std::string &activity_name );
+  acpp::value_result<Payload> padReceive( const std::string &pad_name, sim::Clock::time_point time, const std::string &activity_name );
+  bool padSend( const std::string &pad_name, Payload &&payload, const std::string &activity_name );
 #endif
 
 #if ACPP_LESSON > 4
-  void waitUntil( const sim::Clock::time_point &time );
-  acpp::value_result<std::any> padReceive( const std::string &pad_name, sim::Clock::time_point time );
-  bool padSend( const std::string &pad_name, const std::any &payload, bool block = false );
-  void workerFunc();
+  acpp::void_result<> waitUntil( const sim::Clock::time_point &time );
+  acpp::void_result<> waitOn( const std::string &signal );
+  acpp::value_result<Payload> padReceive( const std::string &pad_name, sim::Clock::time_point time );
+  bool padSend( const std::string &pad_name, Payload &&payload );
+  bool suspend();
+  void unwind() noexcept;
+  static void fiberMain( void *self );
+#ifdef SIM_COROUTINES
+  void resumeTask();
+#endif // SIM_COROUTINES
 #endif
 };
 
@@ -199,7 +308,8 @@ Activity::Activity(
   const ActivitySpec &spec,
   const std::string &name,
   const Func &func ) :
-    impl( new Impl{ *this, instance, spec, name, func } ) {
+    impl( new ( Simulation::Private::resource( instance ? instance->owner() : nullptr ) )
+            Impl{ *this, instance, spec, name, func } ) {
 }
 
 Activity::~Activity() noexcept = default;
@@ -210,15 +320,42 @@ ActivitySpec Activity::spec() const {
   return impl->m_spec;
 }
 
-void Activity::Impl::invoke( const std::string &source, const std::any &payload ) {
+void Activity::Impl::invoke( const std::string &source, Payload &&payload ) {
   if (!m_func) {
     return;
   }
+#if ACPP_LESSON > 4
+#ifdef SIM_COROUTINES
+  if ( m_func.target<CoroutineFunc>() ) {
+    // coroutines suspend on their own, no fiber needed
+    if ( !m_task ) {
+      std::invoke( m_func, *m_instance.lock(), m_activity, source, payload );
+    }
+    return;
+  }
+#endif // SIM_COROUTINES
+  if ( m_fiber.active() ) {
+    return; // still running an earlier invocation
+  }
+  auto instance = m_instance.lock();
+  auto stacks = Simulation::Private::stacks( instance ? instance->owner() : nullptr );
+  if ( !stacks ) {
+    return;
+  }
+  m_source = source;
+  m_payload = std::move( payload );
+  if ( !m_fiber.start( *stacks, &Impl::fiberMain, this ) ) {
+    return;
+  }
+  m_state = State::run;
+  m_fiber.resume();
+#else
   std::invoke( m_func, *m_instance.lock(), m_activity, source, payload );
+#endif // ACPP_LESSON > 4
 }
 
-void Activity::invoke( const std::string &source, const std::any &payload ) {
-  impl->invoke( source, payload );
+void Activity::invoke( const std::string &source, Payload &&payload ) {
+  impl->invoke( source, std::move( payload ) );
 }
 
 #if ACPP_LESSON > 4
@@ -232,53 +369,259 @@ std::shared_ptr<Instance> Activity::owner() const {
 }
 
 std::string Activity::name() const {
-  return impl->m_spec.name;
+  return impl->m_name;
 }
 
+SymbolId Activity::Private::id( const Activity &activity ) {
+  return activity.impl->m_id;
+}
+
+uint32_t Activity::Private::slot( const Activity &activity ) {
+  return activity.impl->m_slot;
+}
 
+bool Activity::Private::idle( [[maybe_unused]] const Activity &activity ) {
 #if ACPP_LESSON > 4
-void Activity::Impl::workerFunc() {
-  if ( !m_spec.function ) {
+#ifdef SIM_COROUTINES
+  if ( activity.impl->m_task ) {
+    return false;
+  }
+#endif // SIM_COROUTINES
+  return !activity.impl->m_fiber.active();
+#else
+  return true;
+#endif // ACPP_LESSON > 4
+}
+
+
+#if ACPP_LESSON > 4
+void Activity::Impl::fiberMain( void *self ) {
+  auto &impl = *static_cast<Impl *>( self );
+  auto instance = impl.m_instance.lock();
+  if ( instance ) {
+    std::invoke( impl.m_func, *instance, impl.m_activity, impl.m_source, impl.m_payload );
+  }
+  impl.m_payload.reset();
+  impl.m_state = State::done;
+}
+
+void Activity::Impl::unwind() noexcept {
+#ifdef SIM_COROUTINES
+  if ( m_task ) {
+    m_task.destroy(); // runs the destructors of the suspended body's locals
+    m_task = {};
+    m_state = State::done;
+  }
+#endif // SIM_COROUTINES
+  // a suspended fiber runs to its end, its pending wait and any later one returning as canceled
+  if ( m_fiber.active() && m_state == State::pause ) {
+    m_state = State::done;
+    m_woken = false;
+    m_unwinding = true;
+    try {
+      m_fiber.resume();
+    } catch ( ... ) {
+    }
+  }
+}
+
+void Activity::Private::unwind( Activity &activity ) {
+  activity.impl->unwind();
+}
+
+bool Activity::Impl::suspend() {
+  m_state = State::pause;
+  Fiber::yield(); // back to the simulation loop until Activity::Private::resume
+  return m_woken;
+}
+
+void Activity::Private::resume( Activity &activity, bool woken ) {
+  auto &impl = *activity.impl;
+  if ( impl.m_state != State::pause ) {
     return;
   }
-  std::unique_lock<std::mutex> state_lock( m_state_mut );
-  m_state_cnd.wait( state_lock, [this]() { return m_state != State::init && m_state != State::pause; } );
-  if ( m_state == State::run ) {
-    state_lock.unlock();
-    std::invoke( m_func, *m_instance.lock(), m_activity, {}, {} );
+#ifdef SIM_COROUTINES
+  if ( impl.m_task ) {
+    impl.m_state = State::run;
+    impl.m_woken = woken;
+    impl.resumeTask();
+    return;
+  }
+#endif // SIM_COROUTINES
+  if ( !impl.m_fiber.active() ) {
+    return;
+  }
+  impl.m_state = State::run;
+  impl.m_woken = woken;
+  impl.m_fiber.resume();
+}
+
+#ifdef SIM_COROUTINES
+void Activity::Impl::resumeTask() {
+  m_task.resume();
+  if ( !m_task.done() ) {
+    return;
+  }
+  auto exception = std::exchange( m_task.promise().exception, nullptr );
+  m_task.destroy();
+  m_task = {};
+  m_state = State::done;
+  if ( exception ) {
+    std::rethrow_exception( exception );
   }
 }
+
+void Activity::Private::startTask( Activity &activity, Task::handle_type task ) {
+  auto &impl = *activity.impl;
+  if ( !task ) {
+    return;
+  }
+  if ( impl.m_task ) {
+    task.destroy(); // already running an earlier invocation
+    return;
+  }
+  impl.m_task = task;
+  impl.m_state = State::run;
+  impl.resumeTask();
+}
+
+acpp::void_result<> Activity::Private::suspendTask(
+    Activity &activity,
+    const Clock::time_point &time,
+    const std::string &pad_name ) {
+  auto &impl = *activity.impl;
+  if ( impl.m_state != State::run || !impl.m_task ) {
+    return { {}, "not running as a coroutine" };
+  }
+  auto instance = impl.m_instance.lock();
+  if ( !instance ) {
+    return { {}, "no instance" };
+  }
+  std::shared_ptr<Pad> pad;
+  if ( !pad_name.empty() ) {
+    pad = instance->pad( pad_name );
+    if ( !pad ) {
+      return { {}, "no pad: " + pad_name };
+    }
+  }
+  auto waiting = pad
+      ? Simulation::Private::activityPadReceive(
+            instance->owner(), activity.shared_from_this(), Pad::Private::id( *pad ), time )
+      : Simulation::Private::insertResumeActivity( instance->owner(), activity.shared_from_this(), time );
+  if ( waiting ) {
+    impl.m_state = State::pause;
+  }
+  return waiting;
+}
+
+bool Activity::Private::woken( const Activity &activity ) {
+  return activity.impl->m_woken;
+}
+#endif // SIM_COROUTINES
+#else
+void Activity::Private::resume( Activity &, bool ) {
+  // nothing suspends before fibers
+}
+
+void Activity::Private::unwind( Activity & ) {
+}
 #endif // ACPP_LESSON > 4
 
 #if ACPP_LESSON > 4
-void Activity::Impl::waitUntil( const sim::Clock::time_point &time ) {
-  // TODO lock
-  if ( m_state != State::RUN ) {
-    return;
+acpp::void_result<> Activity::Impl::waitUntil( const sim::Clock::time_point &time ) {
+  if ( m_unwinding ) {
+    return { {}, "wait canceled" };
+  }
+  if ( m_state != State::run || Fiber::current() != &m_fiber ) {
+    return { {}, "not running on its fiber" };
   }
-  m_state = State::PAUSE;
-  auto future = Simulation::Private::insertResumeActivity(
-      m_instance.lock()->owner(),
+  auto instance = m_instance.lock();
+  if ( !instance ) {
+    return { {}, "no instance" };
+  }
+  auto waiting = Simulation::Private::insertResumeActivity(
+      instance->owner(),
       m_activity.shared_from_this(),
       time );
-  future.get();
+  if ( !waiting ) {
+    return waiting;
+  }
+  if ( !suspend() ) {
+    return { {}, "wait canceled" };
+  }
+  return {};
+}
+
+acpp::void_result<> Activity::Impl::waitOn( const std::string &signal ) {
+  if ( m_unwinding ) {
+    return { {}, "wait canceled" };
+  }
+  if ( m_state != State::run || Fiber::current() != &m_fiber ) {
+    return { {}, "not running on its fiber" };
+  }
+  auto instance = m_instance.lock();
+  if ( !instance ) {
+    return { {}, "no instance" };
+  }
+  auto waiting = Simulation::Private::activityWaitOn( instance->owner(), m_activity.shared_from_this(), signal );
+  if ( !waiting ) {
+    return waiting;
+  }
+  if ( !suspend() ) {
+    return { {}, "wait canceled" };
+  }
+  return {};
 }
 #endif // ACPP_LESSON > 4
 
+#if ACPP_LESSON > 3
+namespace {
+
+/**
+ * @brief Get the simulation time a delay from now, or nothing once the simulation is going away
+ * The simulation isn't held past the call: one held on a waiting fiber's stack would
+ * never be destroyed.
+ */
+std::optional<Clock::time_point> deadline( const Activity &activity, Clock::duration delay ) {
+  auto instance = activity.owner();
+  auto simulation = instance ? instance->owner() : nullptr;
+  if ( !simulation ) {
+    return {};
+  }
+  return simulation->simtime() + delay;
+}
+
+}  // namespace
+#endif // ACPP_LESSON > 3
+
 #if ACPP_LESSON > 4
-void Activity::waitUntil( const sim::Clock::time_point &time ) {
-  impl->waitUntil( time );
+acpp::void_result<> Activity::waitUntil( const sim::Clock::time_point &time ) {
+  return impl->waitUntil( time );
 }
-void Activity::waitFor( sim::Clock::duration dur ) {
-  auto instance = impl->m_instance.lock();
-  waitUntil( instance->owner()->simtime() + dur );
+acpp::void_result<> Activity::waitFor( sim::Clock::duration dur ) {
+  if ( impl->m_unwinding ) {
+    return { {}, "wait canceled" }; // before the simulation going away is noticed
+  }
+  auto time = deadline( *this, dur );
+  if ( !time ) {
+    return { {}, "no simulation" };
+  }
+  return waitUntil( *time );
+}
+acpp::void_result<> Activity::waitOn( const std::string &signal ) {
+  return impl->waitOn( signal );
 }
 #endif // ACPP_LESSON > 4
 
 #if ACPP_LESSON > 3
-acpp::value_result<std::any> Activity::Impl::padReceive( const std::string &pad_name, sim::Clock::time_point time, const std::string &activity_name ) {
+acpp::value_result<Payload> Activity::Impl::padReceive( const std::string &pad_name, sim::Clock::time_point time, const std::string &activity_name ) {
+#if ACPP_LESSON > 4
+  if ( m_unwinding ) {
+    return { {}, "receive canceled" };
+  }
+#endif // ACPP_LESSON > 4
   auto instance = m_instance.lock();
-  auto pad = m_instance.lock()->pad( pad_name );
+  auto pad = instance ? instance->pad( pad_name ) : nullptr;
   if ( !pad ) {
     return {{}, "no pad: " + pad_name};
   }
@@ -288,18 +631,18 @@ acpp::value_result<std::any> Activity::Impl::padReceive( const std::string &pad_
   }
   
 #if ACPP_LESSON > 4
-  // TODO lock state
-  if ( m_state != State::RUN ) {
-    return { {}, "already waiting" }; // Activity already waiting
+  if ( m_state != State::run || Fiber::current() != &m_fiber ) {
+    return { {}, "not running on its fiber" }; // Activity already waiting or invoked directly
   }
-  m_state = State::PAUSE;
-  auto future = Simulation::Private::activityPadReceive(
+  auto waiting = Simulation::Private::activityPadReceive(
       instance->owner(),
       m_activity.shared_from_this(),
-      pad_name,
+      Pad::Private::id( *pad ),
       time );
-  auto rv = future.get();
-  if (!rv) {
+  if ( !waiting ) {
+    return { waiting.err, waiting.msg };
+  }
+  if ( !suspend() ) {
     return { {}, "receive canceled" };
   }
 #endif // ACPP_LESSON > 4
@@ -309,9 +652,12 @@ acpp::value_result<std::any> Activity::Impl::padReceive( const std::string &pad_
 #endif // ACPP_LESSON > 3
 
 #if ACPP_LESSON > 4
-acpp::value_result<std::any> Activity::Impl::padReceive( const std::string &pad_name, sim::Clock::time_point time ) {
+acpp::value_result<Payload> Activity::Impl::padReceive( const std::string &pad_name, sim::Clock::time_point time ) {
+  if ( m_unwinding ) {
+    return { {}, "receive canceled" };
+  }
   auto instance = m_instance.lock();
-  auto pad = m_instance.lock()->pad( pad_name );
+  auto pad = instance ? instance->pad( pad_name ) : nullptr;
   if ( !pad ) {
     return {{}, "no pad: " + pad_name};
   }
@@ -320,18 +666,18 @@ acpp::value_result<std::any> Activity::Impl::padReceive( const std::string &pad_
     return Pad::Private::pull( pad );
   }
   
-  // TODO lock state
-  if ( m_state != State::RUN ) {
-    return { {}, "already waiting" }; // Activity already waiting
+  if ( m_state != State::run || Fiber::current() != &m_fiber ) {
+    return { {}, "not running on its fiber" }; // Activity already waiting or invoked directly
   }
-  m_state = State::PAUSE;
-  auto future = Simulation::Private::activityPadReceive(
+  auto waiting = Simulation::Private::activityPadReceive(
       instance->owner(),
       m_activity.shared_from_this(),
-      pad_name,
+      Pad::Private::id( *pad ),
       time );
-  auto rv = future.get();
-  if (!rv) {
+  if ( !waiting ) {
+    return { waiting.err, waiting.msg };
+  }
+  if ( !suspend() ) {
     return { {}, "receive canceled" };
   }
   return Pad::Private::pull( pad );
@@ -339,51 +685,72 @@ acpp::value_result<std::any> Activity::Impl::padReceive( const std::string &pad_
 #endif // ACPP_LESSON > 4
 
 #if ACPP_LESSON > 3
-bool Activity::Impl::padSend( const std::string &pad_name, const std::any &payload, const std::string &activity_name ) {
-  auto pad = m_instance.lock()->pad( pad_name );
+bool Activity::Impl::padSend( const std::string &pad_name, Payload &&payload, const std::string &activity_name ) {
+  auto instance = m_instance.lock();
+  auto pad = instance ? instance->pad( pad_name ) : nullptr;
   if ( !(pad && pad->peer()) ) {
     return false;
   }
-  return Pad::Private::push( pad->peer(), payload );
+  return Simulation::Private::padSend( instance->owner(), pad, std::move( payload ) );
 }
 #endif // ACPP_LESSON > 3
 
 #if ACPP_LESSON > 4
-bool Activity::Impl::padSend( const std::string &pad_name, const std::any &payload ) {
-  auto pad = m_instance.lock()->pad( pad_name );
+bool Activity::Impl::padSend( const std::string &pad_name, Payload &&payload ) {
+  auto instance = m_instance.lock();
+  auto pad = instance ? instance->pad( pad_name ) : nullptr;
   if ( !(pad && pad->peer()) ) {
     return false;
   }
-  return Pad::Private::push( pad->peer(), payload );
+  return Simulation::Private::padSend( instance->owner(), pad, std::move( payload ) );
 }
 #endif // ACPP_LESSON > 4
 
 #if ACPP_LESSON > 3
-acpp::value_result<std::any> Activity::padReceive( const std::string &pad_name, const std::string &activity_name ) {
+acpp::value_result<Payload> Activity::padReceive( const std::string &pad_name, const std::string &activity_name ) {
   return impl->padReceive( pad_name, {}, activity_name );
 }
-acpp::value_result<std::any> Activity::padReceive( const std::string &pad_name, sim::Clock::duration timeout, const std::string &activity_name ) {
-  return impl->padReceive( pad_name, owner()->owner()->simtime() + timeout, activity_name );
+acpp::value_result<Payload> Activity::padReceive( const std::string &pad_name, sim::Clock::duration timeout, const std::string &activity_name ) {
+#if ACPP_LESSON > 4
+  if ( impl->m_unwinding ) {
+    return { {}, "receive canceled" };
+  }
+#endif // ACPP_LESSON > 4
+  auto time = deadline( *this, timeout );
+  if ( !time ) {
+    return { {}, "no simulation" };
+  }
+  return impl->padReceive( pad_name, *time, activity_name );
 }
-bool Activity::padSend( const std::string &pad_name, const std::any &payload, const std::string &activity_name ) {
-  return impl->padSend( pad_name, payload, activity_name );
+bool Activity::padSend( const std::string &pad_name, Payload payload, const std::string &activity_name ) {
+  return impl->padSend( pad_name, std::move( payload ), activity_name );
 }
 #endif // ACPP_LESSON > 3
 
 #if ACPP_LESSON > 4
-acpp::value_result<std::any> Activity::padReceive( const std::string &pad_name ) {
+acpp::value_result<Payload> Activity::padReceive( const std::string &pad_name ) {
   return impl->padReceive( pad_name, {} );
 }
-acpp::value_result<std::any> Activity::padReceive( const std::string &pad_name, sim::Clock::duration timeout ) {
-  return impl->padReceive( pad_name, owner()->owner()->simtime() + timeout );
+acpp::value_result<Payload> Activity::padReceive( const std::string &pad_name, sim::Clock::duration timeout ) {
+  if ( impl->m_unwinding ) {
+    return { {}, "receive canceled" };
+  }
+  auto time = deadline( *this, timeout );
+  if ( !time ) {
+    return { {}, "no simulation" };
+  }
+  return impl->padReceive( pad_name, *time );
 }
-bool Activity::padSend( const std::string &pad_name, const std::any &payload ) {
-  return impl->padSend( pad_name, payload );
+bool Activity::padSend( const std::string &pad_name, Payload payload, bool block ) {
+  if ( block ) {
+    return false; // no way yet to wait for room at the peer
+  }
+  return impl->padSend( pad_name, std::move( payload ) );
 }
 #endif // ACPP_LESSON > 4
 
 
-struct Pad::Impl {
+struct Pad::Impl : ArenaObject {
   Impl(
       Pad &pad,
       std::shared_ptr<Instance> instance,
@@ -392,28 +759,105 @@ struct Pad::Impl {
       m_pad{ pad },
       m_instance{ instance },
       m_spec{ spec },
-      m_name{ name } {
+      m_name{ name },
+      m_queue{ makeQueue( spec, name, instance.get(), Simulation::Private::resource( instance ? instance->owner() : nullptr ) ) },
+      m_overflow( Simulation::Private::resource( instance ? instance->owner() : nullptr ) ) {
     if ( name.empty() ) {
       throw "name not supplied";
     }
+    if ( instance ) {
+      m_id = Simulation::Private::intern( instance->owner(), m_name );
+    }
+    auto lookahead = m_spec.parameters.find( "lookahead" );
+    if ( lookahead != m_spec.parameters.end() ) {
+      auto seconds = acpp::get_as<double>( lookahead->second ).value_or( 0.0 );
+      if ( seconds < 0.0 ) {
+        throw "negative lookahead";
+      }
+      m_lookahead = std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( seconds ) );
+    }
+    if ( instance ) {
+      m_receives = instance->model()->activity( m_name ).type == ActivitySpec::Type::pad_receive;
+    }
   }
 
+  /**
+   * Messages are pushed by the thread stepping the receiving instance's partition, which
+   * also pulls them, so a ring for one producer does unless the pad is FAN_IN. What comes
+   * while the ring is full waits in m_overflow, touched by that thread only.
+   */
+  using Queue = std::variant<SpscRing<Payload>, MpscRing<Payload>>;
+  static constexpr size_t s_default_capacity = 64;
+  static Queue makeQueue(
+      const PadSpec &spec, const std::string &name, const Instance *instance, std::pmr::memory_resource *resource );
+
   bool connect( std::shared_ptr<Instance> instance, const std::string &pad_name );
-  acpp::value_result<std::any> pull();
-  bool push( const std::any &payload );
-  bool push( std::any &&payload );
+  acpp::value_result<Payload> pull();
+  void push( Payload &&payload );
+  size_t size() const {
+    return std::visit( []( const auto &queue ) { return queue.size(); }, m_queue ) + m_overflow.size();
+  }
+  std::shared_ptr<Activity> receiver();
+  /**
+   * @brief Record the number of messages waiting in m_length, if observed, and in m_chrome
+   */
+  void measure() {
+    if ( !m_length && !m_chrome ) {
+      return;
+    }
+    auto waiting = size();
+    if ( m_length ) {
+      m_length->set( m_simulation->simtime(), double( waiting ) );
+    }
+    if ( m_chrome ) {
+      m_chrome->length( m_chrome_instance, m_id, waiting );
+    }
+  }
 
   Pad &m_pad; // Pad owns Pad::Impl
   std::weak_ptr<Instance> m_instance;
   PadSpec m_spec;
   std::string m_name;
-  std::shared_ptr<Pad> m_peer;
-  std::shared_mutex m_queue_mut;
-  std::deque<std::any> m_queue;
+  SymbolId m_id = no_symbol;
+  Clock::duration m_lookahead{ 0 }; // delay of everything sent out of this pad
+  bool m_receives = false; // whether the model has a pad_receive activity of this name
+  std::weak_ptr<Pad> m_peer; // peers don't own each other
+  Queue m_queue;
+  std::pmr::deque<Payload> m_overflow; // after those in m_queue, in the order they came
+  std::shared_ptr<TimeWeighted> m_length;
+  Simulation *m_simulation = nullptr; // owns the instance, while m_length is set
+  ChromeTraceBuffer *m_chrome = nullptr; // while exporting, see Pad::Private::exportLength
+  SymbolId m_chrome_instance = no_symbol;
 };
 
+Pad::Impl::Queue Pad::Impl::makeQueue(
+    const PadSpec &spec, const std::string &name, const Instance *instance, std::pmr::memory_resource *resource ) {
+  // a pad that only sends holds no messages, so large topologies don't pay for its slots
+  size_t capacity = spec.flags & PadSpec::Flag::CAN_INPUT ? s_default_capacity : 1;
+  // the instance's "<pad>.capacity" parameter comes before the spec's
+  std::optional<double> requested;
+  if ( instance ) {
+    requested = instance->parameter<double>( name + ".capacity" );
+  }
+  auto parameter = spec.parameters.find( "capacity" );
+  if ( !requested && parameter != spec.parameters.end() ) {
+    requested = acpp::get_as<double>( parameter->second ).value_or( 0.0 );
+  }
+  if ( requested ) {
+    if ( *requested < 1.0 ) {
+      throw "pad capacity below one";
+    }
+    capacity = static_cast<size_t>( *requested );
+  }
+  if ( spec.flags & PadSpec::Flag::FAN_IN ) {
+    return Queue{ std::in_place_index<1>, capacity, resource };
+  }
+  return Queue{ std::in_place_index<0>, capacity, resource };
+}
+
 Pad::Pad( std::shared_ptr<Instance> instance, const PadSpec &spec, const std::string &name ) :
-    impl( new Impl{ *this, instance, spec, name } ) {
+    impl( new ( Simulation::Private::resource( instance ? instance->owner() : nullptr ) )
+            Impl{ *this, instance, spec, name } ) {
 }
 
 Pad::~Pad() noexcept = default;
@@ -433,7 +877,23 @@ std::shared_ptr<Instance> Pad::owner() const {
 }
 
 std::shared_ptr<Pad> Pad::peer() const {
-  return impl->m_peer;
+  return impl->m_peer.lock();
+}
+
+Clock::duration Pad::lookahead() const {
+  return impl->m_lookahead;
+}
+
+void Pad::observe( std::shared_ptr<TimeWeighted> length ) {
+  auto instance = owner();
+  auto simulation = instance ? instance->owner() : nullptr;
+  impl->m_simulation = simulation.get();
+  impl->m_length = simulation ? std::move( length ) : nullptr;
+  impl->measure();
+}
+
+SymbolId Pad::Private::id( const Pad &pad ) {
+  return pad.impl->m_id;
 }
 
 bool Pad::connect( std::shared_ptr<Instance> instance, const std::string &pad_name ) {
@@ -449,7 +909,8 @@ bool Pad::Impl::connect( std::shared_ptr<Instance> instance, const std::string &
     return false;
   }
 
-  if (m_peer == peer) {
+  auto current = m_peer.lock();
+  if (current == peer) {
     return true;
   }
 
@@ -459,8 +920,8 @@ bool Pad::Impl::connect( std::shared_ptr<Instance> instance, const std::string &
   }
 
   // disconnect if needed
-  if (m_peer && m_peer->impl->m_peer && m_peer->impl->m_peer->impl.get() == this) {
-    m_peer->impl->m_peer.reset();
+  if (current && current->peer() && current->peer()->impl.get() == this) {
+    current->impl->m_peer.reset();
   }
 
   // now connect
@@ -471,33 +932,69 @@ bool Pad::Impl::connect( std::shared_ptr<Instance> instance, const std::string &
 }
 
 size_t Pad::available() const {
-  std::shared_lock lock { impl->m_queue_mut };
-  return impl->m_queue.size();
+  return impl->size();
 }
 
-acpp::value_result<std::any> Pad::Private::pull( std::shared_ptr<Pad> pad ) {
+acpp::value_result<Payload> Pad::Private::pull( std::shared_ptr<Pad> pad ) {
   return pad->impl->pull();
 }
 
-acpp::value_result<std::any> Pad::Impl::pull() {
-  std::unique_lock lock { m_queue_mut };
-  if (m_queue.empty()) {
+acpp::value_result<Payload> Pad::Impl::pull() {
+  Payload msg;
+  if ( !std::visit( [&]( auto &queue ) { return queue.pop( msg ); }, m_queue ) ) {
     return { {}, "nothing waiting" };
   }
-  auto msg = m_queue.front();
-  m_queue.pop_front();
+  // the oldest that overflowed takes the slot just freed
+  if ( !m_overflow.empty() && std::visit( [&]( auto &queue ) { return queue.push( std::move( m_overflow.front() ) ); }, m_queue ) ) {
+    m_overflow.pop_front();
+  }
+  measure();
+  return acpp::value_result<Payload>( std::move( msg ) );
+}
 
-  return acpp::value_result<std::any>( msg );
+bool Pad::Private::receives( const Pad &pad ) {
+  return pad.impl->m_receives;
 }
 
-bool Pad::Private::push( std::shared_ptr<Pad> pad, const std::any &payload ) {
-  return pad->impl->push( payload );
+void Pad::Private::exportLength( Pad &pad, ChromeTraceBuffer *buffer, SymbolId instance ) {
+  pad.impl->m_chrome = buffer;
+  pad.impl->m_chrome_instance = instance;
 }
 
-bool Pad::Impl::push( const std::any &payload ) {
-  std::unique_lock lock { m_queue_mut };
-  m_queue.push_back( payload );
-  return true;
+std::shared_ptr<Activity> Pad::Impl::receiver() {
+  auto instance = m_instance.lock();
+  if ( !instance ) {
+    return {};
+  }
+  auto activity = Instance::Private::activity( *instance, m_id );
+  return activity ? activity : instance->addActivity( m_name, m_name );
+}
+
+void Pad::Private::push( std::shared_ptr<Pad> pad, Payload &&payload ) {
+  if ( pad->impl->m_receives ) {
+    // hand the message to a run of the pad's activity, unless that is still busy
+    auto activity = pad->impl->receiver();
+    if ( activity && Activity::Private::idle( *activity ) ) {
+      activity->invoke( pad->impl->m_name, std::move( payload ) );
+      return;
+    }
+  }
+  pad->impl->push( std::move( payload ) );
+  if ( auto instance = pad->owner() ) {
+    Simulation::Private::padReceived( instance->owner(), pad );
+  }
+}
+
+void Pad::Private::requeue( Pad &pad, Payload &&payload ) {
+  pad.impl->push( std::move( payload ) );
+}
+
+void Pad::Impl::push( Payload &&payload ) {
+  // behind any that overflowed already, so that they keep their order
+  if ( !m_overflow.empty() || !std::visit( [&]( auto &queue ) { return queue.push( std::move( payload ) ); }, m_queue ) ) {
+    m_overflow.push_back( std::move( payload ) );
+  }
+  measure();
 }
 
 }  // namespace sim
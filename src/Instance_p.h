@@ -8,15 +8,108 @@
 
 #include <CxxSimulator/Simulator.h>
 #include <CxxSimulator/Instance.h>
+#include "SymbolTable.h"
+#ifdef SIM_COROUTINES
+#include <CxxSimulator/Coroutine.h>
+#endif // SIM_COROUTINES
 
 #include <memory>
 #include <string>
 
 namespace sim {
 
+class ChromeTraceBuffer;
+
+struct Instance::Private {
+  static SymbolId id( const Instance &instance );
+  static std::shared_ptr<Activity> activity( const Instance &instance, SymbolId name );
+  static std::shared_ptr<Pad> pad( const Instance &instance, SymbolId name );
+  /**
+   * @brief Get the instance's pads, indexed by pad name id with gaps
+   */
+  static const std::vector<std::shared_ptr<Pad>> &pads( const Instance &instance );
+  /**
+   * @brief Finish a freshly made instance with its pads and start activity
+   * The constructor can't, as it can't hand out shared_from_this() yet.
+   * @param partition the simulation partition the instance runs in
+   */
+  static void initialize( Instance &instance, uint32_t partition );
+  static uint32_t partition( const Instance &instance );
+  static const PropertyList &parameters( const Instance &instance );
+  /**
+   * @brief Count one more event scheduled by the instance
+   * @return uint64_t the count, which orders the instance's events at equal times
+   */
+  static uint64_t nextSeq( Instance &instance );
+  static uint64_t eventCount( const Instance &instance );
+  /**
+   * @brief Rewind the count of scheduled events, as part of a rollback
+   */
+  static void setEventCount( Instance &instance, uint64_t count );
+};
+
+struct Activity::Private {
+  /**
+   * @brief Continue an activity suspended in a wait, on the calling thread
+   * @param woken true if the wait ended normally, false to cancel it
+   */
+  static void resume( Activity &activity, bool woken );
+  /**
+   * @brief End a suspended activity, letting its pending wait return as canceled
+   */
+  static void unwind( Activity &activity );
+  static SymbolId id( const Activity &activity );
+  /**
+   * @brief Get the dense index the simulation gave the activity when it was made
+   * @return uint32_t the index, or no_symbol for an activity outside any simulation
+   */
+  static uint32_t slot( const Activity &activity );
+  /**
+   * @brief Whether the activity can be invoked, rather than still running an earlier invocation
+   */
+  static bool idle( const Activity &activity );
+#ifdef SIM_COROUTINES
+  /**
+   * @brief Adopt and run a coroutine body until its first suspension
+   */
+  static void startTask( Activity &activity, Task::handle_type task );
+  /**
+   * @brief Register the wait of a coroutine about to suspend
+   * @param time when to resume or time out, {} for no timeout
+   * @param pad_name pad to receive on or empty for a plain wait
+   * @return acpp::void_result<> error if the coroutine must not suspend
+   */
+  static acpp::void_result<> suspendTask( Activity &activity, const Clock::time_point &time, const std::string &pad_name );
+  /**
+   * @brief Whether the last wait ended by a resume rather than a cancel
+   */
+  static bool woken( const Activity &activity );
+#endif // SIM_COROUTINES
+};
+
 struct Pad::Private {
-  static acpp::value_result<std::any> pull( std::shared_ptr<Pad> pad );
-  static bool push( std::shared_ptr<Pad> pad, const std::any &payload );
+  static SymbolId id( const Pad &pad );
+  static acpp::value_result<Payload> pull( std::shared_ptr<Pad> pad );
+  /**
+   * @brief Deliver a message, running the pad's pad_receive activity if idle or queuing it
+   * A full pad takes it all the same, past its capacity, see PadSpec.
+   */
+  static void push( std::shared_ptr<Pad> pad, Payload &&payload );
+  /**
+   * @brief Queue a message as it is, running no activity and waking no one
+   * For putting back messages taken out to be looked at, e.g. by a checkpoint.
+   */
+  static void requeue( Pad &pad, Payload &&payload );
+  /**
+   * @brief Whether messages to the pad run its pad_receive activity, see ActivitySpec
+   */
+  static bool receives( const Pad &pad );
+  /**
+   * @brief Record the messages waiting at the pad into a Chrome trace as they change
+   * @param buffer of the partition of the pad's instance, nullptr to stop
+   * @param instance the id of the pad's instance
+   */
+  static void exportLength( Pad &pad, ChromeTraceBuffer *buffer, SymbolId instance );
 };
 
 }  // namespace sim
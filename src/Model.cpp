@@ -38,11 +38,14 @@ Model::Model( const std::string &name ) : impl( new Impl{ name } ) {
 
 Model::~Model() = default;
 
+void Model::startActivity( std::shared_ptr<Instance>, std::shared_ptr<Activity> ) {
+}
+
 std::shared_ptr<Instance> Model::makeInstance(
     std::shared_ptr<Simulation> sim,
     const std::string &name,
     const PropertyList &parameters ) {
-  return std::make_shared<Instance>( sim, this->shared_from_this(), name, parameters );
+  return Simulation::Private::makeShared<Instance>( sim, sim, this->shared_from_this(), name, parameters );
 }
 
 void Model::addActivitySpec( const ActivitySpec &spec ) {
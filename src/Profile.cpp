@@ -0,0 +1,69 @@
+// Profile.cpp : sums over event loop profiles and their flame graph stacks
+//
+
+#include <CxxSimulator/Profile.h>
+
+#include <cmath>
+#include <fstream>
+#include <ostream>
+
+namespace sim {
+
+namespace {
+
+template <typename Key>
+std::map<std::string, ProfileCost> sumBy( const std::vector<Profile::Row> &rows, Key &&key ) {
+  std::map<std::string, ProfileCost> sums;
+  for ( const auto &row : rows ) {
+    sums[key( row )].add( row.cost );
+  }
+  return sums;
+}
+
+}  // namespace
+
+ProfileCost Profile::total() const {
+  ProfileCost sum;
+  for ( const auto &row : rows ) {
+    sum.add( row.cost );
+  }
+  return sum;
+}
+
+std::map<std::string, ProfileCost> Profile::byType() const {
+  return sumBy( rows, []( const Row &row ) { return row.type; } );
+}
+
+std::map<std::string, ProfileCost> Profile::byModel() const {
+  return sumBy( rows, []( const Row &row ) { return row.model; } );
+}
+
+std::map<std::string, ProfileCost> Profile::byInstance() const {
+  return sumBy( rows, []( const Row &row ) { return row.instance; } );
+}
+
+void Profile::writeFolded( std::ostream &out ) const {
+  for ( const auto &row : rows ) {
+    if ( row.instance.empty() ) {
+      out << "simulation";
+    } else {
+      out << ( row.model.empty() ? "?" : row.model ) << ';' << row.instance;
+    }
+    out << ';' << row.type << ' ' << uint64_t( std::llround( row.cost.seconds * 1e9 ) ) << '\n';
+  }
+}
+
+acpp::void_result<> Profile::writeFolded( const std::string &path ) const {
+  std::ofstream out{ path };
+  if ( !out ) {
+    return { {}, "can't open " + path };
+  }
+  writeFolded( out );
+  out.close();
+  if ( !out ) {
+    return { {}, "can't write " + path };
+  }
+  return {};
+}
+
+}  // namespace sim
@@ -0,0 +1,419 @@
+// Results.cpp : columnar results files and the thread writing them out
+//
+
+#include <CxxSimulator/Results.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace sim {
+
+namespace {
+
+constexpr char s_magic[8] = { 'C', 'x', 'S', 'i', 'm', 'R', 'e', 's' };
+constexpr uint32_t s_version = 1;
+
+/**
+ * @brief The rows of a chunk, a vector per column of which only one of the two is used
+ */
+struct Chunk {
+  std::vector<std::vector<int64_t>> integers;
+  std::vector<std::vector<double>> reals;
+  size_t rows = 0;
+
+  void clear() noexcept {
+    for ( auto &column : integers ) {
+      column.clear();
+    }
+    for ( auto &column : reals ) {
+      column.clear();
+    }
+    rows = 0;
+  }
+};
+
+template <typename T>
+void appendRaw( std::string &bytes, const T &value ) {
+  bytes.append( reinterpret_cast<const char *>( &value ), sizeof( value ) );
+}
+
+void appendVarint( std::string &bytes, uint64_t value ) {
+  while ( value >= 0x80 ) {
+    bytes.push_back( char( value | 0x80 ) );
+    value >>= 7;
+  }
+  bytes.push_back( char( value ) );
+}
+
+/**
+ * @brief Encode integers as zigzag varints of their differences
+ */
+void encodeIntegers( std::string &bytes, const std::vector<int64_t> &values ) {
+  int64_t last = 0;
+  for ( auto value : values ) {
+    auto delta = uint64_t( value ) - uint64_t( last ); // wraps rather than overflows
+    appendVarint( bytes, ( delta << 1 ) ^ uint64_t( int64_t( delta ) >> 63 ) );
+    last = value;
+  }
+}
+
+bool decodeIntegers( const std::string &bytes, size_t count, std::vector<int64_t> &values ) {
+  values.resize( count );
+  size_t position = 0;
+  uint64_t last = 0;
+  for ( auto &value : values ) {
+    uint64_t zigzag = 0;
+    for ( unsigned shift = 0;; shift += 7 ) {
+      if ( position == bytes.size() || shift > 63 ) {
+        return false;
+      }
+      auto byte = uint8_t( bytes[position++] );
+      zigzag |= uint64_t( byte & 0x7f ) << shift;
+      if ( !( byte & 0x80 ) ) {
+        break;
+      }
+    }
+    last += ( zigzag >> 1 ) ^ ( ~( zigzag & 1 ) + 1 );
+    value = int64_t( last );
+  }
+  return position == bytes.size();
+}
+
+}  // namespace
+
+class ResultsWriter::Impl {
+public:
+  ~Impl() noexcept {
+    stop();
+  }
+
+  void stop() noexcept {
+    if ( m_thread.joinable() ) {
+      {
+        std::lock_guard lock{ m_mut };
+        m_stop = true;
+      }
+      m_cnd.notify_all();
+      m_thread.join();
+    }
+  }
+
+  void resetChunk( Chunk &chunk ) const {
+    chunk.integers.assign( m_columns.size(), {} );
+    chunk.reals.assign( m_columns.size(), {} );
+    for ( size_t column = 0; column < m_columns.size(); ++column ) {
+      if ( m_columns[column].type == ResultsColumn::Type::INTEGER ) {
+        chunk.integers[column].reserve( m_chunk_rows );
+      } else {
+        chunk.reals[column].reserve( m_chunk_rows );
+      }
+    }
+  }
+
+  /**
+   * @brief Hand the filled chunk to the thread, waiting while it still has the last one
+   */
+  void handOff() {
+    std::unique_lock lock{ m_mut };
+    m_cnd.wait( lock, [this] { return !m_pending_full; } );
+    std::swap( m_filling, m_pending );
+    m_pending_full = true;
+    lock.unlock();
+    m_cnd.notify_all();
+  }
+
+  void writeMain() {
+    Chunk writing;
+    resetChunk( writing );
+    std::string bytes;
+    for ( ;; ) {
+      {
+        std::unique_lock lock{ m_mut };
+        m_cnd.wait( lock, [this] { return m_pending_full || m_stop; } );
+        if ( !m_pending_full ) {
+          return;
+        }
+        std::swap( writing, m_pending );
+        m_pending_full = false;
+      }
+      m_cnd.notify_all();
+      write( writing, bytes );
+      writing.clear();
+    }
+  }
+
+  /**
+   * @brief Encode a chunk and write it, on the writer thread
+   */
+  void write( const Chunk &chunk, std::string &bytes ) {
+    if ( m_failure || !chunk.rows ) {
+      return;
+    }
+    bytes.clear();
+    appendRaw( bytes, uint64_t( chunk.rows ) );
+    auto sizes = bytes.size();
+    bytes.resize( sizes + m_columns.size() * sizeof( uint64_t ) );
+    for ( size_t column = 0; column < m_columns.size(); ++column ) {
+      auto start = bytes.size();
+      if ( m_columns[column].type == ResultsColumn::Type::INTEGER ) {
+        encodeIntegers( bytes, chunk.integers[column] );
+      } else {
+        const auto &values = chunk.reals[column];
+        bytes.append( reinterpret_cast<const char *>( values.data() ), values.size() * sizeof( double ) );
+      }
+      uint64_t size = bytes.size() - start;
+      std::memcpy( &bytes[sizes + column * sizeof( uint64_t )], &size, sizeof( size ) );
+    }
+    m_out.write( bytes.data(), std::streamsize( bytes.size() ) );
+    if ( !m_out ) {
+      m_failure = "can't write " + m_path;
+    }
+  }
+
+  std::string m_path;
+  std::ofstream m_out;
+  std::vector<ResultsColumn> m_columns;
+  size_t m_chunk_rows = s_chunk_rows;
+  Chunk m_filling; // the appending thread's
+  std::mutex m_mut;
+  std::condition_variable m_cnd;
+  Chunk m_pending; // full, for the writer thread to take
+  bool m_pending_full = false;
+  bool m_stop = false;
+  std::optional<std::string> m_failure; // the writer thread's until it stopped
+  std::thread m_thread;
+};
+
+ResultsWriter::ResultsWriter() : impl{ new Impl } {}
+
+ResultsWriter::~ResultsWriter() noexcept {
+  close();
+}
+
+acpp::value_result<std::unique_ptr<ResultsWriter>> ResultsWriter::open(
+    const std::string &path,
+    const std::vector<ResultsColumn> &columns,
+    size_t chunk_rows ) {
+  if ( columns.empty() || !chunk_rows ) {
+    return { {}, "results need columns and rows" };
+  }
+  std::unique_ptr<ResultsWriter> writer{ new ResultsWriter };
+  auto &impl = *writer->impl;
+  impl.m_path = path;
+  impl.m_columns = columns;
+  impl.m_chunk_rows = chunk_rows;
+  impl.m_out.open( path, std::ios::binary | std::ios::trunc );
+  if ( !impl.m_out ) {
+    return { {}, "can't open " + path };
+  }
+  std::string header{ s_magic, sizeof( s_magic ) };
+  appendRaw( header, s_version );
+  appendRaw( header, uint32_t( columns.size() ) );
+  for ( const auto &column : columns ) {
+    appendRaw( header, column.type );
+    appendRaw( header, uint32_t( column.name.size() ) );
+    header.append( column.name );
+  }
+  impl.m_out.write( header.data(), std::streamsize( header.size() ) );
+  if ( !impl.m_out ) {
+    return { {}, "can't write " + path };
+  }
+  impl.resetChunk( impl.m_filling );
+  impl.resetChunk( impl.m_pending );
+  impl.m_thread = std::thread{ [&impl] { impl.writeMain(); } };
+  return acpp::value_result<std::unique_ptr<ResultsWriter>>{ std::move( writer ) };
+}
+
+void ResultsWriter::append( std::initializer_list<Value> row ) {
+  auto &chunk = impl->m_filling;
+  if ( row.size() != impl->m_columns.size() || !impl->m_thread.joinable() ) {
+    return;
+  }
+  size_t column = 0;
+  for ( const auto &value : row ) {
+    if ( impl->m_columns[column].type == ResultsColumn::Type::INTEGER ) {
+      chunk.integers[column].push_back( value.integer );
+    } else {
+      chunk.reals[column].push_back( value.real );
+    }
+    ++column;
+  }
+  if ( ++chunk.rows == impl->m_chunk_rows ) {
+    impl->handOff();
+  }
+}
+
+acpp::void_result<> ResultsWriter::close() {
+  if ( !impl->m_thread.joinable() ) {
+    return {};
+  }
+  if ( impl->m_filling.rows ) {
+    impl->handOff();
+  }
+  impl->stop();
+  impl->m_out.close();
+  if ( impl->m_failure ) {
+    return { {}, *impl->m_failure };
+  }
+  if ( !impl->m_out ) {
+    return { {}, "can't write " + impl->m_path };
+  }
+  return {};
+}
+
+class ResultsReader::Impl {
+public:
+  /**
+   * @brief Where a chunk's columns are in the file
+   */
+  struct ChunkIndex {
+    uint64_t rows;
+    std::vector<uint64_t> offsets; // by column
+    std::vector<uint64_t> sizes;
+  };
+
+  template <typename T>
+  bool get( T &value ) {
+    m_in.read( reinterpret_cast<char *>( &value ), sizeof( value ) );
+    return static_cast<bool>( m_in );
+  }
+
+  /**
+   * @brief Read the bytes of a column of each chunk in turn
+   */
+  template <typename Decode>
+  acpp::void_result<> scan( const std::string &name, ResultsColumn::Type type, Decode &&decode ) {
+    auto found = std::find_if( m_columns.begin(), m_columns.end(), [&]( const auto &column ) {
+      return column.name == name && column.type == type;
+    } );
+    if ( found == m_columns.end() ) {
+      return { {}, "no such column: " + name };
+    }
+    auto column = size_t( found - m_columns.begin() );
+    std::string bytes;
+    for ( const auto &chunk : m_chunks ) {
+      bytes.resize( chunk.sizes[column] );
+      m_in.clear();
+      m_in.seekg( std::streamoff( chunk.offsets[column] ) );
+      m_in.read( bytes.data(), std::streamsize( bytes.size() ) );
+      if ( !m_in || !decode( bytes, chunk.rows ) ) {
+        return { {}, m_path + " is corrupt" };
+      }
+    }
+    return {};
+  }
+
+  std::string m_path;
+  std::ifstream m_in;
+  std::vector<ResultsColumn> m_columns;
+  std::vector<ChunkIndex> m_chunks;
+  uint64_t m_rows = 0;
+};
+
+ResultsReader::ResultsReader() : impl{ new Impl } {}
+
+ResultsReader::~ResultsReader() noexcept = default;
+
+acpp::value_result<std::unique_ptr<ResultsReader>> ResultsReader::open( const std::string &path ) {
+  std::unique_ptr<ResultsReader> reader{ new ResultsReader };
+  auto &impl = *reader->impl;
+  impl.m_path = path;
+  impl.m_in.open( path, std::ios::binary | std::ios::ate );
+  if ( !impl.m_in ) {
+    return { {}, "can't open " + path };
+  }
+  uint64_t size = uint64_t( impl.m_in.tellg() );
+  impl.m_in.seekg( 0 );
+  char magic[sizeof( s_magic )];
+  uint32_t version = 0, count = 0;
+  impl.m_in.read( magic, sizeof( magic ) );
+  if ( !impl.m_in || !std::equal( std::begin( s_magic ), std::end( s_magic ), magic ) || !impl.get( version ) ||
+       version != s_version || !impl.get( count ) || !count ) {
+    return { {}, path + " is not a results file of this version" };
+  }
+  for ( uint32_t index = 0; index < count; ++index ) {
+    ResultsColumn column;
+    uint32_t length = 0;
+    if ( !impl.get( column.type ) || column.type > ResultsColumn::Type::REAL || !impl.get( length ) ||
+         length > size ) {
+      return { {}, path + " is corrupt" };
+    }
+    column.name.resize( length );
+    impl.m_in.read( column.name.data(), length );
+    impl.m_columns.push_back( std::move( column ) );
+  }
+  // index the chunks, reading their headers only
+  uint64_t offset = uint64_t( impl.m_in.tellg() );
+  while ( impl.m_in && offset < size ) {
+    Impl::ChunkIndex chunk;
+    chunk.sizes.resize( count );
+    if ( !impl.get( chunk.rows ) ||
+         !impl.m_in.read( reinterpret_cast<char *>( chunk.sizes.data() ), count * sizeof( uint64_t ) ) ) {
+      return { {}, path + " is truncated" };
+    }
+    offset += sizeof( uint64_t ) * ( 1 + count );
+    for ( uint32_t column = 0; column < count; ++column ) {
+      auto column_size = chunk.sizes[column];
+      if ( column_size > size - offset ) {
+        return { {}, path + " is truncated" };
+      }
+      // every value takes a byte at least, so the row count is never trusted alone
+      bool real = impl.m_columns[column].type == ResultsColumn::Type::REAL;
+      if ( real ? column_size != chunk.rows * sizeof( double ) : column_size < chunk.rows ) {
+        return { {}, path + " is corrupt" };
+      }
+      chunk.offsets.push_back( offset );
+      offset += column_size;
+    }
+    impl.m_rows += chunk.rows;
+    impl.m_chunks.push_back( std::move( chunk ) );
+    impl.m_in.seekg( std::streamoff( offset ) );
+  }
+  if ( !impl.m_in ) {
+    return { {}, path + " is corrupt" };
+  }
+  return acpp::value_result<std::unique_ptr<ResultsReader>>{ std::move( reader ) };
+}
+
+const std::vector<ResultsColumn> &ResultsReader::columns() const {
+  return impl->m_columns;
+}
+
+uint64_t ResultsReader::rows() const {
+  return impl->m_rows;
+}
+
+acpp::void_result<> ResultsReader::scanIntegers(
+    const std::string &column,
+    const std::function<void( const int64_t *values, size_t count )> &chunk ) const {
+  std::vector<int64_t> values;
+  return impl->scan( column, ResultsColumn::Type::INTEGER, [&]( const std::string &bytes, uint64_t rows ) {
+    if ( !decodeIntegers( bytes, rows, values ) ) {
+      return false;
+    }
+    chunk( values.data(), values.size() );
+    return true;
+  } );
+}
+
+acpp::void_result<> ResultsReader::scanReals(
+    const std::string &column,
+    const std::function<void( const double *values, size_t count )> &chunk ) const {
+  std::vector<double> values;
+  return impl->scan( column, ResultsColumn::Type::REAL, [&]( const std::string &bytes, uint64_t rows ) {
+    if ( bytes.size() != rows * sizeof( double ) ) {
+      return false;
+    }
+    values.resize( rows );
+    std::memcpy( values.data(), bytes.data(), bytes.size() );
+    chunk( values.data(), values.size() );
+    return true;
+  } );
+}
+
+}  // namespace sim
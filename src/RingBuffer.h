@@ -0,0 +1,312 @@
+/**
+ * RingBuffer.h
+ * Bounded lock-free queues that pads hold their messages in
+ */
+
+#ifndef SIM_RING_BUFFER_H_INCLUDED
+#define SIM_RING_BUFFER_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sim {
+
+namespace ring_util {
+
+// kept apart so that a producer and a consumer never write to the same cache line
+constexpr size_t s_cache_line = 64;
+
+inline size_t roundCapacity( size_t capacity ) noexcept {
+  size_t rounded = 1;
+  while ( rounded < capacity ) {
+    rounded <<= 1;
+  }
+  return rounded;
+}
+
+/**
+ * @brief One block from a memory resource holding a control header followed by slots
+ */
+template <typename Control, typename Slot>
+struct RingBlock {
+  static RingBlock allocate( size_t capacity, std::pmr::memory_resource *resource ) {
+    if ( !resource ) {
+      resource = std::pmr::new_delete_resource();
+    }
+    RingBlock block;
+    block.resource = resource;
+    block.capacity = capacity;
+    block.memory = resource->allocate( bytes( capacity ), s_cache_line );
+    block.control = ::new ( block.memory ) Control{};
+    block.slots = reinterpret_cast<Slot *>( static_cast<std::byte *>( block.memory ) + sizeof( Control ) );
+    for ( size_t index = 0; index < capacity; ++index ) {
+      ::new ( &block.slots[index] ) Slot; // default-initialized, storage stays raw until a push
+    }
+    return block;
+  }
+  void release() noexcept {
+    if ( !memory ) {
+      return;
+    }
+    for ( size_t index = 0; index < capacity; ++index ) {
+      slots[index].~Slot();
+    }
+    control->~Control();
+    resource->deallocate( memory, bytes( capacity ), s_cache_line );
+    memory = nullptr;
+  }
+  static size_t bytes( size_t capacity ) noexcept {
+    return sizeof( Control ) + capacity * sizeof( Slot );
+  }
+
+  std::pmr::memory_resource *resource = nullptr;
+  void *memory = nullptr;
+  Control *control = nullptr;
+  Slot *slots = nullptr;
+  size_t capacity = 0;
+};
+
+}  // namespace ring_util
+
+/**
+ * @brief Bounded queue for one producer thread and one consumer thread
+ * Elements are moved in and moved out of fixed slots; nothing is copied and nothing
+ * is allocated after construction. Each side keeps its index on its own cache line,
+ * along with a cached copy of the other side's, so it only reads the other's line
+ * when the ring looks full or empty.
+ * @tparam T the element type, must be nothrow move constructible
+ */
+template <typename T>
+class SpscRing {
+  static_assert( std::is_nothrow_move_constructible_v<T>, "ring elements must move without throwing" );
+
+public:
+  /**
+   * @param capacity the least number of elements held, rounded up to a power of two
+   * @param resource where the slots are allocated, nullptr for new/delete
+   */
+  explicit SpscRing( size_t capacity, std::pmr::memory_resource *resource = nullptr ) :
+      m_block{ Block::allocate( ring_util::roundCapacity( capacity ), resource ) },
+      m_mask{ m_block.capacity - 1 } {}
+  ~SpscRing() noexcept {
+    clear();
+    m_block.release();
+  }
+  SpscRing( SpscRing &&other ) noexcept :
+      m_block{ std::exchange( other.m_block, {} ) },
+      m_mask{ other.m_mask } {}
+  SpscRing( const SpscRing & ) = delete;
+  SpscRing &operator=( const SpscRing & ) = delete;
+  SpscRing &operator=( SpscRing && ) = delete;
+
+  /**
+   * @brief Move an element in, from the producer thread
+   * @return false, leaving value untouched, if the ring is full
+   */
+  bool push( T &&value ) noexcept {
+    auto &tail = m_block.control->tail;
+    auto position = tail.index.load( std::memory_order_relaxed );
+    if ( position - tail.other == m_block.capacity ) {
+      tail.other = m_block.control->head.index.load( std::memory_order_acquire );
+      if ( position - tail.other == m_block.capacity ) {
+        return false;
+      }
+    }
+    ::new ( m_block.slots[position & m_mask].storage ) T( std::move( value ) );
+    tail.index.store( position + 1, std::memory_order_release );
+    return true;
+  }
+  /**
+   * @brief Move the oldest element out, from the consumer thread
+   * @return false, leaving value untouched, if the ring is empty
+   */
+  bool pop( T &value ) noexcept {
+    auto &head = m_block.control->head;
+    auto position = head.index.load( std::memory_order_relaxed );
+    if ( position == head.other ) {
+      head.other = m_block.control->tail.index.load( std::memory_order_acquire );
+      if ( position == head.other ) {
+        return false;
+      }
+    }
+    auto *element = std::launder( reinterpret_cast<T *>( m_block.slots[position & m_mask].storage ) );
+    value = std::move( *element );
+    element->~T();
+    head.index.store( position + 1, std::memory_order_release );
+    return true;
+  }
+  /**
+   * @brief Move up to count of the oldest elements out at once, from the consumer thread
+   * Publishes the freed slots once for the lot, so draining a busy ring costs the
+   * producer one cache line transfer rather than one per element.
+   * @return size_t the number of elements moved into values
+   */
+  size_t pop( T *values, size_t count ) noexcept {
+    auto &head = m_block.control->head;
+    auto position = head.index.load( std::memory_order_relaxed );
+    head.other = m_block.control->tail.index.load( std::memory_order_acquire );
+    auto moved = std::min( count, head.other - position );
+    for ( size_t index = 0; index < moved; ++index ) {
+      auto *element = std::launder( reinterpret_cast<T *>( m_block.slots[( position + index ) & m_mask].storage ) );
+      values[index] = std::move( *element );
+      element->~T();
+    }
+    head.index.store( position + moved, std::memory_order_release );
+    return moved;
+  }
+  /**
+   * @brief Count the elements, exact on the consumer thread
+   */
+  size_t size() const noexcept {
+    auto head = m_block.control->head.index.load( std::memory_order_acquire );
+    return m_block.control->tail.index.load( std::memory_order_acquire ) - head;
+  }
+  size_t capacity() const noexcept {
+    return m_block.capacity;
+  }
+
+private:
+  struct alignas( ring_util::s_cache_line ) Index {
+    std::atomic<size_t> index{ 0 };
+    size_t other = 0; // last index seen of the other side
+  };
+  struct Control {
+    Index tail; // producer's
+    Index head; // consumer's
+  };
+  struct Slot {
+    alignas( T ) unsigned char storage[sizeof( T )];
+  };
+  using Block = ring_util::RingBlock<Control, Slot>;
+
+  void clear() noexcept {
+    if ( !m_block.memory ) {
+      return;
+    }
+    auto head = m_block.control->head.index.load( std::memory_order_relaxed );
+    auto tail = m_block.control->tail.index.load( std::memory_order_relaxed );
+    for ( ; head != tail; ++head ) {
+      std::launder( reinterpret_cast<T *>( m_block.slots[head & m_mask].storage ) )->~T();
+    }
+    m_block.control->head.index.store( head, std::memory_order_relaxed );
+  }
+
+  Block m_block;
+  size_t m_mask;
+};
+
+/**
+ * @brief Bounded queue for any number of producer threads and one consumer thread
+ * Producers claim a slot by advancing the tail and publish it through the slot's own
+ * sequence number (D. Vyukov's bounded queue), so a slow producer only holds up the
+ * consumer at its own slot.
+ * @tparam T the element type, must be nothrow move constructible
+ */
+template <typename T>
+class MpscRing {
+  static_assert( std::is_nothrow_move_constructible_v<T>, "ring elements must move without throwing" );
+
+public:
+  /**
+   * @param capacity the least number of elements held, rounded up to a power of two
+   * @param resource where the slots are allocated, nullptr for new/delete
+   */
+  explicit MpscRing( size_t capacity, std::pmr::memory_resource *resource = nullptr ) :
+      m_block{ Block::allocate( ring_util::roundCapacity( capacity ), resource ) },
+      m_mask{ m_block.capacity - 1 } {
+    for ( size_t index = 0; index < m_block.capacity; ++index ) {
+      m_block.slots[index].sequence.store( index, std::memory_order_relaxed );
+    }
+  }
+  ~MpscRing() noexcept {
+    if ( m_block.memory ) {
+      T value;
+      while ( pop( value ) ) {
+      }
+    }
+    m_block.release();
+  }
+  MpscRing( MpscRing &&other ) noexcept :
+      m_block{ std::exchange( other.m_block, {} ) },
+      m_mask{ other.m_mask } {}
+  MpscRing( const MpscRing & ) = delete;
+  MpscRing &operator=( const MpscRing & ) = delete;
+  MpscRing &operator=( MpscRing && ) = delete;
+
+  /**
+   * @brief Move an element in, from any thread
+   * @return false, leaving value untouched, if the ring is full
+   */
+  bool push( T &&value ) noexcept {
+    auto &tail = m_block.control->tail;
+    auto position = tail.load( std::memory_order_relaxed );
+    for ( ;; ) {
+      auto &slot = m_block.slots[position & m_mask];
+      auto sequence = slot.sequence.load( std::memory_order_acquire );
+      auto lag = static_cast<std::ptrdiff_t>( sequence - position );
+      if ( lag == 0 ) {
+        if ( tail.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ) {
+          ::new ( slot.storage ) T( std::move( value ) );
+          slot.sequence.store( position + 1, std::memory_order_release );
+          return true;
+        }
+      } else if ( lag < 0 ) {
+        return false; // the consumer has not freed this slot yet
+      } else {
+        position = tail.load( std::memory_order_relaxed );
+      }
+    }
+  }
+  /**
+   * @brief Move the oldest published element out, from the consumer thread
+   * @return false, leaving value untouched, if the ring is empty or the oldest claimed
+   * slot is still being written
+   */
+  bool pop( T &value ) noexcept {
+    auto &head = m_block.control->head;
+    auto position = head.load( std::memory_order_relaxed );
+    auto &slot = m_block.slots[position & m_mask];
+    if ( slot.sequence.load( std::memory_order_acquire ) != position + 1 ) {
+      return false;
+    }
+    auto *element = std::launder( reinterpret_cast<T *>( slot.storage ) );
+    value = std::move( *element );
+    element->~T();
+    slot.sequence.store( position + m_block.capacity, std::memory_order_release );
+    head.store( position + 1, std::memory_order_release );
+    return true;
+  }
+  /**
+   * @brief Count the elements, including any a producer is still writing
+   */
+  size_t size() const noexcept {
+    auto head = m_block.control->head.load( std::memory_order_acquire );
+    return m_block.control->tail.load( std::memory_order_acquire ) - head;
+  }
+  size_t capacity() const noexcept {
+    return m_block.capacity;
+  }
+
+private:
+  struct Control {
+    alignas( ring_util::s_cache_line ) std::atomic<size_t> tail{ 0 }; // producers'
+    alignas( ring_util::s_cache_line ) std::atomic<size_t> head{ 0 }; // consumer's
+  };
+  struct Slot {
+    std::atomic<size_t> sequence{ 0 };
+    alignas( T ) unsigned char storage[sizeof( T )];
+  };
+  using Block = ring_util::RingBlock<Control, Slot>;
+
+  Block m_block;
+  size_t m_mask;
+};
+
+}  // namespace sim
+
+#endif  // SIM_RING_BUFFER_H_INCLUDED
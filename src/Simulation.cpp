@@ -5,6 +5,16 @@
 #include "Simulation_p.h"
 #include "Instance_p.h"
 #include "Timeline.h"
+#include "SymbolTable.h"
+#include "Arena.h"
+#include "Fiber.h"
+#include "RingBuffer.h"
+#include "Checkpoint.h"
+#include "Ticks.h"
+#include "ChromeTrace.h"
+#ifdef SIM_TRACE
+#include "Trace.h"
+#endif
 
 #include <map>
 #include <vector>
@@ -15,9 +25,20 @@
 #include <deque>
 #include <list>
 #include <set>
-#include <any>
+#include <memory_resource>
 #include <variant>
 #include <queue>
+#include <atomic>
+#include <shared_mutex>
+#include <exception>
+#include <unordered_map>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <system_error>
+#include <array>
+#include <fstream>
+#include <sstream>
 
 namespace sim {
 
@@ -33,31 +54,33 @@ struct SimEvent {
 
   SimEvent( Type type,
       const Clock::time_point &time,
-      const std::string &spec,
-      const std::string &name,
-      const std::string &owner = {},
-      const PropertyList &parameters = {},
-      std::any payload = {} ) :
+      SymbolId spec,
+      SymbolId name,
+      SymbolId owner = no_symbol,
+      Payload &&payload = {} ) :
       type{ type },
       time{ time },
       spec{ spec },
       name{ name },
       owner{ owner },
-      parameters{ parameters },
-      payload{ payload } {}
+      payload{ std::move( payload ) } {}
   ~SimEvent() = default;
-  SimEvent( SimEvent & ) = default;
-  SimEvent &operator=( SimEvent & ) = default;
   SimEvent( SimEvent && ) = default;
   SimEvent &operator=( SimEvent && ) = default;
 
+  /**
+   * @brief Copy the event, with its payload if that can be copied
+   */
+  SimEvent clone() const {
+    return SimEvent{ type, time, spec, name, owner, payload.clone() };
+  }
+
   Type type;
   Clock::time_point time;
-  std::string spec;
-  std::string name;
-  std::string owner;
-  PropertyList parameters;
-  std::any payload;
+  SymbolId spec;  // model, activity spec or pad name, by type
+  SymbolId name;  // instance (SPAWN_INSTANCE) or activity name
+  SymbolId owner; // instance owning the activity or receiving pad
+  Payload payload;
 
   friend bool operator<( const SimEvent &eva, const SimEvent &evb ) {
     return eva.time < evb.time;
@@ -68,40 +91,445 @@ struct SimEvent {
 };
 
 struct WaitingActivity {
-  using PromiseVariant = std::variant<std::promise<bool>, std::promise<std::any>>;
-
   WaitingActivity( const Clock::time_point &time = {} ) :
-      promise{ std::in_place_index<0> },
       time{ time } {}
-  WaitingActivity( const std::string &signal_name, const Clock::time_point &time ) :
-      promise{ std::in_place_index<1> },
+  WaitingActivity( SymbolId signal, const Clock::time_point &time, SymbolId scope = no_symbol ) :
       time{ time },
-      signal_name{ signal_name } {}
-  PromiseVariant promise;
+      signal{ signal },
+      scope{ scope } {}
   Clock::time_point time;
-  std::string signal_name;
+  SymbolId signal = no_symbol; // signal or pad name waited on
+  SymbolId scope = no_symbol;  // instance id owning the pad, no_symbol for a signal
+  TimelineHandle resume; // the scheduled RESUME_ACTIVITY (wake up or timeout), if any
+  std::shared_ptr<Activity> activity; // null while the slot is free
+  // neighbouring slots waiting on the same signal or pad, no_symbol at the ends, see Waiters
+  uint32_t prev = no_symbol;
+  uint32_t next = no_symbol;
+  // when the wait began, while exporting a Chrome trace
+  Clock::time_point since;
+  uint64_t since_ticks = 0;
+};
+
+/**
+ * @brief The slots waiting on one signal or pad, linked through WaitingActivity prev and next
+ * in the order they began, so that any of them leaves in constant time
+ */
+struct Waiters {
+  uint32_t first = no_symbol;
+  uint32_t last = no_symbol;
+  size_t count = 0;
+};
+
+struct PendingSpawn {
+  TimelineHandle event; // empty while the spawn waits in the inbox
+  PropertyList parameters;
+  uint32_t partition;
+};
+
+/**
+ * @brief An event posted to the inbox from outside the simulation, see Simulation::inject
+ */
+struct Injection {
+  uint32_t partition = 0;
+  uint64_t seq = 0;
+  SimEvent event{ SimEvent::Type::STATE_CHANGE, {}, no_symbol, no_symbol };
+  SymbolId signal = no_symbol; // a signal to raise as the run takes it in, instead of the event
+};
+
+/**
+ * @brief An event an optimistic run handled but may still have to take back
+ */
+struct Processed {
+  struct Sent {
+    uint64_t seq;
+    Clock::time_point time;
+    uint32_t partition;
+  };
+
+  Processed( uint64_t seq, SimEvent &&event ) :
+      seq{ seq },
+      event{ std::move( event ) } {}
+
+  uint64_t seq;
+  SimEvent event;               // with a copy of its payload, to be handled again
+  Instance *instance = nullptr; // that handled it
+  Payload state;                // of the instance before
+  uint64_t event_count = 0;     // of the instance before
+  std::vector<Sent> sent;       // events it scheduled
+};
+
+namespace {
+
+/*
+ * Events at equal times are ordered by how many events at that time led to them, then
+ * by the instance that scheduled them, then in the order it scheduled them, rather than
+ * by insertion into an event list. That order is the same however the instances are
+ * partitioned, which is what lets a parallel run reproduce a sequential one exactly, and
+ * an event always orders after the one that scheduled it, which is what lets an
+ * optimistic run tell which events a late message should have preceded. The
+ * tie-breaker holds the depth above the instance id + 1 above this many bits of the
+ * instance's count; events scheduled from outside any instance use 0 for both. Chains
+ * of equal times deeper than s_max_depth share the last depth.
+ */
+constexpr unsigned s_depth_shift = 56;
+constexpr unsigned s_origin_shift = 36;
+constexpr uint64_t s_max_depth = ( uint64_t( 1 ) << ( 64 - s_depth_shift ) ) - 1;
+constexpr uint64_t s_max_instances = ( uint64_t( 1 ) << ( s_depth_shift - s_origin_shift ) ) - 1;
+
+/*
+ * Events an optimistic partition runs ahead between agreements on GVT
+ */
+constexpr size_t s_optimism = 256;
+
+Clock::time_point later( const Clock::time_point &time, Clock::duration delay ) {
+  return time < Clock::time_point::max() - delay ? time + delay : Clock::time_point::max();
+}
+
+constexpr const char *s_type_names[] = {
+    "STATE_CHANGE", "SPAWN_INSTANCE", "SPAWN_ACTIVITY", "RESUME_ACTIVITY", "SPAWN_PAD", "PAD_SEND" };
+constexpr size_t s_event_types = std::size( s_type_names );
+static_assert( s_event_types == size_t( SimEvent::Type::PAD_SEND ) + 1, "a name for every event type" );
+
+const char *typeName( uint8_t type ) noexcept {
+  return type < s_event_types ? s_type_names[type] : "UNKNOWN";
+}
+
+/**
+ * @brief What one partition handled while profiling, by instance and event type
+ * Only the thread stepping the partition touches it.
+ */
+struct PartitionProfile {
+  struct Cell {
+    uint64_t events = 0;
+    uint64_t ticks = 0;
+    uint64_t depth_sum = 0;
+    uint64_t depth_max = 0;
+  };
+
+  /**
+   * @param instance the instance the event was for, no_symbol for none
+   * @param depth the events left pending as it was dispatched
+   */
+  void add( SymbolId instance, SimEvent::Type type, size_t depth, uint64_t elapsed ) {
+    auto index = ( instance == no_symbol ? 0 : size_t( instance ) + 1 ) * s_event_types + size_t( type );
+    if ( index >= m_cells.size() ) {
+      m_cells.resize( std::max( index + 1, m_cells.size() * 2 ) );
+    }
+    auto &cell = m_cells[index];
+    ++cell.events;
+    cell.ticks += elapsed;
+    cell.depth_sum += depth;
+    cell.depth_max = std::max<uint64_t>( cell.depth_max, depth );
+  }
+
+  std::vector<Cell> m_cells; // by ( instance id + 1 ) * s_event_types + type, 0 for none
 };
 
+#ifdef SIM_TRACE
+/*
+ * Which name table each id of an event indexes, which varies by type
+ */
+enum class IdKind { NONE, NAME, INSTANCE };
+
+std::array<IdKind, 3> eventIds( SimEvent::Type type ) noexcept {
+  // spec, name, owner
+  switch ( type ) {
+  case SimEvent::Type::SPAWN_INSTANCE:
+    return { IdKind::NAME, IdKind::INSTANCE, IdKind::NONE };
+  case SimEvent::Type::RESUME_ACTIVITY: // named by the activity's id
+  case SimEvent::Type::PAD_SEND:
+    return { IdKind::NAME, IdKind::NONE, IdKind::INSTANCE };
+  default:
+    return { IdKind::NAME, IdKind::NAME, IdKind::INSTANCE };
+  }
+}
+
+/**
+ * @brief Describe an event for a replay failure, e.g. "PAD_SEND in n1 at 2000000 ns, seq 7"
+ */
+std::string describeEvent( uint8_t type,
+    int64_t time,
+    uint64_t seq,
+    const std::array<uint32_t, 3> &ids,
+    const std::vector<std::string> &names,
+    const std::vector<std::string> &instance_names ) {
+  std::string text = typeName( type );
+  auto kinds = eventIds( SimEvent::Type( type ) );
+  for ( size_t field = 0; field < ids.size(); ++field ) {
+    auto id = ids[field];
+    if ( id == no_symbol ) {
+      continue;
+    }
+    const auto &table = kinds[field] == IdKind::INSTANCE ? instance_names : names;
+    text += ' ';
+    text += kinds[field] != IdKind::NONE && id < table.size() ? table[id] : "#" + std::to_string( id );
+  }
+  return text + " at " + std::to_string( time ) + " ns, seq " + std::to_string( seq );
+}
+#endif
+
+}  // namespace
+
 struct Simulation::Impl {
-  Impl( Simulation &simulation ) : m_simulation{ simulation } {}
-  ~Impl() = default;
+  struct Channel;
+
+  /**
+   * @brief A share of the instances with its own event list
+   * In a parallel run each partition is stepped by its own thread, which alone touches
+   * its members; between runs the simulation steps them all in one time order.
+   */
+  struct Partition {
+    Partition( Impl &owner, uint32_t index, QueueKind queue, std::pmr::memory_resource *resource ) :
+        m_owner{ &owner },
+        m_index{ index },
+        m_events{ SelectableQueue{ queue } },
+        m_waiting{ resource },
+        m_waiters{ resource } {}
+
+    /**
+     * @brief Schedule an event, see Impl::schedule for one an optimistic run can take back
+     * @param parameters of the instance a SPAWN_INSTANCE spawns, for the trace
+     */
+    TimelineHandle insert( uint64_t seq, SimEvent &&event, const PropertyList *parameters = nullptr ) {
+#ifdef SIM_TRACE
+      if ( m_trace ) {
+        m_owner->traceInsert( *this, seq, event, parameters );
+      }
+#else
+      (void)parameters;
+#endif
+      return m_events.emplace_ordered( seq, std::move( event ) );
+    }
+    bool cancel( TimelineHandle handle ) {
+#ifdef SIM_TRACE
+      if ( m_trace && m_events.contains( handle ) ) {
+        m_trace->record( trace::Op::CANCEL, handle.seq, 0, 0, no_symbol, no_symbol, no_symbol, uint16_t( m_index ) );
+      }
+#endif
+      return m_events.cancel( handle );
+    }
+    bool reschedule( TimelineHandle handle, const Clock::time_point &time ) {
+#ifdef SIM_TRACE
+      if ( m_trace && m_events.contains( handle ) ) {
+        m_trace->record( trace::Op::RESCHEDULE, handle.seq, time.time_since_epoch().count(), 0, no_symbol, no_symbol,
+            no_symbol, uint16_t( m_index ) );
+      }
+#endif
+      return m_events.reschedule( handle, time );
+    }
+    /**
+     * @brief Take the earliest event out to handle it
+     * @param seq set to its tie-breaker
+     */
+    SimEvent extract( uint64_t &seq ) {
+      seq = m_events.top_entry().seq;
+#ifdef SIM_TRACE
+      if ( m_trace ) {
+        const auto &event = m_events.top();
+        m_trace->record( trace::Op::HANDLE, seq, event.time.time_since_epoch().count(), uint8_t( event.type ),
+            event.owner, event.name, event.spec, uint16_t( m_index ) );
+      }
+#endif
+      return m_events.extract();
+    }
+
+    StackPool m_stacks; // first so that it outlives the activities waiting below
+    Impl *m_owner;
+    uint32_t m_index;
+    Clock::time_point m_simtime;
+    Timeline<SimEvent, SelectableQueue> m_events;
+    std::pmr::vector<WaitingActivity> m_waiting; // by activity slot, grown on demand
+    size_t m_waiting_count = 0;
+    // slots waiting on a signal or pad in the order they began, see waiterKey
+    std::pmr::unordered_map<uint64_t, Waiters> m_waiters;
+    Instance *m_origin = nullptr; // instance whose event is being handled, see nextSeq
+    uint64_t m_seq = 0;           // tie-breaker of the event being handled
+    // parallel runs only
+    std::vector<Channel *> m_inputs;
+    std::vector<Channel *> m_outputs; // by receiving partition, nullptr where not linked
+    bool m_idle = false;
+    std::mutex m_wake_mut;
+    std::condition_variable m_wake_cnd;
+    uint64_t m_wakeups = 0;
+    // optimistic runs only
+    std::deque<Processed> m_processed; // not before GVT, in the order handled
+    std::unordered_map<uint64_t, TimelineHandle> m_scheduled; // m_events by tie-breaker
+    Processed *m_record = nullptr; // of the event being handled
+    uint64_t m_posted = 0;         // messages and anti-messages sent
+    std::string m_failure;
+    std::unique_ptr<PartitionProfile> m_profile; // while profiling, see attachProfile
+    ChromeTraceBuffer *m_chrome = nullptr; // while exporting, see attachChromeTrace
+#ifdef SIM_TRACE
+    TraceBuffer *m_trace = nullptr; // while tracing, see attachTrace
+#endif
+  };
+
+  /**
+   * @brief Messages and null messages from one partition to another in a parallel run
+   * The promise says the sender won't send anything earlier. Messages are pushed before
+   * the promise covering them is raised, both under m_mut, so a receiver reading the
+   * promise and draining under m_mut holds every message earlier than the promise.
+   */
+  struct Channel {
+    struct Message {
+      uint64_t seq;
+      SimEvent event;
+      bool anti = false; // takes back the message of the same seq in an optimistic run
+    };
+
+    Channel( uint32_t from, uint32_t to, Clock::duration lookahead ) :
+        m_from{ from },
+        m_to{ to },
+        m_lookahead{ lookahead } {}
+
+    uint32_t m_from;
+    uint32_t m_to;
+    Clock::duration m_lookahead; // least lookahead of the pad links it carries
+    std::mutex m_mut;
+    std::vector<Message> m_messages;
+    Clock::time_point m_promise;
+  };
+
+  /**
+   * @brief Where the partitions of an optimistic run meet, e.g. to agree on GVT
+   * Each brings a time and a flag, and leaves once all came with the least time and
+   * whether any flag was set.
+   */
+  struct Rendezvous {
+    std::pair<Clock::time_point, bool> meet( const Clock::time_point &time, bool flag ) {
+      std::unique_lock lock{ m_mut };
+      if ( m_arrived == 0 ) {
+        m_least = Clock::time_point::max();
+        m_any = false;
+      }
+      m_least = std::min( m_least, time );
+      m_any = m_any || flag;
+      if ( ++m_arrived == m_parties ) {
+        m_arrived = 0;
+        m_result = { m_least, m_any };
+        ++m_generation;
+        m_cnd.notify_all();
+      } else {
+        auto generation = m_generation;
+        m_cnd.wait( lock, [&] { return m_generation != generation; } );
+      }
+      return m_result;
+    }
+
+    size_t m_parties = 0;
+    size_t m_arrived = 0;
+    uint64_t m_generation = 0;
+    Clock::time_point m_least;
+    bool m_any = false;
+    std::pair<Clock::time_point, bool> m_result;
+    std::mutex m_mut;
+    std::condition_variable m_cnd;
+  };
+
+  /**
+   * @brief Makes a partition the current one on this thread for a while
+   */
+  struct PartitionScope {
+    explicit PartitionScope( Partition &partition ) noexcept : m_previous{ t_partition } {
+      t_partition = &partition;
+    }
+    ~PartitionScope() noexcept {
+      t_partition = m_previous;
+    }
+    Partition *m_previous;
+  };
+
+  Impl( Simulation &simulation, Simulator &simulator, EventQueue queue ) :
+      m_simulation{ simulation },
+      m_simulator{ &simulator },
+      m_queue{ toQueueKind( queue ) },
+      m_pending_spawns{ m_arena.resource() } {
+    m_partitions.push_back( std::make_unique<Partition>( *this, 0, m_queue, m_arena.resource() ) );
+  }
+  ~Impl() {
+#ifdef SIM_TRACE
+    stopTrace();
+#endif
+    stopChromeTrace();
+    // waiting activities unwind while their instances and every partition are there
+    for ( auto &partition : m_partitions ) {
+      for ( auto &waiting : partition->m_waiting ) {
+        if ( waiting.activity ) {
+          Activity::Private::unwind( *waiting.activity );
+        }
+      }
+    }
+    for ( auto &partition : m_partitions ) {
+      partition->m_waiters.clear();
+      partition->m_waiting.clear();
+      partition->m_waiting_count = 0;
+    }
+    m_instances.clear();
+  }
   Impl( Impl &&other ) = default;
   Impl &operator=( Impl &&other ) = default;
-  
+
   struct ActivityEvents {
     std::set<SimEvent> events;
   };
+  Arena m_arena; // first so that it is destroyed after everything allocated from it
   Simulation &m_simulation; // Simulation owns Simulation::Impl
-  Clock::time_point m_simtime;
-  State m_state = State::INIT;
-  State m_pending_state = State::INIT;
+  Simulator *m_simulator;    // resolves model names, outlives the simulation
+  QueueKind m_queue;
+  Clock::time_point m_simtime; // of the last event handled by a run, or where it was run until
+  std::atomic<State> m_state{ State::INIT };
+  std::atomic<State> m_pending_state{ State::INIT };
   PropertyList m_parameters;
-  std::map<std::string, std::shared_ptr<Instance>> m_instances;
-  Timeline<SimEvent> m_events;
-  std::map<std::shared_ptr<Activity>, WaitingActivity> m_waiting_activities;
-  std::thread m_worker;
-  std::mutex m_state_mut;
-  std::condition_variable m_state_cnd;
+  mutable std::mutex m_collectors_mut;
+  std::map<std::string, std::shared_ptr<Collector>> m_collectors;
+  mutable std::shared_mutex m_names_mut; // the name tables, m_models and growing m_instances
+  SymbolTable m_instance_names; // ids index m_instances
+  SymbolTable m_names;          // model, activity, pad and signal names
+  std::vector<std::shared_ptr<Model>> m_models; // resolved on first spawn, by m_names id
+  std::mutex m_spawn_mut;
+  std::pmr::unordered_map<SymbolId, PendingSpawn> m_pending_spawns;
+  std::vector<std::unique_ptr<Partition>> m_partitions; // before m_instances, whose fibers use their stacks
+  std::vector<std::shared_ptr<Instance>> m_instances;   // never grows during a parallel run
+  std::vector<std::unique_ptr<Channel>> m_channels;     // between partitions during a parallel run
+  std::atomic<bool> m_running{ false };
+  std::atomic<bool> m_interrupt{ false }; // PAUSE or DONE was requested while running
+  std::atomic<bool> m_parallel{ false }; // read by spawns from any thread
+  Synchronization m_synchronization = Synchronization::CONSERVATIVE;
+  bool m_optimistic = false; // during an optimistic parallel run
+  Rendezvous m_rendezvous;
+  std::atomic<size_t> m_active{ 0 }; // busy partitions plus undelivered messages
+  std::atomic<bool> m_stopping{ false };
+  std::atomic<uint64_t> m_external_seq{ 0 };
+  std::atomic<uint32_t> m_activity_slots{ 0 }; // handed out by activitySlot
+  std::once_flag m_inbox_once;
+  std::unique_ptr<MpscRing<Injection>> m_inbox; // made on first use, see inbox()
+  std::atomic<bool> m_inbox_made{ false };
+  std::mutex m_error_mut;
+  std::exception_ptr m_error;
+#ifdef SIM_TRACE
+  std::unique_ptr<TraceWriter> m_trace; // while tracing
+#endif
+  /**
+   * @brief The span a profile covers; partitions count into their m_profile while it runs
+   */
+  struct Profiling {
+    TickRate rate;                 // from the start
+    Clock::time_point from;        // simulation time at the start
+    Clock::time_point until;       // and at the stop, once stopped
+    double wall = 0.0;             // once stopped
+    double ticks_per_second = 0.0; // once stopped
+    bool running = true;
+    std::vector<PartitionProfile> stopped; // the partitions' counts, once stopped
+  };
+  std::unique_ptr<Profiling> m_profiling; // since the first startProfile
+  std::unique_ptr<ChromeTraceWriter> m_chrome; // while exporting
+
+  static thread_local Partition *t_partition;
+
+  /**
+   * Events the inbox holds before it pushes back on other threads
+   */
+  static constexpr size_t s_inbox_capacity = 1024;
 
   acpp::void_result<> insertSpawnInstance(
       const std::string &model,
@@ -109,47 +537,277 @@ struct Simulation::Impl {
       const PropertyList &parameters,
       const Clock::time_point &time );
 
+  /**
+   * @brief Make an instance at once rather than by an event, then schedule its start
+   * Only between runs, so that it can be connected before any of its activities run.
+   * @return acpp::value_result<std::shared_ptr<Instance>> the instance or error
+   */
+  acpp::value_result<std::shared_ptr<Instance>> makeInstance(
+      const std::string &model,
+      const std::string &name,
+      const PropertyList &parameters );
+  /**
+   * @brief The partition an instance goes to, see setPartitions
+   */
+  uint32_t partitionFor( SymbolId instance_id, const PropertyList &parameters ) const;
+
   acpp::void_result<> insertSpawnActivity(
       const std::string &spec,
       const std::string &name,
       const std::string &instance,
       const Clock::time_point &time );
 
-  std::future<bool> insertResumeActivity(
+  acpp::void_result<> insertResumeActivity(
       std::shared_ptr<Activity> activity,
       const Clock::time_point &time );
 
-  std::future<bool> activityWaitOn(
+  acpp::void_result<> activityWaitOn(
       std::shared_ptr<Activity> activity,
-      const std::string &signal_name,
+      SymbolId signal,
       const Clock::time_point &time = {} );
 
   /**
    * @brief Schedule a Pad receiving event in the simulator
-   * 
+   *
    * @param activity the activity owning the pad
-   * @param pad_name the name of the pad which will receive or timeout
+   * @param pad the name id of the pad which will receive or timeout
    * @param time the time at which the pad will receive or timeout
-   * @return std::future<bool> to wait on
+   * @return acpp::void_result<> success or error
    */
-  std::future<bool> activityPadReceive(
+  acpp::void_result<> activityPadReceive(
       std::shared_ptr<Activity> activity,
-      const std::string &pad_name,
+      SymbolId pad,
       const Clock::time_point &time = {} );
 
-  void handleStateChange( const SimEvent &event );
-  void handleSpawnInstance( const SimEvent &event );
-  void handleSpawnActivity( const SimEvent &event );
-  void handleResumeActivity( const SimEvent &event );
-  void handleSpawnPad( const SimEvent &event );
-  void handlePadSend( const SimEvent &event );
+  /**
+   * @brief Record an activity as waiting, dropping any resume it still had scheduled
+   * @param partition the partition of the activity's instance
+   * @param activity the activity about to block
+   * @param waiting its wait description, resume may be a freshly scheduled event
+   * @return acpp::void_result<> success or error
+   */
+  acpp::void_result<> waitActivity( Partition &partition, std::shared_ptr<Activity> activity, WaitingActivity &&waiting );
+
+  /**
+   * @brief Free the slot of a waiting activity and take it off its signal's waiters
+   * @return std::shared_ptr<Activity> the activity that waited in the slot
+   */
+  std::shared_ptr<Activity> releaseWaiting( Partition &partition, uint32_t slot );
+
+  /**
+   * @brief Key of m_waiters: the pad owner's instance id, or no_symbol, and the signal
+   */
+  static uint64_t waiterKey( const WaitingActivity &waiting ) noexcept {
+    return uint64_t( waiting.scope ) << 32 | waiting.signal;
+  }
+
+  /**
+   * @brief Schedule the resume of a waiting activity at now, moving its timeout if any
+   */
+  void wakeWaiting( Partition &partition, WaitingActivity &waiting );
+
+  /**
+   * @brief Wake every activity of the partition waiting on a signal
+   * @return size_t the number woken
+   */
+  size_t raiseSignal( Partition &partition, SymbolId signal );
+  /**
+   * @brief Wake the activities waiting on a signal, from any thread
+   * Called from an activity, only its own partition's waiters are woken. From another
+   * thread during a run the signal goes through the inbox, see Simulation::raiseSignal.
+   * @return acpp::value_result<size_t> the number woken, 0 if posted, or inbox full
+   */
+  acpp::value_result<size_t> raiseSignal( const std::string &signal_name );
+
+  /**
+   * @brief Wake an activity blocked receiving on a pad that just got a message
+   * A pending receive timeout is moved to now rather than left in the timeline.
+   * @param pad the pad that received
+   */
+  void padReceived( std::shared_ptr<Pad> pad );
+  bool padSend( std::shared_ptr<Pad> pad, Payload &&payload );
+
+  void handleStateChange( Partition &partition, const SimEvent &event );
+  void handleSpawnInstance( Partition &partition, const SimEvent &event );
+  void handleSpawnActivity( Partition &partition, SimEvent &event );
+  void handleResumeActivity( Partition &partition, SimEvent &event );
+  void handleSpawnPad( Partition &partition, const SimEvent &event );
+  void handlePadSend( Partition &partition, SimEvent &event );
+
+  static QueueKind toQueueKind( EventQueue queue );
+  std::shared_ptr<Model> resolveModel( SymbolId model );
+  SymbolId intern( const std::string &name );
+  SymbolId symbol( const std::string &name ) const;
+  std::string name( SymbolId id ) const;
+
+  Partition *current() const noexcept {
+    return t_partition && t_partition->m_owner == this ? t_partition : nullptr;
+  }
+  Partition &partitionOf( const Instance &instance ) const {
+    return *m_partitions[Instance::Private::partition( instance )];
+  }
+  Clock::time_point now() const noexcept {
+    auto partition = current();
+    return partition ? partition->m_simtime : m_simtime;
+  }
+  Clock::time_point eventTime( const Clock::time_point &time ) const noexcept {
+    return time.time_since_epoch() == Clock::duration::zero() ? now() : time;
+  }
+  /**
+   * @brief Make the tie-breaker of an event about to be scheduled, see s_depth_shift
+   * @param time when the event is scheduled for
+   */
+  uint64_t nextSeq( const Clock::time_point &time );
+  /**
+   * @brief Schedule an event in a partition from that partition or between runs
+   * An optimistic run remembers it, to cancel it on rollback.
+   */
+  TimelineHandle schedule( Partition &partition, uint64_t seq, SimEvent &&event );
+  /**
+   * @brief Make a parallel run fail once the event being handled is done
+   */
+  acpp::void_result<> fail( Partition &partition, const std::string &message );
+
+  /**
+   * @brief Whether a request comes from outside the events of a run, from another thread
+   */
+  bool foreign() const noexcept {
+    return m_running.load() && !current();
+  }
+  MpscRing<Injection> &inbox();
+  /**
+   * @brief Post an event to the inbox, from any thread
+   * @return acpp::void_result<> resource_unavailable_try_again if the inbox is full
+   */
+  acpp::void_result<> enqueue( uint32_t partition, uint64_t seq, SimEvent &&event );
+  /**
+   * @brief Move the events posted to the inbox into the event lists, from the running thread
+   * An event posted for no particular time, or for a time gone by, happens now.
+   * @return size_t the number of events moved
+   */
+  size_t drainInbox();
+  acpp::void_result<> injectPadSend(
+      const std::string &instance,
+      const std::string &pad,
+      Payload &&payload,
+      const Clock::time_point &time );
+
+  acpp::void_result<> setPartitions( size_t count );
+  acpp::void_result<> startProfile();
+  acpp::void_result<> stopProfile();
+  acpp::value_result<Profile> profile() const;
+  /**
+   * @brief Give every partition a profile to count into while profiling, none otherwise
+   */
+  void attachProfile();
+  acpp::void_result<> startChromeTrace( const std::string &path, TraceAxis axis );
+  acpp::void_result<> stopChromeTrace();
+  /**
+   * @brief Point every partition and pad at its Chrome trace buffer, or at none when not exporting
+   */
+  void attachChromeTrace();
+  /**
+   * @brief Point the pads of an instance at the buffer of its partition, or at none
+   */
+  void attachChromeTrace( Instance &instance );
+#ifdef SIM_TRACE
+  acpp::void_result<> startTrace( const std::string &path );
+  acpp::void_result<> stopTrace();
+  /**
+   * @brief Point every partition at its trace buffer, or at none when not tracing
+   */
+  void attachTrace();
+  /**
+   * @brief Record a SCHEDULE, and keep the event whole if it comes from outside the simulation
+   */
+  void traceInsert( Partition &partition, uint64_t seq, const SimEvent &event, const PropertyList *parameters );
+  acpp::value_result<size_t> replayTrace( const std::string &path );
+  /**
+   * @brief Schedule an event kept by traceInsert again, interning its names as they were
+   * @return std::string why it can't be, empty if it was
+   */
+  std::string feedStimulus( const trace::Stimulus &stimulus );
+#endif
+  /**
+   * @brief Whether anything was spawned, or is to be, since the simulation was made
+   */
+  bool spawnedAny();
+  acpp::void_result<> runParallel( const Clock::time_point &until );
+  acpp::void_result<> link();
+  void unlink();
+  Clock::time_point drain( Partition &partition );
+  void post( Channel &channel, uint64_t seq, SimEvent &&event, bool anti = false );
+  void publish( Partition &partition, const Clock::time_point &horizon );
+  void wake( Partition &partition );
+  void stop();
+  void partitionMain( Partition &partition, Clock::time_point until );
+  void dispatch( Partition &partition, uint64_t seq, SimEvent &&event );
+
+  // optimistic runs
+  acpp::void_result<> checkOptimistic();
+  void optimisticMain( Partition &partition, Clock::time_point until );
+  /**
+   * @brief Handle events ahead, receiving messages in between
+   * @return bool false if the run failed
+   */
+  bool speculate( Partition &partition, const Clock::time_point &until );
+  /**
+   * @brief Take in messages and anti-messages, rolling back as late ones demand
+   */
+  void receive( Partition &partition );
+  /**
+   * @brief Undo the handled events that order at or after an event
+   * @param time the event's time
+   * @param seq the event's tie-breaker
+   */
+  void rollback( Partition &partition, const Clock::time_point &time, uint64_t seq );
+  void annihilate( Partition &partition, uint64_t seq, const Clock::time_point &time );
+  /**
+   * @brief Receive with all partitions until none has anything left to send
+   */
+  void settle( Partition &partition );
 
   void setState( const Simulation::State &state );
-  void step();
-  void workerFunc();
+  /**
+   * @brief Get the partition holding the earliest event, in the order a parallel run agrees with
+   * @return Partition* the partition or nullptr if no events are left
+   */
+  Partition *earliest() const noexcept;
+  /**
+   * @brief Run events in time order on the calling thread, see Simulation::runUntil
+   * @param until the last time to run events at
+   * @param limit the most events to run
+   * @return acpp::value_result<size_t> the number of events run
+   */
+  acpp::value_result<size_t> run( const Clock::time_point &until, size_t limit );
+
+  // checkpoints, see Simulation::checkpoint
+  acpp::void_result<> checkpoint( std::ostream &out );
+#if ACPP_LESSON > 3
+  /**
+   * @brief Write the messages queued in an instance's pads, leaving them queued
+   */
+  acpp::void_result<> checkpointPads( CheckpointWriter &writer, const Instance &instance );
+  /**
+   * @brief Write each pad link once, from the pad of the lesser instance and pad ids
+   */
+  void checkpointLinks( CheckpointWriter &writer, const std::vector<std::shared_ptr<Instance>> &instances );
+#endif // ACPP_LESSON > 3
+  acpp::void_result<> restore( std::istream &in );
+  acpp::void_result<> restoreInstance( CheckpointReader &reader );
+  acpp::void_result<> restoreLinks( CheckpointReader &reader );
+
+  /**
+   * Events a synchronous run handles between looks at m_interrupt, a power of two
+   */
+  static constexpr size_t s_poll_interval = 64;
 };
 
-Simulation::Simulation() : impl( new Impl{ *this } ) {}
+thread_local Simulation::Impl::Partition *Simulation::Impl::t_partition = nullptr;
+
+Simulation::Simulation() : Simulation( EventQueue::HEAP ) {}
+Simulation::Simulation( EventQueue queue ) : Simulation( Simulator::getInstance(), queue ) {}
+Simulation::Simulation( Simulator &simulator, EventQueue queue ) : impl( new Impl{ *this, simulator, queue } ) {}
 Simulation::~Simulation() = default;
 Simulation::Simulation( Simulation &&other ) = default;
 Simulation &Simulation::operator=( Simulation &&other ) = default;
@@ -170,154 +828,639 @@ acpp::void_result<> Simulation::spawnActivity(
   return impl->insertSpawnActivity( spec_name, name, instance, time );
 }
 
+uint64_t Simulation::Impl::nextSeq( const Clock::time_point &time ) {
+  auto partition = current();
+  if ( partition && partition->m_origin ) {
+    uint64_t depth = 0;
+    if ( partition->m_seq && time == partition->m_simtime ) {
+      depth = std::min( ( partition->m_seq >> s_depth_shift ) + 1, s_max_depth );
+    }
+    auto origin = uint64_t( Instance::Private::id( *partition->m_origin ) ) + 1;
+    return ( depth << s_depth_shift ) | ( origin << s_origin_shift ) |
+           Instance::Private::nextSeq( *partition->m_origin );
+  }
+  return m_external_seq.fetch_add( 1, std::memory_order_relaxed ) + 1;
+}
+
+TimelineHandle Simulation::Impl::schedule( Partition &partition, uint64_t seq, SimEvent &&event ) {
+  if ( !m_optimistic ) {
+    return partition.insert( seq, std::move( event ) );
+  }
+  if ( partition.m_record ) {
+    partition.m_record->sent.push_back( Processed::Sent{ seq, event.time, partition.m_index } );
+  }
+  auto handle = partition.insert( seq, std::move( event ) );
+  partition.m_scheduled[seq] = handle;
+  return handle;
+}
+
+acpp::void_result<> Simulation::Impl::fail( Partition &partition, const std::string &message ) {
+  if ( partition.m_failure.empty() ) {
+    partition.m_failure = message;
+  }
+  return {{}, message};
+}
+
+SymbolId Simulation::Impl::intern( const std::string &name ) {
+  {
+    std::shared_lock lock{ m_names_mut };
+    auto id = m_names.find( name );
+    if ( id != no_symbol ) {
+      return id;
+    }
+  }
+  std::unique_lock lock{ m_names_mut };
+  return m_names.intern( name );
+}
+
+SymbolId Simulation::Impl::symbol( const std::string &name ) const {
+  std::shared_lock lock{ m_names_mut };
+  return m_names.find( name );
+}
+
+std::string Simulation::Impl::name( SymbolId id ) const {
+  std::shared_lock lock{ m_names_mut };
+  return m_names.name( id );
+}
+
 acpp::void_result<> Simulation::Impl::insertSpawnInstance(
     const std::string &name,
     const std::string &model,
     const PropertyList &parameters,
     const Clock::time_point &time ) {
-  auto iiter = m_instances.find( name );
-  if ( iiter != m_instances.end() ) {
-    return {{}, "instance not unique"};
+  if ( m_parallel ) {
+    return {{}, "instances can't spawn during a parallel run"};
+  }
+  SymbolId instance_id, model_id;
+  {
+    std::unique_lock lock{ m_names_mut };
+    instance_id = m_instance_names.intern( name );
+    model_id = m_names.intern( model );
+    if ( symbol_get( m_instances, instance_id ) ) {
+      return {{}, "instance not unique"};
+    }
   }
-  // TODO lock here
+  if ( instance_id >= s_max_instances ) {
+    return {{}, "too many instances"};
+  }
+  auto partition = partitionFor( instance_id, parameters );
+
+  std::lock_guard spawn_lock{ m_spawn_mut };
   // check if this is pending spawn
-  auto eiter = std::find_if( m_events.begin(), m_events.end(), [name]( const SimEvent &event ) {
-    return event.type == SimEvent::Type::SPAWN_INSTANCE && event.name == name;
-  } );
-  if ( eiter != m_events.end() ) {
+  if ( m_pending_spawns.count( instance_id ) > 0 ) {
     return {{}, "instance not unique"};
   }
-
-  Clock::time_point event_time = time;
-  if ( time.time_since_epoch() == Clock::duration::zero() ) {
-    event_time = m_simtime;
+  if ( foreign() ) {
+    auto posted = enqueue( partition, nextSeq( time ), SimEvent{ SimEvent::Type::SPAWN_INSTANCE, time, model_id, instance_id } );
+    if ( posted ) {
+      m_pending_spawns.emplace( instance_id, PendingSpawn{ {}, parameters, partition } );
+    }
+    return posted;
   }
-  // TODO fix parameter passing
-  m_events.emplace( SimEvent::Type::SPAWN_INSTANCE, event_time, model, name, model, parameters );
+  auto event_time = eventTime( time );
+  auto handle = m_partitions[partition]->insert( nextSeq( event_time ),
+      SimEvent{ SimEvent::Type::SPAWN_INSTANCE, event_time, model_id, instance_id }, &parameters );
+  m_pending_spawns.emplace( instance_id, PendingSpawn{ handle, parameters, partition } );
 
   return {};
 }
 
+uint32_t Simulation::Impl::partitionFor( SymbolId instance_id, const PropertyList &parameters ) const {
+  // an explicit partition or round-robin in spawn order
+  uint32_t partition = instance_id % m_partitions.size();
+  auto piter = parameters.find( "partition" );
+  if ( piter != parameters.end() ) {
+    partition = acpp::get_as<uintmax_t>( piter->second ).value_or( partition ) % m_partitions.size();
+  }
+  return partition;
+}
+
+acpp::value_result<std::shared_ptr<Instance>> Simulation::Impl::makeInstance(
+    const std::string &model,
+    const std::string &name,
+    const PropertyList &parameters ) {
+  if ( m_running ) {
+    return { {}, "instances can only be made between runs" };
+  }
+  SymbolId instance_id, model_id;
+  {
+    std::unique_lock lock{ m_names_mut };
+    instance_id = m_instance_names.intern( name );
+    model_id = m_names.intern( model );
+    if ( symbol_get( m_instances, instance_id ) ) {
+      return { {}, "instance not unique" };
+    }
+  }
+  if ( instance_id >= s_max_instances ) {
+    return { {}, "too many instances" };
+  }
+  {
+    std::lock_guard spawn_lock{ m_spawn_mut };
+    if ( m_pending_spawns.count( instance_id ) > 0 ) {
+      return { {}, "instance not unique" };
+    }
+  }
+  auto resolved = resolveModel( model_id );
+  if ( !resolved ) {
+    return { {}, "no model: " + model };
+  }
+  auto &partition = *m_partitions[partitionFor( instance_id, parameters )];
+  auto instance = resolved->makeInstance( m_simulation.shared_from_this(), name, parameters );
+  if ( !instance ) {
+    return { {}, "model " + model + " made no instance" };
+  }
+  Instance::Private::initialize( *instance, partition.m_index );
+  if ( m_chrome ) {
+    attachChromeTrace( *instance );
+  }
+  {
+    std::unique_lock lock{ m_names_mut };
+    symbol_slot( m_instances, instance_id ) = instance;
+  }
+  // the start activity runs as a spawned one would, in load order
+  auto start = intern( "start" );
+  if ( Instance::Private::activity( *instance, start ) ) {
+    auto event_time = eventTime( {} );
+    partition.insert(
+        nextSeq( event_time ), SimEvent{ SimEvent::Type::SPAWN_ACTIVITY, event_time, start, start, instance_id } );
+  }
+  return acpp::value_result<std::shared_ptr<Instance>>{ std::move( instance ) };
+}
+
 acpp::void_result<> Simulation::Impl::insertSpawnActivity(
     const std::string &spec_name,
     const std::string &name,
     const std::string &instance,
     const Clock::time_point &time ) {
-  auto iiter = m_instances.find( instance );
-  if ( iiter == m_instances.end() ) {
+  SymbolId instance_id;
+  std::shared_ptr<Instance> target;
+  {
+    std::shared_lock lock{ m_names_mut };
+    instance_id = m_instance_names.find( instance );
+    target = symbol_get( m_instances, instance_id );
+  }
+  if ( !target ) {
     // TODO allow if there is a spawn instance of the right name before time
     return {{}, "instance not found"};
   }
-  // TODO lock here
-  Clock::time_point event_time = time;
-  if ( time.time_since_epoch() == Clock::duration::zero() ) {
-    event_time = m_simtime;
+  auto &partition = partitionOf( *target );
+  if ( m_parallel && current() != &partition ) {
+    return {{}, "only the instance's own partition can spawn its activities during a parallel run"};
   }
-  m_events.emplace( SimEvent::Type::SPAWN_ACTIVITY, event_time, spec_name, name, instance );
+  if ( foreign() ) {
+    return enqueue( partition.m_index,
+        nextSeq( time ),
+        SimEvent{ SimEvent::Type::SPAWN_ACTIVITY, time, intern( spec_name ), intern( name ), instance_id } );
+  }
+  auto event_time = eventTime( time );
+  schedule( partition,
+      nextSeq( event_time ),
+      SimEvent{ SimEvent::Type::SPAWN_ACTIVITY, event_time, intern( spec_name ), intern( name ), instance_id } );
 
   return {};
 }
 
-std::future<bool> Simulation::Impl::insertResumeActivity(
-    std::shared_ptr<Activity> activity,
-    const Clock::time_point &time ) {
-  // TODO lock here
-  // TODO check that event_time is >= simtime
-  Clock::time_point event_time = time;
-  if ( time.time_since_epoch() == Clock::duration::zero() ) {
-    event_time = m_simtime;
-  }
-  m_events.emplace(
-      SimEvent::Type::RESUME_ACTIVITY,
-      event_time,
-      activity->name(),
-      activity->owner()->name() );
-  auto &wact = m_waiting_activities[activity];
-  wact = {event_time};
-  auto &promise = std::get<0>( wact.promise );
-
-  // it seems copy elision is not assumed here
-  return std::move( promise.get_future() );
+MpscRing<Injection> &Simulation::Impl::inbox() {
+  std::call_once( m_inbox_once, [this] {
+    m_inbox = std::make_unique<MpscRing<Injection>>( s_inbox_capacity, m_arena.resource() );
+    m_inbox_made.store( true, std::memory_order_release );
+  } );
+  return *m_inbox;
 }
 
-std::future<bool> Simulation::Private::insertResumeActivity(
-    std::shared_ptr<Simulation> simulation,
-    std::shared_ptr<Activity> act,
-    const Clock::time_point &time ) {
-  return simulation->impl->insertResumeActivity( act, time );
+acpp::void_result<> Simulation::Impl::enqueue( uint32_t partition, uint64_t seq, SimEvent &&event ) {
+  Injection injection{ partition, seq, std::move( event ) };
+  if ( !inbox().push( std::move( injection ) ) ) {
+    return { std::make_error_code( std::errc::resource_unavailable_try_again ), "inbox full" };
+  }
+  return {};
 }
 
-std::future<bool> Simulation::Impl::activityWaitOn(
-    std::shared_ptr<Activity> activity,
-    const std::string &signal_name,
-    const Clock::time_point &time ) {
-  // TODO lock here
-  // TODO check that event_time is >= simtime
-  if ( time.time_since_epoch() != Clock::duration::zero() ) {
-    m_events.emplace(
-        SimEvent::Type::RESUME_ACTIVITY,
-        time,
-        std::string {},
-        activity->name(),
-        activity->owner()->name() );
+size_t Simulation::Impl::drainInbox() {
+  if ( !m_inbox_made.load( std::memory_order_acquire ) ) {
+    return 0;
   }
-  auto &wact = m_waiting_activities[activity];
-  wact = { signal_name, time };
-  auto &promise = std::get<0>( wact.promise );
-
-  // it seems copy elision is not assumed here
-  return std::move( promise.get_future() );
+  size_t drained = 0;
+  Injection injection;
+  while ( m_inbox->pop( injection ) ) {
+    if ( injection.signal != no_symbol ) {
+      for ( auto &partition : m_partitions ) {
+        raiseSignal( *partition, injection.signal );
+      }
+      injection.signal = no_symbol;
+      ++drained;
+      continue;
+    }
+    auto &partition = *m_partitions[injection.partition % m_partitions.size()];
+    injection.event.time = std::max( eventTime( injection.event.time ), now() );
+    if ( injection.event.type == SimEvent::Type::SPAWN_INSTANCE ) {
+      std::lock_guard spawn_lock{ m_spawn_mut };
+      auto piter = m_pending_spawns.find( injection.event.name );
+      auto *parameters = piter != m_pending_spawns.end() ? &piter->second.parameters : nullptr;
+      auto handle = partition.insert( injection.seq, std::move( injection.event ), parameters );
+      if ( parameters ) {
+        piter->second.event = handle;
+      }
+    } else {
+      partition.insert( injection.seq, std::move( injection.event ) );
+    }
+    ++drained;
+  }
+  return drained;
 }
 
-std::future<bool> Simulation::Private::activityWaitOn(
-    std::shared_ptr<Simulation> simulation,
-    std::shared_ptr<Activity> activity,
-    const std::string &signal_name,
+acpp::void_result<> Simulation::Impl::injectPadSend(
+    const std::string &instance,
+    const std::string &pad,
+    Payload &&payload,
     const Clock::time_point &time ) {
-  if ( !simulation || !activity ) {
-    return {}; // TODO return error
+  SymbolId instance_id;
+  std::shared_ptr<Instance> target;
+  {
+    std::shared_lock lock{ m_names_mut };
+    instance_id = m_instance_names.find( instance );
+    target = symbol_get( m_instances, instance_id );
+  }
+  if ( !target ) {
+    return {{}, "instance not found"};
+  }
+  auto pad_id = symbol( pad );
+  if ( pad_id == no_symbol || !Instance::Private::pad( *target, pad_id ) ) {
+    return {{}, "pad not found"};
   }
-  return simulation->impl->activityWaitOn( activity, signal_name, time );
+  return enqueue( Instance::Private::partition( *target ),
+      m_external_seq.fetch_add( 1, std::memory_order_relaxed ) + 1,
+      SimEvent{ SimEvent::Type::PAD_SEND, time, pad_id, no_symbol, instance_id, std::move( payload ) } );
 }
 
-std::future<bool> Simulation::Impl::activityPadReceive(
+acpp::void_result<> Simulation::Impl::insertResumeActivity(
     std::shared_ptr<Activity> activity,
-    const std::string &pad_name,
     const Clock::time_point &time ) {
-  // TODO lock here
   // TODO check that event_time is >= simtime
-  if ( time.time_since_epoch() != Clock::duration::zero() ) {
-    m_events.emplace(
-        SimEvent::Type::RESUME_ACTIVITY,
-        time,
-        pad_name,
-        activity->name(),
-        activity->owner()->name() );
+  auto instance = activity->owner();
+  auto &partition = partitionOf( *instance );
+  if ( m_optimistic ) {
+    return fail( partition, "activity " + instance->name() + "." + activity->name() + " waits in an optimistic run" );
   }
-  auto &wact = m_waiting_activities[activity];
-  wact = { pad_name, time };
-  auto &promise = std::get<0>( wact.promise );
-
-  // it seems copy elision is not assumed here
-  return std::move( promise.get_future() );
+  auto event_time = eventTime( time );
+  WaitingActivity waiting{ event_time };
+  waiting.resume = partition.insert( nextSeq( event_time ),
+      SimEvent{ SimEvent::Type::RESUME_ACTIVITY,
+          event_time,
+          no_symbol,
+          Activity::Private::id( *activity ),
+          Instance::Private::id( *instance ) } );
+  return waitActivity( partition, activity, std::move( waiting ) );
 }
 
-std::future<bool> Simulation::Private::activityPadReceive(
+acpp::void_result<> Simulation::Impl::waitActivity(
+    Partition &partition,
+    std::shared_ptr<Activity> activity,
+    WaitingActivity &&waiting ) {
+  auto slot = Activity::Private::slot( *activity );
+  if ( slot == no_symbol ) {
+    return {{}, "activity " + activity->name() + " has no slot"};
+  }
+  if ( slot >= partition.m_waiting.size() ) {
+    partition.m_waiting.resize( std::max<size_t>( slot + 1, partition.m_waiting.size() * 2 ) );
+  }
+  auto &entry = partition.m_waiting[slot];
+  if ( entry.activity ) {
+    partition.cancel( entry.resume );
+    releaseWaiting( partition, slot );
+  }
+  entry = std::move( waiting );
+  entry.activity = std::move( activity );
+  if ( partition.m_chrome ) {
+    entry.since = partition.m_simtime;
+    entry.since_ticks = ticks();
+  }
+  ++partition.m_waiting_count;
+  if ( entry.signal != no_symbol ) {
+    auto &waiters = partition.m_waiters[waiterKey( entry )];
+    entry.prev = waiters.last;
+    ( waiters.last != no_symbol ? partition.m_waiting[waiters.last].next : waiters.first ) = slot;
+    waiters.last = slot;
+    ++waiters.count;
+  }
+  return {};
+}
+
+std::shared_ptr<Activity> Simulation::Impl::releaseWaiting( Partition &partition, uint32_t slot ) {
+  auto &entry = partition.m_waiting[slot];
+  if ( partition.m_chrome && entry.since_ticks != 0 ) {
+    auto wait = entry.signal == no_symbol ? chrome_trace::Wait::TIME
+              : entry.scope == no_symbol  ? chrome_trace::Wait::SIGNAL
+                                          : chrome_trace::Wait::PAD;
+    auto instance = entry.activity->owner();
+    partition.m_chrome->wait( instance ? Instance::Private::id( *instance ) : no_symbol,
+        Activity::Private::id( *entry.activity ), wait, entry.signal, entry.since, entry.since_ticks );
+  }
+  if ( entry.signal != no_symbol ) {
+    auto waiters = partition.m_waiters.find( waiterKey( entry ) );
+    if ( waiters != partition.m_waiters.end() && ( entry.prev != no_symbol || waiters->second.first == slot ) ) {
+      auto &linked = waiters->second;
+      ( entry.prev != no_symbol ? partition.m_waiting[entry.prev].next : linked.first ) = entry.next;
+      ( entry.next != no_symbol ? partition.m_waiting[entry.next].prev : linked.last ) = entry.prev;
+      if ( --linked.count == 0 ) {
+        partition.m_waiters.erase( waiters );
+      }
+    }
+  }
+  auto activity = std::move( entry.activity );
+  entry = WaitingActivity{};
+  --partition.m_waiting_count;
+  return activity;
+}
+
+void Simulation::Impl::wakeWaiting( Partition &partition, WaitingActivity &waiting ) {
+  auto time = now();
+  if ( partition.reschedule( waiting.resume, time ) ) {
+    return;
+  }
+  waiting.resume = partition.insert( nextSeq( time ),
+      SimEvent{ SimEvent::Type::RESUME_ACTIVITY,
+          time,
+          waiting.signal,
+          Activity::Private::id( *waiting.activity ),
+          Instance::Private::id( *waiting.activity->owner() ) } );
+}
+
+size_t Simulation::Impl::raiseSignal( Partition &partition, SymbolId signal ) {
+  auto waiters = partition.m_waiters.find( waiterKey( WaitingActivity{ signal, {} } ) );
+  if ( waiters == partition.m_waiters.end() ) {
+    return 0;
+  }
+  // the waiters stay registered until their resume is handled
+  for ( auto slot = waiters->second.first; slot != no_symbol; slot = partition.m_waiting[slot].next ) {
+    wakeWaiting( partition, partition.m_waiting[slot] );
+  }
+  return waiters->second.count;
+}
+
+acpp::void_result<> Simulation::Private::insertResumeActivity(
+    std::shared_ptr<Simulation> simulation,
+    std::shared_ptr<Activity> act,
+    const Clock::time_point &time ) {
+  return simulation->impl->insertResumeActivity( act, time );
+}
+
+acpp::void_result<> Simulation::Impl::activityWaitOn(
+    std::shared_ptr<Activity> activity,
+    SymbolId signal,
+    const Clock::time_point &time ) {
+  // TODO check that event_time is >= simtime
+  auto instance = activity->owner();
+  auto &partition = partitionOf( *instance );
+  if ( m_optimistic ) {
+    return fail( partition, "activity " + instance->name() + "." + activity->name() + " waits in an optimistic run" );
+  }
+  WaitingActivity waiting{ signal, time };
+  if ( time.time_since_epoch() != Clock::duration::zero() ) {
+    waiting.resume = partition.insert( nextSeq( time ),
+        SimEvent{ SimEvent::Type::RESUME_ACTIVITY,
+            time,
+            no_symbol,
+            Activity::Private::id( *activity ),
+            Instance::Private::id( *instance ) } );
+  }
+  return waitActivity( partition, activity, std::move( waiting ) );
+}
+
+acpp::void_result<> Simulation::Private::activityWaitOn(
+    std::shared_ptr<Simulation> simulation,
+    std::shared_ptr<Activity> activity,
+    const std::string &signal_name,
+    const Clock::time_point &time ) {
+  if ( !simulation || !activity ) {
+    return {{}, "no simulation or activity"};
+  }
+  return simulation->impl->activityWaitOn( activity, simulation->impl->intern( signal_name ), time );
+}
+
+acpp::value_result<size_t> Simulation::Impl::raiseSignal( const std::string &signal_name ) {
+  auto signal = symbol( signal_name );
+  if ( signal == no_symbol ) {
+    return acpp::value_result<size_t>( 0 ); // nothing ever waited on it
+  }
+  if ( auto partition = current() ) {
+    return acpp::value_result<size_t>( raiseSignal( *partition, signal ) );
+  }
+  if ( m_running ) {
+    // the partitions belong to the threads running them, the run raises it as it takes it in
+    Injection injection;
+    injection.signal = signal;
+    if ( !inbox().push( std::move( injection ) ) ) {
+      return { std::make_error_code( std::errc::resource_unavailable_try_again ), "inbox full" };
+    }
+    return acpp::value_result<size_t>( 0 );
+  }
+  size_t woken = 0;
+  for ( auto &partition : m_partitions ) {
+    woken += raiseSignal( *partition, signal );
+  }
+  return acpp::value_result<size_t>( woken );
+}
+
+acpp::value_result<size_t> Simulation::Private::raiseSignal( std::shared_ptr<Simulation> simulation, const std::string &signal_name ) {
+  if ( !simulation ) {
+    return { {}, "no simulation" };
+  }
+  return simulation->impl->raiseSignal( signal_name );
+}
+
+acpp::void_result<> Simulation::Impl::activityPadReceive(
+    std::shared_ptr<Activity> activity,
+    SymbolId pad,
+    const Clock::time_point &time ) {
+  // TODO check that event_time is >= simtime
+  auto instance = activity->owner();
+  auto &partition = partitionOf( *instance );
+  if ( m_optimistic ) {
+    return fail( partition, "activity " + instance->name() + "." + activity->name() + " waits in an optimistic run" );
+  }
+  WaitingActivity waiting{ pad, time, Instance::Private::id( *instance ) };
+  if ( time.time_since_epoch() != Clock::duration::zero() ) {
+    waiting.resume = partition.insert( nextSeq( time ),
+        SimEvent{ SimEvent::Type::RESUME_ACTIVITY,
+            time,
+            pad,
+            Activity::Private::id( *activity ),
+            Instance::Private::id( *instance ) } );
+  }
+  return waitActivity( partition, activity, std::move( waiting ) );
+}
+
+acpp::void_result<> Simulation::Private::activityPadReceive(
     std::shared_ptr<Simulation> simulation,
     std::shared_ptr<Activity> activity,
-    const std::string &pad_name,
+    SymbolId pad,
     const Clock::time_point &time ) {
   if ( !simulation || !activity ) {
-    return {}; // TODO return error
+    return {{}, "no simulation or activity"};
+  }
+  return simulation->impl->activityPadReceive( activity, pad, time );
+}
+
+void Simulation::Impl::padReceived( std::shared_ptr<Pad> pad ) {
+  auto instance = pad->owner();
+  if ( !instance ) {
+    return;
+  }
+  auto &partition = partitionOf( *instance );
+  auto waiters = partition.m_waiters.find(
+      waiterKey( WaitingActivity{ Pad::Private::id( *pad ), {}, Instance::Private::id( *instance ) } ) );
+  if ( waiters == partition.m_waiters.end() ) {
+    return;
+  }
+  // the earliest receiver gets the message
+  wakeWaiting( partition, partition.m_waiting[waiters->second.first] );
+}
+
+void Simulation::Private::padReceived( std::shared_ptr<Simulation> simulation, std::shared_ptr<Pad> pad ) {
+  if ( !simulation || !pad ) {
+    return;
+  }
+  simulation->impl->padReceived( pad );
+}
+
+bool Simulation::Impl::padSend( std::shared_ptr<Pad> pad, Payload &&payload ) {
+#if ACPP_LESSON > 3
+  auto peer = pad->peer();
+  auto target = peer ? peer->owner() : nullptr;
+  if ( !target ) {
+    return false;
+  }
+  auto &to = partitionOf( *target );
+  auto from = current();
+  auto lookahead = pad->lookahead();
+  // a pad_receive activity runs as an event of its own, even without lookahead
+  if ( lookahead == Clock::duration::zero() && !m_optimistic && !Pad::Private::receives( *peer ) ) {
+    if ( m_parallel && from != &to ) {
+      return false; // only lookahead lets a message cross partitions
+    }
+    Pad::Private::push( peer, std::move( payload ) );
+    return true;
+  }
+  auto time = later( now(), lookahead );
+  SimEvent event{ SimEvent::Type::PAD_SEND,
+      time,
+      Pad::Private::id( *peer ),
+      no_symbol,
+      Instance::Private::id( *target ),
+      std::move( payload ) };
+  if ( !m_parallel || from == &to ) {
+    schedule( to, nextSeq( time ), std::move( event ) );
+    return true;
+  }
+  auto channel = from ? from->m_outputs[to.m_index] : nullptr;
+  if ( !channel ) {
+    return false; // the pad can't output, or the send came from outside the run
+  }
+  post( *channel, nextSeq( time ), std::move( event ) );
+  return true;
+#else
+  return false;
+#endif // ACPP_LESSON > 3
+}
+
+bool Simulation::Private::padSend( std::shared_ptr<Simulation> simulation, std::shared_ptr<Pad> pad, Payload &&payload ) {
+  if ( !simulation || !pad ) {
+    return false;
+  }
+  return simulation->impl->padSend( pad, std::move( payload ) );
+}
+
+SymbolId Simulation::Private::intern( std::shared_ptr<Simulation> simulation, const std::string &name ) {
+  if ( !simulation ) {
+    return no_symbol;
+  }
+  return simulation->impl->intern( name );
+}
+
+SymbolId Simulation::Private::symbol( std::shared_ptr<Simulation> simulation, const std::string &name ) {
+  if ( !simulation ) {
+    return no_symbol;
+  }
+  return simulation->impl->symbol( name );
+}
+
+acpp::value_result<std::shared_ptr<Instance>> Simulation::Private::makeInstance(
+    std::shared_ptr<Simulation> simulation,
+    const std::string &model,
+    const std::string &name,
+    const PropertyList &parameters ) {
+  if ( !simulation ) {
+    return { {}, "no simulation" };
+  }
+  return simulation->impl->makeInstance( model, name, parameters );
+}
+
+void Simulation::Private::reserveInstances( std::shared_ptr<Simulation> simulation, size_t count ) {
+  if ( !simulation ) {
+    return;
+  }
+  auto &impl = *simulation->impl;
+  std::unique_lock lock{ impl.m_names_mut };
+  impl.m_instance_names.reserve( impl.m_instance_names.size() + count );
+  impl.m_instances.reserve( impl.m_instances.size() + count );
+}
+
+uint32_t Simulation::Private::activitySlot( std::shared_ptr<Simulation> simulation ) {
+  if ( !simulation ) {
+    return no_symbol;
+  }
+  return simulation->impl->m_activity_slots.fetch_add( 1, std::memory_order_relaxed );
+}
+
+SymbolId Simulation::Private::instanceId( std::shared_ptr<Simulation> simulation, const std::string &name ) {
+  if ( !simulation ) {
+    return no_symbol;
+  }
+  std::unique_lock lock{ simulation->impl->m_names_mut };
+  return simulation->impl->m_instance_names.intern( name );
+}
+
+std::pmr::memory_resource *Simulation::Private::resource( std::shared_ptr<Simulation> simulation ) {
+  if ( !simulation ) {
+    return std::pmr::get_default_resource();
+  }
+  return simulation->impl->m_arena.resource();
+}
+
+StackPool *Simulation::Private::stacks( std::shared_ptr<Simulation> simulation ) {
+  if ( !simulation ) {
+    return nullptr;
+  }
+  auto partition = simulation->impl->current();
+  return &( partition ? partition : simulation->impl->m_partitions.front().get() )->m_stacks;
+}
+
+AllocatorStats Simulation::allocatorStats() const {
+  return impl->m_arena.stats();
+}
+
+std::shared_ptr<Instance> Simulation::instance( const std::string &name ) const {
+  std::shared_lock lock{ impl->m_names_mut };
+  return symbol_get( impl->m_instances, impl->m_instance_names.find( name ) );
+}
+
+std::vector<std::shared_ptr<Instance>> Simulation::instances() const {
+  std::vector<std::shared_ptr<Instance>> instances;
+  std::shared_lock lock{ impl->m_names_mut };
+  for ( const auto &instance : impl->m_instances ) {
+    if ( instance ) {
+      instances.push_back( instance );
+    }
   }
-  return simulation->impl->activityPadReceive( activity, pad_name, time );
+  return instances;
 }
 
 // global parameters
 acpp::void_result<> Simulation::setParameter(
     const std::string &name,
     const acpp::unstructured_value &value ) {
-  impl->m_parameters.emplace( name, value );
+  impl->m_parameters.insert_or_assign( name, value );
   return {};
 }
 
@@ -329,8 +1472,30 @@ acpp::unstructured_value Simulation::parameter( const std::string &name ) const
   return iter->second;
 }
 
+std::shared_ptr<Collector> Simulation::collector(
+    const std::string &name,
+    const std::function<std::shared_ptr<Collector>()> &make ) {
+  std::lock_guard lock{ impl->m_collectors_mut };
+  auto &collector = impl->m_collectors[name];
+  if ( !collector && make ) {
+    collector = make();
+  }
+  return collector;
+}
+
+std::map<std::string, std::shared_ptr<Collector>> Simulation::collectors() const {
+  std::lock_guard lock{ impl->m_collectors_mut };
+  std::map<std::string, std::shared_ptr<Collector>> collectors;
+  for ( const auto &[name, collector] : impl->m_collectors ) {
+    if ( collector ) {
+      collectors.emplace( name, collector );
+    }
+  }
+  return collectors;
+}
+
 Clock::time_point Simulation::simtime() const {
-  return impl->m_simtime;
+  return impl->now();
 }
 
 Simulation::State Simulation::state() const {
@@ -347,125 +1512,1745 @@ acpp::void_result<> Simulation::setState( const Simulation::State &state ) {
   return {};
 }
 
+Simulation::EventQueue Simulation::eventQueue() const {
+  switch ( impl->m_queue ) {
+  case QueueKind::CALENDAR:
+    return EventQueue::CALENDAR;
+  case QueueKind::LADDER:
+    return EventQueue::LADDER;
+  default:
+    return EventQueue::HEAP;
+  }
+}
+
+acpp::void_result<> Simulation::setPartitions( size_t count ) {
+  return impl->setPartitions( count );
+}
+
+size_t Simulation::partitions() const {
+  return impl->m_partitions.size();
+}
+
+acpp::void_result<> Simulation::setSynchronization( Synchronization synchronization ) {
+  if ( impl->m_running ) {
+    return {{}, "simulation is running"};
+  }
+  impl->m_synchronization = synchronization;
+  return {};
+}
+
+Simulation::Synchronization Simulation::synchronization() const {
+  return impl->m_synchronization;
+}
+
+acpp::void_result<> Simulation::runParallel( const Clock::time_point &until ) {
+  return impl->runParallel( until );
+}
+
+acpp::void_result<> Simulation::inject(
+    const std::string &instance,
+    const std::string &pad,
+    Payload payload,
+    const Clock::time_point &time ) {
+  return impl->injectPadSend( instance, pad, std::move( payload ), time );
+}
+
+acpp::value_result<size_t> Simulation::raiseSignal( const std::string &signal ) {
+  return impl->raiseSignal( signal );
+}
+
+acpp::value_result<size_t> Simulation::runUntil( const Clock::time_point &time ) {
+  return impl->run( time, std::numeric_limits<size_t>::max() );
+}
+
+acpp::value_result<size_t> Simulation::runFor( Clock::duration duration ) {
+  return impl->run( later( impl->now(), duration ), std::numeric_limits<size_t>::max() );
+}
+
+acpp::value_result<size_t> Simulation::step( size_t count ) {
+  return impl->run( Clock::time_point::max(), count );
+}
+
+acpp::value_result<size_t> Simulation::runToCompletion() {
+  return impl->run( Clock::time_point::max(), std::numeric_limits<size_t>::max() );
+}
+
+acpp::void_result<> Simulation::checkpoint( const std::string &path ) {
+  std::ofstream out{ path, std::ios::binary };
+  if ( !out ) {
+    return {{}, "can't write " + path};
+  }
+  return impl->checkpoint( out );
+}
+
+acpp::void_result<> Simulation::checkpoint( std::ostream &out ) {
+  return impl->checkpoint( out );
+}
+
+acpp::void_result<> Simulation::restore( const std::string &path ) {
+  std::ifstream in{ path, std::ios::binary };
+  if ( !in ) {
+    return {{}, "can't read " + path};
+  }
+  return restore( in );
+}
+
+acpp::void_result<> Simulation::restore( std::istream &in ) {
+  // models may throw making their instances
+  try {
+    return impl->restore( in );
+  } catch ( const char *message ) {
+    return {{}, message};
+  } catch ( const std::exception &e ) {
+    return {{}, e.what()};
+  }
+}
+
+acpp::void_result<> Simulation::startProfile() {
+  return impl->startProfile();
+}
+
+acpp::void_result<> Simulation::stopProfile() {
+  return impl->stopProfile();
+}
+
+acpp::value_result<Profile> Simulation::profile() const {
+  return impl->profile();
+}
+
+acpp::void_result<> Simulation::startChromeTrace( const std::string &path, TraceAxis axis ) {
+  return impl->startChromeTrace( path, axis );
+}
+
+acpp::void_result<> Simulation::stopChromeTrace() {
+  return impl->stopChromeTrace();
+}
+
+acpp::void_result<> Simulation::startTrace( const std::string &path ) {
+#ifdef SIM_TRACE
+  return impl->startTrace( path );
+#else
+  (void)path;
+  return {{}, "tracing is not built in, configure with SIM_TRACE"};
+#endif
+}
+
+acpp::void_result<> Simulation::stopTrace() {
+#ifdef SIM_TRACE
+  return impl->stopTrace();
+#else
+  return {{}, "tracing is not built in, configure with SIM_TRACE"};
+#endif
+}
+
+acpp::value_result<size_t> Simulation::replayTrace( const std::string &path ) {
+#ifdef SIM_TRACE
+  return impl->replayTrace( path );
+#else
+  (void)path;
+  return {{}, "tracing is not built in, configure with SIM_TRACE"};
+#endif
+}
+
+acpp::value_result<std::shared_ptr<Simulation>> Simulation::fork() {
+  std::stringstream snapshot{ std::ios::in | std::ios::out | std::ios::binary };
+  auto saved = impl->checkpoint( snapshot );
+  if ( !saved ) {
+    return { saved.err, saved.msg };
+  }
+  auto copy = std::make_shared<Simulation>( *impl->m_simulator, eventQueue() );
+  auto restored = copy->restore( snapshot );
+  if ( !restored ) {
+    return { restored.err, restored.msg };
+  }
+  return acpp::value_result<std::shared_ptr<Simulation>>{ std::move( copy ) };
+}
+
+QueueKind Simulation::Impl::toQueueKind( EventQueue queue ) {
+  switch ( queue ) {
+  case EventQueue::CALENDAR:
+    return QueueKind::CALENDAR;
+  case EventQueue::LADDER:
+    return QueueKind::LADDER;
+  default:
+    return QueueKind::HEAP;
+  }
+}
+
 void Simulation::Impl::setState( const Simulation::State &state ) {
-  std::unique_lock<std::mutex> state_lock( m_state_mut );
-  if ( m_state == state ) {
+  m_pending_state.store( state );
+  if ( m_running.load() && state != State::RUN ) {
+    // the run takes the state once it notices
+    m_interrupt.store( true, std::memory_order_relaxed );
     return;
   }
-  m_pending_state = state;
-  m_state = state;
-  m_state_cnd.notify_all();
+  m_state.store( state );
 }
 
-void Simulation::Impl::handleStateChange( const SimEvent &event ) {
-  // TODO STUB
+void Simulation::Impl::handleStateChange( Partition &, const SimEvent & ) {
+  // state changes take effect between events (see setState), nothing schedules them as one
 }
 
-void Simulation::Impl::handleSpawnInstance( const SimEvent &event ) {
-  auto model = Simulator::getInstance().model( event.spec );
-  if ( !model ) {
-    return;
+std::shared_ptr<Model> Simulation::Impl::resolveModel( SymbolId model ) {
+  std::unique_lock lock{ m_names_mut };
+  auto &resolved = symbol_slot( m_models, model );
+  if ( !resolved ) {
+    resolved = m_simulator->model( m_names.name( model ) );
   }
-  // TODO check name unique
-  auto rv = m_instances.emplace(
-      event.name,
-      std::make_shared<Instance>(
-          m_simulation.shared_from_this(),
-          model,
-          event.name,
-          PropertyList {} ) );
+  return resolved;
 }
 
-void Simulation::Impl::handleSpawnActivity( const SimEvent &event ) {
-  auto model = Simulator::getInstance().model( event.spec );
+void Simulation::Impl::handleSpawnInstance( Partition &partition, const SimEvent &event ) {
+  PropertyList parameters;
+  {
+    std::lock_guard spawn_lock{ m_spawn_mut };
+    auto piter = m_pending_spawns.find( event.name );
+    if ( piter == m_pending_spawns.end() ) {
+      return;
+    }
+    parameters = std::move( piter->second.parameters );
+    m_pending_spawns.erase( piter );
+  }
+  auto model = resolveModel( event.spec );
   if ( !model ) {
     return;
   }
-  auto iiter = m_instances.find( event.owner );
-  if (iiter == m_instances.end() || !iiter->second) {
+  std::string instance_name;
+  {
+    std::shared_lock lock{ m_names_mut };
+    instance_name = m_instance_names.name( event.name );
+  }
+  auto instance = model->makeInstance( m_simulation.shared_from_this(), instance_name, parameters );
+  if ( !instance ) {
+    return;
+  }
+  Instance::Private::initialize( *instance, partition.m_index );
+  if ( m_chrome ) {
+    attachChromeTrace( *instance );
+  }
+  {
+    std::unique_lock lock{ m_names_mut };
+    symbol_slot( m_instances, event.name ) = instance;
+  }
+  // the start activity is spawned with its instance
+  partition.m_origin = instance.get();
+  if ( auto start = Instance::Private::activity( *instance, intern( "start" ) ) ) {
+    start->invoke( instance_name, {} );
+  }
+}
+
+void Simulation::Impl::handleSpawnActivity( Partition &partition, SimEvent &event ) {
+  auto instance = symbol_get( m_instances, event.owner );
+  if ( !instance ) {
     return;
   }
-  auto activity = iiter->second->addActivity( event.spec, event.name );
+  partition.m_origin = instance.get();
+  // an activity spawned again runs again, once it finished
+  auto activity = Instance::Private::activity( *instance, event.name );
+  if ( !activity ) {
+    activity = instance->addActivity( name( event.spec ), name( event.name ) );
+  }
   if (!activity) {
     return;
   }
-  activity->invoke( event.owner, event.payload );
+  activity->invoke( instance->name(), std::move( event.payload ) );
 }
 
-void Simulation::Impl::handleResumeActivity( const SimEvent &event ) {
-  auto iiter = m_instances.find( event.owner );
-  if ( iiter == m_instances.end() ) {
+void Simulation::Impl::handleResumeActivity( Partition &partition, SimEvent &event ) {
+  auto instance = symbol_get( m_instances, event.owner );
+  if ( !instance ) {
     return;
   }
-  auto activity = iiter->second->activity( event.name );
+  auto activity = Instance::Private::activity( *instance, event.name );
   if ( !activity ) {
     return;
   }
-  auto witer = m_waiting_activities.find( activity );
-  if ( witer == m_waiting_activities.end() ) {
+  auto slot = Activity::Private::slot( *activity );
+  if ( slot >= partition.m_waiting.size() || partition.m_waiting[slot].activity != activity ) {
     return;
   }
-  std::visit(
-      [&]( auto &promise ) {
-        using Ptype = std::decay_t<decltype( promise )>;
-        if constexpr (std::is_same_v<Ptype, std::promise<bool>>) {
-          promise.set_value( true );
-        } else {
-          promise.set_value( event.payload );
-        }
-      },
-      witer->second.promise );
-  m_waiting_activities.erase( witer );
-}
-
-void Simulation::Impl::handleSpawnPad( const SimEvent &event ) {
+  // release first, the activity may wait again before resume returns
+  releaseWaiting( partition, slot );
+  partition.m_origin = instance.get();
+  Activity::Private::resume( *activity, true );
 }
 
-void Simulation::Impl::handlePadSend( const SimEvent &event ) {
+void Simulation::Impl::handleSpawnPad( Partition &, const SimEvent & ) {
+  // pads come with the instance spawning them, nothing schedules them on their own
 }
 
-void Simulation::Impl::step() {
-  if ( m_events.empty() ) {
-    setState( State::DONE );
+void Simulation::Impl::handlePadSend( Partition &partition, SimEvent &event ) {
+#if ACPP_LESSON > 3
+  auto instance = symbol_get( m_instances, event.owner );
+  if ( !instance ) {
+    return;
+  }
+  auto pad = Instance::Private::pad( *instance, event.spec );
+  if ( !pad ) {
+    return;
+  }
+  if ( m_optimistic && !Pad::Private::receives( *pad ) ) {
+    // a queued message would be beyond the reach of a rollback
+    fail( partition, "pad " + instance->name() + "." + pad->name() + " has no pad_receive activity" );
+    return;
   }
-  auto event = m_events.extract();
+  partition.m_origin = instance.get();
+  Pad::Private::push( pad, std::move( event.payload ) );
+#endif // ACPP_LESSON > 3
+}
 
-  if ( event.time > m_simtime ) {
-    m_simtime = event.time;
+void Simulation::Impl::dispatch( Partition &partition, uint64_t seq, SimEvent &&event ) {
+  if ( event.time > partition.m_simtime ) {
+    partition.m_simtime = event.time;
   }
+  partition.m_seq = seq;
+  auto *profile = partition.m_profile.get();
+  auto *chrome = partition.m_chrome;
+  uint64_t begin = profile || chrome ? ticks() : 0;
+  auto type = event.type;
+  auto instance = type == SimEvent::Type::SPAWN_INSTANCE ? event.name : event.owner;
+  // the activity the event runs, by name, for the Chrome trace: a pad's receive activity is named after it
+  auto track = type == SimEvent::Type::SPAWN_ACTIVITY || type == SimEvent::Type::RESUME_ACTIVITY ? event.name
+               : type == SimEvent::Type::PAD_SEND                                              ? event.spec
+                                                                                               : no_symbol;
 
   switch ( event.type ) {
   case SimEvent::Type::STATE_CHANGE:
-    handleStateChange( event );
+    handleStateChange( partition, event );
     break;
   case SimEvent::Type::SPAWN_INSTANCE:
-    handleSpawnInstance( event );
+    handleSpawnInstance( partition, event );
     break;
   case SimEvent::Type::SPAWN_ACTIVITY:
-    handleSpawnActivity( event );
+    handleSpawnActivity( partition, event );
     break;
   case SimEvent::Type::RESUME_ACTIVITY:
-    handleResumeActivity( event );
+    handleResumeActivity( partition, event );
     break;
   case SimEvent::Type::SPAWN_PAD:
-    handleSpawnPad( event );
+    handleSpawnPad( partition, event );
     break;
   case SimEvent::Type::PAD_SEND:
-    handlePadSend( event );
+    handlePadSend( partition, event );
     break;
   }
+  if ( profile || chrome ) {
+    auto end = ticks();
+    if ( profile ) {
+      profile->add( instance, type, partition.m_events.size(), end - begin );
+    }
+    if ( chrome ) {
+      chrome->run( instance, track, uint8_t( type ), begin, end );
+    }
+  }
+  partition.m_origin = nullptr;
+  partition.m_seq = 0;
+}
+
+Simulation::Impl::Partition *Simulation::Impl::earliest() const noexcept {
+  if ( m_partitions.size() == 1 ) {
+    auto &partition = *m_partitions.front();
+    return partition.m_events.empty() ? nullptr : &partition;
+  }
+  Partition *next = nullptr;
+  for ( auto &partition : m_partitions ) {
+    if ( !partition->m_events.empty() &&
+         ( !next || partition->m_events.top_entry() < next->m_events.top_entry() ) ) {
+      next = partition.get();
+    }
+  }
+  return next;
+}
+
+acpp::value_result<size_t> Simulation::Impl::run( const Clock::time_point &until, size_t limit ) {
+  if ( m_running.exchange( true ) ) {
+    return {{}, "simulation is already running"};
+  }
+  setState( State::RUN );
+  m_interrupt.store( false, std::memory_order_relaxed );
+  size_t handled = 0;
+  bool interrupted = false;
+  try {
+    while ( handled < limit ) {
+      if ( ( handled & ( s_poll_interval - 1 ) ) == 0 ) {
+        if ( m_interrupt.load( std::memory_order_relaxed ) ) {
+          interrupted = true;
+          break;
+        }
+        drainInbox();
+      }
+      auto next = earliest();
+      if ( !next || until < next->m_events.top().time ) {
+        // the inbox may hold what comes next
+        if ( drainInbox() == 0 ) {
+          break;
+        }
+        continue;
+      }
+      uint64_t seq;
+      auto event = next->extract( seq );
+      if ( event.time > m_simtime ) {
+        m_simtime = event.time;
+      }
+      next->m_simtime = m_simtime;
+      PartitionScope scope{ *next };
+      dispatch( *next, seq, std::move( event ) );
+      ++handled;
+    }
+  } catch ( ... ) {
+    m_running = false;
+    throw;
+  }
+  m_running = false;
+  interrupted = interrupted || m_interrupt.load( std::memory_order_relaxed );
+  bool pending = earliest() != nullptr;
+  if ( !interrupted && handled < limit && until != Clock::time_point::max() ) {
+    m_simtime = std::max( m_simtime, until ); // nothing is left to happen before
+  }
+  auto requested = m_pending_state.load();
+  setState( interrupted && requested != State::RUN ? requested : pending ? State::PAUSE : State::DONE );
+  return acpp::value_result<size_t>{ handled };
+}
+
+namespace {
+
+void putNames( CheckpointWriter &writer, const SymbolTable &names ) {
+  writer.put( uint32_t( names.size() ) );
+  for ( SymbolId id = 0; id < names.size(); ++id ) {
+    writer.putString( names.name( id ) );
+  }
+}
+
+/**
+ * @brief Read a name table, interning the names in their order so that their ids come back
+ */
+bool getNames( CheckpointReader &reader, SymbolTable &names ) {
+  uint32_t count = 0;
+  if ( !reader.get( count ) ) {
+    return false;
+  }
+  names.clear();
+  std::string name;
+  for ( SymbolId id = 0; id < count; ++id ) {
+    if ( !reader.getString( name ) || names.intern( name ) != id ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+acpp::void_result<> Simulation::Impl::checkpoint( std::ostream &out ) {
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  drainInbox(); // so that injected events are saved with the others
+  for ( const auto &partition : m_partitions ) {
+    if ( partition->m_waiting_count == 0 ) {
+      continue;
+    }
+    // its body is suspended on a fiber stack or in a coroutine frame, tied to the process
+    for ( const auto &waiting : partition->m_waiting ) {
+      if ( waiting.activity ) {
+        auto instance = waiting.activity->owner();
+        return {{}, "activity " + ( instance ? instance->name() + "." : std::string{} ) + waiting.activity->name() +
+                        " is waiting, which a checkpoint can't hold"};
+      }
+    }
+  }
+  CheckpointWriter writer{ out, *m_simulator };
+  writer.put( checkpoint::s_magic );
+  writer.put( checkpoint::s_version );
+  writer.put( checkpoint::s_byte_order );
+  writer.put( uint32_t( m_partitions.size() ) );
+  writer.put( uint8_t( m_state.load() ) );
+  writer.put( m_simtime.time_since_epoch().count() );
+  writer.put( uint64_t( m_external_seq.load() ) );
+  std::vector<std::shared_ptr<Instance>> instances;
+  {
+    std::shared_lock lock{ m_names_mut };
+    putNames( writer, m_names );
+    putNames( writer, m_instance_names );
+    for ( const auto &instance : m_instances ) {
+      if ( instance ) {
+        instances.push_back( instance );
+      }
+    }
+  }
+  writer.putProperties( m_parameters );
+
+  writer.put( uint32_t( instances.size() ) );
+  for ( const auto &instance : instances ) {
+    writer.put( Instance::Private::id( *instance ) );
+    writer.putString( instance->model()->name() );
+    writer.put( Instance::Private::partition( *instance ) );
+    writer.put( Instance::Private::eventCount( *instance ) );
+    writer.putProperties( Instance::Private::parameters( *instance ) );
+    // instances that can't save a state have none to lose
+    auto state = instance->saveState();
+    writer.put( uint8_t( state ? 1 : 0 ) );
+    if ( state ) {
+      auto saved = writer.putPayload( *state.value );
+      if ( !saved ) {
+        return {{}, "state of " + instance->name() + ": " + saved.msg};
+      }
+    }
+#if ACPP_LESSON > 3
+    auto queued = checkpointPads( writer, *instance );
+    if ( !queued ) {
+      return queued;
+    }
+#else
+    writer.put( uint32_t( 0 ) );
+#endif // ACPP_LESSON > 3
+  }
+#if ACPP_LESSON > 3
+  checkpointLinks( writer, instances );
+#else
+  writer.put( uint32_t( 0 ) );
+#endif // ACPP_LESSON > 3
+
+  {
+    std::lock_guard spawn_lock{ m_spawn_mut };
+    std::vector<const std::pair<const SymbolId, PendingSpawn> *> spawns;
+    for ( const auto &spawn : m_pending_spawns ) {
+      spawns.push_back( &spawn );
+    }
+    std::sort( spawns.begin(), spawns.end(), []( auto *lhs, auto *rhs ) { return lhs->first < rhs->first; } );
+    writer.put( uint32_t( spawns.size() ) );
+    for ( auto *spawn : spawns ) {
+      writer.put( spawn->first );
+      writer.put( spawn->second.partition );
+      writer.putProperties( spawn->second.parameters );
+    }
+  }
+
+  for ( const auto &partition : m_partitions ) {
+    auto &events = partition->m_events;
+    writer.put( uint64_t( events.size() ) );
+    for ( auto pos = events.begin(); pos != events.end(); ++pos ) {
+      writer.put( events.handle( pos ).seq );
+      writer.put( pos->type );
+      writer.put( pos->time.time_since_epoch().count() );
+      writer.put( pos->spec );
+      writer.put( pos->name );
+      writer.put( pos->owner );
+      auto saved = writer.putPayload( pos->payload );
+      if ( !saved ) {
+        return saved;
+      }
+    }
+  }
+  if ( !writer.good() ) {
+    return {{}, "checkpoint could not be written"};
+  }
+  return {};
+}
+
+#if ACPP_LESSON > 3
+acpp::void_result<> Simulation::Impl::checkpointPads( CheckpointWriter &writer, const Instance &instance ) {
+  std::vector<std::shared_ptr<Pad>> queued;
+  for ( const auto &pad : Instance::Private::pads( instance ) ) {
+    if ( pad && pad->available() > 0 ) {
+      queued.push_back( pad );
+    }
+  }
+  writer.put( uint32_t( queued.size() ) );
+  std::vector<Payload> messages;
+  for ( const auto &pad : queued ) {
+    messages.clear();
+    while ( pad->available() > 0 ) {
+      auto message = Pad::Private::pull( pad );
+      if ( !message ) {
+        break;
+      }
+      messages.push_back( std::move( *message.value ) );
+    }
+    writer.put( Pad::Private::id( *pad ) );
+    writer.put( uint32_t( messages.size() ) );
+    std::string failure; // every message goes back regardless
+    for ( auto &message : messages ) {
+      auto saved = writer.putPayload( message );
+      if ( !saved && failure.empty() ) {
+        failure = "message in " + instance.name() + "." + pad->name() + ": " + saved.msg;
+      }
+      Pad::Private::requeue( *pad, std::move( message ) );
+    }
+    if ( !failure.empty() ) {
+      return {{}, failure};
+    }
+  }
+  return {};
+}
+
+void Simulation::Impl::checkpointLinks( CheckpointWriter &writer, const std::vector<std::shared_ptr<Instance>> &instances ) {
+  std::vector<std::array<SymbolId, 4>> links;
+  for ( const auto &instance : instances ) {
+    for ( const auto &pad : Instance::Private::pads( *instance ) ) {
+      auto peer = pad ? pad->peer() : nullptr;
+      auto target = peer ? peer->owner() : nullptr;
+      if ( !target ) {
+        continue;
+      }
+      std::array<SymbolId, 4> link{
+          Instance::Private::id( *instance ), Pad::Private::id( *pad ), Instance::Private::id( *target ), Pad::Private::id( *peer ) };
+      if ( std::make_pair( link[0], link[1] ) < std::make_pair( link[2], link[3] ) ) {
+        links.push_back( link );
+      }
+    }
+  }
+  writer.put( uint32_t( links.size() ) );
+  for ( const auto &link : links ) {
+    writer.put( link );
+  }
+}
+#endif // ACPP_LESSON > 3
+
+acpp::void_result<> Simulation::Impl::restore( std::istream &in ) {
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  if ( spawnedAny() ) {
+    return {{}, "only a simulation that spawned nothing can be restored into"};
+  }
+  CheckpointReader reader{ in, *m_simulator };
+  char magic[sizeof( checkpoint::s_magic )];
+  uint32_t version = 0, byte_order = 0, partitions = 0;
+  if ( !reader.get( magic ) || !std::equal( std::begin( magic ), std::end( magic ), checkpoint::s_magic ) ) {
+    return {{}, "not a checkpoint"};
+  }
+  if ( !reader.get( version ) || version != checkpoint::s_version ) {
+    return {{}, "unsupported checkpoint version"};
+  }
+  if ( !reader.get( byte_order ) || byte_order != checkpoint::s_byte_order ) {
+    return {{}, "checkpoint of another byte order"};
+  }
+  uint8_t state = 0;
+  Clock::rep simtime = 0;
+  uint64_t external_seq = 0;
+  if ( !reader.get( partitions ) || !reader.get( state ) || !reader.get( simtime ) || !reader.get( external_seq ) ||
+       state > uint8_t( State::DONE ) ) {
+    return {{}, "checkpoint corrupt"};
+  }
+  auto split = setPartitions( partitions );
+  if ( !split ) {
+    return split;
+  }
+  {
+    std::unique_lock lock{ m_names_mut };
+    m_models.clear();
+    m_instances.clear();
+    if ( !getNames( reader, m_names ) || !getNames( reader, m_instance_names ) ) {
+      return {{}, "checkpoint corrupt"};
+    }
+  }
+  if ( !reader.getProperties( m_parameters ) ) {
+    return {{}, "checkpoint corrupt"};
+  }
+
+  uint32_t count = 0;
+  if ( !reader.get( count ) ) {
+    return {{}, "checkpoint corrupt"};
+  }
+  for ( uint32_t index = 0; index < count; ++index ) {
+    auto restored = restoreInstance( reader );
+    if ( !restored ) {
+      return restored;
+    }
+  }
+  auto linked = restoreLinks( reader );
+  if ( !linked ) {
+    return linked;
+  }
+
+  if ( !reader.get( count ) ) {
+    return {{}, "checkpoint corrupt"};
+  }
+  for ( uint32_t index = 0; index < count; ++index ) {
+    SymbolId id = no_symbol;
+    PendingSpawn spawn;
+    if ( !reader.get( id ) || !reader.get( spawn.partition ) || !reader.getProperties( spawn.parameters ) ||
+         spawn.partition >= m_partitions.size() ) {
+      return {{}, "checkpoint corrupt"};
+    }
+    std::lock_guard spawn_lock{ m_spawn_mut };
+    m_pending_spawns.insert_or_assign( id, std::move( spawn ) );
+  }
+
+  for ( auto &partition : m_partitions ) {
+    uint64_t events = 0;
+    if ( !reader.get( events ) ) {
+      return {{}, "checkpoint corrupt"};
+    }
+    for ( uint64_t index = 0; index < events; ++index ) {
+      uint64_t seq = 0;
+      SimEvent::Type type;
+      Clock::rep time = 0;
+      SymbolId spec = no_symbol, name = no_symbol, owner = no_symbol;
+      if ( !reader.get( seq ) || !reader.get( type ) || !reader.get( time ) || !reader.get( spec ) ||
+           !reader.get( name ) || !reader.get( owner ) || seq == 0 || type > SimEvent::Type::PAD_SEND ||
+           type == SimEvent::Type::RESUME_ACTIVITY ) {
+        return {{}, "checkpoint corrupt"};
+      }
+      auto payload = reader.getPayload();
+      if ( !payload ) {
+        return { payload.err, payload.msg };
+      }
+      // not traced, like what is pending when a trace starts
+      auto handle = partition->m_events.emplace_ordered( seq,
+          type, Clock::time_point{ Clock::duration{ time } }, spec, name, owner, std::move( *payload.value ) );
+      if ( type == SimEvent::Type::SPAWN_INSTANCE ) {
+        std::lock_guard spawn_lock{ m_spawn_mut };
+        auto piter = m_pending_spawns.find( name );
+        if ( piter != m_pending_spawns.end() ) {
+          piter->second.event = handle;
+        }
+      }
+    }
+  }
+
+  m_simtime = Clock::time_point{ Clock::duration{ simtime } };
+  for ( auto &partition : m_partitions ) {
+    partition->m_simtime = m_simtime;
+  }
+  m_external_seq.store( external_seq );
+  m_state.store( State( state ) );
+  m_pending_state.store( State( state ) );
+  return {};
+}
+
+acpp::void_result<> Simulation::Impl::restoreInstance( CheckpointReader &reader ) {
+  SymbolId id = no_symbol;
+  std::string model_name;
+  uint32_t partition = 0;
+  uint64_t event_count = 0;
+  PropertyList parameters;
+  uint8_t has_state = 0;
+  if ( !reader.get( id ) || !reader.getString( model_name ) || !reader.get( partition ) ||
+       !reader.get( event_count ) || !reader.getProperties( parameters ) || !reader.get( has_state ) ||
+       partition >= m_partitions.size() ) {
+    return {{}, "checkpoint corrupt"};
+  }
+  std::string instance_name;
+  {
+    std::shared_lock lock{ m_names_mut };
+    instance_name = m_instance_names.name( id );
+  }
+  if ( instance_name.empty() ) {
+    return {{}, "checkpoint corrupt"};
+  }
+  auto model = resolveModel( intern( model_name ) );
+  if ( !model ) {
+    return {{}, "no model: " + model_name};
+  }
+  auto instance = model->makeInstance( m_simulation.shared_from_this(), instance_name, parameters );
+  if ( !instance || Instance::Private::id( *instance ) != id ) {
+    return {{}, "model " + model_name + " made no instance " + instance_name};
+  }
+  Instance::Private::initialize( *instance, partition );
+  if ( m_chrome ) {
+    attachChromeTrace( *instance );
+  }
+  Instance::Private::setEventCount( *instance, event_count );
+  if ( has_state ) {
+    auto state = reader.getPayload();
+    if ( !state ) {
+      return {{}, "state of " + instance_name + ": " + state.msg};
+    }
+    instance->restoreState( std::move( *state.value ) );
+  }
+  {
+    std::unique_lock lock{ m_names_mut };
+    symbol_slot( m_instances, id ) = instance;
+  }
+
+  uint32_t pads = 0;
+  if ( !reader.get( pads ) ) {
+    return {{}, "checkpoint corrupt"};
+  }
+  for ( uint32_t index = 0; index < pads; ++index ) {
+    SymbolId pad_id = no_symbol;
+    uint32_t messages = 0;
+    if ( !reader.get( pad_id ) || !reader.get( messages ) ) {
+      return {{}, "checkpoint corrupt"};
+    }
+#if ACPP_LESSON > 3
+    auto pad = Instance::Private::pad( *instance, pad_id );
+    if ( !pad ) {
+      return {{}, "no pad " + name( pad_id ) + " on " + instance_name};
+    }
+    for ( uint32_t message = 0; message < messages; ++message ) {
+      auto payload = reader.getPayload();
+      if ( !payload ) {
+        return { payload.err, payload.msg };
+      }
+      Pad::Private::requeue( *pad, std::move( *payload.value ) );
+    }
+#else
+    return {{}, "checkpoint has pads"};
+#endif // ACPP_LESSON > 3
+  }
+  return {};
+}
+
+acpp::void_result<> Simulation::Impl::restoreLinks( CheckpointReader &reader ) {
+  uint32_t count = 0;
+  if ( !reader.get( count ) ) {
+    return {{}, "checkpoint corrupt"};
+  }
+  for ( uint32_t index = 0; index < count; ++index ) {
+    std::array<SymbolId, 4> link;
+    if ( !reader.get( link ) ) {
+      return {{}, "checkpoint corrupt"};
+    }
+#if ACPP_LESSON > 3
+    std::shared_ptr<Instance> from, to;
+    {
+      std::shared_lock lock{ m_names_mut };
+      from = symbol_get( m_instances, link[0] );
+      to = symbol_get( m_instances, link[2] );
+    }
+    auto pad = from ? Instance::Private::pad( *from, link[1] ) : nullptr;
+    if ( !pad || !to || !pad->connect( to, name( link[3] ) ) ) {
+      return {{}, "checkpoint links pads that aren't there"};
+    }
+#else
+    return {{}, "checkpoint has pads"};
+#endif // ACPP_LESSON > 3
+  }
+  return {};
+}
+
+acpp::void_result<> Simulation::Impl::setPartitions( size_t count ) {
+  if ( count == 0 ) {
+    return {{}, "need at least one partition"};
+  }
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  if ( spawnedAny() ) {
+    return {{}, "partitions can only change before anything is spawned"};
+  }
+  m_partitions.clear();
+  for ( size_t index = 0; index < count; ++index ) {
+    m_partitions.push_back(
+        std::make_unique<Partition>( *this, static_cast<uint32_t>( index ), m_queue, m_arena.resource() ) );
+  }
+  attachProfile();
+  attachChromeTrace();
+#ifdef SIM_TRACE
+  attachTrace();
+#endif
+  return {};
+}
+
+acpp::void_result<> Simulation::Impl::startProfile() {
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  if ( m_profiling && m_profiling->running ) {
+    return {{}, "already profiling"};
+  }
+  for ( auto &partition : m_partitions ) {
+    partition->m_profile.reset(); // counts start again
+  }
+  m_profiling = std::make_unique<Profiling>();
+  m_profiling->from = m_simtime;
+  attachProfile();
+  return {};
+}
+
+acpp::void_result<> Simulation::Impl::stopProfile() {
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  if ( !m_profiling || !m_profiling->running ) {
+    return {{}, "not profiling"};
+  }
+  auto &profiling = *m_profiling;
+  profiling.until = m_simtime;
+  profiling.wall = profiling.rate.seconds();
+  profiling.ticks_per_second = profiling.rate.perSecond();
+  profiling.running = false;
+  for ( auto &partition : m_partitions ) {
+    profiling.stopped.push_back( std::move( *partition->m_profile ) );
+  }
+  attachProfile();
+  return {};
+}
+
+void Simulation::Impl::attachProfile() {
+  bool profiling = m_profiling && m_profiling->running;
+  for ( auto &partition : m_partitions ) {
+    if ( !profiling ) {
+      partition->m_profile.reset();
+    } else if ( !partition->m_profile ) {
+      partition->m_profile = std::make_unique<PartitionProfile>();
+    }
+  }
+}
+
+acpp::value_result<Profile> Simulation::Impl::profile() const {
+  if ( !m_profiling ) {
+    return {{}, "not profiled"};
+  }
+  if ( m_running && m_parallel ) {
+    return {{}, "partitions are running on their threads"};
+  }
+  const auto &profiling = *m_profiling;
+  // the partitions' counts summed, the same cells of each meaning the same
+  std::vector<PartitionProfile::Cell> cells;
+  auto gather = [&cells]( const PartitionProfile &partition ) {
+    if ( cells.size() < partition.m_cells.size() ) {
+      cells.resize( partition.m_cells.size() );
+    }
+    for ( size_t index = 0; index < partition.m_cells.size(); ++index ) {
+      const auto &from = partition.m_cells[index];
+      auto &to = cells[index];
+      to.events += from.events;
+      to.ticks += from.ticks;
+      to.depth_sum += from.depth_sum;
+      to.depth_max = std::max( to.depth_max, from.depth_max );
+    }
+  };
+  if ( profiling.running ) {
+    for ( const auto &partition : m_partitions ) {
+      if ( partition->m_profile ) {
+        gather( *partition->m_profile );
+      }
+    }
+  } else {
+    for ( const auto &partition : profiling.stopped ) {
+      gather( partition );
+    }
+  }
+
+  Profile profile;
+  auto until = profiling.running ? now() : profiling.until;
+  profile.simulated = std::chrono::duration<double>( until - profiling.from ).count();
+  profile.wall = profiling.running ? profiling.rate.seconds() : profiling.wall;
+  auto ticks_per_second = profiling.running ? profiling.rate.perSecond() : profiling.ticks_per_second;
+  std::shared_lock lock{ m_names_mut };
+  for ( size_t index = 0; index < cells.size(); ++index ) {
+    const auto &cell = cells[index];
+    if ( cell.events == 0 ) {
+      continue;
+    }
+    Profile::Row row;
+    row.type = typeName( uint8_t( index % s_event_types ) );
+    if ( auto slot = index / s_event_types; slot > 0 ) {
+      auto id = SymbolId( slot - 1 );
+      row.instance = m_instance_names.name( id );
+      if ( id < m_instances.size() && m_instances[id] ) {
+        row.model = m_instances[id]->model()->name();
+      }
+    }
+    row.cost.events = cell.events;
+    row.cost.seconds = ticks_per_second > 0.0 ? double( cell.ticks ) / ticks_per_second : 0.0;
+    row.cost.depth_sum = cell.depth_sum;
+    row.cost.depth_max = cell.depth_max;
+    profile.rows.push_back( std::move( row ) );
+  }
+  return acpp::value_result<Profile>{ std::move( profile ) };
+}
+
+acpp::void_result<> Simulation::Impl::startChromeTrace( const std::string &path, TraceAxis axis ) {
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  if ( m_chrome ) {
+    return {{}, "already exporting a Chrome trace"};
+  }
+  // the writer thread names ids as it meets them, while the run may intern more
+  chrome_trace::Names names{
+      [this]( SymbolId id ) {
+        std::shared_lock lock{ m_names_mut };
+        return m_names.name( id );
+      },
+      [this]( SymbolId id ) {
+        std::shared_lock lock{ m_names_mut };
+        return m_instance_names.name( id );
+      },
+      []( uint8_t type ) { return typeName( type ); } };
+  auto writer = ChromeTraceWriter::open( path, static_cast<chrome_trace::Axis>( axis ), std::move( names ) );
+  if ( !writer ) {
+    return {{}, writer.msg};
+  }
+  m_chrome = std::move( *writer.value );
+  attachChromeTrace();
+  // activities already waiting began as far as the trace knows
+  auto since_ticks = ticks();
+  for ( auto &partition : m_partitions ) {
+    for ( auto &waiting : partition->m_waiting ) {
+      if ( waiting.activity ) {
+        waiting.since = partition->m_simtime;
+        waiting.since_ticks = since_ticks;
+      }
+    }
+  }
+  return {};
+}
+
+acpp::void_result<> Simulation::Impl::stopChromeTrace() {
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  if ( !m_chrome ) {
+    return {{}, "not exporting a Chrome trace"};
+  }
+  auto writer = std::move( m_chrome );
+  attachChromeTrace();
+  return writer->finish();
+}
+
+void Simulation::Impl::attachChromeTrace() {
+  for ( auto &partition : m_partitions ) {
+    partition->m_chrome = m_chrome ? &m_chrome->buffer( partition->m_index, partition->m_simtime ) : nullptr;
+  }
+  for ( auto &instance : m_instances ) {
+    if ( instance ) {
+      attachChromeTrace( *instance );
+    }
+  }
+}
+
+void Simulation::Impl::attachChromeTrace( Instance &instance ) {
+#if ACPP_LESSON > 3
+  auto *buffer = partitionOf( instance ).m_chrome;
+  for ( auto &pad : Instance::Private::pads( instance ) ) {
+    if ( pad ) {
+      Pad::Private::exportLength( *pad, buffer, Instance::Private::id( instance ) );
+    }
+  }
+#else
+  (void)instance;
+#endif // ACPP_LESSON > 3
+}
+
+#ifdef SIM_TRACE
+acpp::void_result<> Simulation::Impl::startTrace( const std::string &path ) {
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  if ( m_trace ) {
+    return {{}, "already tracing"};
+  }
+  auto writer = TraceWriter::open( path );
+  if ( !writer ) {
+    return {{}, writer.msg};
+  }
+  m_trace = std::move( *writer.value );
+  attachTrace();
+  return {};
+}
+
+acpp::void_result<> Simulation::Impl::stopTrace() {
+  if ( m_running ) {
+    return {{}, "simulation is running"};
+  }
+  if ( !m_trace ) {
+    return {{}, "not tracing"};
+  }
+  auto writer = std::move( m_trace );
+  attachTrace();
+  std::shared_lock names_lock{ m_names_mut };
+  return writer->finish( m_names, m_instance_names );
+}
+
+void Simulation::Impl::attachTrace() {
+  for ( auto &partition : m_partitions ) {
+    partition->m_trace = m_trace ? &m_trace->buffer( partition->m_index ) : nullptr;
+  }
+}
+
+void Simulation::Impl::traceInsert(
+    Partition &partition,
+    uint64_t seq,
+    const SimEvent &event,
+    const PropertyList *parameters ) {
+  partition.m_trace->record( trace::Op::SCHEDULE, seq, event.time.time_since_epoch().count(), uint8_t( event.type ),
+      event.owner, event.name, event.spec, uint16_t( partition.m_index ) );
+  // only what came from outside an instance, and only once: a rollback schedules it again
+  if ( seq >= ( uint64_t( 1 ) << s_origin_shift ) || m_optimistic ) {
+    return;
+  }
+  std::ostringstream out{ std::ios::binary };
+  CheckpointWriter writer{ out, *m_simulator };
+  writer.put( partition.m_index );
+  writer.put( seq );
+  writer.put( event.type );
+  writer.put( event.time.time_since_epoch().count() );
+  writer.put( event.spec );
+  writer.put( event.name );
+  writer.put( event.owner );
+  {
+    // the names, so that a replay can intern them as they were
+    std::shared_lock lock{ m_names_mut };
+    std::array<SymbolId, 3> ids{ event.spec, event.name, event.owner };
+    auto kinds = eventIds( event.type );
+    for ( size_t field = 0; field < ids.size(); ++field ) {
+      auto &table = kinds[field] == IdKind::INSTANCE ? m_instance_names : m_names;
+      writer.putString( kinds[field] == IdKind::NONE ? std::string{} : table.name( ids[field] ) );
+    }
+  }
+  auto tag = event.payload.tag();
+  bool kept = !tag || m_simulator->payloadSerializer( tag );
+  writer.put( uint8_t( kept ) );
+  if ( kept ) {
+    writer.putPayload( event.payload );
+  } else {
+    writer.put( tag ); // a replay fails on it
+  }
+  if ( event.type == SimEvent::Type::SPAWN_INSTANCE ) {
+    writer.putProperties( parameters ? *parameters : PropertyList{} );
+  }
+  m_trace->addStimulus( trace::Stimulus{ ticks(), out.str() } );
+}
+
+std::string Simulation::Impl::feedStimulus( const trace::Stimulus &stimulus ) {
+  std::istringstream in{ stimulus.bytes, std::ios::binary };
+  CheckpointReader reader{ in, *m_simulator };
+  uint32_t partition = 0;
+  uint64_t seq = 0;
+  SimEvent::Type type;
+  Clock::rep time = 0;
+  std::array<SymbolId, 3> ids{};
+  std::array<std::string, 3> texts;
+  uint8_t kept = 0;
+  if ( !reader.get( partition ) || !reader.get( seq ) || !reader.get( type ) || !reader.get( time ) ||
+       !reader.get( ids[0] ) || !reader.get( ids[1] ) || !reader.get( ids[2] ) || !reader.getString( texts[0] ) ||
+       !reader.getString( texts[1] ) || !reader.getString( texts[2] ) || !reader.get( kept ) ) {
+    return "stimulus corrupt";
+  }
+  Payload payload;
+  if ( kept ) {
+    auto read = reader.getPayload();
+    if ( !read ) {
+      return read.msg;
+    }
+    payload = std::move( *read.value );
+  } else {
+    uint32_t tag = 0;
+    reader.get( tag );
+    return "a " + std::string( typeName( uint8_t( type ) ) ) + " from outside has a payload of tag " +
+           std::to_string( tag ) + " that had no serializer, so it wasn't recorded";
+  }
+  PropertyList parameters;
+  if ( type == SimEvent::Type::SPAWN_INSTANCE && !reader.getProperties( parameters ) ) {
+    return "stimulus corrupt";
+  }
+  if ( partition >= m_partitions.size() ) {
+    return "the trace has more partitions than the simulation";
+  }
+  // intern in the order the simulation did, so that the ids come back
+  std::array<SymbolId, 3> interned{ no_symbol, no_symbol, no_symbol };
+  switch ( type ) {
+  case SimEvent::Type::SPAWN_INSTANCE: {
+    std::unique_lock lock{ m_names_mut };
+    interned[1] = m_instance_names.intern( texts[1] );
+    interned[0] = m_names.intern( texts[0] );
+    if ( symbol_get( m_instances, interned[1] ) ) {
+      return "instance " + texts[1] + " already exists";
+    }
+    break;
+  }
+  case SimEvent::Type::SPAWN_ACTIVITY:
+    interned[0] = intern( texts[0] );
+    interned[1] = intern( texts[1] );
+    [[fallthrough]];
+  case SimEvent::Type::PAD_SEND: {
+    if ( type == SimEvent::Type::PAD_SEND ) {
+      interned[0] = symbol( texts[0] );
+    }
+    std::shared_lock lock{ m_names_mut };
+    interned[2] = m_instance_names.find( texts[2] );
+    if ( !symbol_get( m_instances, interned[2] ) ) {
+      return "instance " + texts[2] + " not found";
+    }
+    break;
+  }
+  default:
+    return "a " + std::string( typeName( uint8_t( type ) ) ) + " from outside a run can't be replayed";
+  }
+  if ( interned != ids ) {
+    return "names are interned in another order than when the trace was recorded";
+  }
+  if ( m_external_seq.load() < seq ) {
+    m_external_seq.store( seq );
+  }
+  SimEvent event{ type, Clock::time_point{ Clock::duration{ time } }, ids[0], ids[1], ids[2], std::move( payload ) };
+  auto &target = *m_partitions[partition];
+  if ( type != SimEvent::Type::SPAWN_INSTANCE ) {
+    target.insert( seq, std::move( event ) );
+    return {};
+  }
+  std::lock_guard spawn_lock{ m_spawn_mut };
+  if ( m_pending_spawns.count( ids[1] ) > 0 ) {
+    return "instance " + texts[1] + " already exists";
+  }
+  auto &pending = m_pending_spawns.emplace( ids[1], PendingSpawn{ {}, std::move( parameters ), partition } ).first->second;
+  pending.event = target.insert( seq, std::move( event ), &pending.parameters );
+  return {};
+}
+
+acpp::value_result<size_t> Simulation::Impl::replayTrace( const std::string &path ) {
+  if ( m_running ) {
+    return {{}, "simulation is already running"};
+  }
+  auto read = readTrace( path );
+  if ( !read ) {
+    return {{}, read.msg};
+  }
+  const auto &file = *read.value;
+  if ( file.header.dropped > 0 ) {
+    return {{}, path + " lost records to full buffers"};
+  }
+  // what each partition handled, in order
+  std::vector<std::vector<const trace::Record *>> expected( m_partitions.size() );
+  for ( const auto &record : file.records ) {
+    if ( record.op != trace::Op::HANDLE ) {
+      continue;
+    }
+    if ( record.partition >= expected.size() ) {
+      return {{}, "the trace has more partitions than the simulation"};
+    }
+    expected[record.partition].push_back( &record );
+  }
+  std::vector<const trace::Stimulus *> stimuli;
+  for ( const auto &stimulus : file.stimuli ) {
+    stimuli.push_back( &stimulus );
+  }
+  std::stable_sort( stimuli.begin(), stimuli.end(), []( auto *lhs, auto *rhs ) { return lhs->ticks < rhs->ticks; } );
+  auto describeHandled = [&]( uint64_t seq, const SimEvent &event ) {
+    std::vector<std::string> names, instance_names;
+    {
+      std::shared_lock lock{ m_names_mut };
+      for ( SymbolId id = 0; id < m_names.size(); ++id ) {
+        names.push_back( m_names.name( id ) );
+      }
+      for ( SymbolId id = 0; id < m_instance_names.size(); ++id ) {
+        instance_names.push_back( m_instance_names.name( id ) );
+      }
+    }
+    return describeEvent( uint8_t( event.type ), event.time.time_since_epoch().count(), seq,
+        { event.spec, event.name, event.owner }, names, instance_names );
+  };
+  auto describeRecord = [&]( const trace::Record &record ) {
+    return describeEvent( record.type, record.simtime, record.seq, { record.spec, record.name, record.owner },
+        file.names, file.instance_names );
+  };
+
+  if ( m_running.exchange( true ) ) {
+    return {{}, "simulation is already running"};
+  }
+  drainInbox();
+  setState( State::RUN );
+  std::vector<size_t> done( m_partitions.size() );
+  size_t fed = 0;
+  size_t handled = 0;
+  std::string failure;
+  try {
+    while ( failure.empty() ) {
+      auto next = earliest();
+      // a stimulus goes in before what was handled after it was scheduled
+      if ( fed < stimuli.size() ) {
+        auto index = next ? next->m_index : 0;
+        if ( !next || done[index] == expected[index].size() ||
+             stimuli[fed]->ticks < expected[index][done[index]]->ticks ) {
+          failure = feedStimulus( *stimuli[fed++] );
+          continue;
+        }
+      }
+      if ( !next ) {
+        break;
+      }
+      auto &records = expected[next->m_index];
+      auto &position = done[next->m_index];
+      uint64_t seq;
+      auto event = next->extract( seq );
+      if ( position == records.size() || records[position]->seq != seq ||
+           records[position]->simtime != event.time.time_since_epoch().count() ||
+           records[position]->type != uint8_t( event.type ) || records[position]->owner != event.owner ||
+           records[position]->name != event.name || records[position]->spec != event.spec ) {
+        failure = "partition " + std::to_string( next->m_index ) + " event " + std::to_string( position + 1 ) +
+                  " differs: the trace has " + ( position == records.size() ? "none" : describeRecord( *records[position] ) ) +
+                  ", the simulation " + describeHandled( seq, event );
+        next->insert( seq, std::move( event ) ); // left as it was
+        break;
+      }
+      ++position;
+      if ( event.time > m_simtime ) {
+        m_simtime = event.time;
+      }
+      next->m_simtime = m_simtime;
+      PartitionScope scope{ *next };
+      dispatch( *next, seq, std::move( event ) );
+      ++handled;
+    }
+  } catch ( ... ) {
+    m_running = false;
+    throw;
+  }
+  m_running = false;
+  for ( size_t index = 0; index < expected.size() && failure.empty(); ++index ) {
+    if ( done[index] < expected[index].size() ) {
+      failure = "partition " + std::to_string( index ) + " event " + std::to_string( done[index] + 1 ) +
+                " differs: the trace has " + describeRecord( *expected[index][done[index]] ) + ", the simulation none";
+    }
+  }
+  setState( earliest() ? State::PAUSE : State::DONE );
+  if ( !failure.empty() ) {
+    return {{}, failure};
+  }
+  return acpp::value_result<size_t>{ handled };
+}
+#endif
+
+bool Simulation::Impl::spawnedAny() {
+  {
+    std::lock_guard spawn_lock{ m_spawn_mut };
+    if ( !m_pending_spawns.empty() ) {
+      return true;
+    }
+  }
+  for ( const auto &partition : m_partitions ) {
+    if ( !partition->m_events.empty() ) {
+      return true;
+    }
+  }
+  std::shared_lock lock{ m_names_mut };
+  return std::any_of( m_instances.begin(), m_instances.end(), []( const auto &instance ) {
+    return static_cast<bool>( instance );
+  } );
+}
+
+acpp::void_result<> Simulation::Impl::runParallel( const Clock::time_point &until ) {
+  if ( m_partitions.size() == 1 ) {
+    // nothing to synchronize with, run on the calling thread
+    auto ran = run( until, std::numeric_limits<size_t>::max() );
+    if ( !ran ) {
+      return {{}, ran.msg};
+    }
+    return {};
+  }
+  if ( m_running.exchange( true ) ) {
+    return {{}, "simulation is already running"};
+  }
+  drainInbox(); // what is posted later waits for the end of the run
+  for ( auto &partition : m_partitions ) {
+    partition->m_simtime = m_simtime;
+  }
+
+  bool optimistic = m_synchronization == Synchronization::OPTIMISTIC;
+  if ( optimistic ) {
+    auto suitable = checkOptimistic();
+    if ( !suitable ) {
+      m_running = false;
+      return suitable;
+    }
+  }
+  auto linked = link();
+  if ( !linked ) {
+    unlink();
+    m_running = false;
+    return linked;
+  }
+  {
+    // spawns are refused from here on, so m_instances can be read without locking
+    std::unique_lock lock{ m_names_mut };
+    if ( m_instances.size() < m_instance_names.size() ) {
+      m_instances.resize( m_instance_names.size() );
+    }
+  }
+  if ( optimistic ) {
+    for ( auto &partition : m_partitions ) {
+      for ( auto pos = partition->m_events.begin(); pos != partition->m_events.end(); ++pos ) {
+        auto handle = partition->m_events.handle( pos );
+        partition->m_scheduled.emplace( handle.seq, handle );
+      }
+    }
+    m_rendezvous.m_parties = m_partitions.size();
+  }
+  size_t active = 0;
+  for ( auto &partition : m_partitions ) {
+    partition->m_idle = partition->m_events.empty();
+    active += partition->m_idle ? 0 : 1;
+  }
+  m_active.store( active );
+  m_stopping.store( active == 0 );
+  m_error = nullptr;
+  m_parallel = true;
+  m_optimistic = optimistic;
+  setState( State::RUN );
+
+  std::vector<std::thread> workers;
+  workers.reserve( m_partitions.size() );
+  for ( auto &partition : m_partitions ) {
+    workers.emplace_back( optimistic ? &Impl::optimisticMain : &Impl::partitionMain, this, std::ref( *partition ), until );
+  }
+  for ( auto &worker : workers ) {
+    worker.join();
+  }
+
+  m_optimistic = false;
+  m_parallel = false;
+  m_running = false;
+  // what was sent beyond until is still in the channels
+  for ( auto &channel : m_channels ) {
+    auto &to = *m_partitions[channel->m_to];
+    for ( auto &message : channel->m_messages ) {
+      to.insert( message.seq, std::move( message.event ) );
+    }
+  }
+  unlink();
+  bool pending = false;
+  std::string failure;
+  for ( auto &partition : m_partitions ) {
+    m_simtime = std::max( m_simtime, partition->m_simtime );
+    pending = pending || !partition->m_events.empty();
+    if ( failure.empty() ) {
+      failure = partition->m_failure;
+    }
+    partition->m_failure.clear();
+    partition->m_processed.clear();
+    partition->m_scheduled.clear();
+  }
+  if ( failure.empty() && !m_error && until != Clock::time_point::max() ) {
+    m_simtime = std::max( m_simtime, until ); // as after a synchronous run
+  }
+  setState( pending ? State::PAUSE : State::DONE );
+  if ( m_error ) {
+    std::rethrow_exception( std::exchange( m_error, nullptr ) );
+  }
+  if ( !failure.empty() ) {
+    return {{}, failure};
+  }
+  return {};
+}
+
+acpp::void_result<> Simulation::Impl::link() {
+  unlink();
+  for ( auto &partition : m_partitions ) {
+    partition->m_outputs.assign( m_partitions.size(), nullptr );
+  }
+#if ACPP_LESSON > 3
+  for ( const auto &instance : m_instances ) {
+    if ( !instance ) {
+      continue;
+    }
+    auto from = Instance::Private::partition( *instance );
+    for ( const auto &pad : Instance::Private::pads( *instance ) ) {
+      auto peer = pad ? pad->peer() : nullptr;
+      auto target = peer ? peer->owner() : nullptr;
+      if ( !target || !( pad->spec().flags & PadSpec::Flag::CAN_OUTPUT ) ) {
+        continue;
+      }
+      auto to = Instance::Private::partition( *target );
+      if ( to == from ) {
+        continue;
+      }
+      auto lookahead = pad->lookahead();
+      if ( lookahead <= Clock::duration::zero() && m_synchronization == Synchronization::CONSERVATIVE ) {
+        return {{}, "pad " + instance->name() + "." + pad->name() + " links partitions without lookahead"};
+      }
+      auto &channel = m_partitions[from]->m_outputs[to];
+      if ( !channel ) {
+        m_channels.push_back( std::make_unique<Channel>( from, to, lookahead ) );
+        channel = m_channels.back().get();
+        m_partitions[to]->m_inputs.push_back( channel );
+      }
+      channel->m_lookahead = std::min( channel->m_lookahead, lookahead );
+    }
+  }
+#endif // ACPP_LESSON > 3
+  for ( auto &channel : m_channels ) {
+    // nothing is sent before the run starts at m_simtime
+    channel->m_promise = later( m_simtime, channel->m_lookahead );
+  }
+  return {};
+}
+
+void Simulation::Impl::unlink() {
+  for ( auto &partition : m_partitions ) {
+    partition->m_inputs.clear();
+    partition->m_outputs.clear();
+  }
+  m_channels.clear();
+}
+
+Clock::time_point Simulation::Impl::drain( Partition &partition ) {
+  auto safe = Clock::time_point::max();
+  size_t drained = 0;
+  for ( auto channel : partition.m_inputs ) {
+    std::lock_guard lock{ channel->m_mut };
+    safe = std::min( safe, channel->m_promise );
+    for ( auto &message : channel->m_messages ) {
+      partition.insert( message.seq, std::move( message.event ) );
+    }
+    drained += channel->m_messages.size();
+    channel->m_messages.clear();
+  }
+  if ( drained > 0 ) {
+    // count this partition busy before the messages stop counting
+    if ( partition.m_idle ) {
+      partition.m_idle = false;
+      m_active.fetch_add( 1 );
+    }
+    m_active.fetch_sub( drained );
+  }
+  return safe;
+}
+
+void Simulation::Impl::post( Channel &channel, uint64_t seq, SimEvent &&event, bool anti ) {
+  auto &from = *m_partitions[channel.m_from];
+  ++from.m_posted;
+  if ( m_optimistic && !anti && from.m_record ) {
+    from.m_record->sent.push_back( Processed::Sent{ seq, event.time, channel.m_to } );
+  }
+  m_active.fetch_add( 1 ); // the message keeps the run going until it is drained
+  std::lock_guard lock{ channel.m_mut };
+  channel.m_messages.push_back( Channel::Message{ seq, std::move( event ), anti } );
+}
+
+void Simulation::Impl::publish( Partition &partition, const Clock::time_point &horizon ) {
+  for ( auto channel : partition.m_outputs ) {
+    if ( !channel ) {
+      continue;
+    }
+    auto promise = later( horizon, channel->m_lookahead );
+    {
+      std::lock_guard lock{ channel->m_mut };
+      if ( !( channel->m_promise < promise ) ) {
+        continue;
+      }
+      channel->m_promise = promise; // the null message
+    }
+    wake( *m_partitions[channel->m_to] );
+  }
+}
+
+void Simulation::Impl::wake( Partition &partition ) {
+  {
+    std::lock_guard lock{ partition.m_wake_mut };
+    ++partition.m_wakeups;
+  }
+  partition.m_wake_cnd.notify_one();
+}
+
+void Simulation::Impl::stop() {
+  m_stopping.store( true );
+  for ( auto &partition : m_partitions ) {
+    wake( *partition );
+  }
+}
+
+void Simulation::Impl::partitionMain( Partition &partition, Clock::time_point until ) {
+  PartitionScope scope{ partition };
+  try {
+    while ( !m_stopping.load() ) {
+      uint64_t wakeups;
+      {
+        std::lock_guard lock{ partition.m_wake_mut };
+        wakeups = partition.m_wakeups;
+      }
+      // events before every input's promise can't be overtaken by a message
+      auto safe = drain( partition );
+      while ( !partition.m_events.empty() ) {
+        const auto &next = partition.m_events.top();
+        if ( !( next.time < safe ) || until < next.time ) {
+          break;
+        }
+        uint64_t seq;
+        auto event = partition.extract( seq );
+        dispatch( partition, seq, std::move( event ) );
+      }
+      if ( partition.m_events.empty() && !partition.m_idle ) {
+        partition.m_idle = true;
+        if ( m_active.fetch_sub( 1 ) == 1 ) {
+          stop(); // every partition idle and nothing in flight
+          break;
+        }
+      }
+      auto horizon = partition.m_events.empty() ? safe : std::min( safe, partition.m_events.top().time );
+      publish( partition, horizon );
+      if ( until < horizon ) {
+        break; // neither this partition nor its inputs have anything left before until
+      }
+      std::unique_lock lock{ partition.m_wake_mut };
+      partition.m_wake_cnd.wait( lock, [&] { return partition.m_wakeups != wakeups || m_stopping.load(); } );
+    }
+  } catch ( ... ) {
+    {
+      std::lock_guard lock{ m_error_mut };
+      if ( !m_error ) {
+        m_error = std::current_exception();
+      }
+    }
+    stop();
+  }
+}
+
+acpp::void_result<> Simulation::Impl::checkOptimistic() {
+  {
+    std::lock_guard spawn_lock{ m_spawn_mut };
+    if ( !m_pending_spawns.empty() ) {
+      return {{}, "instances must spawn before an optimistic run"};
+    }
+  }
+  for ( const auto &partition : m_partitions ) {
+    if ( partition->m_waiting_count > 0 ) {
+      return {{}, "activities are waiting, which an optimistic run can't roll back"};
+    }
+  }
+  return {};
+}
+
+void Simulation::Impl::optimisticMain( Partition &partition, Clock::time_point until ) {
+  PartitionScope scope{ partition };
+  while ( true ) {
+    bool failed = !partition.m_failure.empty();
+    if ( !failed ) {
+      try {
+        failed = !speculate( partition, until );
+      } catch ( ... ) {
+        partition.m_record = nullptr;
+        partition.m_origin = nullptr;
+        partition.m_seq = 0;
+        std::lock_guard lock{ m_error_mut };
+        if ( !m_error ) {
+          m_error = std::current_exception();
+        }
+        failed = true;
+      }
+    }
+    // all stop running ahead here, and if any failed all go back to the last GVT
+    bool stop = m_rendezvous.meet( Clock::time_point::max(), failed ).second;
+    if ( stop ) {
+      rollback( partition, Clock::time_point::min(), 0 );
+    }
+    settle( partition );
+    // with nothing in flight, the earliest pending event of all is what nothing can precede
+    auto next = partition.m_events.empty() ? Clock::time_point::max() : partition.m_events.top().time;
+    auto gvt = m_rendezvous.meet( next, false ).first;
+    while ( !partition.m_processed.empty() && partition.m_processed.front().event.time < gvt ) {
+      partition.m_processed.pop_front(); // fossil collection
+    }
+    if ( stop || until < gvt || gvt == Clock::time_point::max() ) {
+      break;
+    }
+  }
+}
+
+bool Simulation::Impl::speculate( Partition &partition, const Clock::time_point &until ) {
+  for ( size_t count = 0; count < s_optimism; ++count ) {
+    receive( partition );
+    if ( partition.m_events.empty() || until < partition.m_events.top().time ) {
+      break;
+    }
+    uint64_t seq;
+    auto event = partition.extract( seq );
+    partition.m_scheduled.erase( seq );
+    if ( !event.payload.copyable() ) {
+      fail( partition, "an optimistic run can't copy a payload to handle it again" );
+    }
+    Processed record{ seq, event.clone() };
+    if ( auto instance = symbol_get( m_instances, event.owner ) ) {
+      auto state = instance->saveState();
+      if ( !state ) {
+        fail( partition, state.msg );
+      } else {
+        record.instance = instance.get();
+        record.state = std::move( *state.value );
+        record.event_count = Instance::Private::eventCount( *instance );
+      }
+    }
+    if ( !partition.m_failure.empty() ) {
+      partition.m_scheduled[seq] = partition.insert( seq, std::move( event ) );
+      return false;
+    }
+    partition.m_processed.push_back( std::move( record ) );
+    partition.m_record = &partition.m_processed.back();
+    partition.m_simtime = event.time;
+    dispatch( partition, seq, std::move( event ) );
+    partition.m_record = nullptr;
+    if ( !partition.m_failure.empty() ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Simulation::Impl::receive( Partition &partition ) {
+  for ( auto channel : partition.m_inputs ) {
+    std::vector<Channel::Message> messages;
+    {
+      std::lock_guard lock{ channel->m_mut };
+      messages.swap( channel->m_messages );
+    }
+    for ( auto &message : messages ) {
+      if ( message.anti ) {
+        annihilate( partition, message.seq, message.event.time );
+        continue;
+      }
+      // a message in the past undoes what it should have preceded
+      rollback( partition, message.event.time, message.seq );
+      partition.m_scheduled[message.seq] = partition.insert( message.seq, std::move( message.event ) );
+    }
+  }
+}
+
+void Simulation::Impl::rollback( Partition &partition, const Clock::time_point &time, uint64_t seq ) {
+  auto key = std::make_pair( time, seq );
+  while ( !partition.m_processed.empty() ) {
+    auto &record = partition.m_processed.back();
+    if ( std::make_pair( record.event.time, record.seq ) < key ) {
+      break;
+    }
+    // events it scheduled here are pending again by now, as they ordered after it
+    for ( auto sent = record.sent.rbegin(); sent != record.sent.rend(); ++sent ) {
+      if ( sent->partition != partition.m_index ) {
+        post( *partition.m_outputs[sent->partition],
+            sent->seq,
+            SimEvent{ SimEvent::Type::PAD_SEND, sent->time, no_symbol, no_symbol },
+            true );
+        continue;
+      }
+      auto scheduled = partition.m_scheduled.find( sent->seq );
+      if ( scheduled != partition.m_scheduled.end() ) {
+        partition.cancel( scheduled->second );
+        partition.m_scheduled.erase( scheduled );
+      }
+    }
+    if ( record.instance ) {
+      record.instance->restoreState( std::move( record.state ) );
+      Instance::Private::setEventCount( *record.instance, record.event_count );
+    }
+    partition.m_simtime = std::min( partition.m_simtime, record.event.time );
+    partition.m_scheduled[record.seq] = partition.insert( record.seq, std::move( record.event ) );
+    partition.m_processed.pop_back();
+  }
+}
+
+void Simulation::Impl::annihilate( Partition &partition, uint64_t seq, const Clock::time_point &time ) {
+  // the message arrived before its anti-message, but may have been handled since
+  if ( partition.m_scheduled.count( seq ) == 0 ) {
+    rollback( partition, time, seq );
+  }
+  auto scheduled = partition.m_scheduled.find( seq );
+  if ( scheduled != partition.m_scheduled.end() ) {
+    partition.cancel( scheduled->second );
+    partition.m_scheduled.erase( scheduled );
+  }
 }
 
-void Simulation::Impl::workerFunc() {
-  std::unique_lock<std::mutex> state_lock( m_state_mut );
-  
-  m_state_cnd.wait( state_lock, [this]() { return m_state != State::INIT; } );
-  while ( m_state != State::DONE ) {
-    m_state_cnd.wait( state_lock, [this]() { return m_state != State::PAUSE; } );
-    if (m_state == State::RUN) {
-      state_lock.unlock();
-      step();
-      state_lock.lock();
+void Simulation::Impl::settle( Partition &partition ) {
+  // what one round sends the next receives, so a round with nothing sent leaves no messages
+  while ( true ) {
+    auto posted = partition.m_posted;
+    receive( partition );
+    if ( !m_rendezvous.meet( Clock::time_point::max(), partition.m_posted != posted ).second ) {
+      break;
     }
   }
 }
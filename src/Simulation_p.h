@@ -9,34 +9,100 @@
 #include <CxxSimulator/Simulator.h>
 #include <CxxSimulator/Instance.h>
 #include <CxxSimulator/Model.h>
+#include "SymbolTable.h"
+#include "Arena.h"
+#include "Fiber.h"
 
 #include <memory>
 #include <functional>
 #include <string>
-#include <any>
-#include <future>
+#include <memory_resource>
 
 namespace sim {
 
+/**
+ * The activity wait functions only register the wait; the activity then suspends its
+ * fiber and the simulation loop resumes it through Activity::Private::resume.
+ */
 struct Simulation::Private {
-  static std::future<bool> insertResumeActivity(
+  static acpp::void_result<> insertResumeActivity(
       std::shared_ptr<Simulation> simulation,
       std::shared_ptr<Activity> activity,
       const Clock::time_point &time );
-  static std::future<bool> activityWaitOn(
+  static acpp::void_result<> activityWaitOn(
       std::shared_ptr<Simulation> simulation,
       std::shared_ptr<Activity> activity,
       const std::string &signal_name,
       const Clock::time_point &time = {} );
-  static std::future<bool> activityPadReceive(
+  /**
+   * @brief Wake the activities waiting on a signal, see activityWaitOn and Simulation::raiseSignal
+   * Called from an activity, only its own partition's waiters are woken.
+   * @return acpp::value_result<size_t> the number of activities woken, 0 if posted to the inbox
+   */
+  static acpp::value_result<size_t> raiseSignal( std::shared_ptr<Simulation> simulation, const std::string &signal_name );
+  static acpp::void_result<> activityPadReceive(
       std::shared_ptr<Simulation> simulation,
       std::shared_ptr<Activity> activity,
-      const std::string &pad_name,
-      const Clock::time_point &time = {} );
-  static std::future<bool> padSend( std::shared_ptr<Simulation> simulation,
-      std::shared_ptr<Pad> pad,
-      const std::any &payload,
+      SymbolId pad,
       const Clock::time_point &time = {} );
+  /**
+   * @brief Get the id of an activity, pad, model or signal name, interning it if new
+   */
+  static SymbolId intern( std::shared_ptr<Simulation> simulation, const std::string &name );
+  /**
+   * @brief Get the id of an activity, pad, model or signal name without interning it
+   * @return SymbolId the id or no_symbol
+   */
+  static SymbolId symbol( std::shared_ptr<Simulation> simulation, const std::string &name );
+  /**
+   * @brief Get the id of an instance name, interning it if new
+   */
+  static SymbolId instanceId( std::shared_ptr<Simulation> simulation, const std::string &name );
+  /**
+   * @brief Make an instance at once, between runs, and schedule its start activity
+   * Loaders use it to connect pads before any activity runs, see Simulator::loadTopology.
+   * @return acpp::value_result<std::shared_ptr<Instance>> the instance or error
+   */
+  static acpp::value_result<std::shared_ptr<Instance>> makeInstance(
+      std::shared_ptr<Simulation> simulation,
+      const std::string &model,
+      const std::string &name,
+      const PropertyList &parameters );
+  /**
+   * @brief Make room for a number of instances more in the instance tables
+   */
+  static void reserveInstances( std::shared_ptr<Simulation> simulation, size_t count );
+  /**
+   * @brief Give a new activity its dense index, which its waits are kept under
+   * @return uint32_t the index or no_symbol if simulation is null
+   */
+  static uint32_t activitySlot( std::shared_ptr<Simulation> simulation );
+  /**
+   * @brief Get the memory resource of a simulation's pool
+   * @return std::pmr::memory_resource* the pool or the default resource if simulation is null
+   */
+  static std::pmr::memory_resource *resource( std::shared_ptr<Simulation> simulation );
+  /**
+   * @brief Get the pool of fiber stacks activities of a simulation run on
+   * @return StackPool* the pool or nullptr if simulation is null
+   */
+  static StackPool *stacks( std::shared_ptr<Simulation> simulation );
+  /**
+   * @brief Make a shared object allocated from a simulation's pool
+   */
+  template <typename Tp, typename... Args>
+  static std::shared_ptr<Tp> makeShared( std::shared_ptr<Simulation> simulation, Args &&... args ) {
+    return allocate_shared_from<Tp>( resource( simulation ), std::forward<Args>( args )... );
+  }
+  static void padReceived( std::shared_ptr<Simulation> simulation, std::shared_ptr<Pad> pad );
+  /**
+   * @brief Send a payload out of a pad to its peer
+   * Delivery is immediate for a pad without lookahead, otherwise it is scheduled that
+   * much later, possibly in another partition.
+   * @param pad the sending pad, which must have a peer
+   * @return bool whether the payload was sent
+   */
+  static bool padSend( std::shared_ptr<Simulation> simulation, std::shared_ptr<Pad> pad, Payload &&payload );
 };
 
 } // namespace sim
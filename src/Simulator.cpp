@@ -3,27 +3,30 @@
 
 #include <CxxSimulator/Simulator.h>
 #include "Simulation_p.h"
-
-#include <nlohmann/json.hpp>
+#include "Topology.h"
 
 #include <map>
 #include <vector>
 #include <string>
 #include <memory>
 #include <algorithm>
-
-using json = nlohmann::json;
+#include <atomic>
+#include <thread>
+#include <istream>
+#include <variant>
 
 namespace sim {
 
 struct Simulator::Impl {
   std::unordered_map<std::string, std::shared_ptr<Model>> m_models;
-  std::vector<Simulation> m_simulations;
+  std::unordered_map<uint32_t, PayloadSerializer> m_serializers; // by payload tag
 };
 
 Simulator::Simulator() : impl( new Impl ) {
 }
 
+Simulator::~Simulator() = default;
+
 void Simulator::reset() {
   impl = std::make_unique<Impl>();
 }
@@ -33,8 +36,124 @@ Simulator &Simulator::getInstance() {
   return instance;
 }
 
-std::shared_ptr<Simulation> Simulator::loadTopology( const std::string &topo_json ) {
-  return {};  // unimplemented
+acpp::value_result<Simulator::Replications> Simulator::runReplications(
+    const Topology &topology,
+    size_t count,
+    const std::vector<uint64_t> &seeds,
+    size_t threads,
+    const Clock::time_point &until ) {
+  if ( !topology ) {
+    return { {}, "no topology" };
+  }
+  if ( !seeds.empty() && seeds.size() != count ) {
+    return { {}, "need one seed per replica" };
+  }
+  if ( threads == 0 ) {
+    threads = std::max<size_t>( 1, std::thread::hardware_concurrency() );
+  }
+  threads = std::min( threads, count );
+
+  std::vector<std::string> errors( count );
+  std::vector<std::map<std::string, std::shared_ptr<Collector>>> collectors( count );
+  std::atomic<size_t> next{ 0 };
+  auto work = [&] {
+    for ( size_t replica; ( replica = next.fetch_add( 1, std::memory_order_relaxed ) ) < count; ) {
+      try {
+        auto simulation = std::make_shared<Simulation>( *this );
+        auto seed = seeds.empty() ? uint64_t( replica ) : seeds[replica];
+        simulation->setParameter( "seed", uintmax_t( seed ) );
+        auto built = topology( simulation );
+        if ( !built ) {
+          errors[replica] = built.msg.empty() ? "topology failed" : built.msg;
+          continue;
+        }
+        auto ran = simulation->runParallel( until );
+        if ( !ran ) {
+          errors[replica] = ran.msg.empty() ? "run failed" : ran.msg;
+          continue;
+        }
+        collectors[replica] = simulation->collectors();
+      } catch ( const char *message ) {
+        errors[replica] = message;
+      } catch ( const std::exception &e ) {
+        errors[replica] = e.what();
+      } catch ( ... ) {
+        errors[replica] = "replica threw";
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for ( size_t thread = 1; thread < threads; ++thread ) {
+    pool.emplace_back( work );
+  }
+  work();
+  for ( auto &thread : pool ) {
+    thread.join();
+  }
+
+  Replications replications;
+  replications.errors = std::move( errors );
+  for ( auto &replica : collectors ) {
+    for ( auto &[name, collector] : replica ) {
+      auto [iter, inserted] = replications.collectors.emplace( name, collector );
+      if ( !inserted ) {
+        iter->second->merge( *collector );
+      }
+    }
+  }
+  return acpp::value_result<Replications>{ std::move( replications ) };
+}
+
+namespace {
+
+/**
+ * @brief Make a simulation and let build fill it in, catching what models throw
+ */
+template <typename Build>
+acpp::value_result<std::shared_ptr<Simulation>> buildSimulation( Simulator &simulator, Build &&build ) {
+  try {
+    auto simulation = std::make_shared<Simulation>( simulator );
+    auto built = build( simulation );
+    if ( !built ) {
+      return { {}, built.msg };
+    }
+    return acpp::value_result<std::shared_ptr<Simulation>>{ std::move( simulation ) };
+  } catch ( const char *message ) {
+    return { {}, message };
+  } catch ( const std::exception &e ) {
+    return { {}, e.what() };
+  }
+}
+
+}  // namespace
+
+acpp::value_result<std::shared_ptr<Simulation>> Simulator::loadTopology( const std::string &topo_json ) {
+  return buildSimulation( *this, [&]( std::shared_ptr<Simulation> simulation ) {
+    SimulationBuilder builder{ simulation };
+    return readTopology( topo_json, builder );
+  } );
+}
+
+acpp::value_result<std::shared_ptr<Simulation>> Simulator::loadTopology( std::istream &topo_json ) {
+  return buildSimulation( *this, [&]( std::shared_ptr<Simulation> simulation ) {
+    SimulationBuilder builder{ simulation };
+    return readTopology( topo_json, builder );
+  } );
+}
+
+acpp::void_result<> Simulator::compileTopology( std::istream &topo_json, const std::string &image_path ) {
+  ImageWriter writer;
+  auto read = readTopology( topo_json, writer );
+  if ( !read ) {
+    return read;
+  }
+  return writer.write( image_path );
+}
+
+acpp::value_result<std::shared_ptr<Simulation>> Simulator::loadCompiledTopology( const std::string &image_path ) {
+  return buildSimulation( *this, [&]( std::shared_ptr<Simulation> simulation ) {
+    return loadImage( image_path, simulation );
+  } );
 }
 
 void Simulator::addModel( std::shared_ptr<Model> model ) {
@@ -52,4 +171,19 @@ std::shared_ptr<Model> Simulator::model( const std::string &name ) {
   return nullptr;
 }
 
+void Simulator::addPayloadSerializer( uint32_t tag, PayloadSerializer serializer ) {
+  if ( tag == 0 || tag >= 0x80000000u ) {
+    throw "payload tag not registered with SIM_REGISTER_PAYLOAD";
+  }
+  if ( !serializer.save || !serializer.load ) {
+    throw "payload serializer incomplete";
+  }
+  impl->m_serializers.insert_or_assign( tag, std::move( serializer ) );
+}
+
+const PayloadSerializer *Simulator::payloadSerializer( uint32_t tag ) const {
+  auto iter = impl->m_serializers.find( tag );
+  return iter == impl->m_serializers.end() ? nullptr : &iter->second;
+}
+
 }  // namespace sim
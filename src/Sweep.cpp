@@ -0,0 +1,285 @@
+// Sweep.cpp : designs of experiments over compiled topologies, and the pool running them
+//
+
+#include <CxxSimulator/Simulator.h>
+#include "Topology.h"
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+
+namespace sim {
+
+namespace {
+
+/**
+ * @brief A primitive polynomial and the initial direction numbers of a Sobol dimension
+ * From S. Joe and F. Y. Kuo, new-joe-kuo-6.21201, for the dimensions after the first.
+ */
+struct SobolPolynomial {
+  unsigned degree;
+  uint32_t coefficients; // the inner ones, highest first
+  uint32_t initial[6];
+};
+
+constexpr SobolPolynomial s_sobol_polynomials[] = {
+  { 1, 0, { 1 } },
+  { 2, 1, { 1, 3 } },
+  { 3, 1, { 1, 3, 1 } },
+  { 3, 2, { 1, 1, 1 } },
+  { 4, 1, { 1, 1, 3, 3 } },
+  { 4, 4, { 1, 3, 5, 13 } },
+  { 5, 2, { 1, 1, 5, 5, 17 } },
+  { 5, 4, { 1, 1, 5, 5, 5 } },
+  { 5, 7, { 1, 1, 7, 11, 19 } },
+  { 5, 11, { 1, 1, 5, 1, 1 } },
+  { 5, 13, { 1, 1, 1, 3, 11 } },
+  { 5, 14, { 1, 3, 5, 5, 31 } },
+  { 6, 1, { 1, 3, 3, 9, 7, 49 } },
+  { 6, 13, { 1, 1, 1, 15, 21, 21 } },
+  { 6, 16, { 1, 3, 1, 13, 27, 49 } },
+};
+
+constexpr size_t s_sobol_dimensions = std::size( s_sobol_polynomials ) + 1;
+constexpr unsigned s_sobol_bits = 32;
+
+/**
+ * @brief Draw from [0, 1) with all 53 bits, the same with every standard library
+ */
+double uniform( std::mt19937_64 &random ) {
+  return double( random() >> 11 ) * 0x1.0p-53;
+}
+
+std::vector<std::vector<double>> fullFactorial( const std::vector<Simulator::Sweep::Factor> &factors, size_t points ) {
+  std::vector<std::vector<double>> units( points, std::vector<double>( factors.size() ) );
+  for ( size_t point = 0; point < points; ++point ) {
+    auto rest = point;
+    for ( size_t factor = factors.size(); factor-- > 0; ) {
+      auto levels = factors[factor].levels;
+      units[point][factor] = levels > 1 ? double( rest % levels ) / double( levels - 1 ) : 0.0;
+      rest /= levels;
+    }
+  }
+  return units;
+}
+
+std::vector<std::vector<double>> latinHypercube( size_t dimensions, size_t points, uint64_t seed ) {
+  std::vector<std::vector<double>> units( points, std::vector<double>( dimensions ) );
+  std::mt19937_64 random{ seed };
+  std::vector<size_t> strata( points );
+  for ( size_t dimension = 0; dimension < dimensions; ++dimension ) {
+    for ( size_t stratum = 0; stratum < points; ++stratum ) {
+      strata[stratum] = stratum;
+    }
+    // Fisher-Yates by hand, std::shuffle differs between standard libraries
+    for ( size_t last = points; last > 1; --last ) {
+      std::swap( strata[last - 1], strata[size_t( random() % last )] );
+    }
+    for ( size_t point = 0; point < points; ++point ) {
+      units[point][dimension] = ( double( strata[point] ) + uniform( random ) ) / double( points );
+    }
+  }
+  return units;
+}
+
+std::vector<std::vector<double>> sobol( size_t dimensions, size_t points ) {
+  // direction numbers, scaled to 32 bits
+  std::vector<std::array<uint32_t, s_sobol_bits + 1>> directions( dimensions );
+  for ( size_t dimension = 0; dimension < dimensions; ++dimension ) {
+    auto &v = directions[dimension];
+    if ( dimension == 0 ) {
+      for ( unsigned bit = 1; bit <= s_sobol_bits; ++bit ) {
+        v[bit] = uint32_t( 1 ) << ( s_sobol_bits - bit );
+      }
+      continue;
+    }
+    const auto &polynomial = s_sobol_polynomials[dimension - 1];
+    auto degree = polynomial.degree;
+    for ( unsigned bit = 1; bit <= s_sobol_bits; ++bit ) {
+      if ( bit <= degree ) {
+        v[bit] = polynomial.initial[bit - 1] << ( s_sobol_bits - bit );
+        continue;
+      }
+      v[bit] = v[bit - degree] ^ ( v[bit - degree] >> degree );
+      for ( unsigned term = 1; term < degree; ++term ) {
+        if ( ( polynomial.coefficients >> ( degree - 1 - term ) ) & 1 ) {
+          v[bit] ^= v[bit - term];
+        }
+      }
+    }
+  }
+  // Gray code order: each point flips the direction of the lowest zero bit of the one before
+  std::vector<std::vector<double>> units( points, std::vector<double>( dimensions ) );
+  std::vector<uint32_t> x( dimensions, 0 );
+  for ( size_t point = 0; point < points; ++point ) {
+    unsigned bit = 1;
+    for ( auto rest = point; rest & 1; rest >>= 1 ) {
+      ++bit;
+    }
+    for ( size_t dimension = 0; dimension < dimensions; ++dimension ) {
+      x[dimension] ^= directions[dimension][bit];
+      units[point][dimension] = double( x[dimension] ) * 0x1.0p-32;
+    }
+  }
+  return units;
+}
+
+}  // namespace
+
+acpp::value_result<std::vector<std::vector<double>>> Simulator::sweepPoints( const Sweep &sweep ) {
+  const auto &factors = sweep.factors;
+  if ( factors.empty() ) {
+    return { {}, "no factors" };
+  }
+  for ( const auto &factor : factors ) {
+    if ( factor.name.empty() ) {
+      return { {}, "factor without a name" };
+    }
+    if ( !( factor.low <= factor.high ) ) {
+      return { {}, "factor " + factor.name + " has low above high" };
+    }
+  }
+
+  std::vector<std::vector<double>> units;
+  switch ( sweep.design ) {
+  case Sweep::Design::FULL_FACTORIAL: {
+    size_t points = 1;
+    for ( const auto &factor : factors ) {
+      if ( factor.levels == 0 ) {
+        return { {}, "factor " + factor.name + " has no levels" };
+      }
+      if ( points > std::numeric_limits<size_t>::max() / factor.levels ) {
+        return { {}, "too many points" };
+      }
+      points *= factor.levels;
+    }
+    units = fullFactorial( factors, points );
+    break;
+  }
+  case Sweep::Design::LATIN_HYPERCUBE:
+    if ( sweep.points == 0 ) {
+      return { {}, "no points" };
+    }
+    units = latinHypercube( factors.size(), sweep.points, sweep.seed );
+    break;
+  case Sweep::Design::SOBOL:
+    if ( sweep.points == 0 ) {
+      return { {}, "no points" };
+    }
+    if ( factors.size() > s_sobol_dimensions ) {
+      return { {}, "Sobol points for at most " + std::to_string( s_sobol_dimensions ) + " factors" };
+    }
+    if ( sweep.points >= ( uint64_t( 1 ) << s_sobol_bits ) ) {
+      return { {}, "too many points" };
+    }
+    units = sobol( factors.size(), sweep.points );
+    break;
+  }
+
+  for ( auto &point : units ) {
+    for ( size_t factor = 0; factor < factors.size(); ++factor ) {
+      const auto &range = factors[factor];
+      auto value = range.low + ( range.high - range.low ) * point[factor];
+      point[factor] = range.integer ? std::round( value ) : value;
+    }
+  }
+  return acpp::value_result<std::vector<std::vector<double>>>{ std::move( units ) };
+}
+
+acpp::void_result<> Simulator::runSweep(
+    const std::string &image_path,
+    const Sweep &sweep,
+    const std::function<void( SweepPoint &&point )> &done ) {
+  if ( !done ) {
+    return { {}, "nothing to report the points to" };
+  }
+  auto points = sweepPoints( sweep );
+  if ( !points ) {
+    return { {}, points.msg };
+  }
+  auto opened = CompiledTopology::open( image_path );
+  if ( !opened ) {
+    return { {}, opened.msg };
+  }
+  auto topology = *opened.value;
+
+  // the overrides of every point, resolved once; the last sets the seed
+  std::vector<ParameterOverride> resolved;
+  for ( const auto &factor : sweep.factors ) {
+    auto dot = factor.name.find( '.' );
+    if ( dot == std::string::npos ) {
+      resolved.push_back( { topology_image::s_none, factor.name, {} } );
+      continue;
+    }
+    auto instance = topology->instance( factor.name.substr( 0, dot ) );
+    if ( instance == topology_image::s_none ) {
+      return { {}, "factor " + factor.name + " names no instance" };
+    }
+    resolved.push_back( { instance, factor.name.substr( dot + 1 ), {} } );
+  }
+  resolved.push_back( { topology_image::s_none, "seed", {} } );
+
+  const auto &values = *points.value;
+  auto count = values.size();
+  auto threads = sweep.threads;
+  if ( threads == 0 ) {
+    threads = std::max<size_t>( 1, std::thread::hardware_concurrency() );
+  }
+  threads = std::min( threads, count );
+
+  std::atomic<size_t> next{ 0 };
+  std::mutex done_mut;
+  auto work = [&] {
+    auto overrides = resolved;
+    for ( size_t index; ( index = next.fetch_add( 1, std::memory_order_relaxed ) ) < count; ) {
+      SweepPoint point;
+      point.index = index;
+      point.values = values[index];
+      for ( size_t factor = 0; factor < sweep.factors.size(); ++factor ) {
+        auto value = point.values[factor];
+        if ( sweep.factors[factor].integer ) {
+          overrides[factor].value = intmax_t( std::llround( value ) );
+        } else {
+          overrides[factor].value = value;
+        }
+      }
+      overrides.back().value = uintmax_t( sweep.seed + index );
+      try {
+        auto simulation = std::make_shared<Simulation>( *this );
+        auto built = topology->build( simulation, overrides );
+        if ( !built ) {
+          point.error = built.msg.empty() ? "topology failed" : built.msg;
+        } else if ( auto ran = simulation->runParallel( sweep.until ); !ran ) {
+          point.error = ran.msg.empty() ? "run failed" : ran.msg;
+        } else {
+          point.collectors = simulation->collectors();
+        }
+      } catch ( const char *message ) {
+        point.error = message;
+      } catch ( const std::exception &e ) {
+        point.error = e.what();
+      } catch ( ... ) {
+        point.error = "run threw";
+      }
+      std::lock_guard lock{ done_mut };
+      done( std::move( point ) );
+    }
+  };
+  std::vector<std::thread> pool;
+  for ( size_t thread = 1; thread < threads; ++thread ) {
+    pool.emplace_back( work );
+  }
+  work();
+  for ( auto &thread : pool ) {
+    thread.join();
+  }
+  return {};
+}
+
+}  // namespace sim
@@ -0,0 +1,101 @@
+/**
+ * SymbolTable.h
+ * Interning of names into dense integer identifiers
+ */
+
+#ifndef SIM_SYMBOL_TABLE_H_INCLUDED
+#define SIM_SYMBOL_TABLE_H_INCLUDED
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sim {
+
+using SymbolId = uint32_t;
+
+constexpr SymbolId no_symbol = std::numeric_limits<SymbolId>::max();
+
+/**
+ * @brief Maps names to dense ids 0..size()-1 in order of first interning
+ * Names are never removed, so an id stays valid for the life of the table and can
+ * index flat vectors instead of string-keyed maps.
+ */
+class SymbolTable {
+public:
+  /**
+   * @brief Get the id of a name, adding the name if it is new
+   * @param name the name to intern
+   * @return SymbolId its id
+   */
+  SymbolId intern( std::string_view name ) {
+    auto iter = m_ids.find( name );
+    if ( iter != m_ids.end() ) {
+      return iter->second;
+    }
+    auto id = static_cast<SymbolId>( m_names.size() );
+    const auto &stored = m_names.emplace_back( name );
+    m_ids.emplace( stored, id );
+    return id;
+  }
+  /**
+   * @brief Get the id of a name without adding it
+   * @param name the name to look up
+   * @return SymbolId its id or no_symbol if it was never interned
+   */
+  SymbolId find( std::string_view name ) const {
+    auto iter = m_ids.find( name );
+    return iter == m_ids.end() ? no_symbol : iter->second;
+  }
+  /**
+   * @brief Get the name of an id
+   * @param id the id to look up
+   * @return const std::string& the name or an empty string for an unknown id
+   */
+  const std::string &name( SymbolId id ) const {
+    static const std::string unknown;
+    return id < m_names.size() ? m_names[id] : unknown;
+  }
+  size_t size() const noexcept {
+    return m_names.size();
+  }
+  void reserve( size_t count ) {
+    m_ids.reserve( count );
+  }
+  void clear() noexcept {
+    m_ids.clear();
+    m_names.clear();
+  }
+
+private:
+  std::deque<std::string> m_names; // a deque so the views keying m_ids stay valid
+  std::unordered_map<std::string_view, SymbolId> m_ids;
+};
+
+/**
+ * @brief Access a flat table indexed by SymbolId, growing it as needed
+ */
+template <typename Tp>
+inline Tp &symbol_slot( std::vector<Tp> &table, SymbolId id ) {
+  if ( id >= table.size() ) {
+    table.resize( static_cast<size_t>( id ) + 1 );
+  }
+  return table[id];
+}
+
+/**
+ * @brief Read a flat table indexed by SymbolId
+ * @return Tp the entry or a value-initialized Tp if id is out of range
+ */
+template <typename Tp>
+inline Tp symbol_get( const std::vector<Tp> &table, SymbolId id ) {
+  return id < table.size() ? table[id] : Tp{};
+}
+
+}  // namespace sim
+
+#endif  // SIM_SYMBOL_TABLE_H_INCLUDED
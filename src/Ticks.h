@@ -0,0 +1,62 @@
+/**
+ * Ticks.h
+ * Reading the wall clock cheaply, for traces and profiles
+ */
+
+#ifndef SIM_TICKS_H_INCLUDED
+#define SIM_TICKS_H_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define SIM_TICKS_TSC 1
+#endif
+
+namespace sim {
+
+/**
+ * @brief Read the wall clock cheaply, the time stamp counter where there is one
+ */
+inline uint64_t ticks() noexcept {
+#ifdef SIM_TICKS_TSC
+  return __rdtsc();
+#else
+  return uint64_t( std::chrono::steady_clock::now().time_since_epoch().count() );
+#endif
+}
+
+/**
+ * @brief Measures how fast ticks go, against the steady clock over the same span
+ */
+class TickRate {
+public:
+  TickRate() noexcept : m_ticks{ ticks() }, m_time{ std::chrono::steady_clock::now() } {}
+
+  /**
+   * @brief Get the ticks per second since construction, 0 if no time has passed
+   */
+  double perSecond() const noexcept {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_time;
+    return elapsed.count() > 0.0 ? double( ticks() - m_ticks ) / elapsed.count() : 0.0;
+  }
+  /**
+   * @brief Get the seconds passed since construction
+   */
+  double seconds() const noexcept {
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - m_time ).count();
+  }
+
+private:
+  uint64_t m_ticks;
+  std::chrono::steady_clock::time_point m_time;
+};
+
+}  // namespace sim
+
+#endif  // SIM_TICKS_H_INCLUDED
@@ -1,6 +1,6 @@
 /**
- * Simulation_p.h
- * Simulation private interface with instances
+ * Timeline.h
+ * Time-ordered event storage with selectable queueing backends
  */
 
 #ifndef TIMELINE_H_INCLUDED
@@ -13,7 +13,12 @@
 #include <string>
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <limits>
+#include <optional>
 #include <queue>
+#include <type_traits>
+#include <variant>
 
 namespace sim {
 
@@ -56,61 +61,833 @@ inline void heap_remove( RAIter first, RAIter last, RAIter pos, Compare comp ) {
 
 }  // namespace heap_util
 
+/**
+ * @brief How a Timeline derives, and changes, the ordering key of a stored value
+ * Arithmetic values are their own key. Anything else is expected to have a
+ * Clock::time_point-like `time` member.
+ */
+template <typename Tp, typename = void>
+struct timeline_traits {
+  static int64_t key( const Tp &value ) {
+    return static_cast<int64_t>( value.time.time_since_epoch().count() );
+  }
+  template <typename Time>
+  static void rekey( Tp &value, const Time &time ) {
+    value.time = time;
+  }
+};
+
+template <typename Tp>
+struct timeline_traits<Tp, std::enable_if_t<std::is_arithmetic_v<Tp>>> {
+  static int64_t key( const Tp &value ) {
+    return static_cast<int64_t>( value );
+  }
+  template <typename Key>
+  static void rekey( Tp &value, const Key &key ) {
+    value = static_cast<Tp>( key );
+  }
+};
+
+/**
+ * @brief What the queue backends actually order: a key and a reference to the
+ * Timeline slot holding the value. Keeping these small means the backends never
+ * move the (potentially large) values themselves.
+ */
+struct TimelineEntry {
+  int64_t key;
+  uint64_t seq; // insertion order, breaks ties so that equal keys stay FIFO
+  uint32_t slot;
+
+  friend bool operator<( const TimelineEntry &lhs, const TimelineEntry &rhs ) {
+    return lhs.key < rhs.key || ( lhs.key == rhs.key && lhs.seq < rhs.seq );
+  }
+  friend bool operator>( const TimelineEntry &lhs, const TimelineEntry &rhs ) {
+    return rhs < lhs;
+  }
+};
+
+/**
+ * @brief Stable reference to a value scheduled in a Timeline
+ * A handle stays valid until its value is extracted, erased or cancelled, after
+ * which it is simply stale: operations on it fail rather than hit another value.
+ */
+struct TimelineHandle {
+  uint32_t slot = 0;
+  uint64_t seq = 0; // never issued, so a default handle is always stale
+
+  explicit operator bool() const noexcept {
+    return seq != 0;
+  }
+  friend bool operator==( const TimelineHandle &lhs, const TimelineHandle &rhs ) {
+    return lhs.slot == rhs.slot && lhs.seq == rhs.seq;
+  }
+  friend bool operator!=( const TimelineHandle &lhs, const TimelineHandle &rhs ) {
+    return !( lhs == rhs );
+  }
+};
+
+/**
+ * @brief Indexed binary heap backend, O(log n) push, pop and remove
+ * The heap position of every slot is tracked so that removal needs no search.
+ */
+class HeapQueue {
+public:
+  bool empty() const noexcept {
+    return m_heap.empty();
+  }
+  size_t size() const noexcept {
+    return m_heap.size();
+  }
+  void reserve( size_t count ) {
+    m_heap.reserve( count );
+    m_position.reserve( count );
+  }
+  void clear() noexcept {
+    m_heap.clear();
+  }
+  void push( const TimelineEntry &entry ) {
+    if ( entry.slot >= m_position.size() ) {
+      m_position.resize( entry.slot + 1 );
+    }
+    m_heap.push_back( entry );
+    siftUp( m_heap.size() - 1 );
+  }
+  const TimelineEntry &top() {
+    assert( !m_heap.empty() );
+    return m_heap.front();
+  }
+  TimelineEntry pop() {
+    assert( !m_heap.empty() );
+    auto entry = m_heap.front();
+    removeAt( 0 );
+    return entry;
+  }
+  bool remove( const TimelineEntry &entry ) {
+    if ( entry.slot >= m_position.size() ) {
+      return false;
+    }
+    auto pos = m_position[entry.slot];
+    if ( pos >= m_heap.size() || m_heap[pos].seq != entry.seq ) {
+      return false;
+    }
+    removeAt( pos );
+    return true;
+  }
+
+private:
+  void place( size_t pos, const TimelineEntry &entry ) {
+    m_heap[pos] = entry;
+    m_position[entry.slot] = static_cast<uint32_t>( pos );
+  }
+  void removeAt( size_t pos ) {
+    auto last = m_heap.back();
+    m_heap.pop_back();
+    if ( pos == m_heap.size() ) {
+      return;
+    }
+    place( pos, last );
+    if ( pos > 0 && last < m_heap[heap_util::heap_parent_index( pos )] ) {
+      siftUp( pos );
+    } else {
+      siftDown( pos );
+    }
+  }
+  void siftUp( size_t pos ) {
+    auto entry = m_heap[pos];
+    while ( pos > 0 ) {
+      auto parent = heap_util::heap_parent_index( pos );
+      if ( !( entry < m_heap[parent] ) ) {
+        break;
+      }
+      place( pos, m_heap[parent] );
+      pos = parent;
+    }
+    place( pos, entry );
+  }
+  void siftDown( size_t pos ) {
+    auto entry = m_heap[pos];
+    auto count = m_heap.size();
+    while ( 2 * pos + 1 < count ) {
+      auto child = 2 * pos + 1;
+      if ( child + 1 < count && m_heap[child + 1] < m_heap[child] ) {
+        ++child;
+      }
+      if ( !( m_heap[child] < entry ) ) {
+        break;
+      }
+      place( pos, m_heap[child] );
+      pos = child;
+    }
+    place( pos, entry );
+  }
+
+  std::vector<TimelineEntry> m_heap;
+  std::vector<uint32_t> m_position; // heap index of the entry for each slot
+};
+
+/**
+ * @brief Calendar queue backend (R. Brown, CACM 1988), amortized O(1) push and pop
+ * Entries hash into a power-of-two ring of day buckets by key / width. Each bucket
+ * is kept sorted with the earliest entry at the back. The bucket count follows the
+ * population and the day width is re-estimated from the head of the queue on resize.
+ */
+class CalendarQueue {
+public:
+  CalendarQueue() {
+    reset( s_min_buckets, 1, 0 );
+  }
+
+  bool empty() const noexcept {
+    return m_size == 0;
+  }
+  size_t size() const noexcept {
+    return m_size;
+  }
+  void reserve( size_t count ) {
+    // keep the initial load within the resize thresholds
+    size_t buckets = s_min_buckets;
+    while ( buckets * 2 < count ) {
+      buckets *= 2;
+    }
+    if ( buckets > m_buckets.size() ) {
+      resize( buckets );
+    }
+  }
+  void clear() noexcept {
+    for ( auto &bucket : m_buckets ) {
+      bucket.clear();
+    }
+    m_size = 0;
+  }
+  void push( const TimelineEntry &entry ) {
+    if ( entry.key < m_last_key || entry.key < m_bucket_top - m_width ) {
+      // scheduled behind the dequeue point, or before the day a peek moved it to, wind the calendar back
+      seek( entry.key );
+    }
+    insert( entry );
+    ++m_size;
+    if ( m_size > 2 * m_buckets.size() ) {
+      resize( 2 * m_buckets.size() );
+    }
+  }
+  const TimelineEntry &top() {
+    assert( m_size > 0 );
+    locate();
+    return m_buckets[m_current].back();
+  }
+  TimelineEntry pop() {
+    assert( m_size > 0 );
+    locate();
+    auto &bucket = m_buckets[m_current];
+    auto entry = bucket.back();
+    bucket.pop_back();
+    --m_size;
+    m_last_key = entry.key;
+    if ( m_buckets.size() > s_min_buckets && m_size < m_buckets.size() / 2 ) {
+      resize( m_buckets.size() / 2 );
+    }
+    return entry;
+  }
+  bool remove( const TimelineEntry &entry ) {
+    auto &bucket = m_buckets[bucketOf( entry.key )];
+    auto pos = std::find_if( bucket.begin(), bucket.end(), [&entry]( const TimelineEntry &held ) {
+      return held.seq == entry.seq;
+    } );
+    if ( pos == bucket.end() ) {
+      return false;
+    }
+    bucket.erase( pos );
+    --m_size;
+    return true;
+  }
+
+private:
+  static constexpr size_t s_min_buckets = 16;
+  static constexpr size_t s_width_samples = 25;
+
+  size_t bucketOf( int64_t key ) const noexcept {
+    return static_cast<size_t>( key / m_width ) & ( m_buckets.size() - 1 );
+  }
+
+  void seek( int64_t key ) noexcept {
+    m_last_key = key;
+    m_current = bucketOf( key );
+    m_bucket_top = ( key / m_width + 1 ) * m_width;
+  }
+
+  void insert( const TimelineEntry &entry ) {
+    auto &bucket = m_buckets[bucketOf( entry.key )];
+    auto pos = std::partition_point( bucket.begin(), bucket.end(), [&entry]( const TimelineEntry &held ) {
+      return entry < held;
+    } );
+    bucket.insert( pos, entry );
+  }
+
+  /**
+   * @brief Advance the calendar to the bucket holding the earliest entry
+   */
+  void locate() {
+    for ( size_t visited = 0; visited < m_buckets.size(); ++visited ) {
+      auto &bucket = m_buckets[m_current];
+      if ( !bucket.empty() && bucket.back().key < m_bucket_top ) {
+        return;
+      }
+      m_current = ( m_current + 1 ) & ( m_buckets.size() - 1 );
+      m_bucket_top += m_width;
+    }
+    // a whole year went by without an entry, jump straight to the earliest one
+    const TimelineEntry *earliest = nullptr;
+    for ( const auto &bucket : m_buckets ) {
+      if ( !bucket.empty() && ( !earliest || bucket.back() < *earliest ) ) {
+        earliest = &bucket.back();
+      }
+    }
+    assert( earliest );
+    seek( earliest->key );
+  }
+
+  void reset( size_t bucket_count, int64_t width, int64_t start_key ) {
+    m_buckets.clear();
+    m_buckets.resize( bucket_count );
+    m_width = width;
+    seek( start_key );
+  }
+
+  int64_t estimateWidth( std::vector<TimelineEntry> &entries ) const {
+    if ( entries.size() < 2 ) {
+      return m_width;
+    }
+    auto samples = std::min( entries.size(), s_width_samples );
+    std::nth_element( entries.begin(), entries.begin() + ( samples - 1 ), entries.end() );
+    std::sort( entries.begin(), entries.begin() + samples );
+    auto span = entries[samples - 1].key - entries.front().key;
+    auto average = span / static_cast<int64_t>( samples - 1 );
+    // recompute without the outlying separations
+    int64_t total = 0;
+    int64_t counted = 0;
+    for ( size_t idx = 1; idx < samples; ++idx ) {
+      auto separation = entries[idx].key - entries[idx - 1].key;
+      if ( separation <= 2 * average ) {
+        total += separation;
+        ++counted;
+      }
+    }
+    if ( counted > 0 ) {
+      average = total / counted;
+    }
+    return std::max<int64_t>( 1, 3 * average );
+  }
+
+  void resize( size_t bucket_count ) {
+    std::vector<TimelineEntry> entries;
+    entries.reserve( m_size );
+    for ( auto &bucket : m_buckets ) {
+      entries.insert( entries.end(), bucket.begin(), bucket.end() );
+    }
+    auto width = estimateWidth( entries );
+    reset( bucket_count, width, m_last_key );
+    for ( const auto &entry : entries ) {
+      insert( entry );
+    }
+  }
+
+  std::vector<std::vector<TimelineEntry>> m_buckets;
+  size_t m_size = 0;
+  int64_t m_width = 1;
+  size_t m_current = 0;    // bucket the dequeue point is in
+  int64_t m_bucket_top = 0; // exclusive upper key of the current bucket in this year
+  int64_t m_last_key = 0;
+};
+
+/**
+ * @brief Ladder queue backend (Tang, Goh & Thng, TOMACS 2005), amortized O(1) push and pop
+ * Far-future entries land unsorted in the top tier. When the bottom tier runs dry
+ * the top is spread over a rung of buckets, and any bucket too large to sort cheaply
+ * is spread again over a finer rung. Only small buckets are ever sorted, into bottom.
+ */
+class LadderQueue {
+public:
+  bool empty() const noexcept {
+    return m_size == 0;
+  }
+  size_t size() const noexcept {
+    return m_size;
+  }
+  void reserve( size_t count ) {
+    m_top.reserve( count );
+  }
+  void clear() noexcept {
+    m_top.clear();
+    for ( auto &bucket : m_buckets ) {
+      bucket.clear();
+    }
+    m_rungs.clear();
+    m_bottom.clear();
+    m_top_start = std::numeric_limits<int64_t>::min();
+    m_size = 0;
+  }
+  void push( const TimelineEntry &entry ) {
+    ++m_size;
+    if ( entry.key >= m_top_start ) {
+      if ( m_top.empty() ) {
+        m_top_min = m_top_max = entry.key;
+      } else {
+        m_top_min = std::min( m_top_min, entry.key );
+        m_top_max = std::max( m_top_max, entry.key );
+      }
+      m_top.push_back( entry );
+      return;
+    }
+    for ( auto &rung : m_rungs ) {
+      if ( entry.key >= rung.currentStart() ) {
+        m_buckets[rung.bucketOf( entry.key )].push_back( entry );
+        return;
+      }
+    }
+    insertBottom( entry );
+  }
+  const TimelineEntry &top() {
+    assert( m_size > 0 );
+    refill();
+    return m_bottom.back();
+  }
+  TimelineEntry pop() {
+    assert( m_size > 0 );
+    refill();
+    auto entry = m_bottom.back();
+    m_bottom.pop_back();
+    --m_size;
+    return entry;
+  }
+  bool remove( const TimelineEntry &entry ) {
+    auto matches = [&entry]( const TimelineEntry &held ) { return held.seq == entry.seq; };
+    if ( entry.key >= m_top_start ) {
+      auto pos = std::find_if( m_top.begin(), m_top.end(), matches );
+      if ( pos == m_top.end() ) {
+        return false;
+      }
+      *pos = m_top.back();
+      m_top.pop_back();
+      --m_size;
+      return true;
+    }
+    for ( auto &rung : m_rungs ) {
+      if ( entry.key >= rung.currentStart() ) {
+        auto &bucket = m_buckets[rung.bucketOf( entry.key )];
+        auto pos = std::find_if( bucket.begin(), bucket.end(), matches );
+        if ( pos == bucket.end() ) {
+          return false;
+        }
+        *pos = bucket.back();
+        bucket.pop_back();
+        --m_size;
+        return true;
+      }
+    }
+    auto pos = std::lower_bound( m_bottom.begin(), m_bottom.end(), entry, std::greater<TimelineEntry>{} );
+    if ( pos == m_bottom.end() || pos->seq != entry.seq ) {
+      return false;
+    }
+    m_bottom.erase( pos );
+    --m_size;
+    return true;
+  }
+
+private:
+  static constexpr size_t s_threshold = 50; // largest bucket sorted directly into bottom
+  static constexpr size_t s_max_rungs = 8;
+
+  struct Rung {
+    size_t first;   // index of the first bucket in m_buckets
+    size_t count;   // number of buckets
+    int64_t start;  // key at the start of the first bucket
+    int64_t width;  // key span of each bucket
+    size_t current; // first bucket not yet dequeued
+
+    int64_t currentStart() const noexcept {
+      return start + width * static_cast<int64_t>( current );
+    }
+    size_t bucketOf( int64_t key ) const noexcept {
+      return first + static_cast<size_t>( ( key - start ) / width );
+    }
+  };
+
+  void insertBottom( const TimelineEntry &entry ) {
+    auto pos = std::lower_bound( m_bottom.begin(), m_bottom.end(), entry, std::greater<TimelineEntry>{} );
+    m_bottom.insert( pos, entry );
+  }
+
+  /**
+   * @brief Spread entries over a new rung; rungs use consecutive runs of m_buckets
+   */
+  void spawnRung( std::vector<TimelineEntry> &entries, int64_t start, int64_t width ) {
+    size_t first = m_rungs.empty() ? 0 : m_rungs.back().first + m_rungs.back().count;
+    size_t count = entries.size();
+    if ( m_buckets.size() < first + count ) {
+      m_buckets.resize( first + count );
+    }
+    m_rungs.push_back( Rung{ first, count, start, width, 0 } );
+    const auto &rung = m_rungs.back();
+    for ( const auto &entry : entries ) {
+      m_buckets[rung.bucketOf( entry.key )].push_back( entry );
+    }
+    entries.clear();
+  }
+
+  void transferTop() {
+    assert( !m_top.empty() );
+    auto width = ( m_top_max - m_top_min ) / static_cast<int64_t>( m_top.size() ) + 1;
+    auto start = m_top_min;
+    m_top_start = start + width * static_cast<int64_t>( m_top.size() );
+    spawnRung( m_top, start, width );
+  }
+
+  /**
+   * @brief Make sure bottom holds the earliest entries
+   */
+  void refill() {
+    std::vector<TimelineEntry> spill;
+    while ( m_bottom.empty() ) {
+      if ( m_rungs.empty() ) {
+        transferTop();
+      }
+      auto &rung = m_rungs.back();
+      while ( rung.current < rung.count && m_buckets[rung.first + rung.current].empty() ) {
+        ++rung.current;
+      }
+      if ( rung.current == rung.count ) {
+        m_rungs.pop_back();
+        if ( m_rungs.empty() ) {
+          m_top_start = std::numeric_limits<int64_t>::min();
+        }
+        continue;
+      }
+      auto &bucket = m_buckets[rung.first + rung.current];
+      auto start = rung.currentStart();
+      auto width = rung.width;
+      ++rung.current;
+      if ( bucket.size() > s_threshold && m_rungs.size() < s_max_rungs && width > 1 ) {
+        spill.swap( bucket ); // bucket is invalidated by spawnRung
+        auto count = static_cast<int64_t>( spill.size() );
+        spawnRung( spill, start, ( width + count - 1 ) / count );
+      } else {
+        m_bottom.swap( bucket );
+        std::sort( m_bottom.begin(), m_bottom.end(), std::greater<TimelineEntry>{} );
+      }
+    }
+  }
+
+  std::vector<TimelineEntry> m_top;
+  int64_t m_top_start = std::numeric_limits<int64_t>::min(); // keys at or above this go to top
+  int64_t m_top_min = 0;
+  int64_t m_top_max = 0;
+  std::vector<std::vector<TimelineEntry>> m_buckets;
+  std::vector<Rung> m_rungs;
+  std::vector<TimelineEntry> m_bottom; // sorted, earliest at the back
+  size_t m_size = 0;
+};
+
+/**
+ * @brief The available queue backends, for choosing one at run time
+ */
+enum class QueueKind : uint8_t { HEAP, CALENDAR, LADDER };
+
+/**
+ * @brief Backend that dispatches to one of the others chosen at construction
+ */
+class SelectableQueue {
+public:
+  SelectableQueue( QueueKind kind = QueueKind::HEAP ) {
+    switch ( kind ) {
+    case QueueKind::HEAP:
+      m_queue.emplace<HeapQueue>();
+      break;
+    case QueueKind::CALENDAR:
+      m_queue.emplace<CalendarQueue>();
+      break;
+    case QueueKind::LADDER:
+      m_queue.emplace<LadderQueue>();
+      break;
+    }
+  }
+
+  QueueKind kind() const noexcept {
+    return static_cast<QueueKind>( m_queue.index() );
+  }
+  bool empty() const noexcept {
+    return std::visit( []( const auto &queue ) { return queue.empty(); }, m_queue );
+  }
+  size_t size() const noexcept {
+    return std::visit( []( const auto &queue ) { return queue.size(); }, m_queue );
+  }
+  void reserve( size_t count ) {
+    std::visit( [count]( auto &queue ) { queue.reserve( count ); }, m_queue );
+  }
+  void clear() noexcept {
+    std::visit( []( auto &queue ) { queue.clear(); }, m_queue );
+  }
+  void push( const TimelineEntry &entry ) {
+    std::visit( [&entry]( auto &queue ) { queue.push( entry ); }, m_queue );
+  }
+  const TimelineEntry &top() {
+    return std::visit( []( auto &queue ) -> const TimelineEntry & { return queue.top(); }, m_queue );
+  }
+  TimelineEntry pop() {
+    return std::visit( []( auto &queue ) { return queue.pop(); }, m_queue );
+  }
+  bool remove( const TimelineEntry &entry ) {
+    return std::visit( [&entry]( auto &queue ) { return queue.remove( entry ); }, m_queue );
+  }
+
+private:
+  // alternatives are in QueueKind order
+  std::variant<HeapQueue, CalendarQueue, LadderQueue> m_queue;
+};
+
 /**
  * @brief Timeline keeps track of all scheduled events in time-order.
- * This class is implemented as a priority queue. The std::priority_queue would
- * be used but it does not allow for iteration or search.
+ * Values live in a slot array that is stable across insertions and removals. The
+ * Queue backend orders light-weight TimelineEntry references to those slots.
+ * Iteration visits every scheduled value but not in time order.
+ * Every insertion returns a TimelineHandle for later cancel() or reschedule(),
+ * both O(log n) on HeapQueue and amortized O(1) on the calendar and ladder queues.
+ * @tparam Tp the value type, ordered by timeline_traits<Tp>::key
+ * @tparam Queue one of HeapQueue, CalendarQueue, LadderQueue or SelectableQueue
  */
-template <
-    typename Tp,
-    typename Sequence = std::vector<Tp>,
-    typename Compare = std::greater<typename Sequence::value_type>>
-class Timeline : public std::priority_queue<Tp, Sequence, Compare> {
+template <typename Tp, typename Queue = HeapQueue, typename Traits = timeline_traits<Tp>>
+class Timeline {
+  struct Slot {
+    std::optional<Tp> value;
+    uint64_t seq = 0;
+  };
+  using slot_container = std::vector<Slot>;
+
 public:
-  using BaseType = std::priority_queue<Tp, Sequence, Compare>;
-  using value_type = typename BaseType::value_type;
-  using reference = typename BaseType::reference;
-  using const_reference = typename BaseType::const_reference;
-  using size_type = typename BaseType::size_type;
-  using container_type = Sequence;
-  using value_compare = Compare;
-  using iterator = typename container_type::iterator;
-  using const_iterator = typename container_type::const_iterator;
-
-  // pull in priority_queue constructors
-  using BaseType::BaseType;
+  using value_type = Tp;
+  using reference = value_type &;
+  using const_reference = const value_type &;
+  using size_type = size_t;
+  using queue_type = Queue;
+
+  /**
+   * @brief Forward iterator over the scheduled values in storage order
+   */
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Tp;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Tp *;
+    using reference = const Tp &;
+
+    const_iterator() = default;
+
+    reference operator*() const {
+      return *m_pos->value;
+    }
+    pointer operator->() const {
+      return &*m_pos->value;
+    }
+    const_iterator &operator++() {
+      ++m_pos;
+      skipEmpty();
+      return *this;
+    }
+    const_iterator operator++( int ) {
+      auto prev = *this;
+      ++*this;
+      return prev;
+    }
+    friend bool operator==( const const_iterator &lhs, const const_iterator &rhs ) {
+      return lhs.m_pos == rhs.m_pos;
+    }
+    friend bool operator!=( const const_iterator &lhs, const const_iterator &rhs ) {
+      return lhs.m_pos != rhs.m_pos;
+    }
+
+  private:
+    friend class Timeline;
+    using slot_iterator = typename slot_container::const_iterator;
+
+    const_iterator( slot_iterator pos, slot_iterator end ) : m_pos{ pos }, m_end{ end } {
+      skipEmpty();
+    }
+    void skipEmpty() {
+      while ( m_pos != m_end && !m_pos->value ) {
+        ++m_pos;
+      }
+    }
+
+    slot_iterator m_pos;
+    slot_iterator m_end;
+  };
+  using iterator = const_iterator;
+
+  Timeline() = default;
+  explicit Timeline( queue_type queue ) : m_queue( std::move( queue ) ) {}
+
+  bool empty() const noexcept {
+    return m_queue.empty();
+  }
+  size_type size() const noexcept {
+    return m_queue.size();
+  }
+  queue_type &queue() noexcept {
+    return m_queue;
+  }
+  void reserve( size_type count ) {
+    m_slots.reserve( count );
+    m_queue.reserve( count );
+  }
+  void clear() {
+    m_slots.clear();
+    m_free.clear();
+    m_queue.clear();
+  }
+
+  template <typename... Args>
+  TimelineHandle emplace( Args &&... args ) {
+    auto slot = allocate();
+    auto &held = m_slots[slot];
+    held.value.emplace( std::forward<Args>( args )... );
+    held.seq = m_seq++;
+    m_queue.push( TimelineEntry{ Traits::key( *held.value ), held.seq, slot } );
+    return { slot, held.seq };
+  }
+  /**
+   * @brief Schedule a value with a caller-chosen tie-breaker instead of insertion order
+   * Lets several timelines agree on the order of equal keys, whatever order their
+   * values were inserted in. Don't mix with emplace() on one timeline.
+   * @param seq nonzero and unique among the values ever scheduled on this timeline
+   */
+  template <typename... Args>
+  TimelineHandle emplace_ordered( uint64_t seq, Args &&... args ) {
+    assert( seq != 0 );
+    auto slot = allocate();
+    auto &held = m_slots[slot];
+    held.value.emplace( std::forward<Args>( args )... );
+    held.seq = seq;
+    m_queue.push( TimelineEntry{ Traits::key( *held.value ), held.seq, slot } );
+    return { slot, held.seq };
+  }
+  TimelineHandle push( const value_type &value ) {
+    return emplace( value );
+  }
+  TimelineHandle push( value_type &&value ) {
+    return emplace( std::move( value ) );
+  }
+
+  /**
+   * @brief Check whether a handle still refers to a scheduled value
+   */
+  bool contains( TimelineHandle handle ) const noexcept {
+    return handle.slot < m_slots.size() && m_slots[handle.slot].value && m_slots[handle.slot].seq == handle.seq;
+  }
+  /**
+   * @brief Get the value a handle refers to
+   * @return const value_type* the value or nullptr if the handle is stale
+   */
+  const value_type *get( TimelineHandle handle ) const noexcept {
+    return contains( handle ) ? &*m_slots[handle.slot].value : nullptr;
+  }
+  /**
+   * @brief Get the handle of the value at an iterator
+   */
+  TimelineHandle handle( const_iterator pos ) const noexcept {
+    auto slot = static_cast<uint32_t>( pos.m_pos - m_slots.cbegin() );
+    return { slot, m_slots[slot].seq };
+  }
+  /**
+   * @brief Remove a scheduled value
+   * @return true if the value was removed, false if the handle was stale
+   */
+  bool cancel( TimelineHandle handle ) {
+    if ( !contains( handle ) ) {
+      return false;
+    }
+    auto &held = m_slots[handle.slot];
+    m_queue.remove( TimelineEntry{ Traits::key( *held.value ), held.seq, handle.slot } );
+    release( handle.slot );
+    return true;
+  }
+  /**
+   * @brief Move a scheduled value to a new key, keeping its handle
+   * @param handle the value to move
+   * @param key the new key, as accepted by Traits::rekey (a time_point for events)
+   * @return true if the value was moved, false if the handle was stale
+   */
+  template <typename Key>
+  bool reschedule( TimelineHandle handle, const Key &key ) {
+    if ( !contains( handle ) ) {
+      return false;
+    }
+    auto &held = m_slots[handle.slot];
+    m_queue.remove( TimelineEntry{ Traits::key( *held.value ), held.seq, handle.slot } );
+    Traits::rekey( *held.value, key );
+    m_queue.push( TimelineEntry{ Traits::key( *held.value ), held.seq, handle.slot } );
+    return true;
+  }
+
+  /**
+   * @brief Peek at the earliest value. Not const because backends may reorganise.
+   */
+  const_reference top() {
+    assert( !empty() );
+    return *m_slots[m_queue.top().slot].value;
+  }
+  /**
+   * @brief Peek at the key and tie-breaker of the earliest value, to compare timelines
+   */
+  const TimelineEntry &top_entry() {
+    assert( !empty() );
+    return m_queue.top();
+  }
+  value_type extract() {
+    assert( !empty() );
+    auto entry = m_queue.pop();
+    auto &held = m_slots[entry.slot];
+    value_type top = std::move( *held.value );
+    release( entry.slot );
+    return top; // counting on copy elision here
+  }
+  void erase( const_iterator pos ) {
+    cancel( handle( pos ) );
+  }
 
   // Exposed iterators for finding and access that does not change ordering.
-  // These member functions are delegated to the container. See container's
-  // documentation but note iterators are always invalidated on insertion and
-  // deletion due to this adapter's algorithms.
+  // Iterators are invalidated on insertion, but only the erased one on erasure.
   inline const_iterator begin() const noexcept {
-    return this->c.cbegin();
+    return { m_slots.cbegin(), m_slots.cend() };
   }
   inline const_iterator end() const noexcept {
-    return this->c.cend();
+    return { m_slots.cend(), m_slots.cend() };
   }
   inline const_iterator cbegin() const noexcept {
-    return this->c.cbegin();
+    return begin();
   }
   inline const_iterator cend() const noexcept {
-    return this->c.cend();
+    return end();
   }
-  inline value_type extract() {
-    assert( !this->empty() );
-    std::pop_heap( this->c.begin(), this->c.end(), this->comp );
-    value_type top = std::move( this->c.back() );
-    this->c.pop_back();
-    return top; // counting on copy elision here
+
+private:
+  uint32_t allocate() {
+    if ( !m_free.empty() ) {
+      auto slot = m_free.back();
+      m_free.pop_back();
+      return slot;
+    }
+    m_slots.emplace_back();
+    return static_cast<uint32_t>( m_slots.size() - 1 );
   }
-  inline void erase( const_iterator pos ) {
-    heap_util::heap_remove(
-        this->c.begin(),
-        this->c.end(),
-        this->c.begin() + std::distance(pos, this->c.cbegin()),
-        this->comp );
-    this->c.pop_back();
+  void release( uint32_t slot ) {
+    m_slots[slot].value.reset();
+    m_free.push_back( slot );
   }
+
+  slot_container m_slots;
+  std::vector<uint32_t> m_free;
+  uint64_t m_seq = 1; // 0 is reserved for stale handles
+  queue_type m_queue;
 };
 
 }  // namespace sim
@@ -0,0 +1,911 @@
+// Topology.cpp : JSON topologies, their compiled images and building simulations from both
+//
+
+#include "Topology.h"
+#include "Simulation_p.h"
+#include "Instance_p.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <fstream>
+#include <istream>
+#include <map>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SIM_TOPOLOGY_MMAP 1
+#endif
+
+using json = nlohmann::json;
+
+namespace sim {
+
+namespace {
+
+/**
+ * @brief SAX handler passing a topology on to a builder while it streams by
+ * Only the instance or link being read is held, never the document. Depths count the
+ * enclosing objects and arrays: 1 is the root, 2 a top level value, 3 an instance or
+ * link, 4 an instance's parameters.
+ */
+class TopologyReader {
+public:
+  explicit TopologyReader( TopologyBuilder &builder ) : m_builder{ builder } {}
+
+  bool null() {
+    return value( std::monostate{} );
+  }
+  bool boolean( bool flag ) {
+    return value( uintmax_t( flag ) );
+  }
+  bool number_integer( json::number_integer_t number ) {
+    return value( intmax_t( number ) );
+  }
+  bool number_unsigned( json::number_unsigned_t number ) {
+    return value( uintmax_t( number ) );
+  }
+  bool number_float( json::number_float_t number, const json::string_t & ) {
+    return value( double( number ) );
+  }
+  bool string( json::string_t &text ) {
+    return value( std::move( text ) );
+  }
+  template <typename Binary>
+  bool binary( Binary & ) {
+    return fail( "binary values are not supported" );
+  }
+  bool start_object( size_t );
+  bool end_object();
+  bool start_array( size_t );
+  bool end_array();
+  bool key( json::string_t &name );
+  template <typename Exception>
+  bool parse_error( size_t, const std::string &, const Exception &error ) {
+    return fail( error.what() );
+  }
+
+  const std::string &error() const noexcept {
+    return m_error;
+  }
+
+private:
+  enum class Section { none, parameters, partitions, instance_count, instances, links };
+
+  bool value( acpp::unstructured_value &&item );
+  bool setParameter( acpp::unstructured_value &&item );
+  /**
+   * @brief Track an event while the value of an unknown key is skipped
+   * @param step 1 for an object or array opening, -1 for one closing, 0 for a scalar
+   * @return true if the event is part of a skipped value
+   */
+  bool skipped( int step );
+  bool built( const acpp::void_result<> &result ) {
+    return result ? true : fail( result.msg );
+  }
+  bool fail( const std::string &message ) {
+    if ( m_error.empty() ) {
+      m_error = message;
+    }
+    return false;
+  }
+  static acpp::value_result<acpp::unstructured_value> listValue( std::vector<acpp::unstructured_value> &&items );
+
+  TopologyBuilder &m_builder;
+  std::string m_error;
+  Section m_section = Section::none;
+  size_t m_depth = 0;
+  size_t m_skip_depth = 0; // depth of the key whose value is skipped, 0 if none
+  size_t m_param_depth = 0; // depth of the parameters object being read, 0 if none
+  std::string m_key;
+  bool m_in_list = false;
+  std::vector<acpp::unstructured_value> m_list;
+  // the instance or link being read
+  std::string m_name, m_model, m_from, m_to;
+  PropertyList m_parameters;
+};
+
+bool TopologyReader::skipped( int step ) {
+  if ( !m_skip_depth ) {
+    return false;
+  }
+  m_depth += step;
+  if ( step <= 0 && m_depth == m_skip_depth ) {
+    m_skip_depth = 0; // the skipped value was a scalar or has closed
+  }
+  return true;
+}
+
+bool TopologyReader::key( json::string_t &name ) {
+  if ( m_skip_depth ) {
+    return true;
+  }
+  m_key = std::move( name );
+  bool known = true;
+  if ( m_depth == 1 ) {
+    static const std::map<std::string, Section> sections{
+        { "parameters", Section::parameters },
+        { "partitions", Section::partitions },
+        { "instance_count", Section::instance_count },
+        { "instances", Section::instances },
+        { "links", Section::links } };
+    auto section = sections.find( m_key );
+    known = section != sections.end();
+    m_section = known ? section->second : Section::none;
+  } else if ( m_depth == 3 && m_section == Section::instances ) {
+    known = m_key == "name" || m_key == "model" || m_key == "parameters";
+  } else if ( m_depth == 3 && m_section == Section::links ) {
+    known = m_key == "from" || m_key == "to";
+  }
+  if ( !known ) {
+    m_skip_depth = m_depth;
+  }
+  return true;
+}
+
+bool TopologyReader::value( acpp::unstructured_value &&item ) {
+  if ( skipped( 0 ) ) {
+    return true;
+  }
+  if ( m_in_list ) {
+    m_list.push_back( std::move( item ) );
+    return true;
+  }
+  if ( m_param_depth && m_depth == m_param_depth ) {
+    return setParameter( std::move( item ) );
+  }
+  if ( m_depth == 1 && ( m_section == Section::partitions || m_section == Section::instance_count ) ) {
+    auto count = std::get_if<uintmax_t>( &item );
+    if ( !count ) {
+      return fail( m_key + " must be a count" );
+    }
+    if ( m_section == Section::instance_count ) {
+      m_builder.reserve( *count );
+      return true;
+    }
+    return built( m_builder.partitions( *count ) );
+  }
+  auto text = std::get_if<std::string>( &item );
+  if ( m_depth == 3 && text && m_section == Section::instances ) {
+    ( m_key == "name" ? m_name : m_model ) = std::move( *text );
+    return true;
+  }
+  if ( m_depth == 3 && text && m_section == Section::links ) {
+    ( m_key == "from" ? m_from : m_to ) = std::move( *text );
+    return true;
+  }
+  return fail( "unexpected value for " + m_key );
+}
+
+bool TopologyReader::setParameter( acpp::unstructured_value &&item ) {
+  if ( m_section == Section::instances ) {
+    m_parameters.insert_or_assign( m_key, std::move( item ) );
+    return true;
+  }
+  return built( m_builder.parameter( m_key, std::move( item ) ) );
+}
+
+bool TopologyReader::start_object( size_t ) {
+  if ( skipped( 1 ) ) {
+    return true;
+  }
+  if ( m_depth == 1 && m_section == Section::parameters ) {
+    m_param_depth = 2;
+  } else if ( m_depth == 2 && ( m_section == Section::instances || m_section == Section::links ) ) {
+    m_name.clear();
+    m_model.clear();
+    m_parameters.clear();
+    m_from.clear();
+    m_to.clear();
+  } else if ( m_depth == 3 && m_section == Section::instances && m_key == "parameters" ) {
+    m_param_depth = 4;
+  } else if ( m_depth != 0 ) {
+    return fail( "unexpected object for " + m_key );
+  }
+  ++m_depth;
+  return true;
+}
+
+bool TopologyReader::end_object() {
+  if ( skipped( -1 ) ) {
+    return true;
+  }
+  --m_depth;
+  if ( m_param_depth && m_depth + 1 == m_param_depth ) {
+    m_param_depth = 0;
+  } else if ( m_depth == 2 && m_section == Section::instances ) {
+    if ( m_name.empty() || m_model.empty() ) {
+      return fail( "instance needs a name and a model" );
+    }
+    auto made = m_builder.instance( m_model, m_name, std::move( m_parameters ) );
+    m_parameters.clear();
+    return made ? true : fail( "instance " + m_name + ": " + made.msg );
+  } else if ( m_depth == 2 && m_section == Section::links ) {
+    if ( m_from.empty() || m_to.empty() ) {
+      return fail( "link needs \"from\" and \"to\"" );
+    }
+    return built( m_builder.link( m_from, m_to ) );
+  }
+  return true;
+}
+
+bool TopologyReader::start_array( size_t ) {
+  if ( skipped( 1 ) ) {
+    return true;
+  }
+  if ( m_param_depth && m_depth == m_param_depth ) {
+    m_in_list = true;
+    m_list.clear();
+  } else if ( m_depth != 1 || ( m_section != Section::instances && m_section != Section::links ) ) {
+    return fail( "unexpected array for " + m_key );
+  }
+  ++m_depth;
+  return true;
+}
+
+bool TopologyReader::end_array() {
+  if ( skipped( -1 ) ) {
+    return true;
+  }
+  --m_depth;
+  if ( !m_in_list ) {
+    return true;
+  }
+  m_in_list = false;
+  auto list = listValue( std::move( m_list ) );
+  m_list.clear();
+  if ( !list ) {
+    return fail( m_key + ": " + list.msg );
+  }
+  return setParameter( std::move( *list.value ) );
+}
+
+acpp::value_result<acpp::unstructured_value> TopologyReader::listValue( std::vector<acpp::unstructured_value> &&items ) {
+  // strings only, else the widest number kind: double, intmax_t, then uintmax_t
+  size_t strings = 0, doubles = 0, signeds = 0;
+  for ( const auto &item : items ) {
+    if ( std::holds_alternative<std::monostate>( item ) ) {
+      return { {}, "null in a list" };
+    }
+    strings += std::holds_alternative<std::string>( item );
+    doubles += std::holds_alternative<double>( item );
+    signeds += std::holds_alternative<intmax_t>( item );
+  }
+  if ( strings ) {
+    if ( strings != items.size() ) {
+      return { {}, "list mixes strings and numbers" };
+    }
+    std::vector<std::string> list;
+    list.reserve( items.size() );
+    for ( auto &item : items ) {
+      list.push_back( std::move( std::get<std::string>( item ) ) );
+    }
+    return acpp::value_result<acpp::unstructured_value>{ std::move( list ) };
+  }
+  auto convert = [&]( auto list ) {
+    using Element = typename decltype( list )::value_type;
+    list.reserve( items.size() );
+    for ( const auto &item : items ) {
+      list.push_back( acpp::get_as<Element>( item ).value_or( Element{} ) );
+    }
+    return acpp::value_result<acpp::unstructured_value>{ acpp::unstructured_value{ std::move( list ) } };
+  };
+  if ( doubles ) {
+    return convert( std::vector<double>{} );
+  }
+  if ( signeds ) {
+    return convert( std::vector<intmax_t>{} );
+  }
+  return convert( std::vector<uintmax_t>{} );
+}
+
+template <typename Input>
+acpp::void_result<> parse( Input &&input, TopologyBuilder &builder ) {
+  TopologyReader reader{ builder };
+  if ( !json::sax_parse( std::forward<Input>( input ), &reader ) ) {
+    return { {}, reader.error().empty() ? "topology is not JSON" : reader.error() };
+  }
+  return builder.finish();
+}
+
+/**
+ * @brief Split instance.pad at its last dot
+ */
+bool splitPad( const std::string &path, std::string &instance, std::string &pad ) {
+  auto dot = path.rfind( '.' );
+  if ( dot == std::string::npos ) {
+    return false;
+  }
+  instance = path.substr( 0, dot );
+  pad = path.substr( dot + 1 );
+  return true;
+}
+
+}  // namespace
+
+acpp::void_result<> readTopology( const std::string &topo_json, TopologyBuilder &builder ) {
+  return parse( topo_json, builder );
+}
+
+acpp::void_result<> readTopology( std::istream &topo_json, TopologyBuilder &builder ) {
+  return parse( topo_json, builder );
+}
+
+acpp::void_result<> SimulationBuilder::parameter( const std::string &name, acpp::unstructured_value &&value ) {
+  return m_simulation->setParameter( name, value );
+}
+
+acpp::void_result<> SimulationBuilder::partitions( size_t count ) {
+  return m_simulation->setPartitions( count );
+}
+
+void SimulationBuilder::reserve( size_t instances ) {
+  Simulation::Private::reserveInstances( m_simulation, instances );
+}
+
+acpp::void_result<> SimulationBuilder::instance( const std::string &model, const std::string &name, PropertyList &&parameters ) {
+  auto made = Simulation::Private::makeInstance( m_simulation, model, name, parameters );
+  if ( !made ) {
+    return { {}, made.msg };
+  }
+  return {};
+}
+
+acpp::void_result<> SimulationBuilder::link( const std::string &from, const std::string &to ) {
+  return connect( from, to, false );
+}
+
+acpp::void_result<> SimulationBuilder::finish() {
+  for ( const auto &[from, to] : m_deferred ) {
+    auto connected = connect( from, to, true );
+    if ( !connected ) {
+      return connected;
+    }
+  }
+  m_deferred.clear();
+  return {};
+}
+
+acpp::void_result<> SimulationBuilder::connect( const std::string &from, const std::string &to, bool last_chance ) {
+#if ACPP_LESSON > 3
+  std::string source_name, source_pad, target_name, target_pad;
+  if ( !splitPad( from, source_name, source_pad ) || !splitPad( to, target_name, target_pad ) ) {
+    return { {}, "link needs \"from\" and \"to\" as instance.pad" };
+  }
+  auto source = m_simulation->instance( source_name );
+  auto target = m_simulation->instance( target_name );
+  if ( !source || !target ) {
+    if ( last_chance ) {
+      return { {}, "link " + from + " to " + to + " names no instance" };
+    }
+    m_deferred.emplace_back( from, to );
+    return {};
+  }
+  auto pad = source->pad( source_pad );
+  if ( !pad || !pad->connect( target, target_pad ) ) {
+    return { {}, "can't link " + from + " to " + to };
+  }
+  return {};
+#else
+  return { {}, "links need pads, ACPP_LESSON > 3" };
+#endif // ACPP_LESSON > 3
+}
+
+acpp::void_result<> ImageWriter::parameter( const std::string &name, acpp::unstructured_value &&value ) {
+  m_simulation_parameters.push_back( record( name, value ) );
+  return {};
+}
+
+acpp::void_result<> ImageWriter::partitions( size_t count ) {
+  if ( count == 0 || count > topology_image::s_none ) {
+    return { {}, "partitions out of range" };
+  }
+  m_partitions = uint32_t( count );
+  return {};
+}
+
+void ImageWriter::reserve( size_t instances ) {
+  m_instances.reserve( instances );
+  m_instance_ids.reserve( instances );
+}
+
+acpp::void_result<> ImageWriter::instance( const std::string &model, const std::string &name, PropertyList &&parameters ) {
+  auto [iter, inserted] = m_instance_ids.emplace( name, uint32_t( m_instances.size() ) );
+  if ( !inserted ) {
+    return { {}, "instance not unique" };
+  }
+  topology_image::InstanceRecord instance{
+      string( name ), string( model ), uint32_t( m_parameters.size() ), uint32_t( parameters.size() ) };
+  // in name order, so that an image depends only on its topology
+  std::vector<const PropertyList::value_type *> sorted;
+  sorted.reserve( parameters.size() );
+  for ( const auto &entry : parameters ) {
+    sorted.push_back( &entry );
+  }
+  std::sort( sorted.begin(), sorted.end(), []( auto *left, auto *right ) { return left->first < right->first; } );
+  for ( auto *entry : sorted ) {
+    m_parameters.push_back( record( entry->first, entry->second ) );
+  }
+  m_instances.push_back( instance );
+  return {};
+}
+
+acpp::void_result<> ImageWriter::link( const std::string &from, const std::string &to ) {
+  m_link_names.emplace_back( from, to );
+  return {};
+}
+
+acpp::void_result<> ImageWriter::finish() {
+  m_links.reserve( m_links.size() + m_link_names.size() );
+  for ( const auto &[from, to] : m_link_names ) {
+    std::string source_name, source_pad, target_name, target_pad;
+    if ( !splitPad( from, source_name, source_pad ) || !splitPad( to, target_name, target_pad ) ) {
+      return { {}, "link needs \"from\" and \"to\" as instance.pad" };
+    }
+    auto source = m_instance_ids.find( source_name );
+    auto target = m_instance_ids.find( target_name );
+    if ( source == m_instance_ids.end() || target == m_instance_ids.end() ) {
+      return { {}, "link " + from + " to " + to + " names no instance" };
+    }
+    m_links.push_back( { source->second, string( source_pad ), target->second, string( target_pad ) } );
+  }
+  m_link_names.clear();
+  if ( m_chars.size() >= topology_image::s_none || m_values.size() >= topology_image::s_none ) {
+    return { {}, "topology too large for an image" };
+  }
+  return {};
+}
+
+uint32_t ImageWriter::string( const std::string &text ) {
+  auto [iter, inserted] = m_string_ids.emplace( text, uint32_t( m_strings.size() ) );
+  if ( inserted ) {
+    m_strings.push_back( { uint32_t( m_chars.size() ), uint32_t( text.size() ) } );
+    m_chars += text;
+  }
+  return iter->second;
+}
+
+topology_image::ParameterRecord ImageWriter::record( const std::string &name, const acpp::unstructured_value &value ) {
+  topology_image::ParameterRecord record{ string( name ), uint32_t( value.index() ), 1, 0, 0 };
+  auto word = [this]( const auto &element ) {
+    using Element = std::decay_t<decltype( element )>;
+    uint64_t bits = 0;
+    if constexpr ( std::is_same_v<Element, std::string> ) {
+      bits = string( element );
+    } else {
+      static_assert( sizeof( Element ) == sizeof( bits ) );
+      std::memcpy( &bits, &element, sizeof( bits ) );
+    }
+    return bits;
+  };
+  std::visit(
+      [&]( const auto &item ) {
+        using Value = std::decay_t<decltype( item )>;
+        if constexpr ( std::is_same_v<Value, std::monostate> ) {
+          record.count = 0;
+        } else if constexpr ( std::is_arithmetic_v<Value> || std::is_same_v<Value, std::string> ) {
+          record.value = word( item );
+        } else {
+          record.count = uint32_t( item.size() );
+          record.value = m_values.size();
+          for ( const auto &element : item ) {
+            m_values.push_back( word( element ) );
+          }
+        }
+      },
+      value );
+  return record;
+}
+
+acpp::void_result<> ImageWriter::write( const std::string &path ) const {
+  using namespace topology_image;
+  std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+  if ( !out ) {
+    return { {}, "can't write " + path };
+  }
+  Header header{};
+  std::memcpy( header.magic, s_magic, sizeof( s_magic ) );
+  header.version = s_version;
+  header.byte_order = s_byte_order;
+  header.partitions = m_partitions;
+  header.parameter_count = uint32_t( m_simulation_parameters.size() );
+  uint64_t end = sizeof( Header );
+  auto place = [&]( Section &section, size_t count, size_t size ) {
+    end = ( end + 7 ) & ~uint64_t( 7 );
+    section = { end, count };
+    end += count * size;
+  };
+  place( header.strings, m_strings.size(), sizeof( StringRef ) );
+  place( header.chars, m_chars.size(), sizeof( char ) );
+  place( header.instances, m_instances.size(), sizeof( InstanceRecord ) );
+  place( header.parameters, m_parameters.size() + m_simulation_parameters.size(), sizeof( ParameterRecord ) );
+  place( header.values, m_values.size(), sizeof( uint64_t ) );
+  place( header.links, m_links.size(), sizeof( LinkRecord ) );
+
+  uint64_t position = 0;
+  auto put = [&]( const void *data, size_t bytes ) {
+    out.write( static_cast<const char *>( data ), std::streamsize( bytes ) );
+    position += bytes;
+  };
+  auto seek = [&]( const Section &section ) {
+    static const char zeros[8] = {};
+    put( zeros, section.offset - position );
+  };
+  put( &header, sizeof( header ) );
+  seek( header.strings );
+  put( m_strings.data(), m_strings.size() * sizeof( StringRef ) );
+  seek( header.chars );
+  put( m_chars.data(), m_chars.size() );
+  seek( header.instances );
+  put( m_instances.data(), m_instances.size() * sizeof( InstanceRecord ) );
+  seek( header.parameters );
+  // the simulation's parameters last, so that instance records index from the start
+  put( m_parameters.data(), m_parameters.size() * sizeof( ParameterRecord ) );
+  put( m_simulation_parameters.data(), m_simulation_parameters.size() * sizeof( ParameterRecord ) );
+  seek( header.values );
+  put( m_values.data(), m_values.size() * sizeof( uint64_t ) );
+  seek( header.links );
+  put( m_links.data(), m_links.size() * sizeof( LinkRecord ) );
+  out.close();
+  if ( !out ) {
+    return { {}, "can't write " + path };
+  }
+  return {};
+}
+
+namespace {
+
+/**
+ * @brief A file mapped read only, or read into memory where it can't be mapped
+ */
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() noexcept {
+#ifdef SIM_TOPOLOGY_MMAP
+    if ( m_data ) {
+      munmap( const_cast<char *>( m_data ), m_size );
+    }
+#endif
+  }
+  MappedFile( const MappedFile & ) = delete;
+  MappedFile &operator=( const MappedFile & ) = delete;
+
+  acpp::void_result<> open( const std::string &path ) {
+#ifdef SIM_TOPOLOGY_MMAP
+    int file = ::open( path.c_str(), O_RDONLY );
+    if ( file < 0 ) {
+      return { {}, "can't open " + path };
+    }
+    struct stat status {};
+    if ( fstat( file, &status ) != 0 || status.st_size <= 0 ) {
+      ::close( file );
+      return { {}, "can't map " + path };
+    }
+    m_size = size_t( status.st_size );
+    void *map = mmap( nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0 );
+    ::close( file );
+    if ( map == MAP_FAILED ) {
+      return { {}, "can't map " + path };
+    }
+    // the records are read once, front to back
+    madvise( map, m_size, MADV_SEQUENTIAL );
+    m_data = static_cast<const char *>( map );
+#else
+    std::ifstream in{ path, std::ios::binary };
+    if ( !in ) {
+      return { {}, "can't open " + path };
+    }
+    m_copy.assign( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+    m_data = m_copy.data();
+    m_size = m_copy.size();
+#endif
+    return {};
+  }
+
+  const char *data() const noexcept {
+    return m_data;
+  }
+  size_t size() const noexcept {
+    return m_size;
+  }
+
+  /**
+   * @brief Get the records of a section, nullptr if the section is not within the file
+   */
+  template <typename Record>
+  const Record *records( const topology_image::Section &section ) const noexcept {
+    if ( section.offset % alignof( Record ) != 0 || section.offset > m_size ||
+         section.count > ( m_size - section.offset ) / sizeof( Record ) ) {
+      return nullptr;
+    }
+    return reinterpret_cast<const Record *>( m_data + section.offset );
+  }
+
+private:
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+#ifndef SIM_TOPOLOGY_MMAP
+  std::vector<char> m_copy;
+#endif
+};
+
+/**
+ * @brief The sections of a mapped image, checked so that reading them stays within it
+ */
+struct ImageView {
+  const topology_image::Header *header = nullptr;
+  const topology_image::StringRef *strings = nullptr;
+  const char *chars = nullptr;
+  const topology_image::InstanceRecord *instances = nullptr;
+  const topology_image::ParameterRecord *parameters = nullptr;
+  const uint64_t *values = nullptr;
+  const topology_image::LinkRecord *links = nullptr;
+
+  acpp::void_result<> open( const MappedFile &file );
+  bool valid( const topology_image::ParameterRecord &parameter ) const noexcept;
+
+  std::string text( uint32_t id ) const {
+    return std::string( chars + strings[id].offset, strings[id].length );
+  }
+  acpp::unstructured_value value( const topology_image::ParameterRecord &parameter ) const;
+};
+
+acpp::void_result<> ImageView::open( const MappedFile &file ) {
+  using namespace topology_image;
+  header = file.records<Header>( { 0, 1 } );
+  if ( !header || std::memcmp( header->magic, s_magic, sizeof( s_magic ) ) != 0 ) {
+    return { {}, "not a topology image" };
+  }
+  if ( header->version != s_version ) {
+    return { {}, "topology image version " + std::to_string( header->version ) + " not supported" };
+  }
+  if ( header->byte_order != s_byte_order ) {
+    return { {}, "topology image compiled for another byte order" };
+  }
+  strings = file.records<StringRef>( header->strings );
+  chars = file.records<char>( header->chars );
+  instances = file.records<InstanceRecord>( header->instances );
+  parameters = file.records<ParameterRecord>( header->parameters );
+  values = file.records<uint64_t>( header->values );
+  links = file.records<LinkRecord>( header->links );
+  if ( !strings || !chars || !instances || !parameters || !values || !links ||
+       header->parameter_count > header->parameters.count ) {
+    return { {}, "topology image is corrupt" };
+  }
+  // one pass over the records so that building needs no checks
+  for ( uint64_t index = 0; index < header->strings.count; ++index ) {
+    if ( uint64_t( strings[index].offset ) + strings[index].length > header->chars.count ) {
+      return { {}, "topology image is corrupt" };
+    }
+  }
+  auto instance_parameters = header->parameters.count - header->parameter_count;
+  for ( uint64_t index = 0; index < header->instances.count; ++index ) {
+    const auto &instance = instances[index];
+    if ( instance.name >= header->strings.count || instance.model >= header->strings.count ||
+         uint64_t( instance.first_parameter ) + instance.parameter_count > instance_parameters ) {
+      return { {}, "topology image is corrupt" };
+    }
+  }
+  for ( uint64_t index = 0; index < header->parameters.count; ++index ) {
+    if ( !valid( parameters[index] ) ) {
+      return { {}, "topology image is corrupt" };
+    }
+  }
+  for ( uint64_t index = 0; index < header->links.count; ++index ) {
+    const auto &link = links[index];
+    if ( link.from >= header->instances.count || link.to >= header->instances.count ||
+         link.from_pad >= header->strings.count || link.to_pad >= header->strings.count ) {
+      return { {}, "topology image is corrupt" };
+    }
+  }
+  return {};
+}
+
+bool ImageView::valid( const topology_image::ParameterRecord &parameter ) const noexcept {
+  auto strings_count = header->strings.count;
+  if ( parameter.name >= strings_count || parameter.kind >= std::variant_size_v<acpp::unstructured_value> ) {
+    return false;
+  }
+  switch ( parameter.kind ) {
+  case 4:
+    return parameter.value < strings_count;
+  case 5:
+  case 6:
+  case 7:
+  case 8:
+    if ( parameter.value > header->values.count || parameter.count > header->values.count - parameter.value ) {
+      return false;
+    }
+    if ( parameter.kind == 8 ) {
+      for ( uint32_t element = 0; element < parameter.count; ++element ) {
+        if ( values[parameter.value + element] >= strings_count ) {
+          return false;
+        }
+      }
+    }
+    return true;
+  default:
+    return true;
+  }
+}
+
+acpp::unstructured_value ImageView::value( const topology_image::ParameterRecord &parameter ) const {
+  auto number = []( uint64_t bits, auto zero ) {
+    std::memcpy( &zero, &bits, sizeof( zero ) );
+    return zero;
+  };
+  auto list = [&]( auto zero ) {
+    std::vector<decltype( zero )> elements;
+    elements.reserve( parameter.count );
+    for ( uint32_t element = 0; element < parameter.count; ++element ) {
+      elements.push_back( number( values[parameter.value + element], zero ) );
+    }
+    return elements;
+  };
+  switch ( parameter.kind ) {
+  case 1:
+    return number( parameter.value, intmax_t{} );
+  case 2:
+    return number( parameter.value, uintmax_t{} );
+  case 3:
+    return number( parameter.value, double{} );
+  case 4:
+    return text( uint32_t( parameter.value ) );
+  case 5:
+    return list( intmax_t{} );
+  case 6:
+    return list( uintmax_t{} );
+  case 7:
+    return list( double{} );
+  case 8: {
+    std::vector<std::string> elements;
+    elements.reserve( parameter.count );
+    for ( uint32_t element = 0; element < parameter.count; ++element ) {
+      elements.push_back( text( uint32_t( values[parameter.value + element] ) ) );
+    }
+    return elements;
+  }
+  default:
+    return std::monostate{};
+  }
+}
+
+}  // namespace
+
+class CompiledTopology::Impl {
+public:
+  MappedFile m_file;
+  ImageView m_image;
+};
+
+CompiledTopology::CompiledTopology() : impl( new Impl ) {
+}
+
+CompiledTopology::~CompiledTopology() noexcept = default;
+
+acpp::value_result<std::shared_ptr<const CompiledTopology>> CompiledTopology::open( const std::string &path ) {
+  std::shared_ptr<CompiledTopology> topology{ new CompiledTopology };
+  auto opened = topology->impl->m_file.open( path );
+  if ( !opened ) {
+    return { {}, opened.msg };
+  }
+  auto checked = topology->impl->m_image.open( topology->impl->m_file );
+  if ( !checked ) {
+    return { {}, checked.msg };
+  }
+  return acpp::value_result<std::shared_ptr<const CompiledTopology>>{ std::move( topology ) };
+}
+
+uint32_t CompiledTopology::instance( const std::string &name ) const {
+  const auto &image = impl->m_image;
+  for ( uint64_t index = 0; index < image.header->instances.count; ++index ) {
+    const auto &text = image.strings[image.instances[index].name];
+    if ( name.compare( 0, std::string::npos, image.chars + text.offset, text.length ) == 0 ) {
+      return uint32_t( index );
+    }
+  }
+  return topology_image::s_none;
+}
+
+acpp::void_result<> CompiledTopology::build(
+    std::shared_ptr<Simulation> simulation, const std::vector<ParameterOverride> &overrides ) const {
+  const auto &image = impl->m_image;
+  const auto &header = *image.header;
+  if ( header.partitions ) {
+    auto partitioned = simulation->setPartitions( header.partitions );
+    if ( !partitioned ) {
+      return partitioned;
+    }
+  }
+  auto instance_parameters = header.parameters.count - header.parameter_count;
+  for ( auto index = instance_parameters; index < header.parameters.count; ++index ) {
+    const auto &parameter = image.parameters[index];
+    auto set = simulation->setParameter( image.text( parameter.name ), image.value( parameter ) );
+    if ( !set ) {
+      return set;
+    }
+  }
+  // overrides in instance order, so that making the instances walks them once
+  std::vector<const ParameterOverride *> pending;
+  pending.reserve( overrides.size() );
+  for ( const auto &override : overrides ) {
+    if ( override.instance == topology_image::s_none ) {
+      auto set = simulation->setParameter( override.name, override.value );
+      if ( !set ) {
+        return set;
+      }
+    } else if ( override.instance >= header.instances.count ) {
+      return { {}, "override of parameter " + override.name + " for no instance" };
+    } else {
+      pending.push_back( &override );
+    }
+  }
+  std::stable_sort( pending.begin(), pending.end(), []( const auto *left, const auto *right ) {
+    return left->instance < right->instance;
+  } );
+  auto next = pending.begin();
+
+  Simulation::Private::reserveInstances( simulation, header.instances.count );
+  std::vector<std::shared_ptr<Instance>> instances;
+  instances.reserve( header.instances.count );
+  for ( uint64_t index = 0; index < header.instances.count; ++index ) {
+    const auto &record = image.instances[index];
+    PropertyList parameters;
+    parameters.reserve( record.parameter_count );
+    for ( uint32_t offset = 0; offset < record.parameter_count; ++offset ) {
+      const auto &parameter = image.parameters[record.first_parameter + offset];
+      parameters.insert_or_assign( image.text( parameter.name ), image.value( parameter ) );
+    }
+    for ( ; next != pending.end() && ( *next )->instance == index; ++next ) {
+      parameters.insert_or_assign( ( *next )->name, ( *next )->value );
+    }
+    auto name = image.text( record.name );
+    auto made = Simulation::Private::makeInstance( simulation, image.text( record.model ), name, parameters );
+    if ( !made ) {
+      return { {}, "instance " + name + ": " + made.msg };
+    }
+    instances.push_back( std::move( *made.value ) );
+  }
+
+#if ACPP_LESSON > 3
+  // pad names interned once each, then looked up by id
+  std::vector<SymbolId> pad_ids( header.strings.count, no_symbol );
+  auto padId = [&]( uint32_t name ) {
+    auto &id = pad_ids[name];
+    if ( id == no_symbol ) {
+      id = Simulation::Private::intern( simulation, image.text( name ) );
+    }
+    return id;
+  };
+  for ( uint64_t index = 0; index < header.links.count; ++index ) {
+    const auto &link = image.links[index];
+    auto pad = Instance::Private::pad( *instances[link.from], padId( link.from_pad ) );
+    auto peer = Instance::Private::pad( *instances[link.to], padId( link.to_pad ) );
+    if ( !pad || !peer || !pad->connect( instances[link.to], peer->name() ) ) {
+      return { {}, "can't link " + instances[link.from]->name() + "." + image.text( link.from_pad ) + " to " +
+                       instances[link.to]->name() + "." + image.text( link.to_pad ) };
+    }
+  }
+#else
+  if ( header.links.count ) {
+    return { {}, "links need pads, ACPP_LESSON > 3" };
+  }
+#endif // ACPP_LESSON > 3
+  return {};
+}
+
+acpp::void_result<> loadImage( const std::string &path, std::shared_ptr<Simulation> simulation ) {
+  auto opened = CompiledTopology::open( path );
+  if ( !opened ) {
+    return { {}, opened.msg };
+  }
+  return ( *opened.value )->build( std::move( simulation ) );
+}
+
+}  // namespace sim
@@ -0,0 +1,229 @@
+/**
+ * Topology.h
+ * Reading topologies from JSON and compiling them to memory-mappable images
+ */
+
+#ifndef SIM_TOPOLOGY_H_INCLUDED
+#define SIM_TOPOLOGY_H_INCLUDED
+
+#include <CxxSimulator/Simulation.h>
+#include <CxxSimulator/Common.h>
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace sim {
+
+/**
+ * @brief Receives a topology as a reader goes through it, see readTopology
+ */
+class TopologyBuilder {
+public:
+  virtual ~TopologyBuilder() = default;
+
+  virtual acpp::void_result<> parameter( const std::string &name, acpp::unstructured_value &&value ) = 0;
+  virtual acpp::void_result<> partitions( size_t count ) = 0;
+  /**
+   * @brief A hint of how many instances follow
+   */
+  virtual void reserve( size_t instances ) = 0;
+  virtual acpp::void_result<> instance( const std::string &model, const std::string &name, PropertyList &&parameters ) = 0;
+  /**
+   * @brief Link two pads, each given as instance.pad
+   */
+  virtual acpp::void_result<> link( const std::string &from, const std::string &to ) = 0;
+  /**
+   * @brief Called once the whole topology was read
+   */
+  virtual acpp::void_result<> finish() = 0;
+};
+
+/**
+ * @brief Stream a JSON topology into a builder, see Simulator::loadTopology for the format
+ * @return acpp::void_result<> error if the document or the builder failed
+ */
+acpp::void_result<> readTopology( const std::string &topo_json, TopologyBuilder &builder );
+acpp::void_result<> readTopology( std::istream &topo_json, TopologyBuilder &builder );
+
+/**
+ * @brief Builds a simulation, making instances at once and linking their pads
+ * Links naming instances not made yet wait for finish.
+ */
+class SimulationBuilder : public TopologyBuilder {
+public:
+  explicit SimulationBuilder( std::shared_ptr<Simulation> simulation ) : m_simulation{ std::move( simulation ) } {}
+
+  acpp::void_result<> parameter( const std::string &name, acpp::unstructured_value &&value ) override;
+  acpp::void_result<> partitions( size_t count ) override;
+  void reserve( size_t instances ) override;
+  acpp::void_result<> instance( const std::string &model, const std::string &name, PropertyList &&parameters ) override;
+  acpp::void_result<> link( const std::string &from, const std::string &to ) override;
+  acpp::void_result<> finish() override;
+
+private:
+  acpp::void_result<> connect( const std::string &from, const std::string &to, bool last_chance );
+
+  std::shared_ptr<Simulation> m_simulation;
+  std::vector<std::pair<std::string, std::string>> m_deferred;
+};
+
+/**
+ * Layout of a compiled topology image. Sections are arrays of the records below at
+ * offsets from the start of the image, so it can be mapped anywhere and used in place.
+ * Numbers are in the byte order of the machine that compiled it.
+ */
+namespace topology_image {
+
+constexpr char s_magic[8] = { 'C', 'x', 'S', 'i', 'm', 'T', 'o', 'p' };
+constexpr uint32_t s_version = 1;
+constexpr uint32_t s_byte_order = 0x01020304;
+constexpr uint32_t s_none = UINT32_MAX;
+
+struct Section {
+  uint64_t offset;
+  uint64_t count;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t partitions;      // 0 to keep the simulation's
+  uint32_t parameter_count; // of the simulation, the last records of parameters
+  Section strings;    // StringRef
+  Section chars;      // char, what the strings refer to
+  Section instances;  // InstanceRecord
+  Section parameters; // ParameterRecord
+  Section values;     // uint64_t, elements of list parameters
+  Section links;      // LinkRecord
+};
+
+struct StringRef {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct InstanceRecord {
+  uint32_t name;  // string
+  uint32_t model; // string
+  uint32_t first_parameter;
+  uint32_t parameter_count;
+};
+
+/**
+ * @brief A parameter, kind being the index of its type in acpp::unstructured_value
+ * value holds the bits of a number, the string of a string, or the first of count
+ * values of a list; list elements are numbers or strings the same way.
+ */
+struct ParameterRecord {
+  uint32_t name; // string
+  uint32_t kind;
+  uint32_t count;
+  uint32_t reserved;
+  uint64_t value;
+};
+
+/**
+ * @brief Pad adjacency resolved at compile time: instances by record index
+ */
+struct LinkRecord {
+  uint32_t from;     // instance
+  uint32_t from_pad; // string
+  uint32_t to;       // instance
+  uint32_t to_pad;   // string
+};
+
+static_assert( std::variant_size_v<acpp::unstructured_value> == 9, "ParameterRecord::kind follows unstructured_value" );
+
+}  // namespace topology_image
+
+/**
+ * @brief Compiles a topology into an image, resolving names once at finish
+ */
+class ImageWriter : public TopologyBuilder {
+public:
+  acpp::void_result<> parameter( const std::string &name, acpp::unstructured_value &&value ) override;
+  acpp::void_result<> partitions( size_t count ) override;
+  void reserve( size_t instances ) override;
+  acpp::void_result<> instance( const std::string &model, const std::string &name, PropertyList &&parameters ) override;
+  acpp::void_result<> link( const std::string &from, const std::string &to ) override;
+  acpp::void_result<> finish() override;
+
+  /**
+   * @brief Write the finished image to a file
+   */
+  acpp::void_result<> write( const std::string &path ) const;
+
+private:
+  uint32_t string( const std::string &text );
+  topology_image::ParameterRecord record( const std::string &name, const acpp::unstructured_value &value );
+
+  uint32_t m_partitions = 0;
+  std::unordered_map<std::string, uint32_t> m_string_ids;
+  std::unordered_map<std::string, uint32_t> m_instance_ids; // index of the record
+  std::vector<topology_image::StringRef> m_strings;
+  std::string m_chars;
+  std::vector<topology_image::ParameterRecord> m_simulation_parameters;
+  std::vector<topology_image::InstanceRecord> m_instances;
+  std::vector<topology_image::ParameterRecord> m_parameters;
+  std::vector<uint64_t> m_values;
+  std::vector<std::pair<std::string, std::string>> m_link_names; // resolved by finish
+  std::vector<topology_image::LinkRecord> m_links;
+};
+
+/**
+ * @brief A parameter set on top of those of a compiled image
+ */
+struct ParameterOverride {
+  uint32_t instance; // record index, topology_image::s_none for a simulation parameter
+  std::string name;
+  acpp::unstructured_value value;
+};
+
+/**
+ * @brief A compiled image, mapped and checked once, to build any number of simulations from
+ * Building only reads the image, so threads can build from one at the same time.
+ */
+class CompiledTopology {
+public:
+  /**
+   * @brief Map an image and check that its records lie within it
+   * @return the topology or error if it can't be read or isn't an image
+   */
+  static acpp::value_result<std::shared_ptr<const CompiledTopology>> open( const std::string &path );
+  ~CompiledTopology() noexcept;
+  CompiledTopology( const CompiledTopology & ) = delete;
+  CompiledTopology &operator=( const CompiledTopology & ) = delete;
+
+  /**
+   * @brief Find the record index of an instance, s_none if there is none of that name
+   */
+  uint32_t instance( const std::string &name ) const;
+  /**
+   * @brief Make the instances of the image in a simulation and link their pads
+   * @param overrides set after the image's own parameters, replacing those of the same name
+   */
+  acpp::void_result<> build( std::shared_ptr<Simulation> simulation, const std::vector<ParameterOverride> &overrides = {} ) const;
+
+private:
+  CompiledTopology();
+
+  // PIMPL
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+/**
+ * @brief Map a compiled image and build a simulation from it, see Simulator::loadCompiledTopology
+ */
+acpp::void_result<> loadImage( const std::string &path, std::shared_ptr<Simulation> simulation );
+
+}  // namespace sim
+
+#endif  // SIM_TOPOLOGY_H_INCLUDED
@@ -0,0 +1,372 @@
+// Trace.cpp : binary event traces and the thread writing them out
+//
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SIM_TRACE_MMAP 1
+#endif
+
+namespace sim {
+
+/**
+ * @brief An output file written at offsets, mapped and grown in steps where it can be
+ */
+class TraceWriter::File {
+public:
+  File() = default;
+  ~File() noexcept {
+    close();
+  }
+  File( const File & ) = delete;
+  File &operator=( const File & ) = delete;
+
+  acpp::void_result<> open( const std::string &path ) {
+    m_path = path;
+#ifdef SIM_TRACE_MMAP
+    m_file = ::open( path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( m_file < 0 ) {
+      return { {}, "can't open " + path };
+    }
+    return reserve( s_grow );
+#else
+    m_out.open( path, std::ios::binary | std::ios::trunc );
+    if ( !m_out ) {
+      return { {}, "can't open " + path };
+    }
+    return {};
+#endif
+  }
+
+  /**
+   * @brief Write bytes at an offset, growing the file to fit
+   */
+  acpp::void_result<> write( uint64_t offset, const void *data, size_t size ) {
+    m_size = std::max<uint64_t>( m_size, offset + size );
+#ifdef SIM_TRACE_MMAP
+    if ( offset + size > m_mapped ) {
+      auto reserved = reserve( std::max<uint64_t>( m_mapped * 2, offset + size + s_grow ) );
+      if ( !reserved ) {
+        return reserved;
+      }
+    }
+    std::memcpy( m_data + offset, data, size );
+#else
+    m_out.seekp( std::streamoff( offset ) );
+    m_out.write( static_cast<const char *>( data ), std::streamsize( size ) );
+    if ( !m_out ) {
+      return { {}, "can't write " + m_path };
+    }
+#endif
+    return {};
+  }
+  /**
+   * @brief Cut the file to what was written and close it
+   */
+  acpp::void_result<> close() noexcept {
+#ifdef SIM_TRACE_MMAP
+    if ( m_file < 0 ) {
+      return {};
+    }
+    if ( m_data ) {
+      munmap( m_data, m_mapped );
+      m_data = nullptr;
+    }
+    bool cut = ftruncate( m_file, off_t( m_size ) ) == 0;
+    cut = ::close( m_file ) == 0 && cut;
+    m_file = -1;
+    if ( !cut ) {
+      return { {}, "can't write " + m_path };
+    }
+#else
+    if ( !m_out.is_open() ) {
+      return {};
+    }
+    m_out.close();
+    if ( !m_out ) {
+      return { {}, "can't write " + m_path };
+    }
+#endif
+    return {};
+  }
+
+private:
+  /*
+   * The file grows by at least this much at a time, so that a run remaps it rarely
+   */
+  static constexpr uint64_t s_grow = 64 * 1024 * 1024;
+
+#ifdef SIM_TRACE_MMAP
+  acpp::void_result<> reserve( uint64_t size ) {
+    if ( m_data ) {
+      munmap( m_data, m_mapped );
+      m_data = nullptr;
+      m_mapped = 0;
+    }
+    if ( ftruncate( m_file, off_t( size ) ) != 0 ) {
+      return { {}, "can't grow " + m_path };
+    }
+    void *map = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0 );
+    if ( map == MAP_FAILED ) {
+      return { {}, "can't map " + m_path };
+    }
+    m_data = static_cast<char *>( map );
+    m_mapped = size;
+    return {};
+  }
+
+  int m_file = -1;
+  char *m_data = nullptr;
+  uint64_t m_mapped = 0;
+#else
+  std::ofstream m_out;
+#endif
+  std::string m_path;
+  uint64_t m_size = 0;
+};
+
+acpp::value_result<std::unique_ptr<TraceWriter>> TraceWriter::open( const std::string &path ) {
+  std::unique_ptr<TraceWriter> writer{ new TraceWriter };
+  writer->m_file = std::make_unique<File>();
+  auto opened = writer->m_file->open( path );
+  if ( !opened ) {
+    return { {}, opened.msg };
+  }
+  // the header goes in last, once the counts are known
+  trace::Header header{};
+  auto reserved = writer->m_file->write( 0, &header, sizeof( header ) );
+  if ( !reserved ) {
+    return { {}, reserved.msg };
+  }
+  writer->m_start_ticks = ticks();
+  writer->m_start_time = std::chrono::steady_clock::now();
+  writer->m_thread = std::thread{ [writer = writer.get()] { writer->flushMain(); } };
+  return acpp::value_result<std::unique_ptr<TraceWriter>>{ std::move( writer ) };
+}
+
+TraceWriter::~TraceWriter() noexcept {
+  stop();
+}
+
+void TraceWriter::stop() noexcept {
+  if ( m_thread.joinable() ) {
+    {
+      std::lock_guard lock{ m_stop_mut };
+      m_stop = true;
+    }
+    m_stop_cnd.notify_one();
+    m_thread.join();
+  }
+}
+
+TraceBuffer &TraceWriter::buffer( size_t partition ) {
+  std::lock_guard lock{ m_buffers_mut };
+  if ( m_buffers.size() <= partition ) {
+    m_buffers.resize( partition + 1 );
+  }
+  auto &buffer = m_buffers[partition];
+  if ( !buffer ) {
+    buffer = std::make_unique<TraceBuffer>( s_buffer_capacity );
+  }
+  return *buffer;
+}
+
+void TraceWriter::addStimulus( trace::Stimulus &&stimulus ) {
+  std::lock_guard lock{ m_stimuli_mut };
+  m_stimuli.push_back( std::move( stimulus ) );
+}
+
+void TraceWriter::flushMain() {
+  std::unique_lock lock{ m_stop_mut };
+  while ( !m_stop ) {
+    m_stop_cnd.wait_for( lock, s_flush_interval, [this] { return m_stop; } );
+    lock.unlock();
+    flush();
+    lock.lock();
+  }
+}
+
+void TraceWriter::flush() {
+  std::lock_guard lock{ m_buffers_mut };
+  std::array<trace::Record, s_flush_batch> records;
+  for ( auto &buffer : m_buffers ) {
+    while ( buffer ) {
+      auto count = buffer->m_ring.pop( records.data(), records.size() );
+      if ( count == 0 ) {
+        break;
+      }
+      if ( m_failure ) {
+        continue; // drained all the same, so that recording never blocks
+      }
+      auto written = m_file->write(
+          sizeof( trace::Header ) + m_records * sizeof( trace::Record ), records.data(), count * sizeof( trace::Record ) );
+      if ( !written ) {
+        m_failure = written.msg;
+      }
+      m_records += count;
+    }
+  }
+}
+
+acpp::void_result<> TraceWriter::finish( const SymbolTable &names, const SymbolTable &instance_names ) {
+  stop();
+  flush();
+  if ( m_failure ) {
+    return { {}, std::move( *m_failure ) };
+  }
+
+  trace::Header header{};
+  std::memcpy( header.magic, trace::s_magic, sizeof( header.magic ) );
+  header.version = trace::s_version;
+  header.record_size = sizeof( trace::Record );
+  header.records = m_records;
+  for ( auto &buffer : m_buffers ) {
+    header.dropped += buffer ? buffer->m_dropped.load( std::memory_order_relaxed ) : 0;
+  }
+  header.names = sizeof( trace::Header ) + m_records * sizeof( trace::Record );
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start_time;
+  auto elapsed_ticks = ticks() - m_start_ticks;
+  header.ticks_per_second = elapsed.count() > 0.0 ? uint64_t( double( elapsed_ticks ) / elapsed.count() ) : 0;
+
+  std::string bytes;
+  auto append = [&bytes]( const auto &value ) {
+    bytes.append( reinterpret_cast<const char *>( &value ), sizeof( value ) );
+  };
+  for ( auto *table : { &names, &instance_names } ) {
+    append( uint32_t( table->size() ) );
+    for ( SymbolId id = 0; id < table->size(); ++id ) {
+      const auto &name = table->name( id );
+      append( uint32_t( name.size() ) );
+      bytes.append( name );
+    }
+  }
+  header.stimuli = header.names + bytes.size();
+  {
+    std::lock_guard lock{ m_stimuli_mut };
+    append( uint32_t( m_stimuli.size() ) );
+    for ( const auto &stimulus : m_stimuli ) {
+      append( stimulus.ticks );
+      append( uint32_t( stimulus.bytes.size() ) );
+      bytes.append( stimulus.bytes );
+    }
+  }
+  auto trailer = m_file->write( header.names, bytes.data(), bytes.size() );
+  if ( !trailer ) {
+    return trailer;
+  }
+  auto written = m_file->write( 0, &header, sizeof( header ) );
+  if ( !written ) {
+    return written;
+  }
+  return m_file->close();
+}
+
+namespace {
+
+/**
+ * @brief Reads the parts of a trace file, failing for good once anything lies beyond its end
+ */
+class TraceInput {
+public:
+  explicit TraceInput( std::istream &in, uint64_t size ) : m_in{ in }, m_size{ size } {}
+
+  bool seek( uint64_t offset ) {
+    if ( offset > m_size ) {
+      return false;
+    }
+    m_in.seekg( std::streamoff( offset ) );
+    m_offset = offset;
+    return static_cast<bool>( m_in );
+  }
+  bool read( void *data, uint64_t size ) {
+    if ( size > m_size - m_offset ) {
+      return false;
+    }
+    m_in.read( static_cast<char *>( data ), std::streamsize( size ) );
+    m_offset += size;
+    return static_cast<bool>( m_in );
+  }
+  template <typename T>
+  bool get( T &value ) {
+    return read( &value, sizeof( T ) );
+  }
+  bool getString( std::string &text ) {
+    uint32_t length = 0;
+    if ( !get( length ) || length > m_size - m_offset ) {
+      return false;
+    }
+    text.resize( length );
+    return read( text.data(), length );
+  }
+  bool getNames( std::vector<std::string> &names ) {
+    uint32_t count = 0;
+    if ( !get( count ) ) {
+      return false;
+    }
+    names.resize( count ); // every name takes at least its length
+    for ( auto &name : names ) {
+      if ( !getString( name ) ) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  std::istream &m_in;
+  uint64_t m_size;
+  uint64_t m_offset = 0;
+};
+
+}  // namespace
+
+acpp::value_result<TraceFile> readTrace( const std::string &path ) {
+  std::ifstream in{ path, std::ios::binary | std::ios::ate };
+  if ( !in ) {
+    return { {}, "can't open " + path };
+  }
+  TraceInput input{ in, uint64_t( in.tellg() ) };
+  TraceFile file;
+  auto &header = file.header;
+  if ( !input.seek( 0 ) || !input.get( header ) ||
+       !std::equal( std::begin( trace::s_magic ), std::end( trace::s_magic ), header.magic ) ) {
+    return { {}, path + " is not a trace" };
+  }
+  if ( header.version != trace::s_version || header.record_size != sizeof( trace::Record ) ) {
+    return { {}, path + " is a trace of another version" };
+  }
+  // the records end where the names begin, which is within the file
+  if ( header.records > header.names / sizeof( trace::Record ) ||
+       header.names != sizeof( header ) + header.records * sizeof( trace::Record ) || !input.seek( header.names ) ) {
+    return { {}, path + " is truncated" };
+  }
+  file.records.resize( header.records );
+  uint32_t stimuli = 0;
+  if ( !input.seek( sizeof( header ) ) ||
+       !input.read( file.records.data(), file.records.size() * sizeof( trace::Record ) ) ||
+       !input.getNames( file.names ) || !input.getNames( file.instance_names ) || !input.seek( header.stimuli ) ||
+       !input.get( stimuli ) ) {
+    return { {}, path + " is truncated" };
+  }
+  for ( uint32_t index = 0; index < stimuli; ++index ) {
+    trace::Stimulus stimulus;
+    if ( !input.get( stimulus.ticks ) || !input.getString( stimulus.bytes ) ) {
+      return { {}, path + " is truncated" };
+    }
+    file.stimuli.push_back( std::move( stimulus ) );
+  }
+  return acpp::value_result<TraceFile>{ std::move( file ) };
+}
+
+}  // namespace sim
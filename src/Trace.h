@@ -0,0 +1,200 @@
+/**
+ * Trace.h
+ * Binary event traces, recorded into per-partition rings and flushed to a mapped file
+ */
+
+#ifndef SIM_TRACE_H_INCLUDED
+#define SIM_TRACE_H_INCLUDED
+
+#include <CxxSimulator/cpp_utils.h>
+#include "RingBuffer.h"
+#include "SymbolTable.h"
+#include "Ticks.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Layout of a trace file, in the byte order of the machine that wrote it: a Header,
+ * Header::records Records, each partition's in the order it did them, then at
+ * Header::names the name tables the ids of the records index, each a 32-bit count of
+ * strings given as a 32-bit length and their characters: model, activity, pad and
+ * signal names first, instance names second. Then at Header::stimuli a 32-bit count
+ * of Stimulus, each as its ticks, a 32-bit length and its bytes.
+ */
+namespace trace {
+
+constexpr char s_magic[8] = { 'C', 'x', 'S', 'i', 'm', 'T', 'r', 'c' };
+constexpr uint32_t s_version = 2;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t records;
+  uint64_t dropped;          // records lost to full rings
+  uint64_t names;            // offset of the name tables
+  uint64_t stimuli;          // offset of the stimuli
+  uint64_t ticks_per_second; // of Record::ticks, measured over the trace
+};
+
+/**
+ * @brief What a partition did to its event list
+ */
+enum class Op : uint8_t {
+  SCHEDULE,   // inserted an event
+  CANCEL,     // removed one before it was due, only seq is set
+  RESCHEDULE, // moved one to simtime, only seq and simtime are set
+  HANDLE      // took the earliest out to handle it
+};
+
+/**
+ * @brief One event list operation
+ */
+struct Record {
+  int64_t simtime;    // of the event, nanoseconds
+  uint64_t ticks;     // wall clock, the time stamp counter where there is one
+  uint64_t seq;       // the event's tie-breaker, which identifies it in its partition
+  uint32_t owner;     // the event's instance id, ~0 for none
+  uint32_t name;      // the event's activity name id, or instance id for SPAWN_INSTANCE
+  uint32_t spec;      // the event's model, activity spec or pad name id, by type
+  uint16_t partition;
+  uint8_t type;       // the event's type, see SimEvent::Type
+  Op op;
+};
+
+static_assert( sizeof( Record ) == 40, "trace records are fixed size" );
+
+/**
+ * @brief An event scheduled from outside the simulation while tracing, e.g. a spawn or an
+ * injected message, in full so that a replay can schedule it again
+ * The bytes are written and read by Simulation, in the checkpoint encoding.
+ */
+struct Stimulus {
+  uint64_t ticks;
+  std::string bytes;
+};
+
+}  // namespace trace
+
+/**
+ * @brief Where one partition's thread records, never waiting for the writer
+ * A record that finds the ring full is counted as dropped rather than holding up the run.
+ */
+class TraceBuffer {
+public:
+  explicit TraceBuffer( size_t capacity ) : m_ring{ capacity } {}
+
+  void record( trace::Op op, uint64_t seq, int64_t simtime, uint8_t type, uint32_t owner, uint32_t name, uint32_t spec,
+      uint16_t partition ) noexcept {
+    trace::Record record{ simtime, ticks(), seq, owner, name, spec, partition, type, op };
+    if ( !m_ring.push( std::move( record ) ) ) {
+      m_dropped.fetch_add( 1, std::memory_order_relaxed );
+    }
+  }
+
+private:
+  friend class TraceWriter;
+
+  SpscRing<trace::Record> m_ring;
+  std::atomic<uint64_t> m_dropped{ 0 };
+};
+
+/**
+ * @brief Owns a trace file and the thread flushing the buffers into it
+ * The file is mapped and grown in large steps, so flushing is copying records.
+ */
+class TraceWriter {
+public:
+  /**
+   * @brief Create the file and start flushing
+   * @return the writer or error if the file can't be made
+   */
+  static acpp::value_result<std::unique_ptr<TraceWriter>> open( const std::string &path );
+  ~TraceWriter() noexcept;
+  TraceWriter( const TraceWriter & ) = delete;
+  TraceWriter &operator=( const TraceWriter & ) = delete;
+
+  /**
+   * @brief Get the buffer of a partition, making it on first use
+   * Only one thread at a time may record into a buffer.
+   */
+  TraceBuffer &buffer( size_t partition );
+  /**
+   * @brief Keep an event scheduled from outside, from any thread
+   */
+  void addStimulus( trace::Stimulus &&stimulus );
+  /**
+   * @brief Flush what is left, write the names the records refer to and close the file
+   */
+  acpp::void_result<> finish( const SymbolTable &names, const SymbolTable &instance_names );
+
+  /**
+   * Records a buffer holds before it drops them, 2 MiB worth
+   */
+  static constexpr size_t s_buffer_capacity = 64 * 1024;
+  /**
+   * How often the writer thread flushes
+   */
+  static constexpr std::chrono::milliseconds s_flush_interval{ 5 };
+  /**
+   * Records the writer thread moves out of a buffer at a time
+   */
+  static constexpr size_t s_flush_batch = 1024;
+
+private:
+  class File;
+
+  TraceWriter() = default;
+  void stop() noexcept;
+  void flushMain();
+  /**
+   * @brief Move the records of every buffer to the file, on the writer thread or once it ended
+   */
+  void flush();
+
+  std::unique_ptr<File> m_file;
+  std::mutex m_buffers_mut; // m_buffers grows while flushing
+  std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+  uint64_t m_records = 0;
+  std::optional<std::string> m_failure; // of the first write that failed
+  uint64_t m_start_ticks = 0;
+  std::chrono::steady_clock::time_point m_start_time;
+  std::mutex m_stop_mut;
+  std::condition_variable m_stop_cnd;
+  bool m_stop = false;
+  std::thread m_thread;
+  std::mutex m_stimuli_mut;
+  std::vector<trace::Stimulus> m_stimuli;
+};
+
+/**
+ * @brief A trace file read back whole
+ */
+struct TraceFile {
+  trace::Header header{};
+  std::vector<trace::Record> records;
+  std::vector<std::string> names;          // by SymbolId
+  std::vector<std::string> instance_names; // by SymbolId
+  std::vector<trace::Stimulus> stimuli;    // in the order they were scheduled
+};
+
+/**
+ * @brief Read a file written by TraceWriter, checking that its parts lie within it
+ * @return the trace or error if it can't be read or isn't a trace
+ */
+acpp::value_result<TraceFile> readTrace( const std::string &path );
+
+}  // namespace sim
+
+#endif  // SIM_TRACE_H_INCLUDED